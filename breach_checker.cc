@@ -0,0 +1,923 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "breach_checker.h"
+
+#include <algorithm>          /* std::transform */
+#include <chrono>             /* std::chrono */
+#include <condition_variable> /* std::condition_variable */
+#include <ctime>              /* time */
+#include <iomanip>            /* std::setfill */
+#include <iostream>           /* std::cerr */
+#include <memory>             /* std::shared_ptr */
+#include <mutex>              /* std::mutex */
+#include <sstream>            /* std::stringstream */
+#include <thread>             /* std::this_thread::sleep_for */
+
+#include <curl/curl.h> /* CURL functions */
+
+#include <openssl/err.h> /* ERR_* functions */
+#include <openssl/evp.h> /* EVP_MD_* functions */
+
+#include "compact_store.h"       /* Compact_store */
+#include "concurrency_limiter.h" /* Concurrency_limiter */
+#include "digest_cache.h"        /* Digest_cache */
+#include "direct_store.h"        /* Direct_store */
+#include "disk_cache.h"          /* Disk_range_cache */
+#include "egress_scheduler.h"    /* Egress_scheduler */
+#include "fetch_pool.h"          /* Fetch_pool */
+#include "latency_histogram.h"   /* Stage_timer */
+#include "log_queue.h"           /* Log_queue */
+#include "lookup_chain.h"        /* Lookup_chain */
+#include "range_pack.h"          /* range_body_count */
+#include "replica.h"             /* Range_replica */
+#include "secure_buffer.h"       /* Secure_buffer_pool */
+#include "shm_cache.h"           /* Shm_range_cache */
+#include "status_counters.h"     /* Status_counters */
+
+namespace password_breach_check {
+
+/** Arbitrary large value indicating that empty string is not a good password */
+const long long MAX_RETVAL = 1000000;
+
+/** SHA1 digest size */
+const size_t SHA1_HASH_SIZE = 20;
+
+bool parse_sha1_digest(const char *data, size_t length, bool allow_binary,
+                       std::string &sha1_digest) {
+  static const char HEX[] = "0123456789ABCDEF";
+  if (allow_binary && length == SHA1_HASH_SIZE) {
+    sha1_digest.resize(2 * SHA1_HASH_SIZE);
+    for (size_t i = 0; i < SHA1_HASH_SIZE; ++i) {
+      auto byte = static_cast<unsigned char>(data[i]);
+      sha1_digest[2 * i] = HEX[byte >> 4];
+      sha1_digest[2 * i + 1] = HEX[byte & 0x0F];
+    }
+    return false;
+  }
+  if (length != 2 * SHA1_HASH_SIZE) return true;
+  sha1_digest.assign(data, length);
+  for (auto &c : sha1_digest) {
+    if (c >= 'a' && c <= 'f')
+      c = static_cast<char>(c - 'a' + 'A');
+    else if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F')))
+      return true;
+  }
+  return false;
+}
+
+/** Configuration in effect */
+Config config;
+
+/** Writes messages to stderr, until the embedder installs its own handler */
+static void stderr_log_handler(const char *message, Log_level level) {
+  static const char *LEVEL_NAMES[] = {"ERROR", "WARNING", "INFORMATION"};
+  std::cerr << "password_breach_check " << LEVEL_NAMES[static_cast<int>(level)]
+            << ": " << message << std::endl;
+}
+
+static Log_handler current_log_handler = stderr_log_handler;
+
+void set_log_handler(Log_handler handler) {
+  current_log_handler = handler != nullptr ? handler : stderr_log_handler;
+}
+
+/** Hands queued messages to the handler, on the log queue's thread */
+static void deliver_log_message(const char *message, Log_level level) {
+  current_log_handler(message, level);
+}
+
+void log_message(const std::string &message, Log_level level) {
+  if (Log_queue::instance().push(message, level))
+    current_log_handler(message.c_str(), level);
+}
+
+/** Wait time(in seconds) between two CURL requests */
+const unsigned int WAIT = 2;
+
+static bool curl_init_done = false;
+
+/** Local compact store, if configured. Mapped or read directly. */
+static Compact_store compact_store;
+static Direct_store direct_store;
+
+/** Init CURL and caches */
+void Breach_checker::init_environment() {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  curl_init_done = true;
+
+  Concurrency_limiter::instance().configure(config.max_concurrent_fetches);
+  Egress_scheduler::instance().configure(config.interactive_rate,
+                                         config.batch_rate);
+  if (Digest_cache::instance().resize(config.result_cache_size,
+                                      config.cache_ttl))
+    log_message("Failed to allocate the result cache.", Log_level::WARNING);
+
+  if (Secure_buffer_pool::instance().start(config.secure_buffers))
+    log_message("Failed to set up locked password buffers. Passwords are "
+                "held in heap buffers, which are wiped after use.",
+                Log_level::WARNING);
+
+  /* Messages are delivered synchronously if this fails */
+  Log_queue::instance().start(deliver_log_message, config.log_rate_limit);
+
+  /* Caches are optional. Lookups go to the network if unavailable. */
+  if (!config.shm_cache_name.empty())
+    Shm_range_cache::instance().attach(
+        config.shm_cache_name,
+        static_cast<size_t>(config.shm_cache_size) * 1024 * 1024,
+        config.cache_ttl);
+  if (!config.disk_cache_dir.empty())
+    Disk_range_cache::instance().attach(config.disk_cache_dir);
+  if (!config.replica_dir.empty())
+    Range_replica::instance().start(config.replica_dir, config.replica_rate);
+  if (config.fetch_threads > 0 &&
+      Fetch_pool::instance().start(config.fetch_threads,
+                                   config.fetch_queue_size))
+    log_message("Failed to start fetch threads. Ranges are fetched on "
+                "session threads.",
+                Log_level::WARNING);
+  if (config.compact_store.empty()) {
+    /* Not configured */
+  } else if (!config.compact_store_direct_io) {
+    if (compact_store.open(config.compact_store, config.compact_store_cache))
+      log_message(compact_store.last_error(), Log_level::ERROR);
+  } else if (direct_store.open(config.compact_store,
+                               config.compact_store_cache)) {
+    log_message(direct_store.last_error(), Log_level::ERROR);
+  } else if (!direct_store.direct_io() || !direct_store.io_uring()) {
+    std::stringstream error_message;
+    error_message << "Compact store is read "
+                  << (direct_store.direct_io() ? "with" : "without")
+                  << " O_DIRECT and "
+                  << (direct_store.io_uring() ? "with" : "without")
+                  << " io_uring as they are not supported here.";
+    log_message(error_message.str(), Log_level::WARNING);
+  }
+
+  auto &chain = Lookup_chain::instance();
+  if (chain.configure(config.lookup_chain, compact_store, direct_store))
+    log_message("Lookup chain in effect: " + chain.describe() + ".",
+                Log_level::WARNING);
+}
+
+/** Deinit CURL and caches */
+void Breach_checker::deinit_environment() {
+  Fetch_pool::instance().stop();
+  Secure_buffer_pool::instance().stop();
+  Lookup_chain::instance().clear();
+  direct_store.close();
+  compact_store.close();
+  Range_replica::instance().stop();
+  Disk_range_cache::instance().detach();
+  Shm_range_cache::instance().detach();
+  Digest_cache::instance().resize(0, 0);
+  Log_queue::instance().stop();
+  if (curl_init_done) {
+    curl_global_cleanup();
+    curl_init_done = false;
+  }
+}
+
+/**
+  Constructor
+
+  @param [in] password       Password to be checked, in utf8. Must outlive
+                             the checker, which does not copy it.
+  @param [in] request_class  Who the check is for, which decides the
+                             priority of its fetches
+*/
+Breach_checker::Breach_checker(const char *password,
+                               Request_class request_class)
+    : ready_{true},
+      password_{password ? password : ""},
+      retry_{3},
+      request_class_{request_class} {}
+
+/**
+  Check password against password breach data
+
+  @returns Number of times the password appeared in breach
+*/
+long long Breach_checker::check() const {
+  std::string sha1_digest{};
+  if (digest(sha1_digest) == true) return MAX_RETVAL;
+  return check_digest(sha1_digest);
+}
+
+/**
+  Hash the password
+
+  @param [out] sha1_digest  SHA1 digest of the password, in upper case hex
+
+  @returns status of the operation
+    @retval true  Error, or no password to check
+    @retval false Success
+*/
+bool Breach_checker::digest(std::string &sha1_digest) const {
+  /* 1. Sanity checks */
+  if (!ready_ || password_.length() == 0) return true;
+
+  /* 2. Generate SHA1 hash */
+  Stage_timer sha1_timer{Stage::SHA1};
+  return generate_digest(sha1_digest);
+}
+
+/**
+  Check a password digest against password breach data
+
+  @param [in] sha1_digest  SHA1 digest as returned by digest()
+
+  @returns Number of times the password appeared in breach
+*/
+long long Breach_checker::check_digest(const std::string &sha1_digest) const {
+  long long count = MAX_RETVAL;
+  if (check_cached(sha1_digest, count)) return count;
+  return check_fetched(sha1_digest);
+}
+
+/**
+  Check a password digest without going to the network
+
+  Consults the local tiers of Lookup_chain in order: by default results of
+  recent checks, local replica, compact store, host wide cache and fresh
+  ranges persisted on disk.
+
+  @param [in]  sha1_digest  SHA1 digest as returned by digest()
+  @param [out] count        Number of times the password appeared in breach
+
+  @returns true if answered, false if check_fetched() is needed
+*/
+bool Breach_checker::check_cached(const std::string &sha1_digest,
+                                  long long &count) const {
+  Status_counters::add(Counter::CHECKS);
+  auto prefix = sha1_digest.substr(0, 5);
+  Lookup_key key{sha1_digest, 0, std::string_view(sha1_digest).substr(5)};
+  parse_range_prefix(prefix, key.prefix);
+
+  /* 3. Consult local tiers, fastest first */
+  Stage_timer probe_timer{Stage::CACHE_PROBE};
+  if (!Lookup_chain::instance().lookup(key, count)) return false;
+  probe_timer.stop();
+  report(prefix, count);
+  return true;
+}
+
+/**
+  Check a password digest by fetching its range, or revalidating the range
+  persisted on disk. Follows check_cached() returning false.
+
+  @param [in] sha1_digest  SHA1 digest as returned by digest()
+
+  @returns Number of times the password appeared in breach
+*/
+long long Breach_checker::check_fetched(const std::string &sha1_digest) const {
+  auto prefix = sha1_digest.substr(0, 5);
+  Cached_range range{};
+  Status_counters::add(Counter::CACHE_MISSES);
+  if (fetch_cached_range(prefix, range) == true) return MAX_RETVAL;
+
+  /* 6. Search for the hash suffix */
+  Lookup_key key{sha1_digest, 0, std::string_view(sha1_digest).substr(5)};
+  parse_range_prefix(prefix, key.prefix);
+  Stage_timer parse_timer{Stage::PARSE};
+  long long count = range_body_count(range.body, key.suffix);
+  parse_timer.stop();
+
+  /* 7. Back-fill local tiers */
+  auto &chain = Lookup_chain::instance();
+  chain.fill(key.prefix, range);
+  chain.fill(key, count);
+  report(prefix, count);
+  return count;
+}
+
+/** Range fetch running on a fetch worker while the session validates */
+struct Pending_check {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done{false};
+  long long count{MAX_RETVAL};
+  /* Set by the session once it no longer needs the result */
+  std::atomic<bool> cancelled{false};
+  /* Set by the worker once the password is known to fail the check */
+  std::atomic<bool> breached{false};
+};
+
+/**
+  Run the other validate_password implementations
+
+  @param [in] validators  Other implementations, see Validators
+  @param [in] breached    Set once the password is known to fail the check
+
+  @returns status of other implementations
+    @retval true  Failure
+    @retval false Success
+*/
+bool Breach_checker::run_validators(const Validators &validators,
+                                    const std::atomic<bool> &breached) {
+  Stage_timer timer{Stage::BROADCAST};
+  return validators(breached);
+}
+
+/**
+  Check a password digest by fetching its range and run the other
+  validate_password implementations. Follows check_cached() returning
+  false.
+
+  - With validators_first, the other implementations run first and the
+    fetch is skipped if they fail or reject the password.
+  - Otherwise the range is fetched on a fetch worker while this thread runs
+    the other implementations, so that the two overlap. They are told
+    through breached when the fetch has failed the password, and the fetch
+    is abandoned if they fail.
+  - Without a worker to overlap with, they run only for passwords not found
+    in breaches.
+
+  @param [in]  sha1_digest  SHA1 digest as returned by digest()
+  @param [in]  validators   Other implementations, see Validators
+  @param [in]  rejected     Tells, after validators ran, whether they
+                            rejected the password without failing
+  @param [out] count        Number of times the password appeared in
+                            breach, MAX_RETVAL if it was not checked
+
+  @returns status of other implementations
+    @retval true  Failure
+    @retval false Success, or not run
+*/
+bool Breach_checker::check_fetched(const std::string &sha1_digest,
+                                   const Validators &validators,
+                                   const std::function<bool()> &rejected,
+                                   long long &count) const {
+  static const std::atomic<bool> not_breached{false};
+  count = MAX_RETVAL;
+
+  if (config.validators_first) {
+    if (run_validators(validators, not_breached)) {
+      Status_counters::add(Counter::SKIPPED_LOOKUPS);
+      return true;
+    }
+    if (rejected()) {
+      Status_counters::add(Counter::SKIPPED_LOOKUPS);
+      return false;
+    }
+    count = check_fetched(sha1_digest);
+    return false;
+  }
+
+  /* The worker's requests end by the time the session stops waiting */
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(config.fetch_wait_timeout);
+  auto pending = std::make_shared<Pending_check>();
+  auto request_class = request_class_;
+  Fetch_pool::Task task = [pending, sha1_digest, request_class, deadline]() {
+    long long count = MAX_RETVAL;
+    if (!pending->cancelled) {
+      Breach_checker fetcher("", request_class);
+      fetcher.set_deadline(deadline);
+      count = fetcher.check_fetched(sha1_digest);
+    }
+    if (count != 0) pending->breached = true;
+    std::lock_guard<std::mutex> lock(pending->mutex);
+    pending->count = count;
+    pending->done = true;
+    pending->cv.notify_one();
+  };
+  if (Fetch_pool::instance().submit(std::move(task))) {
+    /* No worker to overlap with. Fails fast if the queue is full. */
+    count = check_fetched(sha1_digest);
+    return count == 0 && run_validators(validators, not_breached);
+  }
+
+  if (run_validators(validators, pending->breached)) {
+    pending->cancelled = true;
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(pending->mutex);
+  if (!pending->cv.wait_until(lock, deadline,
+                              [&pending] { return pending->done; })) {
+    pending->cancelled = true;
+    Status_counters::add(Counter::FETCH_POOL_TIMEOUTS);
+    log_message("Gave up waiting for password breach data.", Log_level::ERROR);
+    return false;
+  }
+  count = pending->count;
+  return false;
+}
+
+/**
+  Check digests that share a prefix, fetching their range at most once
+
+  @param [in]  sha1_digests  Digests as returned by digest(), all with the
+                             same 5 character prefix
+  @param [out] counts        Number of times each password appeared in
+                             breach, MAX_RETVAL for those not checked
+*/
+void Breach_checker::check_group(const std::vector<std::string> &sha1_digests,
+                                 std::vector<long long> &counts) const {
+  counts.assign(sha1_digests.size(), MAX_RETVAL);
+  std::vector<size_t> misses;
+  for (size_t i = 0; i < sha1_digests.size(); ++i)
+    if (!check_cached(sha1_digests[i], counts[i])) misses.push_back(i);
+  if (misses.empty()) return;
+
+  auto prefix = sha1_digests[misses.front()].substr(0, 5);
+  Cached_range range{};
+  Status_counters::add(Counter::CACHE_MISSES, misses.size());
+  if (fetch_cached_range(prefix, range) == true) return;
+
+  auto &chain = Lookup_chain::instance();
+  uint32_t prefix_value = 0;
+  parse_range_prefix(prefix, prefix_value);
+  chain.fill(prefix_value, range);
+  Stage_timer parse_timer{Stage::PARSE};
+  for (auto i : misses) {
+    Lookup_key key{sha1_digests[i], prefix_value,
+                   std::string_view(sha1_digests[i]).substr(5)};
+    counts[i] = range_body_count(range.body, key.suffix);
+    chain.fill(key, counts[i]);
+  }
+  parse_timer.stop();
+  for (auto i : misses) report(prefix, counts[i]);
+}
+
+/**
+  Get the range for a prefix: the copy a tier of the lookup chain keeps if
+  fresh, otherwise fetched
+
+  @param [in]  prefix  5 character hex prefix, case insensitive
+  @param [out] body    Range data in wire format
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Breach_checker::range(const std::string &prefix, std::string &body) const {
+  uint32_t prefix_value = 0;
+  if (parse_range_prefix(prefix, prefix_value) == true) return true;
+
+  auto &chain = Lookup_chain::instance();
+  Cached_range range{};
+  if (chain.stored_range(prefix_value, range) &&
+      static_cast<uint64_t>(time(nullptr)) - range.fetched_at <=
+          config.cache_ttl) {
+    body = std::move(range.body);
+    return false;
+  }
+  if (fetch_cached_range(format_range_prefix(prefix_value), range) == true)
+    return true;
+  chain.fill(prefix_value, range);
+  body = std::move(range.body);
+  return false;
+}
+
+/**
+  Fetch a range, revalidating the copy a tier of the lookup chain keeps,
+  if any
+
+  @param [in]      prefix  SHA1 digest prefix - first 5 characters
+  @param [in, out] range   Kept copy if the caller already looked it up
+                           (fetched_at set), looked up here otherwise.
+                           Range data on return.
+
+  @returns status of the operation
+    @retval true  Failure, or no remote tier in the lookup chain
+    @retval false Success
+*/
+bool Breach_checker::fetch_cached_range(const std::string &prefix,
+                                        Cached_range &range) const {
+  auto &chain = Lookup_chain::instance();
+  if (!chain.remote()) {
+    log_message("The password with SHA1 prefix '" + prefix +
+                    "' was not found in local tiers and lookup_chain has no "
+                    "remote tier.",
+                Log_level::WARNING);
+    return true;
+  }
+  uint32_t prefix_value = 0;
+  parse_range_prefix(prefix, prefix_value);
+
+  /* Kept range, if any, supplies validators */
+  if (range.fetched_at == 0) chain.stored_range(prefix_value, range);
+  Stage_timer network_timer{Stage::NETWORK};
+  return fetch_range(prefix, range);
+}
+
+/** Count and log a breached password */
+void Breach_checker::report(const std::string &prefix, long long count) {
+  if (count <= 0) return;
+  Status_counters::add(Counter::BREACHED);
+  std::stringstream error_message;
+  error_message << "The password with SHA1 prefix '" << prefix
+                << "' has appeared " << count << " times in password breaches.";
+  log_message(error_message.str(), Log_level::WARNING);
+}
+
+/**
+  Function to generated SHA1 digest
+
+  @param [out] digest Generated SHA1 digest
+
+  @returns status of the operation
+    @retval true  Error
+    @retval false Success
+*/
+bool Breach_checker::generate_digest(std::string &digest) const {
+  auto error_out = [&]() {
+    char error_buffer[512]{0};
+    ERR_error_string(ERR_get_error(), error_buffer);
+    std::stringstream error_message;
+    error_message << "Received error from OpenSSL: " << error_buffer;
+    log_message(error_message.str(), Log_level::ERROR);
+  };
+
+  EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+  if (ctx == nullptr) return true;
+  auto ctx_cleanup = [&]() {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    EVP_MD_CTX_free(ctx);
+#else
+    EVP_MD_CTX_destroy(ctx);
+#endif /* OPENSSL_VERSION_NUMBER >= 0x10100000L */
+    ctx = nullptr;
+    ERR_clear_error();
+  };
+
+  if (EVP_DigestInit(ctx, EVP_sha1()) != 1) {
+    error_out();
+    ctx_cleanup();
+    return true;
+  }
+
+  if (EVP_DigestUpdate(ctx, password_.data(), password_.length()) != 1) {
+    error_out();
+    ctx_cleanup();
+    return true;
+  }
+
+  char out[SHA1_HASH_SIZE];
+  if (EVP_DigestFinal(ctx, reinterpret_cast<unsigned char *>(out), nullptr) !=
+      1) {
+    error_out();
+    ctx_cleanup();
+    return true;
+  }
+
+  ctx_cleanup();
+  digest.assign(out, SHA1_HASH_SIZE);
+
+  /* Convert the digest to hex format */
+  std::stringstream hexstream;
+  for (auto const &character : digest) {
+    hexstream << std::setw(2) << std::setfill('0') << std::hex << std::uppercase
+              << (int)(unsigned char)character;
+  }
+  digest.assign(hexstream.str());
+
+  return false;
+}
+
+/** Outcome of a fetch handed to the fetch pool */
+struct Fetch_completion {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done{false};
+  bool failed{true};
+  /* Owned by the worker until done is set */
+  Cached_range range;
+};
+
+/** Deadline given with set_deadline(), else fetch_wait_timeout from now */
+std::chrono::steady_clock::time_point Breach_checker::fetch_deadline() const {
+  if (deadline_ != std::chrono::steady_clock::time_point{}) return deadline_;
+  return std::chrono::steady_clock::now() +
+         std::chrono::seconds(config.fetch_wait_timeout);
+}
+
+/**
+  Get password breach data through the fetch pool
+
+  The session waits for the fetch until its deadline, which also bounds
+  the requests the worker makes, so that no attempt starts after the
+  session gave up. If the pool is disabled the fetch runs on this thread.
+  If its queue is full the fetch fails, so that session threads never do
+  network I/O while a pool is configured.
+
+  @param [in]      prefix  SHA1 digest prefix - first 5 characters
+  @param [in, out] range   As for password_breach_data()
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Breach_checker::fetch_range(const std::string &prefix,
+                                 Cached_range &range) const {
+  auto &pool = Fetch_pool::instance();
+  auto deadline = fetch_deadline();
+  /* Already on a worker: waiting for another one could exhaust the pool */
+  if (Fetch_pool::on_worker() || pool.threads() == 0)
+    return password_breach_data(prefix, range, deadline);
+  auto completion = std::make_shared<Fetch_completion>();
+  completion->range = range;
+  auto request_class = request_class_;
+  Fetch_pool::Task task = [completion, prefix, request_class, deadline]() {
+    Breach_checker fetcher("", request_class);
+    bool failed =
+        fetcher.password_breach_data(prefix, completion->range, deadline);
+    std::lock_guard<std::mutex> lock(completion->mutex);
+    completion->failed = failed;
+    completion->done = true;
+    completion->cv.notify_one();
+  };
+  if (pool.submit(std::move(task))) {
+    Status_counters::add(Counter::FETCH_POOL_OVERFLOWS);
+    log_message("Too many fetches are waiting for a worker. Not fetching "
+                "range of SHA1 prefix '" +
+                    prefix + "'.",
+                Log_level::ERROR);
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(completion->mutex);
+  if (!completion->cv.wait_until(lock, deadline, [&completion] {
+        return completion->done;
+      })) {
+    Status_counters::add(Counter::FETCH_POOL_TIMEOUTS);
+    log_message("Gave up waiting for range of SHA1 prefix '" + prefix +
+                    "'.",
+                Log_level::ERROR);
+    return true;
+  }
+  if (completion->failed) return true;
+  range = std::move(completion->range);
+  return false;
+}
+
+/** Structure used to process GET data */
+struct Result {
+  std::stringstream body;
+  /* Validators sent along with the response */
+  std::string etag;
+  std::string last_modified;
+  /* Sent with 429 */
+  std::string retry_after;
+};
+
+/** Writer callback for CURL */
+size_t writer_callback(void *contents, size_t size, size_t nmemb,
+                       void *userp) {
+  /*
+    As per https://haveibeenpwned.com/API/v2#PwnedPasswords,
+    maximum number of entries returned by a range search is
+    584. Assuming that a password has appeared, 1M times in
+    breaches, each line would have:
+    35 chars in hash suffix + : + 7 chars in count + CRLF = 45 chars
+
+    So we are looking at ~25kb of data in worst case
+  */
+  std::stringstream *ss = static_cast<std::stringstream *>(userp);
+  ss->write(static_cast<char *>(contents), size * nmemb);
+  Status_counters::add(Counter::BYTES_RECEIVED, size * nmemb);
+  return size * nmemb;
+}
+
+/** Header callback for CURL - Picks up ETag and Last-Modified */
+static size_t header_callback(char *buffer, size_t size, size_t nitems,
+                              void *userp) {
+  auto result = static_cast<Result *>(userp);
+  std::string line(buffer, size * nitems);
+  auto colon = line.find(':');
+  if (colon == std::string::npos) return size * nitems;
+
+  std::string name = line.substr(0, colon);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  auto start = line.find_first_not_of(" \t", colon + 1);
+  auto end = line.find_last_not_of(" \t\r\n");
+  std::string value = (start == std::string::npos || end < start)
+                          ? std::string{}
+                          : line.substr(start, end - start + 1);
+  if (name == "etag")
+    result->etag = value;
+  else if (name == "last-modified")
+    result->last_modified = value;
+  else if (name == "retry-after")
+    result->retry_after = value;
+  return size * nitems;
+}
+
+/**
+  Seconds to wait according to a Retry-After value
+
+  @param [in] value  Either seconds or an HTTP date
+
+  @returns Seconds, 0 if absent or not understood
+*/
+static unsigned int retry_after_seconds(const std::string &value) {
+  if (value.empty()) return 0;
+  if (value.find_first_not_of("0123456789") == std::string::npos)
+    return static_cast<unsigned int>(
+        std::min(std::stoul(value.substr(0, 9)), 3600UL));
+  auto until = curl_getdate(value.c_str(), nullptr);
+  auto now = time(nullptr);
+  if (until < 0 || until <= now) return 0;
+  return static_cast<unsigned int>(std::min<time_t>(until - now, 3600));
+}
+
+/**
+  Get password breach data
+
+  If range carries validators, a conditional request is made. If the server
+  reports the range unchanged, range.not_modified is set and range.body is
+  left untouched. Callers set validators only when they can fall back to a
+  body they hold.
+
+  Attempts, and waits between them, are cut to the time left before
+  deadline; none starts after it.
+
+  @param [in]      prefix    SHA1 digest prefix - first 5 characters
+  @param [in, out] range     SHA1 digest suffix of all breached password
+                             along with the count representating how many
+                             times each one appears in data breach, and
+                             validators
+  @param [in]      deadline  Time by which the caller needs the range
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Breach_checker::password_breach_data(
+    const std::string prefix, Cached_range &range,
+    std::chrono::steady_clock::time_point deadline) const {
+  /* 1. Setup CURL */
+  std::string url{config.url};
+  url.append(prefix);
+  auto retry = retry_;
+  range.not_modified = false;
+
+  bool conditional = !range.etag.empty() || !range.last_modified.empty();
+  struct curl_slist *headers = nullptr;
+  if (conditional) {
+    if (!range.etag.empty())
+      headers = curl_slist_append(
+          headers, ("If-None-Match: " + range.etag).c_str());
+    if (!range.last_modified.empty())
+      headers = curl_slist_append(
+          headers, ("If-Modified-Since: " + range.last_modified).c_str());
+  }
+
+  bool failed = true;
+  std::stringstream error_message;
+
+  while (retry > 0) {
+    error_message.str("");
+    if (std::chrono::steady_clock::now() >= deadline) {
+      error_message << "Out of time for SHA1 prefix '" << prefix << "'.";
+      log_message(error_message.str(), Log_level::ERROR);
+      break;
+    }
+    Result result;
+    CURL *curl = curl_easy_init();
+
+    if (curl == nullptr) break;
+
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writer_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &result.body);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &result);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "mysql/1.0");
+    /* Signals are not used for timeouts as this runs on many threads */
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    if (headers != nullptr)
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    if (!config.unix_socket.empty())
+      curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH,
+                       config.unix_socket.c_str());
+
+    /* 2. Call API, within rate and the limit of requests in flight */
+    auto &limiter = Concurrency_limiter::instance();
+    if (Egress_scheduler::instance().acquire(request_class_, deadline)) {
+      curl_easy_cleanup(curl);
+      Status_counters::add(Counter::FETCHES_REJECTED);
+      error_message << "Too many requests to " << config.url
+                    << " in flight or per second, or asked to retry later. "
+                       "Giving up.";
+      log_message(error_message.str(), Log_level::ERROR);
+      break;
+    }
+    /*
+      Bound the attempt by the time left before the deadline, so that a
+      hung upstream releases its limiter slot and worker, and counts as
+      overload.
+    */
+    auto started = std::chrono::steady_clock::now();
+    long timeout_ms = std::max<long>(
+        1, static_cast<long>(
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   deadline - started)
+                   .count()));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+                     std::min(timeout_ms, std::max(1000L, timeout_ms / 3)));
+    CURLcode res = curl_easy_perform(curl);
+    Status_counters::add(Counter::FETCHES);
+    Status_counters::add(
+        Counter::FETCH_TIME,
+        static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started)
+                .count()));
+    if (res == CURLE_OPERATION_TIMEDOUT)
+      Status_counters::add(Counter::TIMEOUTS);
+    long status = 0;
+    if (res == CURLE_OK)
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_cleanup(curl);
+
+    auto outcome = Concurrency_limiter::Outcome::SUCCESS;
+    if (res == CURLE_OK && status == 429) {
+      outcome = Concurrency_limiter::Outcome::THROTTLED;
+      Status_counters::add(Counter::THROTTLED);
+    } else if (res == CURLE_OPERATION_TIMEDOUT ||
+               (res == CURLE_OK && status >= 500)) {
+      outcome = Concurrency_limiter::Outcome::OVERLOAD;
+    } else if (res != CURLE_OK) {
+      outcome = Concurrency_limiter::Outcome::IGNORE;
+    }
+    limiter.release(outcome, std::chrono::steady_clock::now() - started,
+                    retry_after_seconds(result.retry_after));
+
+    /* 3. Process and return the result */
+    if (res == CURLE_OK && status == 200) {
+      /* Populate the output buffer */
+      range.body.assign(result.body.str());
+      range.etag = result.etag;
+      range.last_modified = result.last_modified;
+      failed = false;
+    } else if (res == CURLE_OK && status == 304 && conditional) {
+      /* Cached body is still current */
+      if (!result.etag.empty()) range.etag = result.etag;
+      if (!result.last_modified.empty())
+        range.last_modified = result.last_modified;
+      range.not_modified = true;
+      failed = false;
+    }
+    if (!failed) {
+      range.fetched_at = static_cast<uint64_t>(time(nullptr));
+      break;
+    }
+
+    if (res != CURLE_OK)
+      error_message << "Error making GET request. CURL returned: "
+                    << curl_easy_strerror(res);
+    else
+      error_message << "Error making GET request. Server returned HTTP status "
+                    << status << ".";
+    log_message(error_message.str(), Log_level::ERROR);
+    error_message.str("");
+    retry--;
+    /* A retry that could not start before the deadline is not made */
+    if (std::chrono::steady_clock::now() + std::chrono::seconds(WAIT) >=
+        deadline)
+      break;
+    if (retry > 0) {
+      Status_counters::add(Counter::RETRIES);
+      error_message << "Retrying " << retry << " times before giving up.";
+      log_message(error_message.str(), Log_level::WARNING);
+      std::this_thread::sleep_for(std::chrono::seconds(WAIT));
+    }
+  }
+  curl_slist_free_all(headers);
+
+  if (failed) {
+    error_message.str("");
+    error_message << "Tried " << retry_ - retry << " times for SHA1 prefix: '"
+                  << prefix << "'. Giving up. Please verify that " << config.url
+                  << " is accessible "
+                     "(Should show 'Invalid API query' as response).";
+    log_message(error_message.str(), Log_level::WARNING);
+  }
+  return failed;
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,220 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#ifndef BREACH_CHECKER_H_INCLUDED
+#define BREACH_CHECKER_H_INCLUDED
+
+/*
+  Lookup path: hashing, fetching, parsing and caching. Has no dependency on
+  MySQL services so that it can be built, benchmarked and profiled on its
+  own; the component adapts it in password_breach_check.h.
+*/
+
+#include <atomic>      /* std::atomic */
+#include <chrono>      /* std::chrono::steady_clock */
+#include <cstddef>     /* size_t */
+#include <functional>  /* std::function */
+#include <string>      /* std::string */
+#include <string_view> /* std::string_view */
+#include <vector>      /* std::vector */
+
+#include "disk_cache.h"       /* Cached_range */
+#include "egress_scheduler.h" /* Request_class */
+#include "lookup_chain.h"     /* Lookup_chain */
+
+namespace password_breach_check {
+
+/** Severity of a message */
+enum class Log_level { ERROR, WARNING, INFORMATION };
+
+/** Receives messages. Installed by the embedder. */
+typedef void (*Log_handler)(const char *message, Log_level level);
+
+/**
+  Route messages to a handler
+
+  @param [in] handler  Handler, or nullptr to write to stderr (default)
+*/
+void set_log_handler(Log_handler handler);
+
+void log_message(const std::string &message, Log_level level);
+
+extern const long long MAX_RETVAL;
+
+/**
+  Convert a SHA1 digest given by a caller to the form digest() returns
+
+  @param [in]  data          40 hex characters, case insensitive, or
+                             20 bytes if allow_binary is set
+  @param [in]  length        Length of data
+  @param [in]  allow_binary  Accept binary digests
+  @param [out] sha1_digest   SHA1 digest in upper case hex
+
+  @returns status of the operation
+    @retval true  Not a SHA1 digest
+    @retval false Success
+*/
+bool parse_sha1_digest(const char *data, size_t length, bool allow_binary,
+                       std::string &sha1_digest);
+
+/** Configuration, populated from system variables by the component */
+struct Config {
+  /* URL to which SHA1 prefix is appended to fetch range data */
+  std::string url{"https://api.pwnedpasswords.com/range/"};
+  /* Unix domain socket to connect through instead of TCP. Empty if unused */
+  std::string unix_socket{};
+  /* Name of shared memory segment to cache ranges in. Empty if disabled */
+  std::string shm_cache_name{};
+  /* Size of the shared memory segment in megabytes */
+  unsigned int shm_cache_size{256};
+  /* Seconds for which a cached range is used */
+  unsigned int cache_ttl{86400};
+  /* Directory in which ranges are persisted. Empty if disabled */
+  std::string disk_cache_dir{};
+  /* Directory in which a full replica is maintained. Empty if disabled */
+  std::string replica_dir{};
+  /* Requests per second the replica crawler may issue */
+  unsigned int replica_rate{20};
+  /* Compact store file. Empty if disabled */
+  std::string compact_store{};
+  /* Decompressed compact store blocks kept in memory */
+  unsigned int compact_store_cache{256};
+  /* Read compact store with O_DIRECT instead of mapping it */
+  bool compact_store_direct_io{false};
+  /* Worker threads that fetch ranges. 0 to fetch on the session thread */
+  unsigned int fetch_threads{8};
+  /* Fetches that may wait for a worker */
+  unsigned int fetch_queue_size{1024};
+  /* Seconds a session waits for a fetch before giving up */
+  unsigned int fetch_wait_timeout{30};
+  /* Seconds for which a session reuses its own recent results. 0 disables */
+  unsigned int session_memo_ttl{5};
+  /* Run other validators before fetching, instead of alongside */
+  bool validators_first{false};
+  /* Messages of a kind logged per minute, 0 for no limit */
+  unsigned int log_rate_limit{10};
+  /* Upper bound of the adaptive limit on requests in flight */
+  unsigned int max_concurrent_fetches{64};
+  /* Requests per second for sessions, 0 for no limit */
+  unsigned int interactive_rate{0};
+  /* Requests per second for audits and crawls, 0 for no limit */
+  unsigned int batch_rate{50};
+  /* Results kept by full digest. 0 disables */
+  unsigned int result_cache_size{65536};
+  /* Directory password_breach_check_file() reads from. Empty if disabled */
+  std::string audit_dir{};
+  /* Locked, wiped buffers for plaintext passwords. 0 to use the heap */
+  unsigned int secure_buffers{128};
+  /* Tiers consulted for a digest, fastest first. See Lookup_chain. */
+  std::string lookup_chain{Lookup_chain::DEFAULT_SPEC};
+};
+
+extern Config config;
+
+/**
+  Runs the other validate_password implementations, true on failure. They
+  may stop early once breached is set, as the password fails anyway.
+*/
+typedef std::function<bool(const std::atomic<bool> &breached)> Validators;
+
+/** A class that helps check given password against password breach database */
+class Breach_checker {
+ public:
+  static void init_environment();
+  static void deinit_environment();
+
+ public:
+  Breach_checker(const char *password,
+                 Request_class request_class = Request_class::INTERACTIVE);
+
+  ~Breach_checker() {}
+
+  long long check() const;
+
+  bool digest(std::string &sha1_digest) const;
+
+  long long check_digest(const std::string &sha1_digest) const;
+
+  bool check_cached(const std::string &sha1_digest, long long &count) const;
+
+  long long check_fetched(const std::string &sha1_digest) const;
+
+  bool check_fetched(const std::string &sha1_digest,
+                     const Validators &validators,
+                     const std::function<bool()> &rejected,
+                     long long &count) const;
+
+  static bool run_validators(const Validators &validators,
+                             const std::atomic<bool> &breached);
+
+  void check_group(const std::vector<std::string> &sha1_digests,
+                   std::vector<long long> &counts) const;
+
+  bool range(const std::string &prefix, std::string &body) const;
+
+  /**
+    Bound the fetches of this checker by the deadline of a session waiting
+    for them. Without one, each fetch gets fetch_wait_timeout.
+  */
+  void set_deadline(std::chrono::steady_clock::time_point deadline) {
+    deadline_ = deadline;
+  }
+
+ private:
+  /* Replica crawler fetches ranges through password_breach_data() */
+  friend class Range_replica;
+  /* Benchmarks time individual steps */
+  friend struct Breach_checker_bench;
+
+  bool generate_digest(std::string &digest) const;
+
+  std::chrono::steady_clock::time_point fetch_deadline() const;
+
+  bool fetch_range(const std::string &prefix, Cached_range &range) const;
+
+  bool fetch_cached_range(const std::string &prefix, Cached_range &range) const;
+
+  static void report(const std::string &prefix, long long count);
+
+  bool password_breach_data(
+      const std::string prefix, Cached_range &range,
+      std::chrono::steady_clock::time_point deadline) const;
+
+ private:
+  /* Status */
+  bool ready_{false};
+  /* Password to be checked. Not copied, so that plaintext stays only in
+     the caller's buffer, which it wipes. */
+  std::string_view password_;
+  /* Retry count */
+  unsigned int retry_;
+  /* Who fetches are made for */
+  Request_class request_class_;
+  /* Time by which fetches have to be done, unset if not given */
+  std::chrono::steady_clock::time_point deadline_{};
+};
+
+/** CURL write callback: appends received data to a std::stringstream */
+size_t writer_callback(void *contents, size_t size, size_t nmemb, void *userp);
+
+}  // namespace password_breach_check
+#endif /* BREACH_CHECKER_H_INCLUDED */
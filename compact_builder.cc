@@ -0,0 +1,138 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+/*
+  password_breach_check_compact
+
+  Builds a compact store for password_breach_check.compact_store from a
+  range pack (see password_breach_check_range_mirror --build).
+
+  Usage:
+    password_breach_check_compact --pack <file> --out <file>
+        [--suffixes sorted|elias_fano] [--suffix-bits <8-48>]
+        [--counts none|log8|exact] [--min-count <n>]
+        [--group <ranges per block>] [--zstd <level>] [--align page|none]
+
+  --align page keeps blocks that fit in a 4 KB page from straddling two,
+  so that password_breach_check.compact_store_direct_io reads one page per
+  lookup. Use it with --group 1.
+*/
+
+#include <iostream> /* std::cerr */
+#include <string>   /* std::string */
+#include <vector>   /* std::vector */
+
+#include "compact_store.h"
+#include "range_pack.h"
+
+using namespace password_breach_check;
+
+static void usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " --pack <file> --out <file>\n"
+               "    [--suffixes sorted|elias_fano] [--suffix-bits <8-48>]\n"
+               "    [--counts none|log8|exact] [--min-count <n>]\n"
+               "    [--group <ranges per block>] [--zstd <level>]\n"
+               "    [--align page|none]\n";
+}
+
+int main(int argc, char **argv) {
+  std::string pack_path, out_path;
+  Compact_options options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg(argv[i]), value(argv[i + 1]);
+    if (arg == "--pack")
+      pack_path = value;
+    else if (arg == "--out")
+      out_path = value;
+    else if (arg == "--suffixes" && value == "sorted")
+      options.suffixes = Compact_options::Suffixes::SORTED;
+    else if (arg == "--suffixes" && value == "elias_fano")
+      options.suffixes = Compact_options::Suffixes::ELIAS_FANO;
+    else if (arg == "--suffix-bits")
+      options.suffix_bits = static_cast<uint32_t>(std::stoul(value));
+    else if (arg == "--counts" && value == "none")
+      options.counts = Compact_options::Counts::NONE;
+    else if (arg == "--counts" && value == "log8")
+      options.counts = Compact_options::Counts::LOG8;
+    else if (arg == "--counts" && value == "exact")
+      options.counts = Compact_options::Counts::EXACT;
+    else if (arg == "--min-count")
+      options.min_count = static_cast<uint32_t>(std::stoul(value));
+    else if (arg == "--group")
+      options.group_size = static_cast<uint32_t>(std::stoul(value));
+    else if (arg == "--zstd")
+      options.zstd_level = std::stoi(value);
+    else if (arg == "--align" && (value == "page" || value == "none"))
+      options.page_align = value == "page";
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (pack_path.empty() || out_path.empty() || argc % 2 == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Range_pack pack;
+  if (pack.open(pack_path)) {
+    std::cerr << pack.last_error() << std::endl;
+    return 1;
+  }
+
+  Compact_store_writer writer;
+  if (writer.open(out_path, options)) {
+    std::cerr << writer.last_error() << std::endl;
+    return 1;
+  }
+
+  std::vector<Range_entry> entries;
+  uint64_t source_entries = 0;
+  for (uint32_t prefix = 0; prefix < RANGE_PREFIX_COUNT; ++prefix) {
+    auto body = pack.body(prefix);
+    if (body.empty()) continue;
+    if (parse_range_entries(body, entries)) {
+      std::cerr << "Malformed range data for prefix "
+                << format_range_prefix(prefix) << std::endl;
+      return 1;
+    }
+    source_entries += entries.size();
+    if (writer.add(prefix, entries)) {
+      std::cerr << writer.last_error() << std::endl;
+      return 1;
+    }
+  }
+  if (writer.finish()) {
+    std::cerr << writer.last_error() << std::endl;
+    return 1;
+  }
+
+  std::cout << "Hashes in pack:  " << source_entries << "\n"
+            << "Hashes in store: " << writer.entries() << "\n"
+            << "Store size:      " << writer.size() << " bytes ("
+            << (writer.entries() ? static_cast<double>(writer.size()) /
+                                       writer.entries()
+                                 : 0.0)
+            << " bytes per hash)" << std::endl;
+  return 0;
+}
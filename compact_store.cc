@@ -0,0 +1,614 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "compact_store.h"
+
+#include <algorithm> /* std::max */
+#include <cerrno>    /* errno */
+#include <cmath>     /* std::log2, std::pow */
+#include <cstdio>    /* std::rename */
+#include <cstring>   /* memcpy, strerror */
+
+#include <fcntl.h>    /* open */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* pwrite */
+
+#ifdef HAVE_ZSTD
+#include <zstd.h> /* ZSTD_* functions */
+#endif /* HAVE_ZSTD */
+
+namespace password_breach_check {
+
+/** Magic identifying a compact store */
+static const char COMPACT_MAGIC[8] = {'P', 'B', 'C', 'C', 'M', 'P', 'C', '1'};
+
+/** Current compact store version */
+static const uint32_t COMPACT_VERSION = 1;
+
+/** Zero bytes after each block so that bit reads may overrun by a word */
+static const size_t BLOCK_PADDING = 8;
+
+struct Compact_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t prefix_bits;
+  uint32_t suffixes;
+  uint32_t counts;
+  uint32_t suffix_bits;
+  uint32_t min_count;
+  uint32_t group_size;
+  uint32_t compressed;
+  uint64_t entries;
+  uint32_t block_count;
+  uint32_t reserved[3];
+};
+
+/** Header of an encoded range */
+struct Compact_range {
+  uint16_t count;
+  /* Elias-Fano: number of low bits per element */
+  uint8_t low_bits;
+  uint8_t reserved;
+  /* Elias-Fano: size of the upper bit vector */
+  uint32_t upper_bytes;
+};
+
+static_assert(sizeof(Compact_header) == 64, "Unexpected header size");
+static_assert(sizeof(Compact_range) == 8, "Unexpected range header size");
+
+/** Leading suffix_bits of a binary suffix */
+static uint64_t truncate_suffix(const uint8_t *suffix, uint32_t suffix_bits) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; ++i) value = (value << 8) | suffix[i];
+  return value >> (64 - suffix_bits);
+}
+
+/** Read bits at a bit position, least significant bit first */
+static uint64_t read_bits(const uint8_t *base, uint64_t position,
+                          uint32_t bits) {
+  if (bits == 0) return 0;
+  uint64_t word;
+  memcpy(&word, base + position / 8, sizeof(word));
+  word >>= position % 8;
+  return bits >= 64 ? word : word & ((1ULL << bits) - 1);
+}
+
+static uint8_t encode_log8(uint32_t count) {
+  if (count <= 1) return 1;
+  return static_cast<uint8_t>(
+      std::min(255.0, 1 + std::floor(8 * std::log2(count))));
+}
+
+static long long decode_log8(uint8_t value) {
+  if (value <= 1) return 1;
+  return std::llround(std::pow(2.0, (value - 1) / 8.0));
+}
+
+/** Bytes used by a truncated suffix in the sorted layout */
+static size_t key_bytes(uint32_t suffix_bits) { return (suffix_bits + 7) / 8; }
+
+bool parse_compact_header(const char *data, Compact_options &options,
+                          uint64_t &entries, uint32_t &block_count) {
+  Compact_header header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, COMPACT_MAGIC, sizeof(COMPACT_MAGIC)) != 0 ||
+      header.version != COMPACT_VERSION ||
+      header.prefix_bits != RANGE_PREFIX_BITS || header.suffix_bits < 8 ||
+      header.suffix_bits > 48 || header.group_size == 0 ||
+      header.block_count != RANGE_PREFIX_COUNT / header.group_size ||
+      header.suffixes > 1 || header.counts > 2)
+    return true;
+#ifndef HAVE_ZSTD
+  /* Compressed stores need zstd support */
+  if (header.compressed != 0) return true;
+#endif /* HAVE_ZSTD */
+
+  options.suffixes = static_cast<Compact_options::Suffixes>(header.suffixes);
+  options.counts = static_cast<Compact_options::Counts>(header.counts);
+  options.suffix_bits = header.suffix_bits;
+  options.min_count = header.min_count;
+  options.group_size = header.group_size;
+  /* Level is not recorded, only whether blocks are compressed */
+  options.zstd_level = static_cast<int>(header.compressed);
+  entries = header.entries;
+  block_count = header.block_count;
+  return false;
+}
+
+bool decompress_compact_block(const char *data, size_t size,
+                              std::string &out) {
+#ifdef HAVE_ZSTD
+  /* Page aligned stores leave zero padding after the frame */
+  auto frame_size = ZSTD_findFrameCompressedSize(data, size);
+  if (ZSTD_isError(frame_size)) return true;
+  auto content_size = ZSTD_getFrameContentSize(data, frame_size);
+  if (content_size == ZSTD_CONTENTSIZE_ERROR ||
+      content_size == ZSTD_CONTENTSIZE_UNKNOWN)
+    return true;
+  out.resize(static_cast<size_t>(content_size));
+  return ZSTD_isError(ZSTD_decompress(&out[0], out.size(), data, frame_size));
+#else
+  (void)data;
+  (void)size;
+  (void)out;
+  return true;
+#endif /* HAVE_ZSTD */
+}
+
+bool compact_block_lookup(const Compact_options &options, const char *block,
+                          size_t block_size, uint32_t prefix,
+                          std::string_view suffix, long long &count) {
+  uint8_t binary[RANGE_SUFFIX_BYTES];
+  if (parse_range_suffix(suffix, binary)) return false;
+  uint64_t key = truncate_suffix(binary, options.suffix_bits);
+
+  /* Locate the range within the block */
+  uint32_t position = prefix % options.group_size;
+  if ((static_cast<uint64_t>(position) + 2) * sizeof(uint32_t) > block_size)
+    return false;
+  uint32_t begin, end;
+  memcpy(&begin, block + position * sizeof(uint32_t), sizeof(begin));
+  memcpy(&end, block + (position + 1) * sizeof(uint32_t), sizeof(end));
+  if (begin > end || end - begin < sizeof(Compact_range) ||
+      static_cast<uint64_t>(end) + BLOCK_PADDING > block_size)
+    return false;
+
+  Compact_range range;
+  memcpy(&range, block + begin, sizeof(range));
+  auto data = reinterpret_cast<const uint8_t *>(block + begin) +
+              sizeof(range);
+  uint32_t n = range.count;
+
+  /* A corrupt store must not send the search past the range */
+  auto width = key_bytes(options.suffix_bits);
+  uint64_t low_bytes = (static_cast<uint64_t>(n) * range.low_bits + 7) / 8;
+  uint64_t suffixes_size =
+      options.suffixes == Compact_options::Suffixes::SORTED
+          ? static_cast<uint64_t>(n) * width
+          : low_bytes + range.upper_bytes;
+  uint64_t counts_size = 0;
+  if (options.counts == Compact_options::Counts::LOG8)
+    counts_size = n;
+  else if (options.counts == Compact_options::Counts::EXACT)
+    counts_size = static_cast<uint64_t>(n) * sizeof(uint32_t);
+  if (range.low_bits >= 64 ||
+      sizeof(range) + suffixes_size + counts_size > end - begin)
+    return false;
+
+  /* Find index of the key */
+  int64_t found = -1;
+  if (options.suffixes == Compact_options::Suffixes::SORTED) {
+    auto value_at = [&](uint32_t i) {
+      uint64_t value = 0;
+      for (size_t b = 0; b < width; ++b)
+        value = (value << 8) | data[i * width + b];
+      return value;
+    };
+    uint32_t low = 0, high = n;
+    while (low < high) {
+      uint32_t middle = low + (high - low) / 2;
+      if (value_at(middle) < key)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    if (low < n && value_at(low) == key) found = low;
+  } else {
+    /*
+      Elias-Fano: element i is (upper_i << low_bits) | low_i. low_i are
+      stored packed; the upper bit vector has bit (upper_i + i) set. The
+      elements with upper part h are the ones between the h-th and the
+      h+1-th zero of the upper bit vector.
+    */
+    uint32_t low_bits = range.low_bits;
+    const uint8_t *upper = data + low_bytes;
+    uint64_t upper_bits = static_cast<uint64_t>(range.upper_bytes) * 8;
+    uint64_t high = key >> low_bits;
+    uint64_t low = low_bits == 0 ? 0 : key & ((1ULL << low_bits) - 1);
+
+    /* Skip to just after the high-th zero */
+    uint64_t bit = 0;
+    uint64_t zeros = 0;
+    while (zeros < high && bit < upper_bits) {
+      uint64_t word;
+      memcpy(&word, upper + bit / 8, sizeof(word));
+      auto available = std::min<uint64_t>(64, upper_bits - bit);
+      if (available < 64) word |= ~0ULL << available;
+      auto word_zeros = static_cast<uint64_t>(64 - __builtin_popcountll(word));
+      if (zeros + word_zeros < high) {
+        zeros += word_zeros;
+        bit += available;
+        continue;
+      }
+      while (zeros < high) {
+        if ((word & 1) == 0) ++zeros;
+        word >>= 1;
+        ++bit;
+      }
+    }
+    if (zeros == high) {
+      while (bit < upper_bits && read_bits(upper, bit, 1) == 1) {
+        uint64_t i = bit - high;
+        auto value = read_bits(data, i * low_bits, low_bits);
+        if (value == low) {
+          found = static_cast<int64_t>(i);
+          break;
+        }
+        if (value > low) break;
+        ++bit;
+      }
+    }
+  }
+
+  count = 0;
+  if (found < 0) return true;
+  auto counts = data + suffixes_size;
+  switch (options.counts) {
+    case Compact_options::Counts::NONE:
+      count = 1;
+      break;
+    case Compact_options::Counts::LOG8:
+      count = decode_log8(counts[found]);
+      break;
+    case Compact_options::Counts::EXACT: {
+      uint32_t value;
+      memcpy(&value, counts + found * sizeof(value), sizeof(value));
+      count = value;
+      break;
+    }
+  }
+  return true;
+}
+
+/****************************************************************************/
+
+void Block_cache::resize(size_t capacity) {
+  clear();
+  per_shard_ = std::max<size_t>(1, capacity / SHARDS);
+}
+
+std::shared_ptr<const std::string> Block_cache::get(uint64_t key) {
+  auto &shard = shards_[key % SHARDS];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.blocks.find(key);
+  if (it == shard.blocks.end()) return nullptr;
+  shard.order.splice(shard.order.begin(), shard.order, it->second.second);
+  return it->second.first;
+}
+
+void Block_cache::put(uint64_t key, std::shared_ptr<const std::string> block) {
+  auto &shard = shards_[key % SHARDS];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.blocks.find(key) != shard.blocks.end()) return;
+  shard.order.push_front(key);
+  shard.blocks.emplace(key, std::make_pair(std::move(block),
+                                           shard.order.begin()));
+  if (shard.blocks.size() > per_shard_) {
+    shard.blocks.erase(shard.order.back());
+    shard.order.pop_back();
+  }
+}
+
+void Block_cache::clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.blocks.clear();
+    shard.order.clear();
+  }
+}
+
+/****************************************************************************/
+
+Compact_store::~Compact_store() { close(); }
+
+bool Compact_store::fail(const std::string &message) {
+  error_ = message;
+  close();
+  return true;
+}
+
+bool Compact_store::open(const std::string &path, size_t cache_blocks) {
+  close();
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) return fail("Failed to open " + path + ": " + strerror(errno));
+  struct stat st;
+  if (fstat(fd_, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Compact_header))
+    return fail(path + " is not a compact store");
+
+  size_ = static_cast<size_t>(st.st_size);
+  void *base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (base == MAP_FAILED)
+    return fail("Failed to map " + path + ": " + strerror(errno));
+  base_ = static_cast<const char *>(base);
+
+  if (parse_compact_header(base_, options_, entries_, block_count_))
+    return fail(path + " is not a supported compact store");
+
+  offsets_ = reinterpret_cast<const uint64_t *>(base_ + COMPACT_HEADER_SIZE);
+  if (COMPACT_HEADER_SIZE + (block_count_ + 1ULL) * sizeof(uint64_t) > size_)
+    return fail(path + " is truncated");
+  for (uint32_t i = 0; i < block_count_; ++i)
+    if (offsets_[i] > offsets_[i + 1] || offsets_[i + 1] > size_)
+      return fail(path + " has a block out of bounds");
+
+  cache_.resize(cache_blocks);
+  madvise(const_cast<char *>(base_), size_, MADV_RANDOM);
+  return false;
+}
+
+void Compact_store::close() {
+  if (base_ != nullptr) munmap(const_cast<char *>(base_), size_);
+  if (fd_ >= 0) ::close(fd_);
+  base_ = nullptr;
+  offsets_ = nullptr;
+  size_ = 0;
+  fd_ = -1;
+  cache_.clear();
+}
+
+/** Decompressed block, through the cache */
+std::shared_ptr<const std::string> Compact_store::block(uint32_t index) const {
+  auto cached = cache_.get(index);
+  if (cached != nullptr) return cached;
+
+  auto data = std::make_shared<std::string>();
+  if (decompress_compact_block(
+          base_ + offsets_[index],
+          static_cast<size_t>(offsets_[index + 1] - offsets_[index]), *data))
+    return nullptr;
+  cache_.put(index, data);
+  return data;
+}
+
+bool Compact_store::lookup(uint32_t prefix, std::string_view suffix,
+                           long long &count) const {
+  if (base_ == nullptr || prefix >= RANGE_PREFIX_COUNT) return false;
+
+  uint32_t index = prefix / options_.group_size;
+  if (options_.zstd_level == 0)
+    return compact_block_lookup(
+        options_, base_ + offsets_[index],
+        static_cast<size_t>(offsets_[index + 1] - offsets_[index]), prefix,
+        suffix, count);
+
+  auto data = block(index);
+  return data != nullptr && compact_block_lookup(options_, data->data(),
+                                                 data->size(), prefix, suffix,
+                                                 count);
+}
+
+/****************************************************************************/
+
+Compact_store_writer::~Compact_store_writer() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    unlink(temp_path_.c_str());
+  }
+}
+
+bool Compact_store_writer::fail(const std::string &message) {
+  error_ = message;
+  return true;
+}
+
+bool Compact_store_writer::open(const std::string &path,
+                                const Compact_options &options) {
+  if (options.suffix_bits < 8 || options.suffix_bits > 48)
+    return fail("Suffix bits must be between 8 and 48");
+  if (options.group_size == 0 || options.group_size > RANGE_PREFIX_COUNT ||
+      (options.group_size & (options.group_size - 1)) != 0)
+    return fail("Group size must be a power of 2");
+#ifndef HAVE_ZSTD
+  if (options.zstd_level != 0)
+    return fail("Compression requested but zstd support is not built in");
+#endif /* HAVE_ZSTD */
+
+  options_ = options;
+  path_ = path;
+  temp_path_ = path + ".tmp";
+  fd_ = ::open(temp_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0644);
+  if (fd_ < 0)
+    return fail("Failed to create " + temp_path_ + ": " + strerror(errno));
+
+  auto block_count = RANGE_PREFIX_COUNT / options_.group_size;
+  offset_ = sizeof(Compact_header) + (block_count + 1ULL) * sizeof(uint64_t);
+  offsets_.clear();
+  offsets_.push_back(offset_);
+  directory_.clear();
+  block_.clear();
+  next_prefix_ = 0;
+  entries_ = 0;
+  return false;
+}
+
+/** Append an encoded range to the block being assembled */
+void Compact_store_writer::encode_range(
+    const std::vector<Range_entry> &entries) {
+  /* Truncate, prune and merge suffixes that became equal */
+  std::vector<std::pair<uint64_t, uint32_t>> keys;
+  keys.reserve(entries.size());
+  for (const auto &entry : entries) {
+    if (entry.count == 0 || entry.count < options_.min_count) continue;
+    auto key = truncate_suffix(entry.suffix, options_.suffix_bits);
+    if (!keys.empty() && keys.back().first == key)
+      keys.back().second = std::max(keys.back().second, entry.count);
+    else
+      keys.emplace_back(key, entry.count);
+  }
+  keys.resize(std::min<size_t>(keys.size(), UINT16_MAX));
+  entries_ += keys.size();
+
+  directory_.push_back(static_cast<uint32_t>(block_.size()));
+  Compact_range range{};
+  range.count = static_cast<uint16_t>(keys.size());
+  std::string encoded;
+
+  if (options_.suffixes == Compact_options::Suffixes::SORTED) {
+    auto width = key_bytes(options_.suffix_bits);
+    for (const auto &key : keys)
+      for (size_t b = width; b-- > 0;)
+        encoded.push_back(static_cast<char>((key.first >> (8 * b)) & 0xFF));
+  } else {
+    uint64_t n = keys.size();
+    uint64_t universe = 1ULL << options_.suffix_bits;
+    uint32_t low_bits = 0;
+    if (n > 0 && universe / n > 1)
+      low_bits = 63 - static_cast<uint32_t>(__builtin_clzll(universe / n));
+    uint64_t low_bytes = (n * low_bits + 7) / 8;
+    uint64_t upper_bits = n == 0 ? 0 : (keys.back().first >> low_bits) + n;
+    uint64_t upper_bytes = (upper_bits + 7) / 8;
+    /* Extra word so that bits can be ORed in with 64 bit accesses */
+    std::vector<uint8_t> bits(low_bytes + upper_bytes + 8, 0);
+    auto set_bits = [&bits](uint64_t position, uint64_t value) {
+      for (; value != 0; value >>= 8, position += 8) {
+        bits[position / 8] |= static_cast<uint8_t>(value << (position % 8));
+        bits[position / 8 + 1] |=
+            static_cast<uint8_t>((value & 0xFF) >> (8 - position % 8));
+      }
+    };
+    for (uint64_t i = 0; i < n; ++i) {
+      auto key = keys[i].first;
+      if (low_bits > 0) set_bits(i * low_bits, key & ((1ULL << low_bits) - 1));
+      set_bits(low_bytes * 8 + (key >> low_bits) + i, 1);
+    }
+    range.low_bits = static_cast<uint8_t>(low_bits);
+    range.upper_bytes = static_cast<uint32_t>(upper_bytes);
+    encoded.assign(reinterpret_cast<const char *>(bits.data()),
+                   low_bytes + upper_bytes);
+  }
+
+  for (const auto &key : keys) {
+    if (options_.counts == Compact_options::Counts::LOG8) {
+      encoded.push_back(static_cast<char>(encode_log8(key.second)));
+    } else if (options_.counts == Compact_options::Counts::EXACT) {
+      encoded.append(reinterpret_cast<const char *>(&key.second),
+                     sizeof(key.second));
+    }
+  }
+
+  block_.append(reinterpret_cast<const char *>(&range), sizeof(range));
+  block_.append(encoded);
+}
+
+/** Write out the block being assembled */
+bool Compact_store_writer::flush_block() {
+  /* Directory offsets are relative to the block start */
+  auto directory_size = (options_.group_size + 1) * sizeof(uint32_t);
+  directory_.push_back(static_cast<uint32_t>(block_.size()));
+  for (auto &offset : directory_) offset += directory_size;
+
+  std::string data(reinterpret_cast<const char *>(directory_.data()),
+                   directory_size);
+  data.append(block_);
+  data.append(BLOCK_PADDING, '\0');
+  directory_.clear();
+  block_.clear();
+
+#ifdef HAVE_ZSTD
+  if (options_.zstd_level != 0) {
+    std::string compressed(ZSTD_compressBound(data.size()), '\0');
+    auto size = ZSTD_compress(&compressed[0], compressed.size(), data.data(),
+                              data.size(), options_.zstd_level);
+    if (ZSTD_isError(size))
+      return fail(std::string("Compression failed: ") +
+                  ZSTD_getErrorName(size));
+    compressed.resize(size);
+    data.swap(compressed);
+  }
+#endif /* HAVE_ZSTD */
+
+  /*
+    Start on a new page if the block would otherwise straddle one it could
+    fit in. The gap becomes zero padding at the end of the previous block.
+  */
+  auto in_page = offset_ % COMPACT_PAGE_SIZE;
+  if (options_.page_align && in_page != 0 &&
+      in_page + data.size() > COMPACT_PAGE_SIZE) {
+    offset_ += COMPACT_PAGE_SIZE - in_page;
+    offsets_.back() = offset_;
+  }
+
+  if (pwrite(fd_, data.data(), data.size(), static_cast<off_t>(offset_)) !=
+      static_cast<ssize_t>(data.size()))
+    return fail("Failed to write " + temp_path_ + ": " + strerror(errno));
+  offset_ += data.size();
+  offsets_.push_back(offset_);
+  return false;
+}
+
+bool Compact_store_writer::add(uint32_t prefix,
+                               const std::vector<Range_entry> &entries) {
+  if (fd_ < 0) return fail("Compact store is not open for writing");
+  if (prefix < next_prefix_ || prefix >= RANGE_PREFIX_COUNT)
+    return fail("Prefix " + format_range_prefix(prefix) + " is out of order");
+
+  static const std::vector<Range_entry> empty;
+  while (next_prefix_ <= prefix) {
+    encode_range(next_prefix_ == prefix ? entries : empty);
+    if (++next_prefix_ % options_.group_size == 0 && flush_block())
+      return true;
+  }
+  return false;
+}
+
+bool Compact_store_writer::finish() {
+  if (fd_ < 0) return fail("Compact store is not open for writing");
+  if (next_prefix_ < RANGE_PREFIX_COUNT &&
+      add(RANGE_PREFIX_COUNT - 1, std::vector<Range_entry>{}))
+    return true;
+
+  Compact_header header{};
+  memcpy(header.magic, COMPACT_MAGIC, sizeof(COMPACT_MAGIC));
+  header.version = COMPACT_VERSION;
+  header.prefix_bits = RANGE_PREFIX_BITS;
+  header.suffixes = static_cast<uint32_t>(options_.suffixes);
+  header.counts = static_cast<uint32_t>(options_.counts);
+  header.suffix_bits = options_.suffix_bits;
+  header.min_count = options_.min_count;
+  header.group_size = options_.group_size;
+  header.compressed = options_.zstd_level != 0 ? 1 : 0;
+  header.entries = entries_;
+  header.block_count = RANGE_PREFIX_COUNT / options_.group_size;
+
+  auto offsets_size = offsets_.size() * sizeof(uint64_t);
+  if (pwrite(fd_, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      pwrite(fd_, offsets_.data(), offsets_size, sizeof(header)) !=
+          static_cast<ssize_t>(offsets_size) ||
+      fsync(fd_) != 0)
+    return fail("Failed to write " + temp_path_ + ": " + strerror(errno));
+
+  ::close(fd_);
+  fd_ = -1;
+  if (std::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+    auto message = "Failed to rename " + temp_path_ + " to " + path_ + ": " +
+                   strerror(errno);
+    unlink(temp_path_.c_str());
+    return fail(message);
+  }
+  return false;
+}
+
+}  // namespace password_breach_check
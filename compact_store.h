@@ -0,0 +1,294 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#ifndef COMPACT_STORE_H_INCLUDED
+#define COMPACT_STORE_H_INCLUDED
+
+#include <cstddef>     /* size_t */
+#include <cstdint>     /* uint*_t */
+#include <list>        /* std::list */
+#include <memory>      /* std::shared_ptr */
+#include <mutex>       /* std::mutex */
+#include <string>      /* std::string */
+#include <string_view> /* std::string_view */
+#include <unordered_map> /* std::unordered_map */
+#include <vector>      /* std::vector */
+
+#include "range_pack.h"
+
+namespace password_breach_check {
+
+/**
+  Encoding options of a compact store
+
+  A compact store trades exactness for size. Suffixes are truncated to
+  suffix_bits; the truncated suffix is the fingerprint, so a lookup reports
+  a false match with probability of about entries_per_range / 2^suffix_bits.
+*/
+struct Compact_options {
+  /** How truncated suffixes of a range are laid out */
+  enum class Suffixes : uint32_t {
+    /* Fixed width, big endian, binary searched */
+    SORTED = 0,
+    /* Elias-Fano coded monotone sequence */
+    ELIAS_FANO = 1
+  };
+
+  /** How breach counts are kept */
+  enum class Counts : uint32_t {
+    /* Presence only. Matches report a count of 1. */
+    NONE = 0,
+    /* 1 byte, 8 steps per doubling (about 9% error) */
+    LOG8 = 1,
+    /* 4 bytes */
+    EXACT = 2
+  };
+
+  Suffixes suffixes{Suffixes::ELIAS_FANO};
+  Counts counts{Counts::LOG8};
+  /* Bits of the suffix that are kept: 8 - 48 */
+  uint32_t suffix_bits{32};
+  /* Hashes seen fewer times than this are left out */
+  uint32_t min_count{1};
+  /* Ranges per block. Unit of compression and of caching. Power of 2. */
+  uint32_t group_size{16};
+  /* zstd level for blocks. 0 to store blocks uncompressed. */
+  int zstd_level{0};
+  /* Start a block on a new 4 KB page rather than let it straddle two */
+  bool page_align{false};
+};
+
+/** Alignment used by page_align and by direct reads */
+const size_t COMPACT_PAGE_SIZE = 4096;
+
+/** Size of the compact store header. Block offsets follow it. */
+const size_t COMPACT_HEADER_SIZE = 64;
+
+/**
+  Validate a compact store header
+
+  @param [in]  data         At least COMPACT_HEADER_SIZE bytes
+  @param [out] options      Encoding of the store. zstd_level is 1 if
+                            blocks are compressed.
+  @param [out] entries      Number of hashes in the store
+  @param [out] block_count  Number of blocks
+
+  @returns status of the operation
+    @retval true  Not a supported compact store
+    @retval false Success
+*/
+bool parse_compact_header(const char *data, Compact_options &options,
+                          uint64_t &entries, uint32_t &block_count);
+
+/**
+  Decompress a block
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool decompress_compact_block(const char *data, size_t size, std::string &out);
+
+/**
+  Look up a suffix in a decompressed block
+
+  @param [in]  options     Encoding of the store
+  @param [in]  block       Block data
+  @param [in]  block_size  Size of block data
+  @param [in]  prefix      Numeric prefix. Must belong to the block.
+  @param [in]  suffix      35 character hex suffix
+  @param [out] count       Approximate times suffix appeared in breaches,
+                           0 if not listed
+
+  @returns true if the block answered the lookup, false if it is damaged
+*/
+bool compact_block_lookup(const Compact_options &options, const char *block,
+                          size_t block_size, uint32_t prefix,
+                          std::string_view suffix, long long &count);
+
+/** Small LRU cache of decompressed blocks, sharded to spread contention */
+class Block_cache {
+ public:
+  /** Set number of blocks kept. Drops cached blocks. */
+  void resize(size_t capacity);
+
+  std::shared_ptr<const std::string> get(uint64_t key);
+
+  void put(uint64_t key, std::shared_ptr<const std::string> block);
+
+  void clear();
+
+ private:
+  static const size_t SHARDS = 16;
+
+  struct Shard {
+    std::mutex mutex;
+    std::list<uint64_t> order;
+    std::unordered_map<uint64_t,
+                       std::pair<std::shared_ptr<const std::string>,
+                                 std::list<uint64_t>::iterator>>
+        blocks;
+  };
+
+  Shard shards_[SHARDS];
+  size_t per_shard_{1};
+};
+
+/**
+  Read-only, memory-mapped compact store
+
+  Layout:
+
+  +----------------------------+
+  | header                     |
+  +----------------------------+
+  | uint64 offset              |  x block_count + 1
+  +----------------------------+
+  | block 0                    |  possibly zstd compressed, and
+  |                            |  optionally page aligned
+  | ...                        |
+  +----------------------------+
+
+  A block, once decompressed, holds group_size ranges: a uint32 directory
+  of group_size + 1 range offsets followed by the encoded ranges.
+  Decompressed blocks are kept in a small LRU cache.
+*/
+class Compact_store {
+ public:
+  Compact_store() = default;
+  ~Compact_store();
+
+  Compact_store(const Compact_store &) = delete;
+  Compact_store &operator=(const Compact_store &) = delete;
+
+  /**
+    Map a compact store
+
+    @param [in] path          Location of the store
+    @param [in] cache_blocks  Decompressed blocks to keep in memory
+
+    @returns status of the operation
+      @retval true  Failure. See last_error()
+      @retval false Success
+  */
+  bool open(const std::string &path, size_t cache_blocks);
+
+  void close();
+
+  bool is_open() const { return base_ != nullptr; }
+
+  const Compact_options &options() const { return options_; }
+
+  /** Number of hashes in the store */
+  uint64_t entries() const { return entries_; }
+
+  /**
+    Look up a suffix
+
+    @param [in]  prefix  Numeric prefix
+    @param [in]  suffix  35 character hex suffix
+    @param [out] count   Approximate times suffix appeared in breaches,
+                         0 if not listed
+
+    @returns true if the store answered the lookup
+  */
+  bool lookup(uint32_t prefix, std::string_view suffix,
+              long long &count) const;
+
+  const std::string &last_error() const { return error_; }
+
+ private:
+  bool fail(const std::string &message);
+
+  std::shared_ptr<const std::string> block(uint32_t index) const;
+
+ private:
+  int fd_{-1};
+  const char *base_{nullptr};
+  size_t size_{0};
+  Compact_options options_;
+  uint64_t entries_{0};
+  uint32_t block_count_{0};
+  const uint64_t *offsets_{nullptr};
+  std::string error_;
+
+  mutable Block_cache cache_;
+};
+
+/** Builds a compact store from ranges added in prefix order */
+class Compact_store_writer {
+ public:
+  Compact_store_writer() = default;
+  ~Compact_store_writer();
+
+  Compact_store_writer(const Compact_store_writer &) = delete;
+  Compact_store_writer &operator=(const Compact_store_writer &) = delete;
+
+  bool open(const std::string &path, const Compact_options &options);
+
+  /**
+    Add a range. Prefixes must be added in increasing order; prefixes that
+    are skipped are stored as empty ranges.
+
+    @param [in] prefix   Numeric prefix
+    @param [in] entries  Entries sorted by suffix
+
+    @returns status of the operation
+      @retval true  Failure. See last_error()
+      @retval false Success
+  */
+  bool add(uint32_t prefix, const std::vector<Range_entry> &entries);
+
+  bool finish();
+
+  /** Number of hashes written so far */
+  uint64_t entries() const { return entries_; }
+
+  /** Bytes written so far */
+  uint64_t size() const { return offset_; }
+
+  const std::string &last_error() const { return error_; }
+
+ private:
+  bool fail(const std::string &message);
+
+  bool flush_block();
+
+  void encode_range(const std::vector<Range_entry> &entries);
+
+ private:
+  std::string path_;
+  std::string temp_path_;
+  int fd_{-1};
+  Compact_options options_;
+  uint32_t next_prefix_{0};
+  uint64_t offset_{0};
+  uint64_t entries_{0};
+  std::vector<uint64_t> offsets_;
+  /* Block being assembled */
+  std::vector<uint32_t> directory_;
+  std::string block_;
+  std::string error_;
+};
+
+}  // namespace password_breach_check
+#endif /* COMPACT_STORE_H_INCLUDED */
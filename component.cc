@@ -24,9 +24,20 @@ THE SOFTWARE. */
 #include "password_breach_check.h"
 
 /* Service placeholders */
+REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_register);
+REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_unregister);
+REQUIRES_SERVICE_PLACEHOLDER(dynamic_privilege_register);
+REQUIRES_SERVICE_PLACEHOLDER(global_grants_check);
 REQUIRES_SERVICE_PLACEHOLDER(log_builtins);
 REQUIRES_SERVICE_PLACEHOLDER(log_builtins_string);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_current_thread_reader);
 REQUIRES_SERVICE_PLACEHOLDER(mysql_string_converter);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_security_context);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_store);
+REQUIRES_SERVICE_PLACEHOLDER(pfs_plugin_table_v1);
+REQUIRES_SERVICE_PLACEHOLDER(pfs_plugin_column_string_v2);
+REQUIRES_SERVICE_PLACEHOLDER(pfs_plugin_column_bigint_v1);
+REQUIRES_SERVICE_PLACEHOLDER(status_variable_registration);
 REQUIRES_SERVICE_PLACEHOLDER(udf_registration);
 ADD_BROADCAST_SERVICE_PLACEHOLDERS
 
@@ -50,12 +61,57 @@ static mysql_service_status_t password_breach_check_init() {
   log_bi = mysql_service_log_builtins;
   log_bs = mysql_service_log_builtins_string;
 
-  if (service_broadcast::init(service_name, component_name, true)) return true;
+  if (System_variables::register_variables()) return true;
 
+  if (Status_variables::register_variables()) {
+    System_variables::unregister_variables();
+    return true;
+  }
+
+  if (Latency_table::register_table()) {
+    Status_variables::unregister_variables();
+    System_variables::unregister_variables();
+    return true;
+  }
+
+  if (Session_memo::register_slot()) {
+    Latency_table::unregister_table();
+    Status_variables::unregister_variables();
+    System_variables::unregister_variables();
+    return true;
+  }
+
+  if (service_broadcast::init(service_name, component_name, true)) {
+    Session_memo::unregister_slot();
+    Latency_table::unregister_table();
+    Status_variables::unregister_variables();
+    System_variables::unregister_variables();
+    return true;
+  }
+
+  /* Environment first: the range table and functions use it */
+  set_log_handler(log_handler);
   Breach_checker::init_environment();
+  if (Range_table::register_table()) {
+    Breach_checker::deinit_environment();
+    set_log_handler(nullptr);
+    service_broadcast::deinit();
+    Session_memo::unregister_slot();
+    Latency_table::unregister_table();
+    Status_variables::unregister_variables();
+    System_variables::unregister_variables();
+    return true;
+  }
+
   if (Password_validation::register_functions()) {
+    Range_table::unregister_table();
     Breach_checker::deinit_environment();
+    set_log_handler(nullptr);
     service_broadcast::deinit();
+    Session_memo::unregister_slot();
+    Latency_table::unregister_table();
+    Status_variables::unregister_variables();
+    System_variables::unregister_variables();
     return true;
   }
   return false;
@@ -69,9 +125,20 @@ static mysql_service_status_t password_breach_check_init() {
     @retval false success
 */
 static mysql_service_status_t password_breach_check_deinit() {
+  /*
+    Entry points that use the environment go first, so that no function
+    call or table read is in flight when it is torn down, and a failure
+    leaves the component usable.
+  */
+  if (Password_validation::unregister_functions()) return true;
+  if (Range_table::unregister_table()) return true;
   if (service_broadcast::deinit()) return true;
   Breach_checker::deinit_environment();
-  if (Password_validation::unregister_functions()) return true;
+  set_log_handler(nullptr);
+  if (Session_memo::unregister_slot()) return true;
+  if (Latency_table::unregister_table()) return true;
+  if (Status_variables::unregister_variables()) return true;
+  if (System_variables::unregister_variables()) return true;
   return false;
 }
 
@@ -95,8 +162,19 @@ PROVIDES_SERVICE(password_breach_check, validate_password),
 
 /* Dependencies */
 BEGIN_COMPONENT_REQUIRES(password_breach_check)
-REQUIRES_SERVICE(log_builtins), REQUIRES_SERVICE(log_builtins_string),
+REQUIRES_SERVICE(component_sys_variable_register),
+    REQUIRES_SERVICE(component_sys_variable_unregister),
+    REQUIRES_SERVICE(dynamic_privilege_register),
+    REQUIRES_SERVICE(global_grants_check),
+    REQUIRES_SERVICE(log_builtins), REQUIRES_SERVICE(log_builtins_string),
+    REQUIRES_SERVICE(mysql_current_thread_reader),
     REQUIRES_SERVICE(mysql_string_converter),
+    REQUIRES_SERVICE(mysql_thd_security_context),
+    REQUIRES_SERVICE(mysql_thd_store),
+    REQUIRES_SERVICE(pfs_plugin_table_v1),
+    REQUIRES_SERVICE(pfs_plugin_column_string_v2),
+    REQUIRES_SERVICE(pfs_plugin_column_bigint_v1),
+    REQUIRES_SERVICE(status_variable_registration),
     REQUIRES_SERVICE(udf_registration),
     ADD_BROADCAST_SERVICE_DEPENDENCIES END_COMPONENT_REQUIRES();
 
@@ -0,0 +1,142 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "concurrency_limiter.h"
+
+#include <algorithm> /* std::max */
+
+namespace password_breach_check {
+
+/** Period after which the lowest latency is forgotten */
+static const std::chrono::seconds LATENCY_PERIOD{30};
+
+/** Limit the lowest latency gives way to */
+static const double LATENCY_TOLERANCE = 2.0;
+
+/** Share of the limit requests without priority may use */
+static const double BATCH_SHARE = 0.75;
+
+Concurrency_limiter &Concurrency_limiter::instance() {
+  static Concurrency_limiter limiter;
+  return limiter;
+}
+
+void Concurrency_limiter::configure(unsigned int max_limit) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_limit_ = std::max(1u, max_limit);
+  limit_ = std::min(10.0, max_limit_);
+  min_latency_ = period_min_latency_ = Clock::duration::max();
+  period_start_ = Clock::now();
+  decreased_at_ = Clock::time_point{};
+  blocked_until_ = Clock::time_point{};
+}
+
+bool Concurrency_limiter::acquire(Clock::time_point deadline, bool priority) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool acquired = false;
+  if (priority) priority_waiting_++;
+  for (;;) {
+    auto now = Clock::now();
+    if (blocked_until_ > deadline) break;
+    auto slots = static_cast<unsigned int>(
+        priority ? limit_ : std::max(1.0, limit_ * BATCH_SHARE));
+    if (now >= blocked_until_ && in_flight_ < slots &&
+        (priority || priority_waiting_ == 0)) {
+      in_flight_++;
+      acquired = true;
+      break;
+    }
+    if (now >= deadline) break;
+    /* Releases notify; Retry-After expiring does not */
+    cv_.wait_until(lock, now < blocked_until_ ? blocked_until_ : deadline);
+  }
+  if (priority && --priority_waiting_ == 0) cv_.notify_all();
+  return !acquired;
+}
+
+/**
+  Lower the limit, unless the request started before it was last lowered.
+  Caller holds mutex_.
+
+  @param [in] now      Time the request ended
+  @param [in] latency  Time the request took
+  @param [in] factor   Share of the limit to keep
+*/
+void Concurrency_limiter::decrease(Clock::time_point now,
+                                   Clock::duration latency, double factor) {
+  if (now - latency < decreased_at_) return;
+  limit_ = std::max(1.0, limit_ * factor);
+  decreased_at_ = now;
+}
+
+void Concurrency_limiter::release(Outcome outcome, Clock::duration latency,
+                                  unsigned int retry_after) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    /* Raise only when the limit is what holds requests back */
+    bool saturated = in_flight_ * 2 >= limit_;
+    in_flight_--;
+
+    switch (outcome) {
+      case Outcome::SUCCESS:
+        if (now - period_start_ > LATENCY_PERIOD) {
+          min_latency_ = period_min_latency_;
+          period_min_latency_ = Clock::duration::max();
+          period_start_ = now;
+        }
+        period_min_latency_ = std::min(period_min_latency_, latency);
+        min_latency_ = std::min(min_latency_, latency);
+        if (latency <= min_latency_ * LATENCY_TOLERANCE) {
+          if (saturated) limit_ = std::min(max_limit_, limit_ + 1.0 / limit_);
+        } else {
+          decrease(now, latency, 0.9);
+        }
+        break;
+      case Outcome::OVERLOAD:
+        decrease(now, latency, 0.9);
+        break;
+      case Outcome::THROTTLED:
+        decrease(now, latency, 0.5);
+        blocked_until_ =
+            std::max(blocked_until_,
+                     now + std::chrono::seconds(std::max(1u, retry_after)));
+        break;
+      case Outcome::IGNORE:
+        break;
+    }
+  }
+  cv_.notify_all();
+}
+
+double Concurrency_limiter::limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limit_;
+}
+
+unsigned int Concurrency_limiter::in_flight() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_flight_;
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,128 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef CONCURRENCY_LIMITER_H_INCLUDED
+#define CONCURRENCY_LIMITER_H_INCLUDED
+
+#include <chrono>             /* std::chrono */
+#include <condition_variable> /* std::condition_variable */
+#include <mutex>              /* std::mutex */
+
+namespace password_breach_check {
+
+/**
+  Adaptive limit on requests in flight to the range API
+
+  The limit follows AIMD on latency: a request that completes within twice
+  the lowest recently observed latency raises it by 1/limit (about one per
+  round trip), a slower one or a failure lowers it by 10%, and HTTP 429
+  halves it. Retry-After of a 429 blocks all requests until it has passed.
+  The limit is lowered at most once per window: requests that started
+  before it was last lowered do not lower it again, so that a burst of
+  slow responses to the same congestion counts once.
+
+  Requests over the limit wait for a slot. They fail fast if they would
+  still be blocked by Retry-After at their deadline, or fail once the
+  deadline passes. Requests without priority only use up to BATCH_SHARE of
+  the limit and wait while requests with priority are waiting.
+*/
+class Concurrency_limiter {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  /** How a request ended */
+  enum class Outcome {
+    /* Completed, latency is meaningful */
+    SUCCESS,
+    /* Failed in a way that suggests overload: timeout, 5xx */
+    OVERLOAD,
+    /* Throttled with HTTP 429 */
+    THROTTLED,
+    /* Failed otherwise, limit is left alone */
+    IGNORE
+  };
+
+ public:
+  static Concurrency_limiter &instance();
+
+  /**
+    Set bounds of the limit and reset it
+
+    @param [in] max_limit  Most requests in flight
+  */
+  void configure(unsigned int max_limit);
+
+  /**
+    Wait for a slot
+
+    @param [in] deadline  Time after which to give up
+    @param [in] priority  Whether the request is interactive
+
+    @returns status of the operation
+      @retval true  No slot before deadline
+      @retval false Slot taken, to be returned with release()
+  */
+  bool acquire(Clock::time_point deadline, bool priority = true);
+
+  /**
+    Return a slot and adapt the limit
+
+    @param [in] outcome      How the request ended
+    @param [in] latency      Time the request took
+    @param [in] retry_after  Seconds the server asked to wait, for THROTTLED
+  */
+  void release(Outcome outcome, Clock::duration latency,
+               unsigned int retry_after);
+
+  /** Current limit */
+  double limit() const;
+
+  /** Requests in flight */
+  unsigned int in_flight() const;
+
+ private:
+  void decrease(Clock::time_point now, Clock::duration latency,
+                double factor);
+
+ private:
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  double limit_{10};
+  double max_limit_{64};
+  unsigned int in_flight_{0};
+  unsigned int priority_waiting_{0};
+
+  /* Lowest latency of the current and previous period */
+  Clock::duration min_latency_{Clock::duration::max()};
+  Clock::duration period_min_latency_{Clock::duration::max()};
+  Clock::time_point period_start_{};
+
+  /* Last time the limit was lowered */
+  Clock::time_point decreased_at_{};
+
+  /* No request starts before this, from Retry-After */
+  Clock::time_point blocked_until_{};
+};
+
+}  // namespace password_breach_check
+#endif /* CONCURRENCY_LIMITER_H_INCLUDED */
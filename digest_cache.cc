@@ -0,0 +1,221 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "digest_cache.h"
+
+#include <algorithm> /* std::fill */
+#include <cstring>   /* memcmp */
+#include <ctime>     /* time */
+
+namespace password_breach_check {
+
+/** Digest size in bytes */
+static const size_t DIGEST_BYTES = 20;
+
+/** Entries per bucket */
+static const size_t BUCKET_ENTRIES = 8;
+
+/** Reads retried before giving up on an entry being written */
+static const int READ_ATTEMPTS = 4;
+
+struct Digest_cache::Entry {
+  std::atomic<uint32_t> sequence;
+  uint32_t count;
+  /* Unix time at which the entry was stored, 0 if unused */
+  uint32_t stored_at;
+  uint8_t digest[DIGEST_BYTES];
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == 4, "Entries are 32 bytes");
+
+/** Convert a hex digest to binary */
+static bool parse_digest(std::string_view hex, uint8_t *key) {
+  if (hex.length() != DIGEST_BYTES * 2) return true;
+  auto nibble = [](char c) -> int {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+  };
+  for (size_t i = 0; i < DIGEST_BYTES; ++i) {
+    int high = nibble(hex[2 * i]);
+    int low = nibble(hex[2 * i + 1]);
+    if (high < 0 || low < 0) return true;
+    key[i] = static_cast<uint8_t>(high << 4 | low);
+  }
+  return false;
+}
+
+/* Defined here, where Entry is complete */
+Digest_cache::Digest_cache() = default;
+
+Digest_cache::~Digest_cache() = default;
+
+Digest_cache &Digest_cache::instance() {
+  static Digest_cache cache;
+  return cache;
+}
+
+bool Digest_cache::resize(size_t entries, uint32_t ttl) {
+  entries_.reset();
+  referenced_.reset();
+  hands_.reset();
+  bucket_mask_ = 0;
+  ttl_ = ttl;
+  if (entries == 0) return false;
+
+  size_t buckets = 1;
+  while (buckets * BUCKET_ENTRIES < entries) buckets <<= 1;
+  try {
+    entries_.reset(new Entry[buckets * BUCKET_ENTRIES]);
+    referenced_.reset(new std::atomic<uint8_t>[buckets * BUCKET_ENTRIES]);
+    hands_.reset(new std::atomic<uint8_t>[buckets]);
+  } catch (...) {
+    entries_.reset();
+    referenced_.reset();
+    hands_.reset();
+    return true;
+  }
+  for (size_t i = 0; i < buckets * BUCKET_ENTRIES; ++i) {
+    entries_[i].sequence.store(0, std::memory_order_relaxed);
+    entries_[i].stored_at = 0;
+    referenced_[i].store(0, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < buckets; ++i)
+    hands_[i].store(0, std::memory_order_relaxed);
+  bucket_mask_ = buckets - 1;
+  return false;
+}
+
+/** Digests are uniform, so their leading bytes pick the bucket */
+Digest_cache::Entry *Digest_cache::bucket(const uint8_t *key) const {
+  uint64_t hash;
+  memcpy(&hash, key, sizeof(hash));
+  return &entries_[(hash & bucket_mask_) * BUCKET_ENTRIES];
+}
+
+bool Digest_cache::lookup(std::string_view digest, long long &count) const {
+  if (!entries_) return false;
+  uint8_t key[DIGEST_BYTES];
+  if (parse_digest(digest, key)) return false;
+  auto now = static_cast<uint32_t>(time(nullptr));
+
+  auto *first = bucket(key);
+  for (size_t i = 0; i < BUCKET_ENTRIES; ++i) {
+    auto *current = first + i;
+    for (int attempt = 0; attempt < READ_ATTEMPTS; ++attempt) {
+      auto sequence = current->sequence.load(std::memory_order_acquire);
+      if ((sequence & 1) != 0) continue;
+
+      bool match = memcmp(current->digest, key, DIGEST_BYTES) == 0;
+      auto stored_at = current->stored_at;
+      auto result = current->count;
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (current->sequence.load(std::memory_order_relaxed) != sequence)
+        continue;
+      if (!match || stored_at == 0) break;
+      if (now - stored_at > ttl_) return false;
+
+      /* Avoid dirtying the cache line if already set */
+      auto &referenced = referenced_[current - entries_.get()];
+      if (referenced.load(std::memory_order_relaxed) == 0)
+        referenced.store(1, std::memory_order_relaxed);
+      count = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Digest_cache::store(std::string_view digest, long long count) {
+  if (!entries_ || count < 0 || count > UINT32_MAX) return;
+  uint8_t key[DIGEST_BYTES];
+  if (parse_digest(digest, key)) return;
+
+  /* Reuse entry holding the digest, else an unused one, else by CLOCK */
+  auto *first = bucket(key);
+  Entry *victim = nullptr;
+  for (size_t i = 0; i < BUCKET_ENTRIES && victim == nullptr; ++i) {
+    auto *current = first + i;
+    if (current->stored_at == 0 ||
+        memcmp(current->digest, key, DIGEST_BYTES) == 0)
+      victim = current;
+  }
+  if (victim == nullptr) {
+    auto &hand = hands_[(first - entries_.get()) / BUCKET_ENTRIES];
+    auto position = hand.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= BUCKET_ENTRIES; ++i) {
+      auto index = (position + i) % BUCKET_ENTRIES;
+      auto &referenced = referenced_[(first - entries_.get()) + index];
+      if (referenced.exchange(0, std::memory_order_relaxed) == 0 ||
+          i == BUCKET_ENTRIES) {
+        victim = first + index;
+        hand.store(static_cast<uint8_t>((index + 1) % BUCKET_ENTRIES),
+                   std::memory_order_relaxed);
+        break;
+      }
+    }
+  }
+
+  auto sequence = victim->sequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) != 0 ||
+      !victim->sequence.compare_exchange_strong(sequence, sequence + 1,
+                                                std::memory_order_acquire))
+    return; /* Another writer owns the entry */
+  std::atomic_thread_fence(std::memory_order_release);
+
+  memcpy(victim->digest, key, DIGEST_BYTES);
+  victim->count = static_cast<uint32_t>(count);
+  victim->stored_at = static_cast<uint32_t>(time(nullptr));
+
+  victim->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+Recent_digests::~Recent_digests() {
+  for (auto &entry : entries_)
+    std::fill(entry.digest.begin(), entry.digest.end(), '\0');
+}
+
+bool Recent_digests::find(std::string_view digest, Clock::time_point oldest,
+                          long long &count) const {
+  for (const auto &entry : entries_) {
+    if (entry.digest.empty() || entry.digest != digest ||
+        entry.stored < oldest)
+      continue;
+    count = entry.count;
+    return true;
+  }
+  return false;
+}
+
+void Recent_digests::store(std::string_view digest, long long count,
+                           Clock::time_point now) {
+  auto &entry = entries_[next_];
+  next_ = (next_ + 1) % ENTRIES;
+  entry.digest.assign(digest);
+  entry.count = count;
+  entry.stored = now;
+}
+
+}  // namespace password_breach_check
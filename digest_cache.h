@@ -0,0 +1,151 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef DIGEST_CACHE_H_INCLUDED
+#define DIGEST_CACHE_H_INCLUDED
+
+#include <atomic>      /* std::atomic */
+#include <chrono>      /* std::chrono */
+#include <cstddef>     /* size_t */
+#include <cstdint>     /* uint*_t */
+#include <memory>      /* std::unique_ptr */
+#include <string>      /* std::string */
+#include <string_view> /* std::string_view */
+
+namespace password_breach_check {
+
+/**
+  In-process cache of results by full SHA1 digest
+
+  Answers repeated checks of the same password before any range is looked
+  at. Entries are 32 bytes (digest, count, time stored, sequence) plus a
+  reference byte, in an open-addressing table of buckets of 8 entries.
+
+  Each entry is protected by a sequence lock as in Shm_range_cache:
+  readers never block and retry or miss if an entry changes under them;
+  writers claim an entry with a CAS and skip the store on contention. A
+  full bucket evicts with CLOCK: the hand passes over entries, clearing
+  reference bits set by hits, and replaces the first one not referenced.
+*/
+class Digest_cache {
+ public:
+  static Digest_cache &instance();
+
+  Digest_cache();
+
+  ~Digest_cache();
+
+  /**
+    Allocate the table, dropping all entries. Not safe while the cache is
+    in use.
+
+    @param [in] entries  Number of entries, rounded up to a power of two.
+                         0 disables the cache.
+    @param [in] ttl      Seconds for which an entry is used
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool resize(size_t entries, uint32_t ttl);
+
+  /**
+    Look up a digest
+
+    @param [in]  digest  40 character hex SHA1 digest
+    @param [out] count   Times the password appeared in breaches
+
+    @returns true if found
+  */
+  bool lookup(std::string_view digest, long long &count) const;
+
+  /**
+    Store a result. Best effort, skipped on contention.
+
+    @param [in] digest  40 character hex SHA1 digest
+    @param [in] count   Times the password appeared in breaches
+  */
+  void store(std::string_view digest, long long count);
+
+ private:
+  struct Entry;
+
+  Entry *bucket(const uint8_t *key) const;
+
+ private:
+  std::unique_ptr<Entry[]> entries_;
+  std::unique_ptr<std::atomic<uint8_t>[]> referenced_;
+  std::unique_ptr<std::atomic<uint8_t>[]> hands_;
+  size_t bucket_mask_{0};
+  uint32_t ttl_{0};
+};
+
+/**
+  Last few results of one session, overwritten round robin
+
+  Not thread safe: a session runs one statement at a time. Digests are
+  wiped when the object is destroyed.
+*/
+class Recent_digests {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  /** Results kept */
+  static const size_t ENTRIES = 4;
+
+  ~Recent_digests();
+
+  /**
+    Find a result
+
+    @param [in]  digest  SHA1 digest of the password
+    @param [in]  oldest  Results stored before this are ignored
+    @param [out] count   Times the password appeared in breaches
+
+    @returns true if found
+  */
+  bool find(std::string_view digest, Clock::time_point oldest,
+            long long &count) const;
+
+  /**
+    Keep a result, replacing the oldest one
+
+    @param [in] digest  SHA1 digest of the password
+    @param [in] count   Times the password appeared in breaches
+    @param [in] now     Time the result is stored at
+  */
+  void store(std::string_view digest, long long count, Clock::time_point now);
+
+ private:
+  struct Entry {
+    std::string digest;
+    long long count{0};
+    Clock::time_point stored;
+  };
+  Entry entries_[ENTRIES];
+  /* Entry to overwrite next */
+  size_t next_{0};
+};
+
+}  // namespace password_breach_check
+#endif /* DIGEST_CACHE_H_INCLUDED */
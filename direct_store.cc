@@ -0,0 +1,358 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "direct_store.h"
+
+#include <algorithm> /* std::max */
+#include <cerrno>    /* errno */
+#include <chrono>    /* std::chrono::microseconds */
+#include <cstdlib>   /* std::aligned_alloc, std::free */
+#include <cstring>   /* memcpy, memset, strerror */
+#include <functional> /* std::hash */
+#include <mutex>     /* std::mutex */
+#include <thread>    /* std::this_thread */
+
+#include <fcntl.h>    /* open, O_DIRECT */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* pread */
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h> /* io_uring_* structures */
+#include <sys/syscall.h>    /* __NR_io_uring_* */
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING_SYSCALLS
+#endif
+#endif
+
+namespace password_breach_check {
+
+namespace {
+
+/** Page aligned buffer as required by O_DIRECT */
+struct Aligned_free {
+  void operator()(char *buffer) const { std::free(buffer); }
+};
+using Aligned_buffer = std::unique_ptr<char, Aligned_free>;
+
+Aligned_buffer aligned_buffer(size_t size) {
+  return Aligned_buffer(
+      static_cast<char *>(std::aligned_alloc(COMPACT_PAGE_SIZE, size)));
+}
+
+uint64_t page_floor(uint64_t value) {
+  return value & ~static_cast<uint64_t>(COMPACT_PAGE_SIZE - 1);
+}
+
+uint64_t page_ceil(uint64_t value) {
+  return page_floor(value + COMPACT_PAGE_SIZE - 1);
+}
+
+}  // namespace
+
+/**
+  A single io_uring instance with one read in flight at a time
+
+  liburing is not required: the rings are set up and driven with the
+  io_uring_setup and io_uring_enter system calls directly.
+*/
+struct Direct_store::Ring {
+  std::mutex mutex;
+#ifdef HAVE_IO_URING_SYSCALLS
+  int fd{-1};
+  void *sq_ring{MAP_FAILED};
+  size_t sq_ring_size{0};
+  void *cq_ring{MAP_FAILED};
+  size_t cq_ring_size{0};
+  io_uring_sqe *sqes{static_cast<io_uring_sqe *>(MAP_FAILED)};
+  size_t sqes_size{0};
+
+  unsigned *sq_head{nullptr};
+  unsigned *sq_tail{nullptr};
+  unsigned *sq_mask{nullptr};
+  unsigned *sq_array{nullptr};
+  unsigned *cq_head{nullptr};
+  unsigned *cq_tail{nullptr};
+  unsigned *cq_mask{nullptr};
+  io_uring_cqe *cqes{nullptr};
+
+  ~Ring() { teardown(); }
+
+  bool setup() {
+    io_uring_params params{};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, 4, &params));
+    if (fd < 0) return true;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) sq_ring_size = cq_ring_size =
+        std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) return true;
+    if (single_mmap) {
+      cq_ring = sq_ring;
+    } else {
+      cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq_ring == MAP_FAILED) return true;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(
+        mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) return true;
+
+    auto sq = static_cast<char *>(sq_ring);
+    auto cq = static_cast<char *>(cq_ring);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return false;
+  }
+
+  void teardown() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+      munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+    if (fd >= 0) ::close(fd);
+    sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    cq_ring = sq_ring = MAP_FAILED;
+    fd = -1;
+  }
+
+  /** Whether the ring can take reads. It is torn down if entering fails. */
+  bool usable() const { return fd >= 0; }
+
+  /**
+    Read from a file and wait for completion. Caller holds mutex.
+
+    If io_uring_enter fails, the ring is torn down once nothing refers to
+    buffer any more, so that no stale submission or completion is left for
+    the next read.
+
+    @returns bytes read, or -errno
+  */
+  long long read(int file, char *buffer, size_t size, uint64_t offset) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    auto sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = static_cast<uint32_t>(size);
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    unsigned to_submit = 1;
+    unsigned head = *cq_head;
+    while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+      auto submitted = syscall(__NR_io_uring_enter, fd, to_submit, 1,
+                               IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (submitted < 0) {
+        if (errno == EINTR) continue;
+        int error = errno;
+        if (__atomic_load_n(sq_head, __ATOMIC_ACQUIRE) != tail + 1) {
+          /* Not consumed, and only io_uring_enter consumes: withdrawn */
+          __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        } else {
+          /* In flight, so buffer is written until it completes */
+          while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+          __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        }
+        teardown();
+        return -error;
+      }
+      to_submit -= std::min<unsigned>(to_submit,
+                                      static_cast<unsigned>(submitted));
+    }
+    long long result = cqes[head & *cq_mask].res;
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return result;
+  }
+#else
+  bool setup() { return true; }
+
+  bool usable() const { return false; }
+
+  long long read(int, char *, size_t, uint64_t) { return -ENOSYS; }
+#endif /* HAVE_IO_URING_SYSCALLS */
+};
+
+Direct_store::Direct_store() = default;
+
+Direct_store::~Direct_store() { close(); }
+
+bool Direct_store::fail(const std::string &message) {
+  error_ = message;
+  close();
+  return true;
+}
+
+/**
+  Read whole pages. offset, size and buffer must be page aligned.
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Direct_store::read(uint64_t offset, size_t size, char *buffer) const {
+  /* The last page of the file may be short */
+  auto needed = static_cast<size_t>(std::min<uint64_t>(size, size_ - offset));
+
+  size_t done = 0;
+  if (rings_ != nullptr) {
+    auto &ring =
+        rings_[std::hash<std::thread::id>{}(std::this_thread::get_id()) %
+               RINGS];
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    while (done < needed && ring.usable()) {
+      auto result = ring.read(fd_, buffer + done, size - done, offset + done);
+      /* A ring that failed is torn down; the rest is read with pread() */
+      if (!ring.usable()) break;
+      if (result < 0) errno = static_cast<int>(-result);
+      if (result <= 0) return true;
+      done += static_cast<size_t>(result);
+    }
+  }
+
+  while (done < needed) {
+    auto result = pread(fd_, buffer + done, size - done,
+                        static_cast<off_t>(offset + done));
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return true;
+    done += static_cast<size_t>(result);
+  }
+  return false;
+}
+
+bool Direct_store::open(const std::string &path, size_t cache_blocks) {
+  close();
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+  direct_io_ = fd_ >= 0;
+  /* tmpfs and some other file systems do not support O_DIRECT */
+  if (fd_ < 0 && errno == EINVAL)
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) return fail("Failed to open " + path + ": " + strerror(errno));
+
+  struct stat info;
+  if (fstat(fd_, &info) != 0)
+    return fail("Failed to stat " + path + ": " + strerror(errno));
+  size_ = static_cast<uint64_t>(info.st_size);
+  if (size_ < COMPACT_HEADER_SIZE) return fail(path + " is truncated");
+
+  rings_.reset(new Ring[RINGS]);
+  for (size_t i = 0; i < RINGS; ++i)
+    if (rings_[i].setup()) {
+      rings_.reset();
+      break;
+    }
+
+  /* First page holds the header. Also checks that the rings can read. */
+  auto page = aligned_buffer(COMPACT_PAGE_SIZE);
+  if (page == nullptr) return fail("Out of memory");
+  if (rings_ != nullptr && read(0, COMPACT_PAGE_SIZE, page.get()))
+    rings_.reset();
+  if (read(0, COMPACT_PAGE_SIZE, page.get()))
+    return fail("Failed to read " + path + ": " + strerror(errno));
+
+  uint32_t block_count = 0;
+  if (parse_compact_header(page.get(), options_, entries_, block_count))
+    return fail(path + " is not a supported compact store");
+
+  /* Block offsets are small enough to keep in memory */
+  auto index_size = (block_count + 1ULL) * sizeof(uint64_t);
+  if (COMPACT_HEADER_SIZE + index_size > size_)
+    return fail(path + " is truncated");
+  auto index_pages = page_ceil(COMPACT_HEADER_SIZE + index_size);
+  auto index = aligned_buffer(index_pages);
+  if (index == nullptr) return fail("Out of memory");
+  if (read(0, index_pages, index.get()))
+    return fail("Failed to read " + path + ": " + strerror(errno));
+  offsets_.resize(block_count + 1);
+  memcpy(offsets_.data(), index.get() + COMPACT_HEADER_SIZE, index_size);
+  for (uint32_t i = 0; i < block_count; ++i)
+    if (offsets_[i] > offsets_[i + 1] || offsets_[i + 1] > size_)
+      return fail(path + " has a block out of bounds");
+
+  cache_.resize(cache_blocks);
+  return false;
+}
+
+void Direct_store::close() {
+  rings_.reset();
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  direct_io_ = false;
+  size_ = 0;
+  offsets_.clear();
+  cache_.clear();
+}
+
+/** Decompressed block, through the cache */
+std::shared_ptr<const std::string> Direct_store::block(uint32_t index) const {
+  auto cached = cache_.get(index);
+  if (cached != nullptr) return cached;
+
+  /* Read the pages the block is on */
+  auto begin = offsets_[index];
+  auto end = offsets_[index + 1];
+  auto first = page_floor(begin);
+  auto size = static_cast<size_t>(page_ceil(end) - first);
+  auto pages = aligned_buffer(size);
+  if (pages == nullptr || read(first, size, pages.get())) return nullptr;
+
+  auto data = std::make_shared<std::string>();
+  auto source = pages.get() + (begin - first);
+  auto source_size = static_cast<size_t>(end - begin);
+  if (options_.zstd_level == 0)
+    data->assign(source, source_size);
+  else if (decompress_compact_block(source, source_size, *data))
+    return nullptr;
+  cache_.put(index, data);
+  return data;
+}
+
+bool Direct_store::lookup(uint32_t prefix, std::string_view suffix,
+                          long long &count) const {
+  if (fd_ < 0 || prefix >= RANGE_PREFIX_COUNT) return false;
+
+  auto data = block(prefix / options_.group_size);
+  return data != nullptr && compact_block_lookup(options_, data->data(),
+                                                 data->size(), prefix, suffix,
+                                                 count);
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,128 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef DIRECT_STORE_H_INCLUDED
+#define DIRECT_STORE_H_INCLUDED
+
+#include <cstddef>     /* size_t */
+#include <cstdint>     /* uint*_t */
+#include <memory>      /* std::shared_ptr, std::unique_ptr */
+#include <string>      /* std::string */
+#include <string_view> /* std::string_view */
+#include <vector>      /* std::vector */
+
+#include "compact_store.h"
+
+namespace password_breach_check {
+
+/**
+  Compact store read with O_DIRECT for datasets larger than RAM
+
+  Only the header and the block offsets are kept in memory. Each lookup
+  reads the page(s) holding its block, bypassing the page cache, through a
+  small pool of io_uring instances driven with raw system calls. Blocks
+  read are kept in a userspace LRU cache instead.
+
+  Build the store with --group 1 --align page so that most lookups read a
+  single 4 KB page.
+
+  Falls back to buffered reads if the file system rejects O_DIRECT and to
+  pread() if io_uring is unavailable or a ring fails.
+*/
+class Direct_store {
+ public:
+  Direct_store();
+  ~Direct_store();
+
+  Direct_store(const Direct_store &) = delete;
+  Direct_store &operator=(const Direct_store &) = delete;
+
+  /**
+    Open a compact store
+
+    @param [in] path          Location of the store
+    @param [in] cache_blocks  Blocks to keep in memory
+
+    @returns status of the operation
+      @retval true  Failure. See last_error()
+      @retval false Success
+  */
+  bool open(const std::string &path, size_t cache_blocks);
+
+  void close();
+
+  bool is_open() const { return fd_ >= 0; }
+
+  /** Whether reads bypass the page cache */
+  bool direct_io() const { return direct_io_; }
+
+  /** Whether reads are issued through io_uring */
+  bool io_uring() const { return rings_ != nullptr; }
+
+  const Compact_options &options() const { return options_; }
+
+  /** Number of hashes in the store */
+  uint64_t entries() const { return entries_; }
+
+  /**
+    Look up a suffix
+
+    @param [in]  prefix  Numeric prefix
+    @param [in]  suffix  35 character hex suffix
+    @param [out] count   Approximate times suffix appeared in breaches,
+                         0 if not listed
+
+    @returns true if the store answered the lookup
+  */
+  bool lookup(uint32_t prefix, std::string_view suffix,
+              long long &count) const;
+
+  const std::string &last_error() const { return error_; }
+
+ private:
+  struct Ring;
+
+  bool fail(const std::string &message);
+
+  bool read(uint64_t offset, size_t size, char *buffer) const;
+
+  std::shared_ptr<const std::string> block(uint32_t index) const;
+
+ private:
+  /* Number of io_uring instances; lookups pick one by thread */
+  static const size_t RINGS = 8;
+
+  int fd_{-1};
+  bool direct_io_{false};
+  uint64_t size_{0};
+  Compact_options options_;
+  uint64_t entries_{0};
+  std::vector<uint64_t> offsets_;
+  std::unique_ptr<Ring[]> rings_;
+  std::string error_;
+
+  mutable Block_cache cache_;
+};
+
+}  // namespace password_breach_check
+#endif /* DIRECT_STORE_H_INCLUDED */
@@ -0,0 +1,488 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "disk_cache.h"
+
+#include <cerrno>  /* errno */
+#include <cstdio>  /* snprintf, std::rename */
+#include <cstring> /* memcpy, strerror */
+#include <ctime>   /* time */
+#include <sstream> /* std::stringstream */
+#include <utility> /* std::swap */
+
+#include <fcntl.h>    /* open */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* write, ftruncate */
+
+#include "breach_checker.h"
+#include "range_pack.h"
+
+namespace password_breach_check {
+
+/** Magic at the start of each record */
+static const uint32_t RECORD_MAGIC = 0x52434250; /* "PBCR" */
+
+/** Prefixes per segment */
+static const uint32_t SEGMENT_PREFIXES =
+    RANGE_PREFIX_COUNT / Disk_range_cache::SEGMENT_COUNT;
+
+/** Granularity of segment mappings */
+static const uint64_t MAP_STEP = 64 * 1024 * 1024;
+
+/** Segments smaller than this are never compacted */
+static const uint64_t COMPACT_MIN_SIZE = 1024 * 1024;
+
+/**
+  Record header. Followed by ETag, Last-Modified and body, padded to a
+  multiple of 8 bytes.
+*/
+struct Record_header {
+  uint32_t magic;
+  /* CRC32 of everything in the record after this field */
+  uint32_t checksum;
+  uint32_t prefix;
+  uint32_t body_length;
+  uint64_t fetched_at;
+  uint16_t etag_length;
+  uint16_t last_modified_length;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(Record_header) == 32, "Unexpected record header size");
+
+/** A segment file, mapped, with the index of its latest records */
+struct Disk_range_cache::Segment_file {
+  int fd{-1};
+  char *base{nullptr};
+  size_t mapped{0};
+  /* Bytes of valid records */
+  uint64_t size{0};
+  /* Bytes of records that are not superseded */
+  uint64_t live{0};
+  /* Offset + 1 of latest record, indexed by prefix within segment */
+  std::vector<uint64_t> index;
+
+  ~Segment_file() { release(); }
+
+  void release() {
+    if (base != nullptr) munmap(base, mapped);
+    if (fd >= 0) close(fd);
+    base = nullptr;
+    mapped = 0;
+    fd = -1;
+  }
+
+  void swap(Segment_file &other) {
+    std::swap(fd, other.fd);
+    std::swap(base, other.base);
+    std::swap(mapped, other.mapped);
+    std::swap(size, other.size);
+    std::swap(live, other.live);
+    index.swap(other.index);
+  }
+
+  /**
+    Make sure the mapping covers all valid records. Mapping is grown in
+    steps of MAP_STEP so that appends rarely force a remap. Pages past the
+    end of file are never touched.
+  */
+  bool map() {
+    if (size <= mapped) return false;
+    if (base != nullptr) munmap(base, mapped);
+    auto length = static_cast<size_t>((size + MAP_STEP - 1) & ~(MAP_STEP - 1));
+    void *address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      base = nullptr;
+      mapped = 0;
+      return true;
+    }
+    base = static_cast<char *>(address);
+    mapped = length;
+    return false;
+  }
+};
+
+/**
+  Only the writer thread opens, grows, compacts or replaces the file of a
+  segment, so it reads it without the mutex. It takes the mutex to change
+  what lookups see, which is the index, size and mapping.
+*/
+struct Disk_range_cache::Segment {
+  std::mutex mutex;
+  std::string path;
+  /* Set by the writer once file is usable, or failed */
+  std::atomic<bool> loaded{false};
+  /* Set by a lookup that found the segment not loaded */
+  std::atomic<bool> load_requested{false};
+  /* Segment could not be loaded. Treated as empty and never written. */
+  bool failed{false};
+  Segment_file file;
+};
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t length) {
+  static uint32_t table[256];
+  static bool table_ready = [] {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; ++bit)
+        value = (value & 1) ? (value >> 1) ^ 0xEDB88320U : value >> 1;
+      table[i] = value;
+    }
+    return true;
+  }();
+  (void)table_ready;
+
+  auto bytes = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < length; ++i)
+    crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint64_t record_length(const Record_header &header) {
+  uint64_t length = sizeof(header) + header.etag_length +
+                    header.last_modified_length + header.body_length;
+  return (length + 7) & ~static_cast<uint64_t>(7);
+}
+
+static uint32_t record_checksum(const char *record, uint64_t length) {
+  auto skip = offsetof(Record_header, checksum) + sizeof(uint32_t);
+  return crc32(0, record + skip, length - skip);
+}
+
+Disk_range_cache &Disk_range_cache::instance() {
+  static Disk_range_cache cache;
+  return cache;
+}
+
+Disk_range_cache::~Disk_range_cache() { detach(); }
+
+bool Disk_range_cache::attach(const std::string &directory) {
+  detach();
+  struct stat st;
+  if (stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    std::stringstream error_message;
+    error_message << "Disk cache directory '" << directory
+                  << "' does not exist. Disk cache is disabled.";
+    log_message(error_message.str(), Log_level::ERROR);
+    return true;
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> lock(segments_mutex_);
+    directory_ = directory;
+    segments_.clear();
+    for (uint32_t i = 0; i < SEGMENT_COUNT; ++i) {
+      char name[32];
+      snprintf(name, sizeof(name), "/ranges-%x.dat", i);
+      segments_.emplace_back(new Segment());
+      segments_.back()->path = directory_ + name;
+    }
+    attached_ = true;
+  }
+
+  stop_ = false;
+  load_requests_ = 0;
+  writer_thread_ = std::thread(&Disk_range_cache::writer, this);
+  return false;
+}
+
+void Disk_range_cache::detach() {
+  attached_ = false;
+  /* Writer does not take segments_mutex_, so it is joined first */
+  if (writer_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      stop_ = true;
+    }
+    queue_cv_.notify_all();
+    writer_thread_.join();
+  }
+  std::unique_lock<std::shared_mutex> lock(segments_mutex_);
+  segments_.clear();
+  directory_.clear();
+}
+
+Disk_range_cache::Segment *Disk_range_cache::segment(uint32_t prefix) {
+  return segments_[(prefix / SEGMENT_PREFIXES) % SEGMENT_COUNT].get();
+}
+
+/**
+  Scan a segment file, build its index and compact it if it is mostly
+  superseded records, then make it visible to lookups. Runs on the writer
+  thread, so that lookups never wait for it.
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Disk_range_cache::load(Segment &current) {
+  Segment_file scanned;
+  scanned.index.assign(SEGMENT_PREFIXES, 0);
+  scanned.fd = open(current.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+  struct stat st;
+  bool failed = scanned.fd < 0 || fstat(scanned.fd, &st) != 0;
+  if (failed) {
+    std::stringstream error_message;
+    error_message << "Failed to open disk cache segment '" << current.path
+                  << "': " << strerror(errno);
+    log_message(error_message.str(), Log_level::ERROR);
+  } else {
+    scanned.size = static_cast<uint64_t>(st.st_size);
+    failed = scanned.map();
+  }
+
+  /* Walk records until the end or the first damaged one */
+  uint64_t offset = 0;
+  while (!failed && offset + sizeof(Record_header) <= scanned.size) {
+    Record_header header;
+    memcpy(&header, scanned.base + offset, sizeof(header));
+    auto length = record_length(header);
+    if (header.magic != RECORD_MAGIC || offset + length > scanned.size ||
+        header.prefix >= RANGE_PREFIX_COUNT ||
+        segment(header.prefix) != &current ||
+        record_checksum(scanned.base + offset, length) != header.checksum)
+      break;
+
+    auto &slot = scanned.index[header.prefix % SEGMENT_PREFIXES];
+    if (slot != 0) {
+      Record_header previous;
+      memcpy(&previous, scanned.base + slot - 1, sizeof(previous));
+      scanned.live -= record_length(previous);
+    }
+    slot = offset + 1;
+    scanned.live += length;
+    offset += length;
+  }
+
+  if (!failed && offset != scanned.size) {
+    std::stringstream error_message;
+    error_message << "Discarding " << scanned.size - offset
+                  << " damaged bytes at the end of disk cache segment '"
+                  << current.path << "'.";
+    log_message(error_message.str(), Log_level::WARNING);
+    failed = ftruncate(scanned.fd, static_cast<off_t>(offset)) != 0;
+    scanned.size = offset;
+  }
+
+  Segment_file compacted;
+  if (!failed && scanned.size > COMPACT_MIN_SIZE &&
+      scanned.size > 2 * scanned.live &&
+      !compact(current.path, scanned, compacted))
+    scanned.swap(compacted);
+
+  {
+    std::lock_guard<std::mutex> lock(current.mutex);
+    current.failed = failed;
+    if (!failed) current.file.swap(scanned);
+  }
+  current.loaded.store(true, std::memory_order_release);
+  return failed;
+}
+
+/**
+  Write the latest record of each prefix of a segment to a new file, and
+  put it in place of the segment file. Runs on the writer thread; the
+  caller makes it visible to lookups.
+
+  @param [in]  path  Segment file
+  @param [in]  from  Segment file as loaded
+  @param [out] to    Compacted file
+
+  @returns status of the operation
+    @retval true  Failure. Segment file is left as it was.
+    @retval false Success
+*/
+bool Disk_range_cache::compact(const std::string &path,
+                               const Segment_file &from, Segment_file &to) {
+  auto temp_path = path + ".tmp";
+  to.fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0640);
+  if (to.fd < 0) return true;
+
+  to.index.assign(SEGMENT_PREFIXES, 0);
+  uint64_t offset = 0;
+  bool error = false;
+  for (uint32_t i = 0; i < SEGMENT_PREFIXES && !error; ++i) {
+    if (from.index[i] == 0) continue;
+    auto record = from.base + from.index[i] - 1;
+    Record_header header;
+    memcpy(&header, record, sizeof(header));
+    auto length = record_length(header);
+    error = pwrite(to.fd, record, length, static_cast<off_t>(offset)) !=
+            static_cast<ssize_t>(length);
+    to.index[i] = offset + 1;
+    offset += length;
+  }
+  to.size = offset;
+  to.live = offset;
+
+  if (error || fsync(to.fd) != 0 || to.map() ||
+      std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    to.release();
+    unlink(temp_path.c_str());
+    return true;
+  }
+  return false;
+}
+
+bool Disk_range_cache::find(uint32_t prefix, Cached_range &range,
+                            uint64_t max_age) {
+  if (prefix >= RANGE_PREFIX_COUNT) return false;
+  std::shared_lock<std::shared_mutex> segments_lock(segments_mutex_);
+  if (segments_.empty()) return false;
+
+  /* Not loaded yet: the writer thread is asked to, and this is a miss */
+  auto &current = *segment(prefix);
+  if (!current.loaded.load(std::memory_order_acquire)) {
+    if (!current.load_requested.exchange(true)) {
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        load_requests_++;
+      }
+      queue_cv_.notify_one();
+    }
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(current.mutex);
+  if (current.failed) return false;
+  auto slot = current.file.index[prefix % SEGMENT_PREFIXES];
+  if (slot == 0) return false;
+
+  auto record = current.file.base + slot - 1;
+  Record_header header;
+  memcpy(&header, record, sizeof(header));
+  if (static_cast<uint64_t>(time(nullptr)) - header.fetched_at > max_age)
+    return false;
+  auto payload = record + sizeof(header);
+  range.etag.assign(payload, header.etag_length);
+  payload += header.etag_length;
+  range.last_modified.assign(payload, header.last_modified_length);
+  payload += header.last_modified_length;
+  range.body.assign(payload, header.body_length);
+  range.fetched_at = header.fetched_at;
+  return true;
+}
+
+void Disk_range_cache::save(uint32_t prefix, Cached_range range) {
+  if (!attached()) return;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (queue_.size() >= MAX_PENDING) return;
+    queue_.emplace_back(prefix, std::move(range));
+  }
+  queue_cv_.notify_one();
+}
+
+/** Append a record to its segment. Runs on the writer thread. */
+void Disk_range_cache::append(uint32_t prefix, const Cached_range &range) {
+  Record_header header{};
+  header.magic = RECORD_MAGIC;
+  header.prefix = prefix;
+  header.body_length = static_cast<uint32_t>(range.body.length());
+  header.fetched_at = range.fetched_at;
+  header.etag_length = static_cast<uint16_t>(
+      std::min<size_t>(range.etag.length(), UINT16_MAX));
+  header.last_modified_length = static_cast<uint16_t>(
+      std::min<size_t>(range.last_modified.length(), UINT16_MAX));
+
+  auto length = record_length(header);
+  std::string record(length, '\0');
+  char *out = &record[0] + sizeof(header);
+  memcpy(out, range.etag.data(), header.etag_length);
+  out += header.etag_length;
+  memcpy(out, range.last_modified.data(), header.last_modified_length);
+  out += header.last_modified_length;
+  memcpy(out, range.body.data(), header.body_length);
+  memcpy(&record[0], &header, sizeof(header));
+  header.checksum = record_checksum(record.data(), length);
+  memcpy(&record[0], &header, sizeof(header));
+
+  auto &current = *segment(prefix);
+  if (!current.loaded.load(std::memory_order_acquire)) load(current);
+  if (current.failed) return;
+
+  /* Lookups only read records below size, so the write needs no lock */
+  auto &file = current.file;
+  if (pwrite(file.fd, record.data(), length, static_cast<off_t>(file.size)) !=
+      static_cast<ssize_t>(length)) {
+    /* Partial record, if any, is cut off when the segment is next loaded */
+    std::stringstream error_message;
+    error_message << "Failed to write disk cache segment '" << current.path
+                  << "': " << strerror(errno);
+    log_message(error_message.str(), Log_level::WARNING);
+    return;
+  }
+
+  uint64_t superseded = 0;
+  auto slot = file.index[prefix % SEGMENT_PREFIXES];
+  if (slot != 0) {
+    Record_header previous;
+    memcpy(&previous, file.base + slot - 1, sizeof(previous));
+    superseded = record_length(previous);
+  }
+  {
+    std::lock_guard<std::mutex> lock(current.mutex);
+    file.index[prefix % SEGMENT_PREFIXES] = file.size + 1;
+    file.size += length;
+    file.live += length - superseded;
+    if (file.map()) {
+      current.failed = true;
+      return;
+    }
+  }
+
+  /* Superseded records would otherwise pile up until the next restart */
+  if (file.size > COMPACT_MIN_SIZE && file.size > 2 * file.live) {
+    Segment_file compacted;
+    if (compact(current.path, file, compacted)) return;
+    std::lock_guard<std::mutex> lock(current.mutex);
+    file.swap(compacted);
+  }
+}
+
+void Disk_range_cache::writer() {
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  while (true) {
+    queue_cv_.wait(lock, [this] {
+      return stop_ || !queue_.empty() || load_requests_ > 0;
+    });
+    if (load_requests_ > 0 && !stop_) {
+      load_requests_ = 0;
+      lock.unlock();
+      for (auto &current : segments_)
+        if (current->load_requested && !current->loaded) load(*current);
+      lock.lock();
+      continue;
+    }
+    if (queue_.empty() && stop_) break;
+    auto item = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    append(item.first, item.second);
+    lock.lock();
+  }
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,147 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#ifndef DISK_CACHE_H_INCLUDED
+#define DISK_CACHE_H_INCLUDED
+
+#include <atomic>             /* std::atomic */
+#include <condition_variable> /* std::condition_variable */
+#include <cstdint>            /* uint*_t */
+#include <deque>              /* std::deque */
+#include <memory>             /* std::unique_ptr */
+#include <mutex>              /* std::mutex */
+#include <shared_mutex>       /* std::shared_mutex */
+#include <string>             /* std::string */
+#include <thread>             /* std::thread */
+#include <vector>             /* std::vector */
+
+namespace password_breach_check {
+
+/** A range along with what is needed to revalidate it */
+struct Cached_range {
+  /* Range data in wire format */
+  std::string body;
+  /* ETag returned with the range. Empty if none. */
+  std::string etag;
+  /* Last-Modified returned with the range. Empty if none. */
+  std::string last_modified;
+  /* Unix time at which the range was fetched or last revalidated */
+  uint64_t fetched_at{0};
+  /* Set when the server reported the range unchanged and body was kept */
+  bool not_modified{false};
+};
+
+/**
+  Persistent cache of ranges that survives restarts
+
+  Ranges are kept in SEGMENT_COUNT append-only files in a directory, one per
+  value of the first hex digit of the prefix. Each record carries a
+  checksum. A segment is scanned and memory-mapped the first time one of its
+  prefixes is looked up; a torn record at the end left by a crash is cut
+  off. A segment that is mostly superseded records is compacted when
+  loaded, and as records are appended.
+
+  Loading, appending and compaction all run on a background thread so
+  that the lookup path never waits for disk reads or writes: a compacted
+  file and its index are built aside and swapped in, and a lookup in a
+  segment that is not loaded yet is a miss. Lookups hold a shared lock on
+  the segments, so that detach() cannot release them underneath.
+*/
+class Disk_range_cache {
+ public:
+  /** Number of segment files */
+  static constexpr uint32_t SEGMENT_COUNT = 16;
+
+  /** Maximum number of records waiting to be written */
+  static constexpr size_t MAX_PENDING = 1024;
+
+ public:
+  static Disk_range_cache &instance();
+
+  ~Disk_range_cache();
+
+  /**
+    Start using a cache directory
+
+    @param [in] directory  Existing directory to keep segment files in
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool attach(const std::string &directory);
+
+  /** Write pending records and release segments */
+  void detach();
+
+  bool attached() const { return attached_; }
+
+  /**
+    Find latest record for a prefix
+
+    @param [in]  prefix   Numeric prefix
+    @param [out] range    Cached range
+    @param [in]  max_age  Seconds since fetched_at beyond which the record
+                          is not copied and counts as not found
+
+    @returns true if a record was found
+  */
+  bool find(uint32_t prefix, Cached_range &range,
+            uint64_t max_age = UINT64_MAX);
+
+  /** Queue a record to be appended. Dropped if the queue is full. */
+  void save(uint32_t prefix, Cached_range range);
+
+ private:
+  struct Segment_file;
+  struct Segment;
+
+  Segment *segment(uint32_t prefix);
+
+  bool load(Segment &segment);
+
+  static bool compact(const std::string &path, const Segment_file &from,
+                      Segment_file &to);
+
+  void append(uint32_t prefix, const Cached_range &range);
+
+  void writer();
+
+ private:
+  std::string directory_;
+  std::atomic<bool> attached_{false};
+  /* Exclusive while segments_ is set up or released */
+  std::shared_mutex segments_mutex_;
+  std::vector<std::unique_ptr<Segment>> segments_;
+
+  /* Records waiting for the writer thread */
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<std::pair<uint32_t, Cached_range>> queue_;
+  /* Segments lookups asked the writer thread to load */
+  unsigned int load_requests_{0};
+  bool stop_{false};
+  std::thread writer_thread_;
+};
+
+}  // namespace password_breach_check
+#endif /* DISK_CACHE_H_INCLUDED */
@@ -0,0 +1,85 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "egress_scheduler.h"
+
+#include <algorithm> /* std::min */
+#include <thread>    /* std::this_thread::sleep_until */
+
+#include "concurrency_limiter.h" /* Concurrency_limiter */
+#include "status_counters.h"     /* Status_counters */
+
+namespace password_breach_check {
+
+void Token_bucket::configure(unsigned int rate) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  rate_ = rate;
+  tokens_ = rate;
+  refilled_ = Clock::now();
+}
+
+bool Token_bucket::take(Clock::time_point deadline) {
+  Clock::time_point ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (rate_ == 0) return false;
+    auto now = Clock::now();
+    tokens_ = std::min(
+        rate_, tokens_ + rate_ * std::chrono::duration<double>(now - refilled_)
+                                     .count());
+    refilled_ = now;
+    if (tokens_ >= 1) {
+      tokens_ -= 1;
+      return false;
+    }
+    /* Reserve the next token and wait for it to accrue */
+    ready = now + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::duration<double>((1 - tokens_) / rate_));
+    if (ready > deadline) return true;
+    tokens_ -= 1;
+  }
+  std::this_thread::sleep_until(ready);
+  return false;
+}
+
+Egress_scheduler &Egress_scheduler::instance() {
+  static Egress_scheduler scheduler;
+  return scheduler;
+}
+
+void Egress_scheduler::configure(unsigned int interactive_rate,
+                                 unsigned int batch_rate) {
+  interactive_.configure(interactive_rate);
+  batch_.configure(batch_rate);
+}
+
+bool Egress_scheduler::acquire(Request_class request_class,
+                               std::chrono::steady_clock::time_point deadline) {
+  bool interactive = request_class == Request_class::INTERACTIVE;
+  Status_counters::add(interactive ? Counter::INTERACTIVE_FETCHES
+                                   : Counter::BATCH_FETCHES);
+  if ((interactive ? interactive_ : batch_).take(deadline)) return true;
+  return Concurrency_limiter::instance().acquire(deadline, interactive);
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,112 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef EGRESS_SCHEDULER_H_INCLUDED
+#define EGRESS_SCHEDULER_H_INCLUDED
+
+#include <chrono> /* std::chrono */
+#include <mutex>  /* std::mutex */
+
+namespace password_breach_check {
+
+/** Who a request to the range API is made for */
+enum class Request_class {
+  /* A session changing or rating a password */
+  INTERACTIVE,
+  /* Audits through the password_breach_check() function, replica crawls */
+  BATCH
+};
+
+/**
+  Token bucket. Takers reserve tokens ahead, so that waiters are served in
+  the order they arrived without polling.
+*/
+class Token_bucket {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  /**
+    @param [in] rate  Tokens per second, 0 for no limit. One second worth
+                      of tokens can be taken at once.
+  */
+  void configure(unsigned int rate);
+
+  /**
+    Take a token, waiting for it if necessary
+
+    @param [in] deadline  Time after which to give up
+
+    @returns status of the operation
+      @retval true  No token before deadline
+      @retval false Token taken
+  */
+  bool take(Clock::time_point deadline);
+
+ private:
+  std::mutex mutex_;
+  double rate_{0};
+  /* Negative while tokens are reserved ahead */
+  double tokens_{0};
+  Clock::time_point refilled_{};
+};
+
+/**
+  Admits requests to the range API, ahead of Concurrency_limiter
+
+  Each class has its own token bucket, so that batch work is held to
+  batch_rate. Interactive requests are also preferred for slots in flight:
+  batch requests leave part of the concurrency limit free and wait while
+  interactive ones are waiting.
+*/
+class Egress_scheduler {
+ public:
+  static Egress_scheduler &instance();
+
+  /**
+    @param [in] interactive_rate  Interactive requests per second, 0 for no
+                                  limit
+    @param [in] batch_rate        Batch requests per second, 0 for no limit
+  */
+  void configure(unsigned int interactive_rate, unsigned int batch_rate);
+
+  /**
+    Wait until a request may be made. Returned with
+    Concurrency_limiter::release().
+
+    @param [in] request_class  Who the request is for
+    @param [in] deadline       Time after which to give up
+
+    @returns status of the operation
+      @retval true  Not admitted before deadline
+      @retval false Admitted
+  */
+  bool acquire(Request_class request_class,
+               std::chrono::steady_clock::time_point deadline);
+
+ private:
+  Token_bucket interactive_;
+  Token_bucket batch_;
+};
+
+}  // namespace password_breach_check
+#endif /* EGRESS_SCHEDULER_H_INCLUDED */
@@ -0,0 +1,122 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "fetch_pool.h"
+
+namespace password_breach_check {
+
+/** Set on worker threads */
+static thread_local bool is_worker = false;
+
+bool Fetch_pool::on_worker() { return is_worker; }
+
+Fetch_pool &Fetch_pool::instance() {
+  static Fetch_pool pool;
+  return pool;
+}
+
+Fetch_pool::~Fetch_pool() { stop(); }
+
+bool Fetch_pool::start(unsigned int threads, unsigned int queue_size) {
+  if (!workers_.empty() || threads == 0) return true;
+  queue_size_ = queue_size;
+  stop_ = false;
+  for (unsigned int i = 0; i < threads; ++i)
+    workers_.emplace_back(new Worker);
+  try {
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i]->thread = std::thread(&Fetch_pool::run, this, i);
+      running_++;
+    }
+  } catch (...) {
+    stop();
+    return true;
+  }
+  return false;
+}
+
+void Fetch_pool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_)
+    if (worker->thread.joinable()) worker->thread.join();
+  workers_.clear();
+  running_ = 0;
+  queued_ = 0;
+}
+
+bool Fetch_pool::submit(Task task) {
+  if (running_.load(std::memory_order_relaxed) == 0) return true;
+  {
+    /* Counted before it is pushed so that a taker never sees it uncounted */
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queued_ >= queue_size_) return true;
+    queued_++;
+  }
+  auto &worker = *workers_[next_.fetch_add(1, std::memory_order_relaxed) %
+                           workers_.size()];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+  cv_.notify_one();
+  return false;
+}
+
+/** Take from the front of own queue, else from the back of another one */
+bool Fetch_pool::take(size_t index, Task &task) {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    auto &worker = *workers_[(index + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) continue;
+    if (i == 0) {
+      task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+    } else {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+    }
+    queued_--;
+    return true;
+  }
+  return false;
+}
+
+void Fetch_pool::run(size_t index) {
+  is_worker = true;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      /* Tasks still queued are dropped with the queues */
+      cv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+      if (stop_) return;
+    }
+    Task task;
+    if (take(index, task)) task();
+  }
+}
+
+}  // namespace password_breach_check
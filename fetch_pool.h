@@ -0,0 +1,123 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef FETCH_POOL_H_INCLUDED
+#define FETCH_POOL_H_INCLUDED
+
+#include <atomic>             /* std::atomic */
+#include <condition_variable> /* std::condition_variable */
+#include <cstddef>            /* size_t */
+#include <deque>              /* std::deque */
+#include <functional>         /* std::function */
+#include <memory>             /* std::unique_ptr */
+#include <mutex>              /* std::mutex */
+#include <thread>             /* std::thread */
+#include <vector>             /* std::vector */
+
+namespace password_breach_check {
+
+/**
+  Worker threads that run range fetches off session threads
+
+  Session threads submit a fetch and wait for it with a timeout, so that a
+  slow range API holds a worker rather than a server thread (or a whole
+  thread pool group). Each worker owns a queue. Tasks are spread over the
+  queues round robin; a worker takes from the front of its own queue and,
+  when that is empty, steals from the back of the others.
+
+  The number of queued tasks is bounded. When the bound is reached submit()
+  refuses the task; callers fail rather than run it on a session thread.
+*/
+class Fetch_pool {
+ public:
+  typedef std::function<void()> Task;
+
+ public:
+  static Fetch_pool &instance();
+
+  ~Fetch_pool();
+
+  /**
+    Start worker threads
+
+    @param [in] threads     Number of workers
+    @param [in] queue_size  Maximum number of queued tasks
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool start(unsigned int threads, unsigned int queue_size);
+
+  /**
+    Stop workers once the tasks they run are done. Tasks not started yet
+    are dropped, so that whoever waits for them gives up at its deadline.
+  */
+  void stop();
+
+  /**
+    Queue a task
+
+    @param [in] task  Task to run on a worker
+
+    @returns status of the operation
+      @retval true  Pool is not running or queue is full, task not queued
+      @retval false Task queued
+  */
+  bool submit(Task task);
+
+  /** Tasks queued and not yet taken by a worker */
+  size_t queue_depth() const { return queued_.load(std::memory_order_relaxed); }
+
+  /** Whether the calling thread is a worker */
+  static bool on_worker();
+
+  /** Running workers */
+  size_t threads() const { return running_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  void run(size_t index);
+
+  bool take(size_t index, Task &task);
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+  size_t queue_size_{0};
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> running_{0};
+  std::atomic<size_t> next_{0};
+
+  /* Idle workers wait here */
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_{false};
+};
+
+}  // namespace password_breach_check
+#endif /* FETCH_POOL_H_INCLUDED */
@@ -0,0 +1,395 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "file_audit.h"
+
+#include <algorithm>          /* std::min */
+#include <atomic>             /* std::atomic */
+#include <cerrno>             /* errno */
+#include <condition_variable> /* std::condition_variable */
+#include <deque>              /* std::deque */
+#include <map>                /* std::map */
+#include <memory>             /* std::unique_ptr */
+#include <mutex>              /* std::mutex */
+#include <system_error>       /* std::system_error */
+#include <thread>             /* std::thread */
+#include <utility>            /* std::pair */
+#include <vector>             /* std::vector */
+
+#include <fcntl.h>    /* open, openat */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* read, close */
+
+#include <openssl/crypto.h> /* OPENSSL_cleanse */
+
+#include "breach_checker.h" /* Breach_checker */
+#include "range_pack.h"     /* parse_range_prefix */
+
+namespace password_breach_check {
+
+/** Digests handed from hashers to lookup workers at once */
+static const size_t BATCH_SIZE = 256;
+
+/** Bytes of lines handed from the reader to hashers at once */
+static const size_t LINE_BATCH_BYTES = 64 * 1024;
+
+/** Batches a queue between stages holds */
+static const size_t QUEUE_BATCHES = 16;
+
+/** Digests a lookup worker collects before grouping them */
+static const size_t GROUP_WINDOW = 4096;
+
+/** Longest password accepted, as for validate_password */
+static const size_t MAX_PASSWORD_LENGTH = 512;
+
+/** Audits that may run at once. Each runs up to 24 threads. */
+static const unsigned int MAX_CONCURRENT_AUDITS = 2;
+
+static std::atomic<unsigned int> running_audits{0};
+
+namespace {
+
+/** Digests handed from hashers to lookup workers */
+typedef std::vector<std::string> Batch;
+
+/**
+  Lines handed from the reader to hashers, each NUL terminated, in a buffer
+  that never grows and is wiped on destruction, so that plaintext is not
+  left behind in freed memory
+*/
+struct Line_batch {
+  Line_batch() : data(new char[LINE_BATCH_BYTES]) {}
+  Line_batch(Line_batch &&) = default;
+  Line_batch &operator=(Line_batch &&other) {
+    wipe();
+    data = std::move(other.data);
+    used = other.used;
+    lines = std::move(other.lines);
+    return *this;
+  }
+  ~Line_batch() { wipe(); }
+
+  void wipe() {
+    if (data) OPENSSL_cleanse(data.get(), used);
+    used = 0;
+    lines.clear();
+  }
+
+  std::unique_ptr<char[]> data;
+  size_t used{0};
+  /* Offset and length of each line */
+  std::vector<std::pair<uint32_t, uint32_t>> lines;
+};
+
+/** Blocking queue of batches with a capacity */
+template <typename T>
+class Bounded_queue {
+ public:
+  /** @returns false if the queue was closed */
+  bool push(T batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(
+        lock, [this] { return closed_ || batches_.size() < QUEUE_BATCHES; });
+    if (closed_) return false;
+    batches_.push_back(std::move(batch));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /** @returns false once the queue is closed and empty */
+  bool pop(T &batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !batches_.empty(); });
+    if (batches_.empty()) return false;
+    batch = std::move(batches_.front());
+    batches_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<T> batches_;
+  bool closed_{false};
+};
+
+typedef Bounded_queue<Line_batch> Line_queue;
+typedef Bounded_queue<Batch> Digest_queue;
+
+/** Summaries of all stages, merged as they finish */
+struct Tally {
+  std::mutex mutex;
+  Audit_summary summary;
+
+  void merge(const Audit_summary &part) {
+    std::lock_guard<std::mutex> lock(mutex);
+    summary.lines += part.lines;
+    summary.digests += part.digests;
+    summary.checked += part.checked;
+    summary.breached += part.breached;
+    summary.occurrences += part.occurrences;
+    summary.errors += part.errors;
+  }
+};
+
+/**
+  Split a file into lines with read(2) into wiped buffers, rather than a
+  stream, whose buffers are neither wiped nor under our control
+*/
+void read_lines(int fd, Line_queue &out, Tally &tally) {
+  Audit_summary part;
+  std::unique_ptr<char[]> chunk(new char[LINE_BATCH_BYTES]);
+  Line_batch batch;
+  size_t start = 0;
+  size_t length = 0;
+  bool too_long = false;
+
+  auto end_line = [&]() {
+    if (length > 0 && batch.data[start + length - 1] == '\r') --length;
+    if (length > MAX_PASSWORD_LENGTH) too_long = true;
+    if (too_long || length == 0) {
+      if (too_long) {
+        part.lines++;
+        part.errors++;
+      }
+      OPENSSL_cleanse(batch.data.get() + start, MAX_PASSWORD_LENGTH + 1);
+    } else {
+      part.lines++;
+      batch.data[start + length] = '\0';
+      batch.lines.emplace_back(static_cast<uint32_t>(start),
+                               static_cast<uint32_t>(length));
+      batch.used = start + length + 1;
+    }
+    too_long = false;
+    length = 0;
+    start = batch.used;
+  };
+
+  bool open = true;
+  ssize_t got;
+  while (open && (got = read(fd, chunk.get(), LINE_BATCH_BYTES)) != 0) {
+    if (got < 0) {
+      if (errno == EINTR) continue;
+      part.errors++;
+      break;
+    }
+    for (ssize_t i = 0; i < got; ++i) {
+      char c = chunk[i];
+      if (c == '\n') {
+        end_line();
+        /* Room for a line of any accepted length and its terminator */
+        if (LINE_BATCH_BYTES - batch.used < MAX_PASSWORD_LENGTH + 2) {
+          if (!out.push(std::move(batch))) {
+            open = false;
+            break;
+          }
+          batch = Line_batch{};
+          start = 0;
+        }
+      } else if (length > MAX_PASSWORD_LENGTH) {
+        too_long = true;
+      } else {
+        batch.data[start + length++] = c;
+      }
+    }
+    OPENSSL_cleanse(chunk.get(), static_cast<size_t>(got));
+  }
+  if (open) {
+    end_line();
+    if (!batch.lines.empty()) out.push(std::move(batch));
+  }
+  out.close();
+  tally.merge(part);
+}
+
+void hash_lines(Line_queue &in, std::vector<std::unique_ptr<Digest_queue>> &out,
+                Tally &tally) {
+  Audit_summary part;
+  std::vector<Batch> routed(out.size());
+  Line_batch batch;
+  while (in.pop(batch)) {
+    for (const auto &line : batch.lines) {
+      const char *text = batch.data.get() + line.first;
+      std::string digest;
+      if (!parse_sha1_digest(text, line.second, false, digest)) {
+        part.digests++;
+      } else if (Breach_checker(text, Request_class::BATCH).digest(digest)) {
+        part.errors++;
+        continue;
+      }
+      uint32_t prefix = 0;
+      parse_range_prefix(std::string_view(digest).substr(0, 5), prefix);
+      auto &target = routed[prefix % out.size()];
+      target.push_back(std::move(digest));
+      if (target.size() == BATCH_SIZE) {
+        out[prefix % out.size()]->push(std::move(target));
+        target = Batch{};
+      }
+    }
+    /* Plaintext is not needed any more */
+    batch.wipe();
+  }
+  for (size_t i = 0; i < out.size(); ++i)
+    if (!routed[i].empty()) out[i]->push(std::move(routed[i]));
+  tally.merge(part);
+}
+
+void look_up(Digest_queue &in, Tally &tally) {
+  Audit_summary part;
+  /* Ordered, so that groups are looked up by ascending prefix */
+  std::map<std::string, Batch> groups;
+  size_t pending = 0;
+  Breach_checker checker("", Request_class::BATCH);
+  std::vector<long long> counts;
+
+  auto flush = [&]() {
+    for (auto &group : groups) {
+      checker.check_group(group.second, counts);
+      for (auto count : counts) {
+        if (count == MAX_RETVAL) {
+          part.errors++;
+          continue;
+        }
+        part.checked++;
+        if (count > 0) {
+          part.breached++;
+          part.occurrences += static_cast<uint64_t>(count);
+        }
+      }
+    }
+    groups.clear();
+    pending = 0;
+  };
+
+  Batch batch;
+  while (in.pop(batch)) {
+    for (auto &digest : batch) {
+      auto prefix = digest.substr(0, 5);
+      groups[prefix].push_back(std::move(digest));
+      if (++pending >= GROUP_WINDOW) flush();
+    }
+  }
+  flush();
+  tally.merge(part);
+}
+
+}  // namespace
+
+bool File_audit::run(const std::string &directory, const std::string &name,
+                     Audit_summary &summary, std::string &error) {
+  summary = Audit_summary{};
+  if (directory.empty()) {
+    error = "No directory is configured for audits.";
+    return true;
+  }
+
+  /* Released when this returns */
+  struct Audit_slot {
+    bool taken;
+    Audit_slot() : taken(++running_audits <= MAX_CONCURRENT_AUDITS) {}
+    ~Audit_slot() { --running_audits; }
+  } slot;
+  if (!slot.taken) {
+    error = "Too many audits in progress. Try again later.";
+    return true;
+  }
+
+  /*
+    Only a plain name is opened, relative to a descriptor of the directory
+    and without following links, so that no path can be swapped in after it
+    was checked. All failures give one error, which does not tell whether a
+    path exists.
+  */
+  int fd = -1;
+  if (!name.empty() && name.find('/') == std::string::npos &&
+      name != "." && name != "..") {
+    int directory_fd =
+        open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd >= 0) {
+      /* Non-blocking, so that a FIFO does not hang the open */
+      fd = openat(directory_fd, name.c_str(),
+                  O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+      close(directory_fd);
+    }
+    struct stat status;
+    if (fd >= 0 && (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd < 0) {
+    error = "Cannot open " + name + " in the audit directory.";
+    return true;
+  }
+
+  auto cores = std::max(1u, std::thread::hardware_concurrency());
+  unsigned int hashers = std::min(8u, std::max(1u, cores / 2));
+  /* Lookups wait on batch_rate more than on the network */
+  unsigned int lookups = std::max(4u, std::min(16u, config.fetch_threads));
+
+  Tally tally;
+  Line_queue lines;
+  std::vector<std::unique_ptr<Digest_queue>> digests;
+  for (unsigned int i = 0; i < lookups; ++i)
+    digests.emplace_back(new Digest_queue);
+
+  /* Threads that did start are shut down and joined if one cannot be */
+  std::vector<std::thread> hash_threads;
+  std::vector<std::thread> lookup_threads;
+  bool started = true;
+  try {
+    for (unsigned int i = 0; i < lookups; ++i)
+      lookup_threads.emplace_back(look_up, std::ref(*digests[i]),
+                                  std::ref(tally));
+    for (unsigned int i = 0; i < hashers; ++i)
+      hash_threads.emplace_back(hash_lines, std::ref(lines),
+                                std::ref(digests), std::ref(tally));
+  } catch (const std::system_error &) {
+    started = false;
+  }
+
+  if (started) read_lines(fd, lines, tally);
+  close(fd);
+  lines.close();
+  for (auto &thread : hash_threads) thread.join();
+  for (auto &queue : digests) queue->close();
+  for (auto &thread : lookup_threads) thread.join();
+
+  if (!started) {
+    error = "Failed to start audit threads.";
+    return true;
+  }
+  summary = tally.summary;
+  return false;
+}
+
+}  // namespace password_breach_check
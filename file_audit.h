@@ -0,0 +1,88 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef FILE_AUDIT_H_INCLUDED
+#define FILE_AUDIT_H_INCLUDED
+
+#include <cstdint> /* uint64_t */
+#include <string>  /* std::string */
+
+namespace password_breach_check {
+
+/** Outcome of auditing a file */
+struct Audit_summary {
+  /* Non-empty lines read */
+  uint64_t lines{0};
+  /* Lines taken as SHA1 hex digests rather than passwords */
+  uint64_t digests{0};
+  /* Lines checked */
+  uint64_t checked{0};
+  /* Lines found in breaches */
+  uint64_t breached{0};
+  /* Sum of the breach counts of breached lines */
+  uint64_t occurrences{0};
+  /* Lines that could not be checked */
+  uint64_t errors{0};
+};
+
+/**
+  Check every line of a file against password breach data
+
+  Lines hold a password each, or the 40 character hex SHA1 digest of one.
+  The file is streamed through stages connected by bounded queues, so that
+  memory use does not depend on its size:
+
+    reader --> hashers --(by prefix)--> lookup workers
+
+  Hashers route each digest to the lookup worker that owns its prefix.
+  Lookup workers collect up to a window of digests, group them by prefix
+  and look each group up with Breach_checker::check_group(), so that a
+  range is fetched once for all digests of a window that share it. Lookups
+  are made as Request_class::BATCH.
+
+  The reader uses read(2) rather than a stream and hands lines to hashers
+  in fixed buffers that are wiped once hashed, so that plaintext is not
+  left behind in freed memory. Only a few audits may run at once; others
+  fail rather than queue.
+*/
+class File_audit {
+ public:
+  /**
+    Audit a file in a directory
+
+    @param [in]  directory  Directory the file has to be in
+    @param [in]  name       Name of a regular file in directory, without
+                            path separators. Links are not followed.
+    @param [out] summary    Counts
+    @param [out] error      Reason of failure
+
+    @returns status of the operation
+      @retval true  Failure, file not audited
+      @retval false Success
+  */
+  static bool run(const std::string &directory, const std::string &name,
+                  Audit_summary &summary, std::string &error);
+};
+
+}  // namespace password_breach_check
+#endif /* FILE_AUDIT_H_INCLUDED */
@@ -0,0 +1,185 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "latency_histogram.h"
+
+#include <algorithm>  /* std::max, std::min */
+#include <atomic>     /* std::atomic */
+#include <chrono>     /* std::chrono::steady_clock */
+#include <functional> /* std::hash */
+#include <thread>     /* std::this_thread */
+#include <vector>     /* std::vector */
+
+#include <sched.h> /* sched_getcpu */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> /* __rdtsc */
+#define HAVE_RDTSC
+#endif
+
+namespace password_breach_check {
+
+/** Linear sub-buckets per power of two */
+static const unsigned SUB_BUCKET_BITS = 4;
+static const uint64_t SUB_BUCKETS = 1ULL << SUB_BUCKET_BITS;
+
+/** Enough buckets for any 64 bit value */
+static const size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+static const size_t STAGES = static_cast<size_t>(Stage::COUNT);
+
+/** Stripes. CPUs beyond this share stripes. */
+static const size_t STRIPES = 8;
+
+struct alignas(64) Histogram {
+  std::atomic<uint64_t> buckets[BUCKETS];
+  std::atomic<uint64_t> max;
+};
+
+static Histogram histograms[STRIPES][STAGES];
+
+static const char *STAGE_NAMES[STAGES] = {
+    "UTF8_CONVERSION", "SHA1", "CACHE_PROBE", "NETWORK", "PARSE", "BROADCAST"};
+
+static uint64_t steady_nanoseconds() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+/** Reference points for converting ticks to nanoseconds */
+static const uint64_t base_ticks = Latency_histograms::now();
+static const uint64_t base_nanoseconds = steady_nanoseconds();
+
+/** Nanoseconds per tick, from the ticks elapsed since load */
+static double nanoseconds_per_tick() {
+#ifdef HAVE_RDTSC
+  auto ticks = Latency_histograms::now() - base_ticks;
+  auto nanoseconds = steady_nanoseconds() - base_nanoseconds;
+  if (ticks == 0 || nanoseconds == 0) return 1.0;
+  return static_cast<double>(nanoseconds) / static_cast<double>(ticks);
+#else
+  return 1.0;
+#endif /* HAVE_RDTSC */
+}
+
+static size_t bucket_of(uint64_t value) {
+  if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+  unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+  auto sub = (value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+  return static_cast<size_t>((msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub);
+}
+
+/** Middle of the values falling in a bucket */
+static uint64_t bucket_value(size_t bucket) {
+  if (bucket < SUB_BUCKETS) return bucket;
+  unsigned msb = static_cast<unsigned>(bucket / SUB_BUCKETS) +
+                 SUB_BUCKET_BITS - 1;
+  uint64_t sub = bucket % SUB_BUCKETS;
+  uint64_t width = 1ULL << (msb - SUB_BUCKET_BITS);
+  return ((SUB_BUCKETS + sub) << (msb - SUB_BUCKET_BITS)) + width / 2;
+}
+
+static Histogram *current_stripe() {
+  int cpu = sched_getcpu();
+  if (cpu < 0) {
+    /* Not supported: spread by thread instead */
+    thread_local size_t thread_stripe =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return histograms[thread_stripe % STRIPES];
+  }
+  return histograms[static_cast<size_t>(cpu) % STRIPES];
+}
+
+uint64_t Latency_histograms::now() {
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return steady_nanoseconds();
+#endif /* HAVE_RDTSC */
+}
+
+void Latency_histograms::record(Stage stage, uint64_t start) {
+  auto end = now();
+  /* TSC may differ slightly between CPUs */
+  auto elapsed = end > start ? end - start : 0;
+  auto &histogram = current_stripe()[static_cast<size_t>(stage)];
+  histogram.buckets[bucket_of(elapsed)].fetch_add(1,
+                                                  std::memory_order_relaxed);
+  auto max = histogram.max.load(std::memory_order_relaxed);
+  while (elapsed > max && !histogram.max.compare_exchange_weak(
+                              max, elapsed, std::memory_order_relaxed)) {
+  }
+}
+
+Latency_summary Latency_histograms::summary(Stage stage) {
+  Latency_summary summary;
+  uint64_t max = 0;
+  std::vector<uint64_t> merged(BUCKETS, 0);
+  for (auto &stripe : histograms) {
+    auto &histogram = stripe[static_cast<size_t>(stage)];
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      auto value = histogram.buckets[i].load(std::memory_order_relaxed);
+      merged[i] += value;
+      summary.count += value;
+    }
+    max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+  }
+  if (summary.count == 0) return summary;
+
+  auto scale = nanoseconds_per_tick();
+  auto to_nanoseconds = [scale](uint64_t ticks) {
+    return static_cast<uint64_t>(static_cast<double>(ticks) * scale);
+  };
+  auto percentile = [&](double fraction) {
+    auto rank = static_cast<uint64_t>(fraction * summary.count);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += merged[i];
+      if (seen >= rank) return to_nanoseconds(std::min(bucket_value(i), max));
+    }
+    return to_nanoseconds(max);
+  };
+  summary.p50 = percentile(0.50);
+  summary.p95 = percentile(0.95);
+  summary.p99 = percentile(0.99);
+  summary.max = to_nanoseconds(max);
+  return summary;
+}
+
+void Latency_histograms::reset() {
+  for (auto &stripe : histograms)
+    for (auto &histogram : stripe) {
+      for (auto &bucket : histogram.buckets)
+        bucket.store(0, std::memory_order_relaxed);
+      histogram.max.store(0, std::memory_order_relaxed);
+    }
+}
+
+const char *Latency_histograms::name(Stage stage) {
+  return STAGE_NAMES[static_cast<size_t>(stage)];
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,179 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "password_breach_check.h"
+
+#include "latency_histogram.h" /* Latency_histograms */
+
+namespace password_breach_check {
+
+static const size_t STAGES = static_cast<size_t>(Stage::COUNT);
+
+/** Cursor over the table. Rows are summarized when a scan starts. */
+struct Latency_table_handle {
+  /* Row being read. The server saves and restores it for rnd_pos. */
+  unsigned int position{0};
+  unsigned int next_position{0};
+  Latency_summary rows[STAGES];
+};
+
+static PSI_table_handle *open_table(PSI_pos **pos) {
+  auto handle = new Latency_table_handle();
+  *pos = reinterpret_cast<PSI_pos *>(&handle->position);
+  return reinterpret_cast<PSI_table_handle *>(handle);
+}
+
+static void close_table(PSI_table_handle *handle) {
+  delete reinterpret_cast<Latency_table_handle *>(handle);
+}
+
+static int rnd_init(PSI_table_handle *h, bool) {
+  auto handle = reinterpret_cast<Latency_table_handle *>(h);
+  for (size_t i = 0; i < STAGES; ++i)
+    handle->rows[i] = Latency_histograms::summary(static_cast<Stage>(i));
+  handle->position = handle->next_position = 0;
+  return 0;
+}
+
+static int rnd_next(PSI_table_handle *h) {
+  auto handle = reinterpret_cast<Latency_table_handle *>(h);
+  handle->position = handle->next_position;
+  if (handle->position >= STAGES) return PFS_HA_ERR_END_OF_FILE;
+  handle->next_position = handle->position + 1;
+  return 0;
+}
+
+static int rnd_pos(PSI_table_handle *h) {
+  auto handle = reinterpret_cast<Latency_table_handle *>(h);
+  return handle->position < STAGES ? 0 : PFS_HA_ERR_END_OF_FILE;
+}
+
+static void reset_position(PSI_table_handle *h) {
+  auto handle = reinterpret_cast<Latency_table_handle *>(h);
+  handle->position = handle->next_position = 0;
+}
+
+static int read_column_value(PSI_table_handle *h, PSI_field *field,
+                             unsigned int index) {
+  auto handle = reinterpret_cast<Latency_table_handle *>(h);
+  auto &row = handle->rows[handle->position];
+  auto set = [field](uint64_t value) {
+    mysql_service_pfs_plugin_column_bigint_v1->set_unsigned(
+        field, PSI_ulonglong{value, false});
+  };
+  switch (index) {
+    case 0:
+      mysql_service_pfs_plugin_column_string_v2->set_varchar_utf8mb4(
+          field,
+          Latency_histograms::name(static_cast<Stage>(handle->position)));
+      break;
+    case 1:
+      set(row.count);
+      break;
+    case 2:
+      set(row.p50);
+      break;
+    case 3:
+      set(row.p95);
+      break;
+    case 4:
+      set(row.p99);
+      break;
+    case 5:
+      set(row.max);
+      break;
+    default:
+      return PFS_HA_ERR_WRONG_COMMAND;
+  }
+  return 0;
+}
+
+/** TRUNCATE TABLE clears the histograms */
+static int delete_all_rows() {
+  Latency_histograms::reset();
+  return 0;
+}
+
+static unsigned long long get_row_count() { return STAGES; }
+
+static PFS_engine_table_share_proxy latency_share = [] {
+  PFS_engine_table_share_proxy share{};
+  share.m_table_name = "password_breach_check_latency";
+  share.m_table_name_length = sizeof("password_breach_check_latency") - 1;
+  share.m_table_definition =
+      "STAGE VARCHAR(32) NOT NULL, "
+      "COUNT BIGINT UNSIGNED NOT NULL, "
+      "P50_NS BIGINT UNSIGNED NOT NULL, "
+      "P95_NS BIGINT UNSIGNED NOT NULL, "
+      "P99_NS BIGINT UNSIGNED NOT NULL, "
+      "MAX_NS BIGINT UNSIGNED NOT NULL";
+  share.m_ref_length = sizeof(Latency_table_handle::position);
+  share.m_acl = TRUNCATABLE;
+  share.delete_all_rows = delete_all_rows;
+  share.get_row_count = get_row_count;
+  share.m_proxy_engine_table = {rnd_next,  rnd_init, rnd_pos,
+                                nullptr,   nullptr,  nullptr,
+                                read_column_value, reset_position,
+                                nullptr,   nullptr,  nullptr,
+                                nullptr,   nullptr,  open_table,
+                                close_table};
+  return share;
+}();
+
+static PFS_engine_table_share_proxy *shares[] = {&latency_share};
+
+/**
+  Add performance_schema.password_breach_check_latency
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Latency_table::register_table() {
+  if (mysql_service_pfs_plugin_table_v1->add_tables(shares, 1) != 0) {
+    raise_error("Failed to add performance_schema."
+                "password_breach_check_latency table.",
+                ERROR_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+/**
+  Remove performance_schema.password_breach_check_latency
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Latency_table::unregister_table() {
+  if (mysql_service_pfs_plugin_table_v1->delete_tables(shares, 1) != 0) {
+    raise_error("Failed to remove performance_schema."
+                "password_breach_check_latency table.",
+                WARNING_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,455 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+/*
+  password_breach_check_load
+
+  Closed-loop load generator. Each of --threads workers checks a password,
+  waits for the result and immediately checks the next one, so offered load
+  rises with the thread count; run with increasing --threads to find where
+  throughput stops growing and latency starts to.
+
+  Passwords are drawn from --keys distinct values with a Zipf distribution
+  of exponent --zipf (0 is uniform). Each password hashes to an unrelated
+  prefix, so the skew over passwords is the skew over prefixes that caches
+  and the range API see.
+
+  By default checks run in process through Breach_checker, configured from
+  the command line. With --mysql-user they run against mysqld instead, as
+  SELECT VALIDATE_PASSWORD_STRENGTH() on one connection per thread (only if
+  built with the MySQL client library).
+
+  Usage:
+    password_breach_check_load [--threads <n>] [--duration <s>]
+        [--interval <s>] [--keys <n>] [--zipf <s>] [--seed <n>]
+        [--url <url>] [--unix-socket <path>] [--shm-cache <name>]
+        [--disk-cache <dir>] [--compact-store <file>]
+        [--lookup-chain <tiers>]
+        [--mysql-host <host>] [--mysql-port <port>]
+        [--mysql-socket <path>] [--mysql-user <user>]
+
+  The MySQL password is taken from MYSQL_PWD or, if that is not set and
+  standard input is a terminal, read from a prompt without echo. It is
+  never accepted on the command line, where other users could see it.
+
+  Every --interval seconds a line with the elapsed time, checks per second,
+  failed checks and p50/p95/p99/max latency in microseconds is printed,
+  followed by the same for the whole run.
+*/
+
+#include <algorithm> /* std::sort, std::upper_bound */
+#include <atomic>    /* std::atomic */
+#include <cerrno>    /* errno */
+#include <chrono>    /* std::chrono */
+#include <climits>   /* LONG_MAX */
+#include <cmath>     /* std::pow */
+#include <cstdio>    /* printf */
+#include <cstdlib>   /* strtol, strtod, getenv */
+#include <iostream>  /* std::cerr */
+#include <mutex>     /* std::mutex */
+#include <random>    /* std::mt19937_64 */
+#include <string>    /* std::string */
+#include <thread>    /* std::thread */
+#include <vector>    /* std::vector */
+
+#include <termios.h> /* tcgetattr */
+#include <unistd.h>  /* isatty */
+
+#ifdef HAVE_MYSQL_CLIENT
+#include <mysql.h> /* mysql_real_connect */
+#endif
+
+#include "breach_checker.h"
+
+using namespace password_breach_check;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Upper bounds of the numeric options */
+const long MAX_THREADS = 4096;
+const long MAX_KEYS = 100000000;
+const double MAX_SECONDS = 86400 * 7;
+const double MAX_ZIPF = 10;
+
+struct Options {
+  unsigned int threads{8};
+  double duration{30};
+  double interval{1};
+  size_t keys{1000000};
+  double zipf{0.99};
+  uint64_t seed{1};
+  std::string mysql_host{"127.0.0.1"};
+  unsigned int mysql_port{3306};
+  std::string mysql_socket;
+  std::string mysql_user;
+  std::string mysql_password;
+};
+
+Options options;
+
+/** Draws ranks in [0, n) with probability proportional to 1 / (rank + 1)^s */
+class Zipf_distribution {
+ public:
+  Zipf_distribution(size_t n, double s) : cdf_(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+      cdf_[i] = sum;
+    }
+    for (auto &value : cdf_) value /= sum;
+  }
+
+  size_t operator()(std::mt19937_64 &random) const {
+    auto point = std::uniform_real_distribution<double>(0, 1)(random);
+    auto rank =
+        std::upper_bound(cdf_.begin(), cdf_.end(), point) - cdf_.begin();
+    return std::min(static_cast<size_t>(rank), cdf_.size() - 1);
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+/** Latencies and failures collected by workers since the last report */
+struct Samples {
+  std::mutex mutex;
+  std::vector<uint64_t> latencies;
+  uint64_t failures{0};
+};
+
+void report(const char *label, double elapsed, double seconds,
+            std::vector<uint64_t> &latencies, uint64_t failures) {
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double fraction) -> unsigned long long {
+    if (latencies.empty()) return 0;
+    auto index = static_cast<size_t>(fraction * (latencies.size() - 1));
+    return latencies[index];
+  };
+  printf("%-6s %8.1f %10.0f %8llu %8llu %8llu %8llu %8llu\n", label, elapsed,
+         seconds > 0 ? latencies.size() / seconds : 0.0,
+         static_cast<unsigned long long>(failures), percentile(0.50),
+         percentile(0.95), percentile(0.99), percentile(1.0));
+  fflush(stdout);
+}
+
+/** Runs checks in process */
+class Local_target {
+ public:
+  bool connect() { return false; }
+
+  /**
+    @retval true  Check failed
+    @retval false Check completed
+  */
+  bool check(const std::string &password) {
+    Breach_checker checker(password.c_str());
+    return checker.check() == MAX_RETVAL;
+  }
+};
+
+#ifdef HAVE_MYSQL_CLIENT
+/** Runs checks through mysqld */
+class Mysql_target {
+ public:
+  ~Mysql_target() {
+    if (mysql_ != nullptr) mysql_close(mysql_);
+  }
+
+  bool connect() {
+    mysql_ = mysql_init(nullptr);
+    if (mysql_ == nullptr) return true;
+    if (mysql_real_connect(
+            mysql_, options.mysql_host.c_str(), options.mysql_user.c_str(),
+            options.mysql_password.c_str(), nullptr, options.mysql_port,
+            options.mysql_socket.empty() ? nullptr
+                                         : options.mysql_socket.c_str(),
+            0) == nullptr) {
+      std::cerr << "Failed to connect: " << mysql_error(mysql_) << std::endl;
+      return true;
+    }
+    return false;
+  }
+
+  bool check(const std::string &password) {
+    std::string escaped(password.length() * 2 + 1, '\0');
+    escaped.resize(mysql_real_escape_string(mysql_, &escaped[0],
+                                            password.c_str(),
+                                            password.length()));
+    auto query = "SELECT VALIDATE_PASSWORD_STRENGTH('" + escaped + "')";
+    if (mysql_real_query(mysql_, query.c_str(), query.length()) != 0)
+      return true;
+    auto result = mysql_store_result(mysql_);
+    if (result == nullptr) return true;
+    mysql_free_result(result);
+    return false;
+  }
+
+ private:
+  MYSQL *mysql_{nullptr};
+};
+#endif
+
+template <typename Target>
+void worker(unsigned int id, const Zipf_distribution &zipf,
+            const std::atomic<bool> &stop, Samples &samples) {
+  Target target;
+  if (target.connect()) return;
+  std::mt19937_64 random(options.seed * 1000003 + id);
+  std::vector<uint64_t> latencies;
+  uint64_t failures = 0;
+  auto flushed = Clock::now();
+  while (!stop.load(std::memory_order_relaxed)) {
+    auto password = "load-" + std::to_string(zipf(random));
+    auto start = Clock::now();
+    failures += target.check(password) ? 1 : 0;
+    auto end = Clock::now();
+    latencies.push_back(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+            .count()));
+    /* Hand samples over in batches to keep the mutex off the fast path */
+    if (end - flushed > std::chrono::milliseconds(50)) {
+      std::lock_guard<std::mutex> lock(samples.mutex);
+      samples.latencies.insert(samples.latencies.end(), latencies.begin(),
+                               latencies.end());
+      samples.failures += failures;
+      latencies.clear();
+      failures = 0;
+      flushed = end;
+    }
+  }
+  std::lock_guard<std::mutex> lock(samples.mutex);
+  samples.latencies.insert(samples.latencies.end(), latencies.begin(),
+                           latencies.end());
+  samples.failures += failures;
+}
+
+template <typename Target>
+void run(const Zipf_distribution &zipf) {
+  std::atomic<bool> stop{false};
+  Samples samples;
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < options.threads; ++i)
+    workers.emplace_back(worker<Target>, i, std::cref(zipf), std::cref(stop),
+                         std::ref(samples));
+
+  printf("%-6s %8s %10s %8s %8s %8s %8s %8s\n", "", "time_s", "checks/s",
+         "failed", "p50_us", "p95_us", "p99_us", "max_us");
+  std::vector<uint64_t> all;
+  uint64_t all_failures = 0;
+  auto start = Clock::now();
+  auto last = start;
+  auto elapsed = [](Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+  };
+  while (elapsed(start, Clock::now()) < options.duration) {
+    auto remaining = options.duration - elapsed(start, Clock::now());
+    std::this_thread::sleep_for(std::chrono::duration<double>(
+        std::min(options.interval, std::max(remaining, 0.0))));
+    std::vector<uint64_t> latencies;
+    uint64_t failures;
+    {
+      std::lock_guard<std::mutex> lock(samples.mutex);
+      latencies.swap(samples.latencies);
+      failures = samples.failures;
+      samples.failures = 0;
+    }
+    auto now = Clock::now();
+    all.insert(all.end(), latencies.begin(), latencies.end());
+    all_failures += failures;
+    report("", elapsed(start, now), elapsed(last, now), latencies, failures);
+    last = now;
+  }
+
+  stop = true;
+  for (auto &thread : workers) thread.join();
+  all.insert(all.end(), samples.latencies.begin(), samples.latencies.end());
+  all_failures += samples.failures;
+  report("total", elapsed(start, Clock::now()), elapsed(start, Clock::now()),
+         all, all_failures);
+}
+
+void usage(const char *program) {
+  std::cerr
+      << "Usage: " << program
+      << " [--threads <n>] [--duration <s>] [--interval <s>]\n"
+         "    [--keys <n>] [--zipf <s>] [--seed <n>] [--url <url>]\n"
+         "    [--unix-socket <path>] [--shm-cache <name>]\n"
+         "    [--disk-cache <dir>] [--compact-store <file>]\n"
+         "    [--lookup-chain <tiers>]\n"
+         "    [--mysql-host <host>] [--mysql-port <port>]\n"
+         "    [--mysql-socket <path>] [--mysql-user <user>]\n"
+         "\n"
+         "  --threads     Concurrent checks (default 8).\n"
+         "  --duration    Seconds to run (default 30).\n"
+         "  --interval    Seconds between reports (default 1).\n"
+         "  --keys        Distinct passwords (default 1000000).\n"
+         "  --zipf        Skew of password popularity, 0 for uniform "
+         "(default 0.99).\n"
+         "  --seed        Seed of password draws (default 1).\n"
+         "  --url ... --lookup-chain\n"
+         "                Same as the component's system variables.\n"
+         "  --mysql-...   Check through mysqld instead of in process.\n"
+         "                Password is read from MYSQL_PWD or a prompt.\n";
+}
+
+/**
+  Parse a decimal number in a range
+
+  @returns status of the operation
+    @retval true  Not a number, or out of range
+    @retval false Success
+*/
+bool parse_number(const std::string &text, long min, long max, long &value) {
+  if (text.empty()) return true;
+  char *end = nullptr;
+  errno = 0;
+  value = strtol(text.c_str(), &end, 10);
+  return errno != 0 || *end != '\0' || value < min || value > max;
+}
+
+/**
+  Parse a real number in a range
+
+  @returns status of the operation
+    @retval true  Not a number, or out of range
+    @retval false Success
+*/
+bool parse_real(const std::string &text, double min, double max,
+                double &value) {
+  if (text.empty()) return true;
+  char *end = nullptr;
+  errno = 0;
+  value = strtod(text.c_str(), &end);
+  /* Also rejects NaN, which fails both comparisons */
+  return errno != 0 || *end != '\0' || !(value >= min && value <= max);
+}
+
+#ifdef HAVE_MYSQL_CLIENT
+/** MySQL password from MYSQL_PWD, or from the terminal without echo */
+std::string mysql_password() {
+  auto environment = getenv("MYSQL_PWD");
+  if (environment != nullptr) return environment;
+  if (!isatty(STDIN_FILENO)) return "";
+
+  termios saved;
+  bool restore = tcgetattr(STDIN_FILENO, &saved) == 0;
+  if (restore) {
+    auto silent = saved;
+    silent.c_lflag &= ~static_cast<tcflag_t>(ECHO);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &silent);
+  }
+  std::cerr << "Enter password: " << std::flush;
+  std::string password;
+  std::getline(std::cin, password);
+  if (restore) tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+  std::cerr << std::endl;
+  return password;
+}
+#endif /* HAVE_MYSQL_CLIENT */
+
+/* Breached passwords are reported on each check; keep only errors */
+void log_errors(const char *message, Log_level level) {
+  if (level == Log_level::ERROR) std::cerr << message << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    std::string value(argv[++i]);
+    bool invalid = false;
+    long number = 0;
+    if (arg == "--threads") {
+      invalid = parse_number(value, 1, MAX_THREADS, number);
+      options.threads = static_cast<unsigned int>(number);
+    } else if (arg == "--duration")
+      invalid = parse_real(value, 0, MAX_SECONDS, options.duration);
+    else if (arg == "--interval")
+      invalid = parse_real(value, 0.001, MAX_SECONDS, options.interval);
+    else if (arg == "--keys") {
+      invalid = parse_number(value, 1, MAX_KEYS, number);
+      options.keys = static_cast<size_t>(number);
+    } else if (arg == "--zipf")
+      invalid = parse_real(value, 0, MAX_ZIPF, options.zipf);
+    else if (arg == "--seed") {
+      invalid = parse_number(value, 0, LONG_MAX, number);
+      options.seed = static_cast<uint64_t>(number);
+    } else if (arg == "--url")
+      config.url = value;
+    else if (arg == "--unix-socket")
+      config.unix_socket = value;
+    else if (arg == "--shm-cache")
+      config.shm_cache_name = value;
+    else if (arg == "--disk-cache")
+      config.disk_cache_dir = value;
+    else if (arg == "--compact-store")
+      config.compact_store = value;
+    else if (arg == "--lookup-chain")
+      config.lookup_chain = value;
+    else if (arg == "--mysql-host")
+      options.mysql_host = value;
+    else if (arg == "--mysql-port") {
+      invalid = parse_number(value, 1, 65535, number);
+      options.mysql_port = static_cast<unsigned int>(number);
+    } else if (arg == "--mysql-socket")
+      options.mysql_socket = value;
+    else if (arg == "--mysql-user")
+      options.mysql_user = value;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+    if (invalid) {
+      std::cerr << "Invalid " << arg << ": " << value << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Zipf_distribution zipf(options.keys, options.zipf);
+  if (!options.mysql_user.empty()) {
+#ifdef HAVE_MYSQL_CLIENT
+    options.mysql_password = mysql_password();
+    mysql_library_init(0, nullptr, nullptr);
+    run<Mysql_target>(zipf);
+    mysql_library_end();
+    return 0;
+#else
+    std::cerr << "Built without the MySQL client library" << std::endl;
+    return 1;
+#endif
+  }
+
+  set_log_handler(log_errors);
+  Breach_checker::init_environment();
+  run<Local_target>(zipf);
+  Breach_checker::deinit_environment();
+  return 0;
+}
@@ -0,0 +1,234 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "log_queue.h"
+
+#include <algorithm>     /* std::min */
+#include <chrono>        /* std::chrono */
+#include <cstring>       /* memcpy */
+#include <sstream>       /* std::stringstream */
+#include <unordered_map> /* std::unordered_map */
+
+#include "status_counters.h" /* Status_counters */
+
+namespace password_breach_check {
+
+/** Slots in the ring, a power of two */
+static const uint64_t SLOTS = 1024;
+
+/** Longest message kept, longer ones are truncated */
+static const size_t MAX_MESSAGE = 512;
+
+/** Period over which rate_limit applies */
+static const std::chrono::seconds RATE_PERIOD{60};
+
+/** Ring slot. sequence tells whether it is free or holds a message. */
+struct Log_queue::Slot {
+  std::atomic<uint64_t> sequence{0};
+  Log_level level{Log_level::INFORMATION};
+  size_t length{0};
+  char text[MAX_MESSAGE];
+};
+
+/** Messages delivered and suppressed per class in the current period */
+struct Log_queue::Rate_state {
+  struct Class {
+    std::chrono::steady_clock::time_point period_start;
+    unsigned int delivered{0};
+    uint64_t suppressed{0};
+    Log_level level{Log_level::INFORMATION};
+    std::string prefix;
+  };
+  std::unordered_map<std::string, Class> classes;
+};
+
+/** Text up to the first digit or quote, which names the message class */
+static std::string message_class(const std::string &message) {
+  auto end = message.find_first_of("0123456789'\"");
+  return message.substr(0, end);
+}
+
+Log_queue &Log_queue::instance() {
+  static Log_queue queue;
+  return queue;
+}
+
+Log_queue::~Log_queue() { stop(); }
+
+bool Log_queue::start(Log_handler deliver, unsigned int rate_limit) {
+  if (running_ || deliver == nullptr) return true;
+  slots_.reset(new Slot[SLOTS]);
+  for (uint64_t i = 0; i < SLOTS; ++i)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  enqueue_ = 0;
+  dequeue_ = 0;
+  dropped_ = 0;
+  deliver_ = deliver;
+  rate_limit_ = rate_limit;
+  rates_.reset(new Rate_state);
+  stop_ = false;
+  try {
+    thread_ = std::thread(&Log_queue::run, this);
+  } catch (...) {
+    return true;
+  }
+  running_ = true;
+  return false;
+}
+
+void Log_queue::stop() {
+  if (!running_.exchange(false)) return;
+  /*
+    A producer that saw running_ set may still be filling a slot. Wait for
+    it, so that the final drain below delivers what it reported as queued.
+  */
+  while (producers_.load() != 0) std::this_thread::yield();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+bool Log_queue::push(const std::string &message, Log_level level) {
+  /* Announced before checking running_, which stop() clears before waiting */
+  producers_.fetch_add(1);
+  if (!running_.load()) {
+    producers_.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  /* Bounded multi producer queue: claim a slot whose sequence is free */
+  auto position = enqueue_.load(std::memory_order_relaxed);
+  Slot *slot;
+  for (;;) {
+    slot = &slots_[position & (SLOTS - 1)];
+    auto sequence = slot->sequence.load(std::memory_order_acquire);
+    auto difference =
+        static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+    if (difference == 0) {
+      if (enqueue_.compare_exchange_weak(position, position + 1,
+                                         std::memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      /* Full */
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      Status_counters::add(Counter::LOG_SUPPRESSED);
+      producers_.fetch_sub(1, std::memory_order_release);
+      return false;
+    } else {
+      position = enqueue_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->level = level;
+  slot->length = std::min(message.length(), MAX_MESSAGE);
+  memcpy(slot->text, message.data(), slot->length);
+  slot->sequence.store(position + 1, std::memory_order_release);
+  producers_.fetch_sub(1, std::memory_order_release);
+  return false;
+}
+
+bool Log_queue::pop(std::string &message, Log_level &level) {
+  auto &slot = slots_[dequeue_ & (SLOTS - 1)];
+  if (slot.sequence.load(std::memory_order_acquire) != dequeue_ + 1)
+    return false;
+  message.assign(slot.text, slot.length);
+  level = slot.level;
+  slot.sequence.store(dequeue_ + SLOTS, std::memory_order_release);
+  dequeue_++;
+  return true;
+}
+
+void Log_queue::deliver(const std::string &message, Log_level level) {
+  if (rate_limit_ == 0) {
+    deliver_(message.c_str(), level);
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  auto &state = rates_->classes[message_class(message)];
+  if (state.delivered == 0 || now - state.period_start >= RATE_PERIOD) {
+    if (state.suppressed > 0) summarize(false);
+    state.period_start = now;
+    state.delivered = 0;
+  }
+  if (state.delivered < rate_limit_) {
+    state.delivered++;
+    deliver_(message.c_str(), level);
+    return;
+  }
+  if (state.suppressed++ == 0) {
+    state.level = level;
+    state.prefix = message_class(message);
+  }
+  Status_counters::add(Counter::LOG_SUPPRESSED);
+}
+
+/** Report suppressed messages of classes whose period is over, or all */
+void Log_queue::summarize(bool all) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto &entry : rates_->classes) {
+    auto &state = entry.second;
+    if (state.suppressed == 0 ||
+        (!all && now - state.period_start < RATE_PERIOD))
+      continue;
+    std::stringstream summary;
+    summary << state.suppressed << " similar messages suppressed: "
+            << state.prefix << "...";
+    deliver_(summary.str().c_str(), state.level);
+    state.suppressed = 0;
+    state.delivered = 0;
+  }
+
+  auto dropped = dropped_.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    std::stringstream summary;
+    summary << dropped << " messages dropped as the log queue was full.";
+    deliver_(summary.str().c_str(), Log_level::WARNING);
+  }
+}
+
+void Log_queue::run() {
+  std::string message;
+  Log_level level;
+  auto summarized = std::chrono::steady_clock::now();
+  for (;;) {
+    while (pop(message, level)) deliver(message, level);
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - summarized >= std::chrono::seconds(1)) {
+      summarize(false);
+      summarized = now;
+    }
+
+    /* Producers do not signal, so that pushing never takes a lock */
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (cv_.wait_for(lock, std::chrono::milliseconds(10),
+                     [this] { return stop_; }))
+      break;
+  }
+  while (pop(message, level)) deliver(message, level);
+  summarize(true);
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,115 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef LOG_QUEUE_H_INCLUDED
+#define LOG_QUEUE_H_INCLUDED
+
+#include <atomic>             /* std::atomic */
+#include <condition_variable> /* std::condition_variable */
+#include <cstddef>            /* size_t */
+#include <cstdint>            /* uint64_t */
+#include <memory>             /* std::unique_ptr */
+#include <mutex>              /* std::mutex */
+#include <string>             /* std::string */
+#include <thread>             /* std::thread */
+
+#include "breach_checker.h" /* Log_level, Log_handler */
+
+namespace password_breach_check {
+
+/**
+  Asynchronous, rate limited delivery of log messages
+
+  Threads on the lookup path push messages into a bounded lock-free ring
+  and return; a background thread delivers them to the log handler. Messages
+  are grouped into classes by their text up to the first digit or quote, so
+  that "...prefix 'ABCDE' has appeared 3 times..." and "...prefix 'FFFFF'
+  has appeared 9 times..." are alike. At most rate_limit messages of a
+  class are delivered per minute; the rest are counted and reported as
+  "N similar messages suppressed" once the minute is over. Messages that do
+  not fit in the ring are dropped and reported the same way.
+*/
+class Log_queue {
+ public:
+  static Log_queue &instance();
+
+  ~Log_queue();
+
+  /**
+    Start delivering messages in the background
+
+    @param [in] deliver     Receives messages on the background thread
+    @param [in] rate_limit  Messages per class and minute, 0 for no limit
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool start(Log_handler deliver, unsigned int rate_limit);
+
+  /** Deliver queued messages and summaries, then stop */
+  void stop();
+
+  /**
+    Queue a message
+
+    @param [in] message  Message, truncated if very long
+    @param [in] level    Severity
+
+    @returns true if not running and the caller is to deliver the message
+  */
+  bool push(const std::string &message, Log_level level);
+
+ private:
+  struct Slot;
+  struct Rate_state;
+
+  void run();
+
+  bool pop(std::string &message, Log_level &level);
+
+  void deliver(const std::string &message, Log_level level);
+
+  void summarize(bool all);
+
+ private:
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<uint64_t> enqueue_{0};
+  alignas(64) uint64_t dequeue_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<bool> running_{false};
+  /* Threads inside push() */
+  std::atomic<unsigned int> producers_{0};
+
+  Log_handler deliver_{nullptr};
+  unsigned int rate_limit_{0};
+  std::unique_ptr<Rate_state> rates_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_{false};
+};
+
+}  // namespace password_breach_check
+#endif /* LOG_QUEUE_H_INCLUDED */
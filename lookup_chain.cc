@@ -0,0 +1,248 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include <ctime> /* time */
+
+#include "breach_checker.h" /* config */
+#include "compact_store.h"  /* Compact_store */
+#include "digest_cache.h"   /* Digest_cache */
+#include "direct_store.h"   /* Direct_store */
+#include "range_pack.h"     /* range_body_count */
+#include "replica.h"        /* Range_replica */
+#include "shm_cache.h"      /* Shm_range_cache */
+
+namespace password_breach_check {
+
+/** Name of the tier that fetches from the range API */
+static const char *REMOTE_TIER = "remote";
+
+namespace {
+
+class Memory_backend : public Lookup_backend {
+ public:
+  const char *name() const override { return "memory"; }
+
+  bool lookup(const Lookup_key &key, long long &count,
+              Cached_range &) override {
+    return Digest_cache::instance().lookup(key.digest, count);
+  }
+
+  void fill_result(const Lookup_key &key, long long count) override {
+    Digest_cache::instance().store(key.digest, count);
+  }
+
+  Counter hit_counter() const override { return Counter::RESULT_CACHE_HITS; }
+};
+
+class Replica_backend : public Lookup_backend {
+ public:
+  const char *name() const override { return "replica"; }
+
+  bool source() const override { return true; }
+
+  bool lookup(const Lookup_key &key, long long &count,
+              Cached_range &) override {
+    return Range_replica::instance().lookup(key.prefix, key.suffix, count);
+  }
+};
+
+class Compact_backend : public Lookup_backend {
+ public:
+  Compact_backend(const Compact_store &compact, const Direct_store &direct)
+      : compact_{compact}, direct_{direct} {}
+
+  const char *name() const override { return "compact"; }
+
+  bool source() const override { return true; }
+
+  bool lookup(const Lookup_key &key, long long &count,
+              Cached_range &) override {
+    return compact_.lookup(key.prefix, key.suffix, count) ||
+           direct_.lookup(key.prefix, key.suffix, count);
+  }
+
+ private:
+  const Compact_store &compact_;
+  const Direct_store &direct_;
+};
+
+class Shm_backend : public Lookup_backend {
+ public:
+  const char *name() const override { return "shm"; }
+
+  bool lookup(const Lookup_key &key, long long &count,
+              Cached_range &) override {
+    return Shm_range_cache::instance().lookup(key.prefix, key.suffix, count);
+  }
+
+  void fill_range(uint32_t prefix, const Cached_range &range) override {
+    Shm_range_cache::instance().store(prefix, range.body);
+  }
+};
+
+class Disk_backend : public Lookup_backend {
+ public:
+  const char *name() const override { return "disk"; }
+
+  /* Stale ranges miss, uncopied; the remote tier revalidates them */
+  bool lookup(const Lookup_key &key, long long &count,
+              Cached_range &range) override {
+    Cached_range found{};
+    if (!Disk_range_cache::instance().find(key.prefix, found, config.cache_ttl))
+      return false;
+    count = range_body_count(found.body, key.suffix);
+    range = std::move(found);
+    return true;
+  }
+
+  void fill_range(uint32_t prefix, const Cached_range &range) override {
+    Disk_range_cache::instance().save(prefix, range);
+  }
+
+  bool stored_range(uint32_t prefix, Cached_range &range) override {
+    return Disk_range_cache::instance().find(prefix, range);
+  }
+};
+
+}  // namespace
+
+Lookup_chain &Lookup_chain::instance() {
+  static Lookup_chain chain;
+  return chain;
+}
+
+const char *const Lookup_chain::DEFAULT_SPEC =
+    "memory,replica,compact,shm,disk,remote";
+
+bool Lookup_chain::configure(const std::string &spec,
+                             const Compact_store &compact,
+                             const Direct_store &direct) {
+  bool skipped = parse(spec, compact, direct);
+  bool has_source = remote_;
+  for (const auto &tier : tiers_) has_source = has_source || tier->source();
+  if (has_source) return skipped;
+
+  log_message("lookup_chain '" + spec +
+                  "' has no source of breach data (remote, replica or "
+                  "compact), so no new password could be checked. Using '" +
+                  DEFAULT_SPEC + "' instead.",
+              Log_level::ERROR);
+  parse(DEFAULT_SPEC, compact, direct);
+  return true;
+}
+
+/** Build tiers from a spec. @returns true if names were skipped or moved */
+bool Lookup_chain::parse(const std::string &spec, const Compact_store &compact,
+                         const Direct_store &direct) {
+  clear();
+  remote_ = false;
+  bool skipped = false;
+  size_t start = 0;
+  while (start <= spec.length()) {
+    auto end = spec.find(',', start);
+    if (end == std::string::npos) end = spec.length();
+    auto name = spec.substr(start, end - start);
+    start = end + 1;
+    name.erase(0, name.find_first_not_of(" \t"));
+    name.erase(name.find_last_not_of(" \t") + 1);
+    if (name.empty()) continue;
+
+    std::unique_ptr<Lookup_backend> tier;
+    if (name == "memory")
+      tier.reset(new Memory_backend);
+    else if (name == "replica")
+      tier.reset(new Replica_backend);
+    else if (name == "compact")
+      tier.reset(new Compact_backend(compact, direct));
+    else if (name == "shm")
+      tier.reset(new Shm_backend);
+    else if (name == "disk")
+      tier.reset(new Disk_backend);
+
+    bool repeated = name == REMOTE_TIER && remote_;
+    for (const auto &existing : tiers_)
+      if (name == existing->name()) repeated = true;
+    if (repeated || (!tier && name != REMOTE_TIER)) {
+      log_message("Skipped " + std::string(repeated ? "repeated" : "unknown") +
+                      " tier '" + name + "' in lookup_chain.",
+                  Log_level::WARNING);
+      skipped = true;
+    } else if (!tier) {
+      remote_ = true;
+    } else {
+      if (remote_) {
+        log_message("Tier '" + name +
+                        "' follows remote in lookup_chain. The range API is "
+                        "always consulted last.",
+                    Log_level::WARNING);
+        skipped = true;
+      }
+      tiers_.push_back(std::move(tier));
+    }
+  }
+  return skipped;
+}
+
+void Lookup_chain::clear() {
+  tiers_.clear();
+  remote_ = true;
+}
+
+bool Lookup_chain::lookup(const Lookup_key &key, long long &count) const {
+  Cached_range range{};
+  for (size_t i = 0; i < tiers_.size(); ++i) {
+    if (!tiers_[i]->lookup(key, count, range)) continue;
+    Status_counters::add(tiers_[i]->hit_counter());
+    for (size_t j = 0; j < i; ++j) {
+      tiers_[j]->fill_result(key, count);
+      /* Result only tiers (replica, compact) have no range to pass on */
+      if (!range.body.empty()) tiers_[j]->fill_range(key.prefix, range);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool Lookup_chain::stored_range(uint32_t prefix, Cached_range &range) const {
+  for (const auto &tier : tiers_)
+    if (tier->stored_range(prefix, range)) return true;
+  return false;
+}
+
+void Lookup_chain::fill(const Lookup_key &key, long long count) const {
+  for (const auto &tier : tiers_) tier->fill_result(key, count);
+}
+
+void Lookup_chain::fill(uint32_t prefix, const Cached_range &range) const {
+  for (const auto &tier : tiers_) tier->fill_range(prefix, range);
+}
+
+std::string Lookup_chain::describe() const {
+  std::string names;
+  for (const auto &tier : tiers_) names += std::string(tier->name()) + ",";
+  if (remote_) names += REMOTE_TIER;
+  if (!names.empty() && names.back() == ',') names.pop_back();
+  return names;
+}
+
+}  // namespace password_breach_check
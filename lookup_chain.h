@@ -0,0 +1,188 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef LOOKUP_CHAIN_H_INCLUDED
+#define LOOKUP_CHAIN_H_INCLUDED
+
+#include <cstdint>     /* uint32_t */
+#include <memory>      /* std::unique_ptr */
+#include <string>      /* std::string */
+#include <string_view> /* std::string_view */
+#include <vector>      /* std::vector */
+
+#include "disk_cache.h"      /* Cached_range */
+#include "status_counters.h" /* Counter */
+
+namespace password_breach_check {
+
+class Compact_store;
+class Direct_store;
+
+/** What a tier is asked for */
+struct Lookup_key {
+  /* SHA1 digest in upper case hex */
+  std::string_view digest;
+  /* Numeric value of the first 5 characters */
+  uint32_t prefix;
+  /* Remaining 35 characters */
+  std::string_view suffix;
+};
+
+/** A local source of breach data: one tier of the lookup chain */
+class Lookup_backend {
+ public:
+  virtual ~Lookup_backend() = default;
+
+  /** Name of the tier in password_breach_check.lookup_chain */
+  virtual const char *name() const = 0;
+
+  /**
+    Look a digest up
+
+    @param [in]  key    Digest
+    @param [out] count  Number of times the password appeared in breach
+    @param [out] range  Whole range of the digest, for tiers that keep
+                        ranges. Left empty by others.
+
+    @returns true if answered
+  */
+  virtual bool lookup(const Lookup_key &key, long long &count,
+                      Cached_range &range) = 0;
+
+  /** Keep a result found by a slower tier. Ignored by read-only tiers. */
+  virtual void fill_result(const Lookup_key &, long long) {}
+
+  /** Keep a range found by a slower tier. Ignored by read-only tiers. */
+  virtual void fill_range(uint32_t, const Cached_range &) {}
+
+  /**
+    Copy of a whole range this tier keeps, fresh or not, so that the remote
+    tier can revalidate it. Only for tiers that keep ranges.
+
+    @returns true if found
+  */
+  virtual bool stored_range(uint32_t, Cached_range &) { return false; }
+
+  /**
+    Whether this tier holds breach data of its own, rather than caching
+    what a slower tier found
+  */
+  virtual bool source() const { return false; }
+
+  /** Status counter for answers */
+  virtual Counter hit_counter() const { return Counter::CACHE_HITS; }
+};
+
+/**
+  Ordered chain of local tiers, consulted before the range API
+
+  Tiers are tried in the configured order until one answers. Faster tiers
+  that missed are then back-filled with the result, and with the range if
+  the answering tier keeps ranges. Ranges fetched from the range API, the
+  remote tier, which always comes last, are back-filled into every tier.
+
+  replica and compact answer with a count only, so a range tier placed
+  before them, as in "shm,compact", is back-filled with ranges fetched from
+  the range API alone. Results they answer are still kept by memory.
+
+  Tiers:
+    memory   results by full digest (Digest_cache)
+    replica  local replica of all ranges (Range_replica)
+    compact  compact store (Compact_store or Direct_store)
+    shm      host wide cache (Shm_range_cache)
+    disk     ranges persisted on disk, while fresh (Disk_range_cache)
+    remote   range API at password_breach_check.url
+
+  A tier that is not configured, e.g. shm without shm_cache_name, misses.
+  A chain needs a source of its own: remote, replica or compact. Without
+  one, passwords not checked before could never be answered and every
+  password change would fail, so the default chain is used instead.
+*/
+class Lookup_chain {
+ public:
+  /** Chain used when none is configured or the configured one has no source */
+  static const char *const DEFAULT_SPEC;
+
+  static Lookup_chain &instance();
+
+  /**
+    Build the chain. Not safe while lookups are in progress.
+
+    @param [in] spec     Comma separated tier names, fastest first
+    @param [in] compact  Store the compact tier consults when mapped
+    @param [in] direct   Store the compact tier consults when read directly
+
+    @returns status of the operation
+      @retval true  Unknown, repeated or misplaced names, which were skipped
+                    or moved, or no source, for which the default chain is
+                    in effect
+      @retval false Success
+  */
+  bool configure(const std::string &spec, const Compact_store &compact,
+                 const Direct_store &direct);
+
+  /** Drop all tiers. Not safe while lookups are in progress. */
+  void clear();
+
+  /**
+    Look a digest up in local tiers, back-filling faster ones on a hit
+
+    @param [in]  key    Digest
+    @param [out] count  Number of times the password appeared in breach
+
+    @returns true if answered
+  */
+  bool lookup(const Lookup_key &key, long long &count) const;
+
+  /**
+    Find the copy of a range that a local tier keeps, fresh or not
+
+    @param [in]  prefix  Numeric prefix
+    @param [out] range   Range data and validators
+
+    @returns true if found
+  */
+  bool stored_range(uint32_t prefix, Cached_range &range) const;
+
+  /** Back-fill a result from the remote tier into all local tiers */
+  void fill(const Lookup_key &key, long long count) const;
+
+  /** Back-fill a range from the remote tier into all local tiers */
+  void fill(uint32_t prefix, const Cached_range &range) const;
+
+  /** Whether misses go to the range API */
+  bool remote() const { return remote_; }
+
+  /** Tier names in effect, comma separated */
+  std::string describe() const;
+
+ private:
+  bool parse(const std::string &spec, const Compact_store &compact,
+             const Direct_store &direct);
+
+  std::vector<std::unique_ptr<Lookup_backend>> tiers_;
+  bool remote_{true};
+};
+
+}  // namespace password_breach_check
+#endif /* LOOKUP_CHAIN_H_INCLUDED */
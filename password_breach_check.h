@@ -25,53 +25,42 @@ THE SOFTWARE. */
 
 #include <mysql/components/component_implementation.h>
 #include <mysql/components/service_implementation.h>
+#include <mysql/components/services/component_status_var_service.h>
+#include <mysql/components/services/component_sys_var_service.h>
+#include <mysql/components/services/dynamic_privilege.h>
 #include <mysql/components/services/log_builtins.h>
+#include <mysql/components/services/mysql_current_thread_reader.h>
 #include <mysql/components/services/mysql_string.h>
+#include <mysql/components/services/mysql_thd_store_service.h>
+#include <mysql/components/services/pfs_plugin_table_service.h>
+#include <mysql/components/services/security_context.h>
 #include <mysql/components/services/udf_registration.h>
 #include <mysql/components/services/validate_password.h>
 
 #include <sstream> /* std::stringstream */
 #include <string>  /* std::string */
 
+#include "breach_checker.h" /* Breach_checker */
+
 /* Service placeholders */
+extern REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_register);
+extern REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_unregister);
+extern REQUIRES_SERVICE_PLACEHOLDER(dynamic_privilege_register);
+extern REQUIRES_SERVICE_PLACEHOLDER(global_grants_check);
 extern REQUIRES_SERVICE_PLACEHOLDER(log_builtins);
 extern REQUIRES_SERVICE_PLACEHOLDER(log_builtins_string);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_current_thread_reader);
 extern REQUIRES_SERVICE_PLACEHOLDER(mysql_string_converter);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_security_context);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_store);
+extern REQUIRES_SERVICE_PLACEHOLDER(pfs_plugin_table_v1);
+extern REQUIRES_SERVICE_PLACEHOLDER(pfs_plugin_column_string_v2);
+extern REQUIRES_SERVICE_PLACEHOLDER(pfs_plugin_column_bigint_v1);
+extern REQUIRES_SERVICE_PLACEHOLDER(status_variable_registration);
 extern REQUIRES_SERVICE_PLACEHOLDER(udf_registration);
 
 namespace password_breach_check {
 
-extern const long long MAX_RETVAL;
-
-/** A class that helps check given password against password breach database */
-class Breach_checker {
- public:
-  static void init_environment();
-  static void deinit_environment();
-
- public:
-  Breach_checker(const char *password);
-
-  Breach_checker(my_h_string password);
-
-  ~Breach_checker() {}
-
-  long long check() const;
-
- private:
-  bool generate_digest(std::string &digest) const;
-
-  bool password_breach_data(const std::string prefix, std::string &out) const;
-
- private:
-  /* Status */
-  bool ready_{false};
-  /* Password to be checked */
-  std::string password_;
-  /* Retry count */
-  unsigned int retry_;
-};
-
 /**
   Password validation service and password_breach_check function
   implementation
@@ -92,11 +81,85 @@ class Password_validation {
                                          unsigned char *is_null,
                                          unsigned char *error);
 
+  static bool password_breach_check_file_init(UDF_INIT *initid,
+                                              UDF_ARGS *args, char *message);
+
+  static void password_breach_check_file_deinit(UDF_INIT *initid);
+
+  static char *password_breach_check_file(UDF_INIT *initid, UDF_ARGS *args,
+                                          char *result, unsigned long *length,
+                                          unsigned char *is_null,
+                                          unsigned char *error);
+
+  static bool password_breach_check_sha1_init(UDF_INIT *initid,
+                                              UDF_ARGS *args, char *message);
+
+  static long long password_breach_check_sha1(UDF_INIT *initid, UDF_ARGS *args,
+                                              unsigned char *is_null,
+                                              unsigned char *error);
+
+  static bool password_breach_check_prefix_init(UDF_INIT *initid,
+                                                UDF_ARGS *args, char *message);
+
+  static void password_breach_check_prefix_deinit(UDF_INIT *initid);
+
+  static char *password_breach_check_prefix(UDF_INIT *initid, UDF_ARGS *args,
+                                            char *result,
+                                            unsigned long *length,
+                                            unsigned char *is_null,
+                                            unsigned char *error);
+
   static bool register_functions();
   static bool unregister_functions();
 };
 
+/** System variables exposed by the component */
+class System_variables {
+ public:
+  static bool register_variables();
+  static bool unregister_variables();
+};
+
+/** Status variables exposed by the component */
+class Status_variables {
+ public:
+  static bool register_variables();
+  static bool unregister_variables();
+};
+
+/** performance_schema table with per stage latency histograms */
+class Latency_table {
+ public:
+  static bool register_table();
+  static bool unregister_table();
+};
+
+/**
+  performance_schema table with the range of a SHA1 prefix, one row per
+  suffix, for joins against candidate digests
+*/
+class Range_table {
+ public:
+  static bool register_table();
+  static bool unregister_table();
+};
+
+/**
+  Recent results of a session, so that validate() and get_strength() for
+  the same password in one statement look it up once
+*/
+class Session_memo {
+ public:
+  static bool register_slot();
+  static bool unregister_slot();
+
+  static bool find(void *thd, const std::string &digest, long long &count);
+  static void store(void *thd, const std::string &digest, long long count);
+};
+
 void raise_error(const char *error_message, loglevel level);
 
+void log_handler(const char *error_message, Log_level level);
+
 }  // namespace password_breach_check
 #endif /* PASSWORD_BREACH_CHECK_H_INCLUDED */
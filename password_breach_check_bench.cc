@@ -0,0 +1,303 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+/*
+  password_breach_check_bench
+
+  Microbenchmarks of the lookup path, built when Google Benchmark is
+  available. Fixtures are synthetic and generated from a fixed seed so that
+  results can be compared run to run. check() is measured end to end
+  against a stub HTTP server started in process, with all caches disabled.
+
+  Usage:
+    password_breach_check_bench [--benchmark_filter=<regex>] [...]
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm> /* std::sort */
+#include <cstdio>  /* snprintf */
+#include <random>  /* std::mt19937_64 */
+#include <sstream> /* std::stringstream */
+#include <string>  /* std::string */
+#include <thread>  /* std::thread */
+#include <vector>  /* std::vector */
+
+#include <netinet/in.h> /* sockaddr_in */
+#include <sys/socket.h> /* socket */
+#include <unistd.h>     /* close */
+
+#include "breach_checker.h"
+#include "digest_cache.h"
+#include "range_pack.h"
+
+namespace password_breach_check {
+
+/** Calls private steps of Breach_checker */
+struct Breach_checker_bench {
+  static bool generate_digest(const Breach_checker &checker,
+                              std::string &digest) {
+    return checker.generate_digest(digest);
+  }
+};
+
+}  // namespace password_breach_check
+
+using namespace password_breach_check;
+
+/** Suffix of SHA1("password"), whose prefix is 5BAA6 */
+static const char *BREACHED_SUFFIX = "1E4C9B93F3F0682250B6CF8331B7EE68FD8";
+
+/**
+  Range body in the format served by the range API
+
+  @param [in] entries  Number of suffixes. Real ranges hold 800-1000.
+*/
+static std::string synthetic_range(size_t entries) {
+  std::mt19937_64 random(42);
+  std::vector<std::string> lines;
+  char line[64];
+  for (size_t i = 0; i + 1 < entries; ++i) {
+    snprintf(line, sizeof(line), "%016llX%016llX%03llX:%llu",
+             static_cast<unsigned long long>(random()),
+             static_cast<unsigned long long>(random()),
+             static_cast<unsigned long long>(random() & 0xFFF),
+             static_cast<unsigned long long>(random() % 1000 + 1));
+    lines.emplace_back(line);
+  }
+  lines.emplace_back(std::string(BREACHED_SUFFIX) + ":9545824");
+  std::sort(lines.begin(), lines.end());
+
+  std::string body;
+  for (auto &entry : lines) {
+    if (!body.empty()) body.append("\r\n");
+    body.append(entry);
+  }
+  return body;
+}
+
+static const std::string &fixture() {
+  static const std::string body = synthetic_range(900);
+  return body;
+}
+
+/**
+  Minimal HTTP/1.1 server answering every request with the fixture
+
+  Connections are served one at a time, which is all a single threaded
+  benchmark needs.
+*/
+class Stub_server {
+ public:
+  bool start() {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener_ < 0) return true;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listener_, reinterpret_cast<sockaddr *>(&address), length) != 0 ||
+        listen(listener_, 16) != 0 ||
+        getsockname(listener_, reinterpret_cast<sockaddr *>(&address),
+                    &length) != 0)
+      return true;
+    port_ = ntohs(address.sin_port);
+
+    response_ = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                "Content-Length: " +
+                std::to_string(fixture().size()) + "\r\n\r\n" + fixture();
+    std::thread([this] { serve(); }).detach();
+    return false;
+  }
+
+  unsigned short port() const { return port_; }
+
+ private:
+  void serve() {
+    for (;;) {
+      int connection = accept(listener_, nullptr, nullptr);
+      if (connection < 0) continue;
+      std::string request;
+      char buffer[4096];
+      for (;;) {
+        auto received = recv(connection, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        request.append(buffer, static_cast<size_t>(received));
+        size_t end;
+        while ((end = request.find("\r\n\r\n")) != std::string::npos) {
+          request.erase(0, end + 4);
+          if (send(connection, response_.data(), response_.size(),
+                   MSG_NOSIGNAL) < 0)
+            break;
+        }
+      }
+      close(connection);
+    }
+  }
+
+  int listener_{-1};
+  unsigned short port_{0};
+  std::string response_;
+};
+
+static void BM_generate_digest(benchmark::State &state) {
+  std::string password(static_cast<size_t>(state.range(0)), 'x');
+  Breach_checker checker(password.c_str());
+  std::string digest;
+  for (auto _ : state) {
+    Breach_checker_bench::generate_digest(checker, digest);
+    benchmark::DoNotOptimize(digest);
+  }
+}
+BENCHMARK(BM_generate_digest)->Arg(8)->Arg(16)->Arg(64);
+
+/* Search of a range as done by check() */
+static void BM_range_body_count(benchmark::State &state) {
+  auto body = synthetic_range(static_cast<size_t>(state.range(0)));
+  bool present = state.range(1) != 0;
+  std::string suffix =
+      present ? BREACHED_SUFFIX : "00000000000000000000000000000000000";
+  for (auto _ : state) benchmark::DoNotOptimize(range_body_count(body, suffix));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(body.size()));
+}
+BENCHMARK(BM_range_body_count)->Args({900, 0})->Args({900, 1});
+
+/* Parsing of a range into sorted entries, as done by the caches */
+static void BM_parse_range_entries(benchmark::State &state) {
+  auto body = synthetic_range(static_cast<size_t>(state.range(0)));
+  std::vector<Range_entry> entries;
+  for (auto _ : state) {
+    parse_range_entries(body, entries);
+    benchmark::DoNotOptimize(entries.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(body.size()));
+}
+BENCHMARK(BM_parse_range_entries)->Arg(900);
+
+/* Buffering of a response delivered in chunks of the given size */
+static void BM_writer_callback(benchmark::State &state) {
+  auto &body = fixture();
+  auto chunk = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    std::stringstream buffer;
+    for (size_t offset = 0; offset < body.size(); offset += chunk)
+      writer_callback(const_cast<char *>(body.data() + offset), 1,
+                      std::min(chunk, body.size() - offset), &buffer);
+    benchmark::DoNotOptimize(buffer.str());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(body.size()));
+}
+BENCHMARK(BM_writer_callback)->Arg(1024)->Arg(16384);
+
+/** Random hex digests, the first half of them stored in the cache */
+struct Digest_cache_fixture {
+  static const size_t DIGESTS = 1 << 16;
+
+  Digest_cache cache;
+  std::vector<std::string> digests;
+
+  Digest_cache_fixture() {
+    cache.resize(DIGESTS, 3600);
+    std::mt19937_64 random(7);
+    char digest[48];
+    for (size_t i = 0; i < DIGESTS; ++i) {
+      snprintf(digest, sizeof(digest), "%016llX%016llX%08llX",
+               static_cast<unsigned long long>(random()),
+               static_cast<unsigned long long>(random()),
+               static_cast<unsigned long long>(random() & 0xFFFFFFFF));
+      digests.emplace_back(digest);
+      if (i < DIGESTS / 2) cache.store(digests.back(), i);
+    }
+  }
+};
+
+static Digest_cache_fixture &digest_cache_fixture() {
+  static Digest_cache_fixture fixture;
+  return fixture;
+}
+
+/* Result cache lookups, half hits, scaling with threads */
+static void BM_digest_cache_lookup(benchmark::State &state) {
+  auto &fixture = digest_cache_fixture();
+  size_t i = static_cast<size_t>(state.thread_index()) * 7919;
+  long long count = 0;
+  for (auto _ : state) {
+    auto &digest = fixture.digests[i++ % Digest_cache_fixture::DIGESTS];
+    benchmark::DoNotOptimize(fixture.cache.lookup(digest, count));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_digest_cache_lookup)->ThreadRange(1, 64)->UseRealTime();
+
+/* One store per eight lookups, scaling with threads */
+static void BM_digest_cache_mixed(benchmark::State &state) {
+  auto &fixture = digest_cache_fixture();
+  size_t i = static_cast<size_t>(state.thread_index()) * 7919;
+  long long count = 0;
+  for (auto _ : state) {
+    auto &digest = fixture.digests[i % Digest_cache_fixture::DIGESTS];
+    if (i++ % 8 == 0)
+      fixture.cache.store(digest, static_cast<long long>(i));
+    else
+      benchmark::DoNotOptimize(fixture.cache.lookup(digest, count));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_digest_cache_mixed)->ThreadRange(1, 64)->UseRealTime();
+
+/* Lookup through the network, on a new connection each time */
+static void BM_check(benchmark::State &state) {
+  const char *password = state.range(0) ? "password" : "not in the fixture";
+  for (auto _ : state) {
+    Breach_checker checker(password);
+    benchmark::DoNotOptimize(checker.check());
+  }
+}
+BENCHMARK(BM_check)->Arg(0)->Arg(1)->UseRealTime();
+
+/* Breached lookups log a warning each time */
+static void discard_log(const char *, Log_level) {}
+
+int main(int argc, char **argv) {
+  set_log_handler(discard_log);
+  Stub_server server;
+  if (server.start()) {
+    fprintf(stderr, "Failed to start stub server\n");
+    return 1;
+  }
+  config.url =
+      "http://127.0.0.1:" + std::to_string(server.port()) + "/range/";
+  /* BM_check measures the whole lookup each time */
+  config.result_cache_size = 0;
+  Breach_checker::init_environment();
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+
+  Breach_checker::deinit_environment();
+  return 0;
+}
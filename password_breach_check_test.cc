@@ -0,0 +1,1854 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+/*
+  password_breach_check_test
+
+  Unit tests of the lookup path. Tests that need the range API run against
+  password_breach_check_stub_server, started on a free local port; they are
+  skipped if it cannot be found. Hand-rolled concurrency (sequence locks,
+  epoch reclamation, the tagged free stack, the log ring) is exercised by
+  racing threads against each other.
+
+  Usage:
+    password_breach_check_test [--stub <stub server>] [<test name> ...]
+
+  The stub server is looked for next to the test if not given. Exits with
+  1 if a test failed.
+*/
+
+#include <algorithm>          /* std::sort */
+#include <atomic>             /* std::atomic */
+#include <cctype>             /* tolower */
+#include <chrono>             /* std::chrono */
+#include <condition_variable> /* std::condition_variable */
+#include <cstddef>            /* offsetof */
+#include <cstdio>             /* std::rename */
+#include <cstdlib>            /* std::abs, atoi */
+#include <cstring>            /* memcmp */
+#include <ctime>              /* time */
+#include <filesystem>         /* std::filesystem */
+#include <fstream>            /* std::ofstream */
+#include <iostream>           /* std::cerr */
+#include <map>                /* std::map */
+#include <mutex>              /* std::mutex */
+#include <random>             /* std::mt19937_64 */
+#include <set>                /* std::set */
+#include <string>             /* std::string */
+#include <thread>             /* std::thread */
+#include <vector>             /* std::vector */
+
+#include <arpa/inet.h>  /* inet_pton */
+#include <fcntl.h>      /* open */
+#include <netinet/in.h> /* sockaddr_in */
+#include <signal.h>     /* kill */
+#include <sys/mman.h>   /* shm_open, mmap */
+#include <sys/socket.h> /* socket */
+#include <sys/stat.h>   /* mkfifo, mkdir, fchmod */
+#include <sys/time.h>   /* timeval */
+#include <sys/wait.h>   /* waitpid */
+#include <unistd.h>     /* fork, execv, symlink */
+
+#include "breach_checker.h"
+#include "compact_store.h"
+#include "concurrency_limiter.h"
+#include "digest_cache.h"
+#include "direct_store.h"
+#include "disk_cache.h"
+#include "egress_scheduler.h"
+#include "fetch_pool.h"
+#include "file_audit.h"
+#include "log_queue.h"
+#include "lookup_chain.h"
+#include "range_pack.h"
+#include "replica.h"
+#include "secure_buffer.h"
+#include "shm_cache.h"
+#include "status_counters.h"
+
+using namespace password_breach_check;
+
+namespace {
+
+/** Failed checks of the running test */
+int failures = 0;
+
+/** Set by a test that cannot run here */
+bool skipped = false;
+
+void report_failure(const char *file, int line, const char *condition) {
+  std::cerr << file << ":" << line << ": Check failed: " << condition
+            << std::endl;
+  ++failures;
+}
+
+}  // namespace
+
+/** Check a condition, and carry on if it does not hold */
+#define CHECK(condition)                                           \
+  ((condition) ? true                                              \
+               : (report_failure(__FILE__, __LINE__, #condition), \
+                  false))
+
+/** Check a condition, and end the test if it does not hold */
+#define REQUIRE(condition)         \
+  do {                             \
+    if (!CHECK(condition)) return; \
+  } while (0)
+
+namespace {
+
+bool port_open(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  bool open = connect(fd, reinterpret_cast<sockaddr *>(&address),
+                      sizeof(address)) == 0;
+  close(fd);
+  return open;
+}
+
+/** A stub server process on a free local port, stopped when destroyed */
+class Stub_server {
+ public:
+  ~Stub_server() { stop(); }
+
+  /**
+    Start the server
+
+    @param [in] path  Stub server executable
+    @param [in] args  Arguments besides --listen
+
+    @returns range API URL, empty if the server did not start
+  */
+  const std::string &start(const std::string &path,
+                           const std::vector<std::string> &args) {
+    stop();
+    if (access(path.c_str(), X_OK) != 0) return url_;
+    std::mt19937 random(static_cast<unsigned int>(getpid() + time(nullptr)));
+    for (int attempt = 0; attempt < 20; ++attempt) {
+      int port = 20000 + static_cast<int>(random() % 40000);
+      if (port_open(port)) continue;
+      auto listen = "127.0.0.1:" + std::to_string(port);
+      std::vector<const char *> argv{path.c_str(), "--listen", listen.c_str()};
+      for (const auto &arg : args) argv.push_back(arg.c_str());
+      argv.push_back(nullptr);
+      pid_t pid = fork();
+      if (pid < 0) return url_;
+      if (pid == 0) {
+        execv(path.c_str(), const_cast<char *const *>(argv.data()));
+        _exit(127);
+      }
+      for (int i = 0; i < 200; ++i) {
+        int status = 0;
+        if (waitpid(pid, &status, WNOHANG) == pid) break; /* Port taken */
+        if (port_open(port)) {
+          pid_ = pid;
+          url_ = "http://" + listen + "/range/";
+          return url_;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+    return url_;
+  }
+
+  void stop() {
+    if (pid_ < 0) return;
+    kill(pid_, SIGTERM);
+    waitpid(pid_, nullptr, 0);
+    pid_ = -1;
+    url_.clear();
+  }
+
+ private:
+  pid_t pid_{-1};
+  std::string url_;
+};
+
+/** Stub server executable */
+std::string stub_path;
+
+/** Range mirror executable */
+std::string mirror_path;
+
+/** Range API of the shared stub server, empty if it is not running */
+std::string stub_url;
+
+/** Run a program to completion. @returns its exit status, -1 if killed */
+int run_program(const std::string &path,
+                const std::vector<std::string> &args) {
+  std::vector<const char *> argv{path.c_str()};
+  for (const auto &arg : args) argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    execv(path.c_str(), const_cast<char *const *>(argv.data()));
+    _exit(127);
+  }
+  int status = 0;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+  return WEXITSTATUS(status);
+}
+
+/**
+  GET a range from a server started by Stub_server, on a connection of its
+  own. @returns the raw response, empty on error.
+*/
+std::string http_get(const std::string &url, const std::string &prefix,
+                     const std::string &headers) {
+  static const std::string HOST = "http://127.0.0.1:";
+  if (url.compare(0, HOST.length(), HOST) != 0) return "";
+  int port = atoi(url.c_str() + HOST.length());
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return "";
+  timeval timeout{5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  std::string response;
+  auto request = "GET /range/" + prefix +
+                 " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n" +
+                 headers + "\r\n";
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address),
+              sizeof(address)) == 0 &&
+      send(fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+          static_cast<ssize_t>(request.size())) {
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+      response.append(buffer, static_cast<size_t>(received));
+  }
+  close(fd);
+  return response;
+}
+
+/** Value of a response header, empty if absent */
+std::string header_value(const std::string &response,
+                         const std::string &name) {
+  auto start = response.find("\r\n" + name + ": ");
+  if (start == std::string::npos) return "";
+  start += name.length() + 4;
+  return response.substr(start, response.find("\r\n", start) - start);
+}
+
+/** Directory removed with its contents when the test ends */
+class Temp_dir {
+ public:
+  Temp_dir() {
+    char name[] = "/tmp/password_breach_check_test.XXXXXX";
+    if (mkdtemp(name) != nullptr) path_ = name;
+  }
+  ~Temp_dir() {
+    std::error_code ignored;
+    if (!path_.empty()) std::filesystem::remove_all(path_, ignored);
+  }
+  const std::string &path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+/** Random 35 character upper case suffix */
+std::string random_suffix(std::mt19937_64 &random) {
+  static const char *HEX = "0123456789ABCDEF";
+  std::string suffix(RANGE_SUFFIX_LENGTH, '0');
+  for (auto &c : suffix) c = HEX[random() % 16];
+  return suffix;
+}
+
+/** Entries with distinct random suffixes, sorted by suffix */
+std::vector<Range_entry> random_entries(std::mt19937_64 &random,
+                                        size_t count) {
+  std::vector<Range_entry> entries;
+  std::set<std::string> seen;
+  while (entries.size() < count) {
+    auto suffix = random_suffix(random);
+    if (!seen.insert(suffix).second) continue;
+    Range_entry entry{};
+    parse_range_suffix(suffix, entry.suffix);
+    entry.count = static_cast<uint32_t>(1 + random() % 100000);
+    entries.push_back(entry);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Range_entry &a, const Range_entry &b) {
+              return memcmp(a.suffix, b.suffix, RANGE_SUFFIX_BYTES) < 0;
+            });
+  return entries;
+}
+
+std::string suffix_text(const Range_entry &entry) {
+  char text[RANGE_SUFFIX_LENGTH];
+  format_range_suffix(entry.suffix, text);
+  return std::string(text, RANGE_SUFFIX_LENGTH);
+}
+
+/** Range body in wire format */
+std::string range_body(const std::vector<Range_entry> &entries) {
+  std::string body;
+  for (const auto &entry : entries) {
+    if (!body.empty()) body += "\r\n";
+    body += suffix_text(entry) + ":" + std::to_string(entry.count);
+  }
+  return body;
+}
+
+/** Digest of the form digest() returns, with a random suffix */
+std::string random_digest(std::mt19937_64 &random) {
+  return format_range_prefix(static_cast<uint32_t>(random() %
+                                                   RANGE_PREFIX_COUNT)) +
+         random_suffix(random);
+}
+
+/**
+  Runs the lookup path against the stub server. Settings not changed by the
+  test are those of a default Config, with no rate limits and lookups made
+  on the calling thread.
+*/
+class Lookup_path {
+ public:
+  Lookup_path() {
+    config = Config{};
+    config.url = stub_url;
+    config.batch_rate = 0;
+    config.fetch_threads = 0;
+    config.log_rate_limit = 0;
+  }
+
+  ~Lookup_path() {
+    if (started_) Breach_checker::deinit_environment();
+    config = Config{};
+  }
+
+  void start() {
+    Breach_checker::init_environment();
+    started_ = true;
+  }
+
+ private:
+  bool started_{false};
+};
+
+/** A digest the stub server lists with a count, and the count */
+bool breached_digest(uint32_t prefix, std::string &digest, long long &count) {
+  std::string body;
+  std::vector<Range_entry> entries;
+  if (Breach_checker("", Request_class::BATCH)
+          .range(format_range_prefix(prefix), body) ||
+      parse_range_entries(body, entries))
+    return false;
+  for (const auto &entry : entries) {
+    if (entry.count == 0) continue;
+    digest = format_range_prefix(prefix) + suffix_text(entry);
+    count = entry.count;
+    return true;
+  }
+  return false;
+}
+
+#define SKIP_WITHOUT_STUB() \
+  do {                      \
+    if (stub_url.empty()) { \
+      skipped = true;       \
+      return;               \
+    }                       \
+  } while (0)
+
+}  // namespace
+
+/* Range pack encodings */
+
+static void range_pack_prefix_round_trip() {
+  uint32_t prefix = 0;
+  CHECK(!parse_range_prefix("00aBc", prefix));
+  CHECK(prefix == 0x00ABCU);
+  CHECK(format_range_prefix(prefix) == "00ABC");
+  CHECK(!parse_range_prefix("FFFFF", prefix));
+  CHECK(prefix == RANGE_PREFIX_COUNT - 1);
+  CHECK(parse_range_prefix("0000G", prefix));
+  CHECK(parse_range_prefix("0000", prefix));
+  CHECK(parse_range_prefix("000000", prefix));
+}
+
+static void range_pack_suffix_round_trip() {
+  std::mt19937_64 random(1);
+  for (int i = 0; i < 1000; ++i) {
+    auto text = random_suffix(random);
+    uint8_t suffix[RANGE_SUFFIX_BYTES];
+    REQUIRE(!parse_range_suffix(text, suffix));
+    char formatted[RANGE_SUFFIX_LENGTH];
+    format_range_suffix(suffix, formatted);
+    CHECK(std::string(formatted, RANGE_SUFFIX_LENGTH) == text);
+  }
+  uint8_t suffix[RANGE_SUFFIX_BYTES];
+  CHECK(parse_range_suffix(std::string(34, 'A'), suffix));
+  CHECK(parse_range_suffix(std::string(34, 'A') + "X", suffix));
+}
+
+static void range_pack_entries_and_counts() {
+  std::mt19937_64 random(2);
+  auto entries = random_entries(random, 500);
+  auto body = range_body(entries);
+
+  std::vector<Range_entry> parsed;
+  REQUIRE(!parse_range_entries(body, parsed));
+  REQUIRE(parsed.size() == entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    CHECK(memcmp(parsed[i].suffix, entries[i].suffix, RANGE_SUFFIX_BYTES) == 0);
+    CHECK(parsed[i].count == entries[i].count);
+    CHECK(range_body_count(body, suffix_text(entries[i])) == entries[i].count);
+    CHECK(find_range_entry(parsed.data(), parsed.size(),
+                           entries[i].suffix) == entries[i].count);
+  }
+  auto absent = random_suffix(random);
+  CHECK(range_body_count(body, absent) == 0);
+  CHECK(parse_range_entries("XYZ:1", parsed));
+}
+
+static void range_pack_normalize_body() {
+  /* LF separated, with and without the prefix */
+  std::string out;
+  REQUIRE(!normalize_range_body("000000A1D4B746FAA3FD526FF6D5BC8052FDB381:5\n"
+                                "0CAEF405439D57847A8657218C618160B22:2\n",
+                                out));
+  CHECK(out == "0A1D4B746FAA3FD526FF6D5BC8052FDB381:5\r\n"
+               "0CAEF405439D57847A8657218C618160B22:2");
+  CHECK(normalize_range_body("not a range\n", out));
+}
+
+static void range_pack_pack_round_trip() {
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  auto path = dir.path() + "/ranges.pack";
+  std::mt19937_64 random(3);
+  auto first = range_body(random_entries(random, 50));
+  auto second = range_body(random_entries(random, 70));
+
+  Range_pack_writer writer;
+  REQUIRE(!writer.open(path));
+  REQUIRE(!writer.add(5, first));
+  REQUIRE(!writer.add(9, second));
+  REQUIRE(!writer.add(12, first));
+  CHECK(writer.add(9, second));
+  REQUIRE(!writer.finish());
+
+  Range_pack pack;
+  REQUIRE(!pack.open(path));
+  CHECK(pack.body(5) == first);
+  CHECK(pack.body(9) == second);
+  CHECK(pack.body(6).empty());
+  uint64_t offset = 0;
+  uint32_t length = 0;
+  CHECK(pack.response(9, offset, length));
+  CHECK(!pack.response(6, offset, length));
+
+  /* ETags are quoted and follow the body only */
+  auto etag = pack.etag(5);
+  REQUIRE(etag.length() >= 3U);
+  CHECK(etag.front() == '"');
+  CHECK(etag.back() == '"');
+  CHECK(pack.etag(12) == etag);
+  CHECK(pack.etag(9) != etag);
+  CHECK(pack.etag(6).empty());
+}
+
+/* Range mirror */
+
+static void range_mirror_answers_not_modified() {
+  if (access(mirror_path.c_str(), X_OK) != 0) {
+    skipped = true;
+    return;
+  }
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  auto source = dir.path() + "/ranges";
+  auto pack = dir.path() + "/ranges.pack";
+  REQUIRE(mkdir(source.c_str(), 0700) == 0);
+  std::mt19937_64 random(16);
+  auto entries = random_entries(random, 20);
+  std::ofstream(source + "/0ABCD.txt") << range_body(entries);
+  REQUIRE(run_program(mirror_path, {"--build", source, "--pack", pack}) == 0);
+
+  Stub_server mirror;
+  auto url = mirror.start(mirror_path, {"--pack", pack, "--threads", "1"});
+  REQUIRE(!url.empty());
+
+  /* A range comes with an ETag */
+  auto response = http_get(url, "0ABCD", "");
+  CHECK(response.compare(0, 12, "HTTP/1.1 200") == 0);
+  CHECK(response.find(suffix_text(entries[0])) != std::string::npos);
+  auto etag = header_value(response, "ETag");
+  REQUIRE(etag.length() >= 3U);
+
+  /* Revalidated without a body while it matches */
+  response = http_get(url, "0ABCD", "If-None-Match: " + etag + "\r\n");
+  CHECK(response.compare(0, 12, "HTTP/1.1 304") == 0);
+  CHECK(header_value(response, "ETag") == etag);
+  CHECK(response.find(suffix_text(entries[0])) == std::string::npos);
+
+  response = http_get(url, "0ABCD", "If-None-Match: \"stale\"\r\n");
+  CHECK(response.compare(0, 12, "HTTP/1.1 200") == 0);
+  CHECK(header_value(response, "ETag") == etag);
+}
+
+/* Compact store encodings */
+
+static void compact_round_trip(Compact_options::Suffixes suffixes,
+                               Compact_options::Counts counts) {
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  auto path = dir.path() + "/store.compact";
+  Compact_options options;
+  options.suffixes = suffixes;
+  options.counts = counts;
+  options.suffix_bits = 40;
+
+  std::mt19937_64 random(4);
+  std::map<uint32_t, std::vector<Range_entry>> ranges;
+  for (uint32_t prefix : {0U, 1U, 17U, 4096U, RANGE_PREFIX_COUNT - 1})
+    ranges[prefix] = random_entries(random, 1 + random() % 300);
+
+  Compact_store_writer writer;
+  REQUIRE(!writer.open(path, options));
+  for (const auto &range : ranges)
+    REQUIRE(!writer.add(range.first, range.second));
+  REQUIRE(!writer.finish());
+
+  Compact_store store;
+  REQUIRE(!store.open(path, 4));
+  CHECK(store.options().suffixes == options.suffixes);
+  CHECK(store.options().counts == options.counts);
+
+  size_t total = 0;
+  for (const auto &range : ranges) {
+    total += range.second.size();
+    for (const auto &entry : range.second) {
+      long long count = -1;
+      REQUIRE(store.lookup(range.first, suffix_text(entry), count));
+      switch (options.counts) {
+        case Compact_options::Counts::NONE:
+          CHECK(count == 1);
+          break;
+        case Compact_options::Counts::LOG8:
+          /* 8 steps per doubling */
+          CHECK(count >= 1);
+          CHECK(std::abs(count - static_cast<long long>(entry.count)) <=
+                static_cast<long long>(entry.count) / 10 + 1);
+          break;
+        case Compact_options::Counts::EXACT:
+          CHECK(count == entry.count);
+          break;
+      }
+    }
+    long long count = -1;
+    REQUIRE(store.lookup(range.first, random_suffix(random), count));
+    CHECK(count == 0);
+  }
+  CHECK(store.entries() == total);
+
+  long long count = -1;
+  REQUIRE(store.lookup(2, random_suffix(random), count));
+  CHECK(count == 0);
+}
+
+static void compact_store_round_trips() {
+  for (auto suffixes : {Compact_options::Suffixes::SORTED,
+                        Compact_options::Suffixes::ELIAS_FANO})
+    for (auto counts :
+         {Compact_options::Counts::NONE, Compact_options::Counts::LOG8,
+          Compact_options::Counts::EXACT})
+      compact_round_trip(suffixes, counts);
+}
+
+static void compact_block_lookup_rejects_corrupt_blocks() {
+  Compact_options options;
+  options.suffixes = Compact_options::Suffixes::SORTED;
+  options.counts = Compact_options::Counts::EXACT;
+  options.suffix_bits = 40;
+  options.group_size = 2;
+
+  /* Directory of 3 offsets, a range of one key, an empty range, padding */
+  const std::string suffix = "0123456789" + std::string(25, '0');
+  const uint32_t directory[3] = {12, 29, 37};
+  const uint8_t range[8] = {1, 0, 0, 0, 0, 0, 0, 0};
+  const uint8_t key[5] = {0x01, 0x23, 0x45, 0x67, 0x89};
+  const uint32_t listed = 5;
+  const uint8_t empty[8] = {0};
+  std::string block(reinterpret_cast<const char *>(directory),
+                    sizeof(directory));
+  block.append(reinterpret_cast<const char *>(range), sizeof(range));
+  block.append(reinterpret_cast<const char *>(key), sizeof(key));
+  block.append(reinterpret_cast<const char *>(&listed), sizeof(listed));
+  block.append(reinterpret_cast<const char *>(empty), sizeof(empty));
+  block.append(8, '\0');
+  REQUIRE(block.size() == 45U);
+
+  long long count = -1;
+  CHECK(compact_block_lookup(options, block.data(), block.size(), 0, suffix,
+                             count));
+  CHECK(count == 5);
+  CHECK(compact_block_lookup(options, block.data(), block.size(), 1, suffix,
+                             count));
+  CHECK(count == 0);
+
+  /* Offset table cut short */
+  CHECK(!compact_block_lookup(options, block.data(), 8, 1, suffix, count));
+  /* Range end past the block */
+  CHECK(!compact_block_lookup(options, block.data(), 40, 1, suffix, count));
+
+  /* More keys than the range holds */
+  auto corrupt = block;
+  corrupt[12] = 2;
+  CHECK(!compact_block_lookup(options, corrupt.data(), corrupt.size(), 0,
+                              suffix, count));
+  /* Range too short for its header */
+  corrupt = block;
+  corrupt[4] = 33;
+  CHECK(!compact_block_lookup(options, corrupt.data(), corrupt.size(), 1,
+                              suffix, count));
+}
+
+/* Digest cache */
+
+static void digest_cache_evicts_unreferenced_first() {
+  Digest_cache cache;
+  /* A single bucket */
+  REQUIRE(!cache.resize(8, 3600));
+  std::mt19937_64 random(5);
+  std::vector<std::string> digests;
+  for (int i = 0; i < 8; ++i) {
+    digests.push_back(random_digest(random));
+    cache.store(digests.back(), i);
+  }
+  long long count = -1;
+  for (int i = 0; i < 8; ++i) {
+    REQUIRE(cache.lookup(digests[i], count));
+    CHECK(count == i);
+  }
+
+  /*
+    All were referenced above, so the first store sweeps the bucket and
+    replaces the entry under the hand. Entry 1 is referenced again, so the
+    next store passes over it.
+  */
+  auto extra = random_digest(random);
+  cache.store(extra, 100);
+  cache.lookup(digests[1], count);
+  auto another = random_digest(random);
+  cache.store(another, 101);
+
+  CHECK(cache.lookup(extra, count));
+  CHECK(cache.lookup(another, count));
+  CHECK(cache.lookup(digests[1], count));
+  size_t kept = 0;
+  for (const auto &digest : digests) kept += cache.lookup(digest, count);
+  CHECK(kept == 6U);
+}
+
+static void digest_cache_capacity() {
+  Digest_cache cache;
+  REQUIRE(!cache.resize(1024, 3600));
+  std::mt19937_64 random(6);
+  std::vector<std::string> digests;
+  for (int i = 0; i < 4096; ++i) {
+    digests.push_back(random_digest(random));
+    cache.store(digests.back(), i);
+  }
+  size_t kept = 0;
+  long long count = -1;
+  for (size_t i = 0; i < digests.size(); ++i) {
+    if (!cache.lookup(digests[i], count)) continue;
+    ++kept;
+    CHECK(count == static_cast<long long>(i));
+  }
+  CHECK(kept <= 1024U);
+  CHECK(kept > 512U);
+  CHECK(cache.lookup(digests.back(), count));
+}
+
+static void digest_cache_expires_after_ttl() {
+  Digest_cache cache;
+  REQUIRE(!cache.resize(64, 1));
+  std::mt19937_64 random(7);
+  auto digest = random_digest(random);
+  cache.store(digest, 42);
+  long long count = -1;
+  REQUIRE(cache.lookup(digest, count));
+  CHECK(count == 42);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+  CHECK(!cache.lookup(digest, count));
+
+  /* Disabled */
+  REQUIRE(!cache.resize(0, 1));
+  cache.store(digest, 42);
+  CHECK(!cache.lookup(digest, count));
+}
+
+/* Readers must never see a count stored for another digest */
+static void digest_cache_sequence_lock() {
+  Digest_cache cache;
+  /* Few buckets, so that writers keep replacing what readers read */
+  REQUIRE(!cache.resize(16, 3600));
+  std::mt19937_64 random(8);
+  std::vector<std::string> digests;
+  for (int i = 0; i < 64; ++i) digests.push_back(random_digest(random));
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> torn{0};
+  std::atomic<uint64_t> hits{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 2; ++t)
+    threads.emplace_back([&, t] {
+      std::mt19937_64 local(static_cast<uint64_t>(t));
+      while (!stop) {
+        auto i = local() % digests.size();
+        cache.store(digests[i], static_cast<long long>(i));
+      }
+    });
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&, t] {
+      std::mt19937_64 local(static_cast<uint64_t>(t) + 100);
+      long long count = -1;
+      while (!stop) {
+        auto i = local() % digests.size();
+        if (!cache.lookup(digests[i], count)) continue;
+        ++hits;
+        if (count != static_cast<long long>(i)) ++torn;
+      }
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  stop = true;
+  for (auto &thread : threads) thread.join();
+  CHECK(torn.load() == 0U);
+  CHECK(hits.load() > 0U);
+}
+
+/* Session memo */
+
+static void recent_digests_expire_and_rotate() {
+  typedef Recent_digests::Clock Clock;
+  Recent_digests memo;
+  std::mt19937_64 random(13);
+  std::vector<std::string> digests;
+  for (size_t i = 0; i <= Recent_digests::ENTRIES; ++i)
+    digests.push_back(random_digest(random));
+
+  /* Found until older than the TTL */
+  auto stored = Clock::now();
+  memo.store(digests[0], 42, stored);
+  long long count = -1;
+  CHECK(memo.find(digests[0], stored - std::chrono::seconds(5), count));
+  CHECK(count == 42);
+  CHECK(memo.find(digests[0], stored, count));
+  CHECK(!memo.find(digests[0], stored + std::chrono::milliseconds(1), count));
+  CHECK(!memo.find(digests[1], stored - std::chrono::seconds(5), count));
+
+  /* The oldest result makes room for a new one */
+  for (size_t i = 1; i <= Recent_digests::ENTRIES; ++i)
+    memo.store(digests[i], static_cast<long long>(i), stored);
+  CHECK(!memo.find(digests[0], stored, count));
+  for (size_t i = 1; i <= Recent_digests::ENTRIES; ++i) {
+    CHECK(memo.find(digests[i], stored, count));
+    CHECK(count == static_cast<long long>(i));
+  }
+}
+
+/* Host wide cache */
+
+static void shm_range_cache_sequence_lock() {
+  auto name = "/password_breach_check_test." + std::to_string(getpid());
+  auto &cache = Shm_range_cache::instance();
+  REQUIRE(!cache.attach(name, 16 * 1024 * 1024, 3600));
+
+  /* Two versions of a range that disagree on the count of one suffix */
+  std::mt19937_64 random(9);
+  auto entries = random_entries(random, 400);
+  auto watched = suffix_text(entries[123]);
+  entries[123].count = 1000;
+  auto first = range_body(entries);
+  entries[123].count = 2000;
+  auto second = range_body(entries);
+  cache.store(77, first);
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> torn{0};
+  std::atomic<uint64_t> hits{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 2; ++t)
+    threads.emplace_back([&, t] {
+      bool flip = t == 0;
+      while (!stop) {
+        cache.store(77, flip ? first : second);
+        flip = !flip;
+      }
+    });
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&] {
+      long long count = -1;
+      while (!stop) {
+        if (!cache.lookup(77, watched, count)) continue;
+        ++hits;
+        if (count != 1000 && count != 2000) ++torn;
+      }
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  stop = true;
+  for (auto &thread : threads) thread.join();
+
+  long long count = -1;
+  CHECK(!cache.lookup(78, watched, count));
+  cache.detach();
+  shm_unlink(name.c_str());
+  CHECK(torn.load() == 0U);
+  CHECK(hits.load() > 0U);
+}
+
+static void shm_range_cache_reclaims_stale_slots() {
+  auto name = "/password_breach_check_test." + std::to_string(getpid());
+  auto &cache = Shm_range_cache::instance();
+  REQUIRE(!cache.attach(name, 1024 * 1024, 3600));
+  std::mt19937_64 random(10);
+  auto entries = random_entries(random, 50);
+  auto watched = suffix_text(entries[7]);
+  cache.store(5, range_body(entries));
+
+  /* Find the slot through a second mapping, as another server would */
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  REQUIRE(fd >= 0);
+  void *base = mmap(nullptr, 1024 * 1024, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  REQUIRE(base != MAP_FAILED);
+  Shm_range_cache::Slot *held = nullptr;
+  auto stride = (sizeof(Shm_range_cache::Slot) + 63) & ~size_t{63};
+  for (size_t offset = 64; offset + stride <= 1024 * 1024; offset += stride) {
+    auto *slot = reinterpret_cast<Shm_range_cache::Slot *>(
+        static_cast<char *>(base) + offset);
+    if (slot->key.load() == 6) held = slot;
+  }
+  REQUIRE(held != nullptr);
+
+  /* A writer holding the slot blocks others, until it is presumed dead */
+  long long count = -1;
+  auto now = static_cast<uint64_t>(time(nullptr));
+  auto sequence = held->sequence.load();
+  held->sequence.store((now << 32) | ((sequence + 1) & 0xFFFFFFFF));
+  CHECK(!cache.lookup(5, watched, count));
+  cache.store(5, range_body(entries));
+  CHECK(!cache.lookup(5, watched, count));
+  auto stale = now - Shm_range_cache::STALE_LOCK_SECONDS - 1;
+  held->sequence.store((stale << 32) | ((sequence + 1) & 0xFFFFFFFF));
+  cache.store(5, range_body(entries));
+  CHECK((held->sequence.load() & 1) == 0U);
+  CHECK(cache.lookup(5, watched, count) && count == entries[7].count);
+  munmap(base, 1024 * 1024);
+  cache.detach();
+  shm_unlink(name.c_str());
+
+  /* A segment others may write to is refused */
+  fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  REQUIRE(fd >= 0);
+  CHECK(fchmod(fd, 0666) == 0);
+  CHECK(ftruncate(fd, 1024 * 1024) == 0);
+  close(fd);
+  CHECK(cache.attach(name, 1024 * 1024, 3600));
+  CHECK(!cache.attached());
+  shm_unlink(name.c_str());
+}
+
+/* Disk cache */
+
+static void disk_range_cache_compacts_while_running() {
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  auto &cache = Disk_range_cache::instance();
+  REQUIRE(!cache.attach(dir.path()));
+
+  /* A reader races appends and the swaps of compacted files */
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> torn{0};
+  std::thread reader([&] {
+    Cached_range seen;
+    while (!stop) {
+      if (!cache.find(5, seen)) continue;
+      if (seen.body.length() != 100000 ||
+          seen.body.find_first_not_of(seen.body[0]) != std::string::npos)
+        ++torn;
+    }
+  });
+
+  Cached_range range;
+  range.fetched_at = static_cast<uint64_t>(time(nullptr)) - 100;
+  range.etag = "\"etag\"";
+  for (int i = 0; i < 100; ++i) {
+    range.body.assign(100000, static_cast<char>('a' + i % 26));
+    cache.save(5, range);
+    /* Queue holds at most MAX_PENDING records */
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  /* Writer is done once the last record is found */
+  Cached_range found;
+  for (int i = 0; i < 500; ++i) {
+    if (cache.find(5, found) && found.body == range.body) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  stop = true;
+  reader.join();
+  CHECK(torn.load() == 0U);
+  CHECK(found.body == range.body);
+  CHECK(found.etag == range.etag);
+  CHECK(found.fetched_at == range.fetched_at);
+  CHECK(!cache.find(5, found, 10));
+  CHECK(cache.find(5, found, 1000));
+  CHECK(!cache.find(6, found));
+  cache.detach();
+
+  /* 100 records of 100 KB without compaction */
+  CHECK(std::filesystem::file_size(dir.path() + "/ranges-0.dat") <
+        4U * 1024 * 1024);
+
+  /* Lookups do not wait for a segment to load; they miss until it is */
+  REQUIRE(!cache.attach(dir.path()));
+  found = Cached_range{};
+  CHECK(!cache.find(5, found));
+  for (int i = 0; i < 500 && !cache.find(5, found); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(found.body == range.body);
+  cache.detach();
+}
+
+/* Locked password buffers */
+
+static void secure_buffer_buffers_are_exclusive() {
+  auto &pool = Secure_buffer_pool::instance();
+  REQUIRE(!pool.start(4));
+  REQUIRE(pool.enabled());
+  auto fallbacks = Status_counters::get(Counter::SECURE_BUFFER_FALLBACKS);
+
+  /* More threads than buffers, so that some fall back to the heap */
+  std::atomic<uint64_t> shared{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t)
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 20000; ++i) {
+        Secure_buffer buffer;
+        memset(buffer.data(), 'a' + t, 64);
+        std::this_thread::yield();
+        for (int j = 0; j < 64; ++j)
+          if (buffer.data()[j] != 'a' + t) {
+            ++shared;
+            break;
+          }
+      }
+    });
+  for (auto &thread : threads) thread.join();
+  CHECK(shared.load() == 0U);
+  CHECK(Status_counters::get(Counter::SECURE_BUFFER_FALLBACKS) > fallbacks);
+
+  /* All buffers were returned, and are wiped */
+  uint32_t slots[4];
+  for (auto &slot : slots) {
+    auto data = pool.acquire(slot);
+    REQUIRE(data != nullptr);
+    for (size_t j = 0; j < SECURE_BUFFER_SIZE; ++j) REQUIRE(data[j] == 0);
+  }
+  uint32_t extra = 0;
+  CHECK(pool.acquire(extra) == nullptr);
+  for (auto slot : slots) pool.release(slot);
+  pool.stop();
+}
+
+/* Log ring */
+
+namespace {
+std::mutex delivered_mutex;
+std::multiset<std::string> delivered;
+
+void collect(const char *message, Log_level) {
+  std::lock_guard<std::mutex> lock(delivered_mutex);
+  delivered.insert(message);
+}
+}  // namespace
+
+static void log_queue_delivers_each_message_once() {
+  delivered.clear();
+  auto &queue = Log_queue::instance();
+  REQUIRE(!queue.start(collect, 0));
+
+  /* Fewer than the ring holds, so that none are dropped */
+  const int THREADS = 4;
+  const int MESSAGES = 200;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t)
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < MESSAGES; ++i)
+        CHECK(!queue.push(
+            "message " + std::to_string(t) + "." + std::to_string(i),
+            Log_level::INFORMATION));
+    });
+  for (auto &thread : threads) thread.join();
+  queue.stop();
+
+  std::lock_guard<std::mutex> lock(delivered_mutex);
+  CHECK(delivered.size() == static_cast<size_t>(THREADS * MESSAGES));
+  for (int t = 0; t < THREADS; ++t)
+    for (int i = 0; i < MESSAGES; ++i)
+      CHECK(delivered.count("message " + std::to_string(t) + "." +
+                            std::to_string(i)) == 1U);
+  CHECK(queue.push("not running", Log_level::INFORMATION));
+}
+
+static void log_queue_push_racing_stop_is_not_lost() {
+  auto &queue = Log_queue::instance();
+  for (int round = 0; round < 20; ++round) {
+    delivered.clear();
+    REQUIRE(!queue.start(collect, 0));
+
+    /* Pushes that reported the message as queued */
+    std::atomic<uint64_t> queued{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&, t] {
+        for (int i = 0;; ++i) {
+          if (queue.push("racing " + std::to_string(t) + "." +
+                             std::to_string(i),
+                         Log_level::INFORMATION))
+            break;
+          ++queued;
+        }
+      });
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    queue.stop();
+    for (auto &thread : threads) thread.join();
+
+    /* Each queued message is delivered or counted as dropped */
+    uint64_t received = 0;
+    uint64_t dropped = 0;
+    std::lock_guard<std::mutex> lock(delivered_mutex);
+    for (const auto &message : delivered) {
+      if (message.compare(0, 7, "racing ") == 0)
+        ++received;
+      else if (message.find("messages dropped") != std::string::npos)
+        dropped += std::stoull(message);
+    }
+    CHECK(received + dropped == queued.load());
+  }
+}
+
+/* Fetch pool */
+
+static void fetch_pool_steals_and_overflows() {
+  Fetch_pool pool;
+  REQUIRE(!pool.start(2, 8));
+
+  /* Hold one worker. Tasks queued behind it are stolen by the other. */
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool release = false;
+  std::atomic<int> held{0};
+  auto hold = [&] {
+    ++held;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return release; });
+  };
+  REQUIRE(!pool.submit(hold));
+  while (held.load() < 1) std::this_thread::yield();
+  std::atomic<int> ran{0};
+  for (int i = 0; i < 8; ++i) REQUIRE(!pool.submit([&] { ++ran; }));
+  for (int i = 0; i < 500 && ran.load() < 8; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  CHECK(ran.load() == 8);
+
+  /* With both held, the queue fills and then refuses */
+  REQUIRE(!pool.submit(hold));
+  while (held.load() < 2) std::this_thread::yield();
+  for (int i = 0; i < 8; ++i) CHECK(!pool.submit([&] { ++ran; }));
+  CHECK(pool.queue_depth() == 8U);
+  CHECK(pool.submit([&] { ++ran; }));
+
+  /* Stopping drops what did not start */
+  std::thread stopper([&] { pool.stop(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    release = true;
+  }
+  cv.notify_all();
+  stopper.join();
+  CHECK(ran.load() == 8);
+  CHECK(pool.threads() == 0U);
+  CHECK(pool.queue_depth() == 0U);
+  CHECK(pool.submit([&] { ++ran; }));
+}
+
+/* A session deadline bounds the worker's attempts and retries as well */
+static void lookup_path_fetch_stops_at_deadline() {
+  SKIP_WITHOUT_STUB();
+  Stub_server slow;
+  auto url = slow.start(stub_path, {"--latency", "3000"});
+  REQUIRE(!url.empty());
+  Lookup_path lookup_path;
+  config.url = url;
+  config.fetch_threads = 2;
+  config.fetch_wait_timeout = 1;
+  lookup_path.start();
+
+  std::mt19937_64 random(11);
+  auto fetches = Status_counters::get(Counter::FETCHES);
+  auto started = std::chrono::steady_clock::now();
+  CHECK(Breach_checker("").check_fetched(random_digest(random)) ==
+        MAX_RETVAL);
+  CHECK(std::chrono::steady_clock::now() - started <
+        std::chrono::milliseconds(1500));
+  /* The worker gave up too, without retrying */
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  CHECK(Status_counters::get(Counter::FETCHES) - fetches == 1U);
+}
+
+/* Fetches overlapped with other validators */
+
+static void lookup_path_fan_out_cancels_and_signals() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  config.fetch_threads = 1;
+  lookup_path.start();
+  auto &pool = Fetch_pool::instance();
+  const auto always_false = [] { return false; };
+
+  /* The only worker is busy, so the fetch is still queued when cancelled */
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool release = false;
+  REQUIRE(!pool.submit([&] {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return release; });
+  }));
+  std::mt19937_64 random(14);
+  auto fetches = Status_counters::get(Counter::FETCHES);
+  long long count = 0;
+  CHECK(Breach_checker("").check_fetched(
+      random_digest(random),
+      [](const std::atomic<bool> &) { return true; }, always_false, count));
+  CHECK(count == MAX_RETVAL);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    release = true;
+  }
+  cv.notify_all();
+  for (int i = 0; i < 200 && pool.queue_depth() > 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches);
+
+  /* Validators learn that the password is breached while they run */
+  std::string digest;
+  long long listed = 0;
+  REQUIRE(breached_digest(70000, digest, listed));
+  bool saw_breached = false;
+  CHECK(!Breach_checker("").check_fetched(
+      digest,
+      [&saw_breached](const std::atomic<bool> &breached) {
+        for (int i = 0; i < 500 && !breached; ++i)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        saw_breached = breached;
+        return false;
+      },
+      always_false, count));
+  CHECK(saw_breached);
+  CHECK(count == listed);
+}
+
+static void lookup_path_validators_first_skips_fetch() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  config.validators_first = true;
+  lookup_path.start();
+  std::mt19937_64 random(15);
+  auto digest = random_digest(random);
+  Breach_checker checker("");
+  const auto pass = [](const std::atomic<bool> &) { return false; };
+  auto fetches = Status_counters::get(Counter::FETCHES);
+  auto skipped = Status_counters::get(Counter::SKIPPED_LOOKUPS);
+
+  /* Other validators failed or rejected the password: nothing to fetch */
+  long long count = 0;
+  CHECK(checker.check_fetched(
+      digest, [](const std::atomic<bool> &) { return true; },
+      [] { return false; }, count));
+  CHECK(count == MAX_RETVAL);
+  CHECK(!checker.check_fetched(digest, pass, [] { return true; }, count));
+  CHECK(count == MAX_RETVAL);
+  CHECK(Status_counters::get(Counter::SKIPPED_LOOKUPS) == skipped + 2);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches);
+
+  /* Accepted by them: fetched */
+  CHECK(!checker.check_fetched(digest, pass, [] { return false; }, count));
+  CHECK(count != MAX_RETVAL);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches + 1);
+}
+
+/* Adaptive concurrency limit */
+
+static void concurrency_limiter_decreases_once_per_window() {
+  typedef Concurrency_limiter::Clock Clock;
+  typedef Concurrency_limiter::Outcome Outcome;
+  Concurrency_limiter limiter;
+  limiter.configure(64);
+  REQUIRE(limiter.limit() == 10.0);
+
+  /* A burst of slow responses to requests in flight together */
+  auto soon = Clock::now() + std::chrono::seconds(1);
+  for (int i = 0; i < 8; ++i) REQUIRE(!limiter.acquire(soon));
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  for (int i = 0; i < 8; ++i)
+    limiter.release(Outcome::OVERLOAD, std::chrono::milliseconds(5), 0);
+  CHECK(limiter.limit() == 9.0);
+  CHECK(limiter.in_flight() == 0U);
+
+  /* A request started after the decrease lowers it again */
+  REQUIRE(!limiter.acquire(soon));
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  limiter.release(Outcome::OVERLOAD, std::chrono::milliseconds(1), 0);
+  CHECK(limiter.limit() < 8.2 && limiter.limit() > 8.0);
+
+  /* Fast responses while saturated raise it, by under one per window */
+  auto before = limiter.limit();
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 8; ++i) REQUIRE(!limiter.acquire(soon));
+    for (int i = 0; i < 8; ++i)
+      limiter.release(Outcome::SUCCESS, std::chrono::microseconds(1), 0);
+  }
+  CHECK(limiter.limit() > before + 2 && limiter.limit() < before + 10);
+
+  /* Never below one */
+  for (int i = 0; i < 100; ++i) {
+    REQUIRE(!limiter.acquire(soon));
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+    limiter.release(Outcome::OVERLOAD, std::chrono::microseconds(1), 0);
+  }
+  CHECK(limiter.limit() == 1.0);
+}
+
+static void concurrency_limiter_honours_retry_after_and_priority() {
+  typedef Concurrency_limiter::Clock Clock;
+  typedef Concurrency_limiter::Outcome Outcome;
+  Concurrency_limiter limiter;
+  limiter.configure(4);
+  auto soon = Clock::now() + std::chrono::milliseconds(50);
+
+  /* Batch requests get a share of the limit only */
+  REQUIRE(!limiter.acquire(soon, false));
+  REQUIRE(!limiter.acquire(soon, false));
+  REQUIRE(!limiter.acquire(soon, false));
+  CHECK(limiter.acquire(soon, false));
+  CHECK(!limiter.acquire(soon, true));
+  CHECK(limiter.acquire(soon, true));
+  for (int i = 0; i < 4; ++i)
+    limiter.release(Outcome::IGNORE, std::chrono::milliseconds(1), 0);
+  CHECK(limiter.limit() == 4.0);
+
+  /* 429 halves the limit and blocks everyone until Retry-After passed */
+  REQUIRE(!limiter.acquire(soon));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  limiter.release(Outcome::THROTTLED, std::chrono::microseconds(1), 1);
+  CHECK(limiter.limit() == 2.0);
+  auto started = Clock::now();
+  CHECK(limiter.acquire(started + std::chrono::milliseconds(500)));
+  CHECK(Clock::now() - started < std::chrono::milliseconds(100));
+  CHECK(!limiter.acquire(started + std::chrono::seconds(3)));
+  CHECK(Clock::now() - started >= std::chrono::milliseconds(900));
+  limiter.release(Outcome::IGNORE, std::chrono::milliseconds(1), 0);
+}
+
+static void concurrency_limiter_admits_interactive_first() {
+  typedef Concurrency_limiter::Clock Clock;
+  typedef Concurrency_limiter::Outcome Outcome;
+  /* One slot, which batch requests may use too */
+  Concurrency_limiter limiter;
+  limiter.configure(1);
+  REQUIRE(!limiter.acquire(Clock::now()));
+
+  /* The batch request waits first, the interactive one still goes first */
+  auto deadline = Clock::now() + std::chrono::seconds(5);
+  std::atomic<bool> batch_admitted{false};
+  std::atomic<bool> interactive_admitted{false};
+  std::thread batch([&] {
+    batch_admitted = !limiter.acquire(deadline, false);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::thread interactive([&] {
+    interactive_admitted = !limiter.acquire(deadline, true);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  limiter.release(Outcome::IGNORE, std::chrono::milliseconds(1), 0);
+  interactive.join();
+  CHECK(interactive_admitted.load());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK(!batch_admitted.load());
+
+  limiter.release(Outcome::IGNORE, std::chrono::milliseconds(1), 0);
+  batch.join();
+  CHECK(batch_admitted.load());
+  limiter.release(Outcome::IGNORE, std::chrono::milliseconds(1), 0);
+  CHECK(limiter.in_flight() == 0U);
+}
+
+/* Egress scheduler */
+
+static void token_bucket_bursts_then_paces() {
+  typedef Token_bucket::Clock Clock;
+  Token_bucket bucket;
+  bucket.configure(10);
+
+  /* One second worth of tokens at once */
+  auto now = Clock::now();
+  for (int i = 0; i < 10; ++i) CHECK(!bucket.take(now));
+
+  /* Then one every 100ms. Giving up reserves nothing. */
+  CHECK(bucket.take(Clock::now() + std::chrono::milliseconds(20)));
+  auto started = Clock::now();
+  CHECK(!bucket.take(started + std::chrono::seconds(1)));
+  auto waited = Clock::now() - started;
+  CHECK(waited >= std::chrono::milliseconds(70));
+  CHECK(waited < std::chrono::milliseconds(500));
+
+  bucket.configure(0);
+  for (int i = 0; i < 100; ++i) CHECK(!bucket.take(now));
+}
+
+static void egress_scheduler_limits_each_class() {
+  typedef std::chrono::steady_clock Clock;
+  auto &limiter = Concurrency_limiter::instance();
+  limiter.configure(8);
+  auto &scheduler = Egress_scheduler::instance();
+  scheduler.configure(0, 2);
+
+  /* Batch has its own bucket, which does not hold interactive requests */
+  auto soon = Clock::now() + std::chrono::milliseconds(50);
+  CHECK(!scheduler.acquire(Request_class::BATCH, soon));
+  CHECK(!scheduler.acquire(Request_class::BATCH, soon));
+  CHECK(scheduler.acquire(Request_class::BATCH, soon));
+  for (int i = 0; i < 5; ++i)
+    CHECK(!scheduler.acquire(Request_class::INTERACTIVE, soon));
+  CHECK(limiter.in_flight() == 7U);
+
+  while (limiter.in_flight() > 0)
+    limiter.release(Concurrency_limiter::Outcome::IGNORE,
+                    std::chrono::milliseconds(1), 0);
+  scheduler.configure(0, 0);
+}
+
+/* Lookup chain */
+
+static void lookup_path_chain_order_and_backfill() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  config.disk_cache_dir = dir.path();
+  config.lookup_chain = "memory,disk,remote";
+  lookup_path.start();
+  CHECK(Lookup_chain::instance().describe() == "memory,disk,remote");
+
+  std::string digest;
+  REQUIRE(!Breach_checker("password").digest(digest));
+  uint32_t prefix = 0;
+  parse_range_prefix(std::string_view(digest).substr(0, 5), prefix);
+  Breach_checker checker("", Request_class::BATCH);
+
+  /* Fetched, then filled into memory and disk */
+  auto fetches = Status_counters::get(Counter::FETCHES);
+  auto count = checker.check_digest(digest);
+  REQUIRE(count != MAX_RETVAL);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches + 1);
+
+  /* Answered by memory */
+  auto memory_hits = Status_counters::get(Counter::RESULT_CACHE_HITS);
+  CHECK(checker.check_digest(digest) == count);
+  CHECK(Status_counters::get(Counter::RESULT_CACHE_HITS) == memory_hits + 1);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches + 1);
+
+  /* Written to disk in the background */
+  Cached_range range;
+  for (int i = 0; i < 200 && !Disk_range_cache::instance().find(prefix, range);
+       ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(!range.body.empty());
+
+  /* Answered by disk once memory forgot, which back-fills memory */
+  Digest_cache::instance().resize(config.result_cache_size, config.cache_ttl);
+  auto disk_hits = Status_counters::get(Counter::CACHE_HITS);
+  CHECK(checker.check_digest(digest) == count);
+  CHECK(Status_counters::get(Counter::CACHE_HITS) == disk_hits + 1);
+  CHECK(checker.check_digest(digest) == count);
+  CHECK(Status_counters::get(Counter::RESULT_CACHE_HITS) == memory_hits + 2);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches + 1);
+
+  /* Ranges kept by disk are served without a fetch */
+  std::string breached;
+  long long breached_count = 0;
+  REQUIRE(breached_digest(prefix, breached, breached_count));
+  CHECK(checker.check_digest(breached) == breached_count);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches + 1);
+}
+
+static void lookup_path_chain_result_tiers_fill_no_ranges() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  lookup_path.start();
+  auto name = "/password_breach_check_test." + std::to_string(getpid());
+  auto &shm = Shm_range_cache::instance();
+  REQUIRE(!shm.attach(name, 16 * 1024 * 1024, 3600));
+
+  auto path = dir.path() + "/store.compact";
+  Compact_options options;
+  options.counts = Compact_options::Counts::EXACT;
+  options.suffix_bits = 40;
+  std::mt19937_64 random(12);
+  auto entries = random_entries(random, 50);
+  Compact_store_writer writer;
+  REQUIRE(!writer.open(path, options));
+  REQUIRE(!writer.add(42, entries));
+  REQUIRE(!writer.finish());
+  Compact_store compact;
+  Direct_store direct;
+  REQUIRE(!compact.open(path, 4));
+
+  auto &chain = Lookup_chain::instance();
+  CHECK(!chain.configure("memory,shm,compact", compact, direct));
+  auto digest = format_range_prefix(42) + suffix_text(entries[0]);
+  Lookup_key key{digest, 42, std::string_view(digest).substr(5)};
+  long long count = -1;
+  CHECK(chain.lookup(key, count));
+  CHECK(count == entries[0].count);
+
+  /* Memory keeps the result, shm gets no range from compact */
+  auto memory_hits = Status_counters::get(Counter::RESULT_CACHE_HITS);
+  CHECK(chain.lookup(key, count));
+  CHECK(Status_counters::get(Counter::RESULT_CACHE_HITS) == memory_hits + 1);
+  CHECK(!shm.lookup(42, key.suffix, count));
+
+  chain.clear();
+  shm.detach();
+  shm_unlink(name.c_str());
+}
+
+static void lookup_path_chain_falls_back_without_source() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  lookup_path.start();
+  Compact_store compact;
+  Direct_store direct;
+  auto &chain = Lookup_chain::instance();
+
+  CHECK(chain.configure("memory,disk", compact, direct));
+  CHECK(chain.describe() == Lookup_chain::DEFAULT_SPEC);
+  CHECK(chain.configure("", compact, direct));
+  CHECK(chain.describe() == Lookup_chain::DEFAULT_SPEC);
+
+  /* Remote is always consulted last */
+  CHECK(chain.configure("remote,memory", compact, direct));
+  CHECK(chain.describe() == "memory,remote");
+  CHECK(chain.configure("memory,bogus,memory,remote", compact, direct));
+  CHECK(chain.describe() == "memory,remote");
+
+  CHECK(!chain.configure("compact", compact, direct));
+  CHECK(!chain.remote());
+  CHECK(!chain.configure("memory,shm,remote", compact, direct));
+  CHECK(chain.remote());
+}
+
+/* Replica */
+
+namespace {
+
+/* Layout of a replica generation, see replica.cc */
+struct Generation_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t prefix_bits;
+  uint64_t generation;
+  uint64_t created;
+  uint64_t complete;
+  uint64_t entries;
+  uint64_t reserved[2];
+};
+
+struct Generation_bucket {
+  uint64_t offset;
+  uint32_t count;
+  uint32_t reserved;
+  char etag[48];
+};
+
+/** Write a complete generation as the crawler would */
+bool write_generation(
+    const std::string &directory, uint64_t number,
+    const std::map<uint32_t, std::vector<Range_entry>> &ranges,
+    const std::map<uint32_t, std::string> &etags = {}) {
+  auto path = directory + "/replica-" + std::to_string(number) + ".dat";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+  if (fd < 0) return true;
+  const uint64_t data_offset =
+      sizeof(Generation_header) +
+      sizeof(Generation_bucket) * static_cast<uint64_t>(RANGE_PREFIX_COUNT);
+
+  Generation_header header{};
+  memcpy(header.magic, "PBCREPL1", 8);
+  header.version = 1;
+  header.prefix_bits = RANGE_PREFIX_BITS;
+  header.generation = number;
+  header.created = static_cast<uint64_t>(time(nullptr));
+  header.complete = 1;
+
+  std::vector<Generation_bucket> buckets(4096);
+  uint64_t offset = data_offset;
+  bool error = false;
+  for (uint32_t first = 0; first < RANGE_PREFIX_COUNT && !error;
+       first += 4096) {
+    for (uint32_t i = 0; i < 4096; ++i) {
+      buckets[i] = Generation_bucket{};
+      buckets[i].offset = offset;
+      auto etag = etags.find(first + i);
+      if (etag != etags.end())
+        etag->second.copy(buckets[i].etag, sizeof(buckets[i].etag) - 1);
+      auto range = ranges.find(first + i);
+      if (range == ranges.end()) continue;
+      auto length = range->second.size() * sizeof(Range_entry);
+      error = error || pwrite(fd, range->second.data(), length,
+                              static_cast<off_t>(offset)) !=
+                           static_cast<ssize_t>(length);
+      buckets[i].count = static_cast<uint32_t>(range->second.size());
+      header.entries += range->second.size();
+      offset += length;
+    }
+    auto length = buckets.size() * sizeof(Generation_bucket);
+    error = error ||
+            pwrite(fd, buckets.data(), length,
+                   static_cast<off_t>(sizeof(header) +
+                                      first * sizeof(Generation_bucket))) !=
+                static_cast<ssize_t>(length);
+  }
+  error = error || pwrite(fd, &header, sizeof(header), 0) !=
+                       static_cast<ssize_t>(sizeof(header));
+  close(fd);
+  return error;
+}
+
+}  // namespace
+
+static void lookup_path_replica_publish_and_lookup() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  std::mt19937_64 random(10);
+  std::map<uint32_t, std::vector<Range_entry>> ranges;
+  for (uint32_t prefix : {3U, 70000U, RANGE_PREFIX_COUNT - 1})
+    ranges[prefix] = random_entries(random, 200);
+  REQUIRE(!write_generation(dir.path(), 1, ranges));
+
+  /* A newer generation that is not complete is never published */
+  auto altered = ranges;
+  altered[3][0].count += 1;
+  REQUIRE(!write_generation(dir.path(), 2, altered));
+  {
+    std::fstream file(dir.path() + "/replica-2.dat",
+                      std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t incomplete = 0;
+    file.seekp(offsetof(Generation_header, complete));
+    file.write(reinterpret_cast<const char *>(&incomplete),
+               sizeof(incomplete));
+  }
+
+  config.replica_dir = dir.path();
+  config.replica_rate = 1;
+  config.lookup_chain = "replica,remote";
+  lookup_path.start();
+  auto &replica = Range_replica::instance();
+
+  auto verify = [&]() {
+    for (const auto &range : ranges)
+      for (const auto &entry : range.second) {
+        long long count = -1;
+        if (!replica.lookup(range.first, suffix_text(entry), count))
+          return false;
+        if (count != entry.count) return false;
+      }
+    return true;
+  };
+  CHECK(verify());
+  long long count = -1;
+  REQUIRE(replica.lookup(4, random_suffix(random), count));
+  CHECK(count == 0);
+
+  /* Answers the chain without a fetch */
+  auto fetches = Status_counters::get(Counter::FETCHES);
+  const auto &entry = ranges[70000].front();
+  auto digest = format_range_prefix(70000) + suffix_text(entry);
+  CHECK(Breach_checker("", Request_class::BATCH).check_digest(digest) ==
+        entry.count);
+  CHECK(Status_counters::get(Counter::FETCHES) == fetches);
+
+  /*
+    Generations are released and mapped again under readers. A reader that
+    used an unmapped generation would crash or read other counts.
+  */
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> wrong{0};
+  std::atomic<uint64_t> answered{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t)
+    readers.emplace_back([&] {
+      while (!stop) {
+        for (const auto &range : ranges)
+          for (const auto &entry : range.second) {
+            long long count = -1;
+            if (!replica.lookup(range.first, suffix_text(entry), count))
+              continue;
+            ++answered;
+            if (count != entry.count) ++wrong;
+          }
+      }
+    });
+  for (int i = 0; i < 20; ++i) {
+    replica.stop();
+    CHECK(!replica.start(dir.path(), 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  stop = true;
+  for (auto &reader : readers) reader.join();
+  CHECK(wrong.load() == 0U);
+  CHECK(answered.load() > 0U);
+  CHECK(verify());
+}
+
+static void lookup_path_replica_resumes_and_revalidates() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  const uint32_t last = RANGE_PREFIX_COUNT - 1;
+  std::mt19937_64 random(11);
+  std::map<uint32_t, std::vector<Range_entry>> ranges;
+  ranges[last] = random_entries(random, 50);
+  /* The ETag the stub server sends for the last prefix with seed 7 */
+  std::map<uint32_t, std::string> etags{{last, "\"7-FFFFF\""}};
+  REQUIRE(!write_generation(dir.path(), 1, ranges, etags));
+
+  /*
+    Generation 2 was crawled up to the last two prefixes before a restart.
+    Generation 5 was abandoned and is removed on start.
+  */
+  REQUIRE(!write_generation(dir.path(), 2, ranges, etags));
+  REQUIRE(std::rename((dir.path() + "/replica-2.dat").c_str(),
+                      (dir.path() + "/replica-2.dat.partial").c_str()) == 0);
+  std::ofstream(dir.path() + "/replica-5.dat.partial") << "abandoned";
+  std::ofstream(dir.path() + "/replica.checkpoint") << "2 " << last - 1;
+
+  /* Fetches go to the stub server, the crawler fills the replica */
+  std::string digest;
+  long long count = 0;
+  config.lookup_chain = "remote";
+  lookup_path.start();
+  REQUIRE(breached_digest(last - 1, digest, count));
+  auto &replica = Range_replica::instance();
+  REQUIRE(!replica.start(dir.path(), 10));
+  CHECK(access((dir.path() + "/replica-5.dat.partial").c_str(), F_OK) != 0);
+
+  /* The resumed prefix is fetched, the unchanged one is carried over */
+  long long found = -1;
+  for (int i = 0; i < 150 && found != count; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    replica.lookup(last - 1, std::string_view(digest).substr(5), found);
+  }
+  CHECK(found == count);
+  CHECK(access((dir.path() + "/replica-2.dat").c_str(), F_OK) == 0);
+  for (const auto &entry : ranges[last]) {
+    found = -1;
+    CHECK(replica.lookup(last, suffix_text(entry), found));
+    CHECK(found == entry.count);
+  }
+  replica.stop();
+}
+
+/* File audit */
+
+static void lookup_path_file_audit_counts() {
+  SKIP_WITHOUT_STUB();
+  Lookup_path lookup_path;
+  Temp_dir dir;
+  REQUIRE(!dir.path().empty());
+  lookup_path.start();
+
+  std::string breached;
+  long long breached_count = 0;
+  REQUIRE(breached_digest(0x12345, breached, breached_count));
+  std::string lower = breached;
+  for (auto &c : lower) c = static_cast<char>(tolower(c));
+  {
+    std::ofstream file(dir.path() + "/audit.txt");
+    file << "correct horse battery staple\n"
+         << "\n"
+         << lower << "\r\n"
+         << std::string(600, 'x') << "\n"
+         << "Tr0ub4dor&3\n"
+         << "last line without newline";
+  }
+
+  Audit_summary summary;
+  std::string error;
+  REQUIRE(!File_audit::run(dir.path(), "audit.txt", summary, error));
+  CHECK(summary.lines == 5U);
+  CHECK(summary.digests == 1U);
+  CHECK(summary.checked == 4U);
+  CHECK(summary.breached == 1U);
+  CHECK(summary.occurrences == static_cast<uint64_t>(breached_count));
+  CHECK(summary.errors == 1U);
+
+  /* Escapes, links and special files fail alike */
+  REQUIRE(symlink("/etc/passwd", (dir.path() + "/link.txt").c_str()) == 0);
+  REQUIRE(mkfifo((dir.path() + "/fifo.txt").c_str(), 0600) == 0);
+  CHECK(File_audit::run(dir.path(), "../etc/passwd", summary, error));
+  CHECK(error == "Cannot open ../etc/passwd in the audit directory.");
+  CHECK(File_audit::run(dir.path(), "/etc/passwd", summary, error));
+  CHECK(File_audit::run(dir.path(), "link.txt", summary, error));
+  CHECK(error == "Cannot open link.txt in the audit directory.");
+  CHECK(File_audit::run(dir.path(), "fifo.txt", summary, error));
+  CHECK(File_audit::run(dir.path(), "missing.txt", summary, error));
+  CHECK(error == "Cannot open missing.txt in the audit directory.");
+  CHECK(File_audit::run("", "audit.txt", summary, error));
+}
+
+/** Tests in the order they run */
+static const struct {
+  const char *name;
+  void (*run)();
+} tests[] = {
+    {"range_pack_prefix_round_trip", range_pack_prefix_round_trip},
+    {"range_pack_suffix_round_trip", range_pack_suffix_round_trip},
+    {"range_pack_entries_and_counts", range_pack_entries_and_counts},
+    {"range_pack_normalize_body", range_pack_normalize_body},
+    {"range_pack_pack_round_trip", range_pack_pack_round_trip},
+    {"range_mirror_answers_not_modified", range_mirror_answers_not_modified},
+    {"compact_store_round_trips", compact_store_round_trips},
+    {"compact_block_lookup_rejects_corrupt_blocks",
+     compact_block_lookup_rejects_corrupt_blocks},
+    {"digest_cache_evicts_unreferenced_first",
+     digest_cache_evicts_unreferenced_first},
+    {"digest_cache_capacity", digest_cache_capacity},
+    {"digest_cache_expires_after_ttl", digest_cache_expires_after_ttl},
+    {"digest_cache_sequence_lock", digest_cache_sequence_lock},
+    {"recent_digests_expire_and_rotate", recent_digests_expire_and_rotate},
+    {"shm_range_cache_sequence_lock", shm_range_cache_sequence_lock},
+    {"shm_range_cache_reclaims_stale_slots",
+     shm_range_cache_reclaims_stale_slots},
+    {"disk_range_cache_compacts_while_running",
+     disk_range_cache_compacts_while_running},
+    {"secure_buffer_buffers_are_exclusive",
+     secure_buffer_buffers_are_exclusive},
+    {"log_queue_delivers_each_message_once",
+     log_queue_delivers_each_message_once},
+    {"log_queue_push_racing_stop_is_not_lost",
+     log_queue_push_racing_stop_is_not_lost},
+    {"fetch_pool_steals_and_overflows", fetch_pool_steals_and_overflows},
+    {"lookup_path_fetch_stops_at_deadline",
+     lookup_path_fetch_stops_at_deadline},
+    {"lookup_path_fan_out_cancels_and_signals",
+     lookup_path_fan_out_cancels_and_signals},
+    {"lookup_path_validators_first_skips_fetch",
+     lookup_path_validators_first_skips_fetch},
+    {"concurrency_limiter_decreases_once_per_window",
+     concurrency_limiter_decreases_once_per_window},
+    {"concurrency_limiter_honours_retry_after_and_priority",
+     concurrency_limiter_honours_retry_after_and_priority},
+    {"concurrency_limiter_admits_interactive_first",
+     concurrency_limiter_admits_interactive_first},
+    {"token_bucket_bursts_then_paces", token_bucket_bursts_then_paces},
+    {"egress_scheduler_limits_each_class", egress_scheduler_limits_each_class},
+    {"lookup_path_chain_order_and_backfill",
+     lookup_path_chain_order_and_backfill},
+    {"lookup_path_chain_result_tiers_fill_no_ranges",
+     lookup_path_chain_result_tiers_fill_no_ranges},
+    {"lookup_path_chain_falls_back_without_source",
+     lookup_path_chain_falls_back_without_source},
+    {"lookup_path_replica_publish_and_lookup",
+     lookup_path_replica_publish_and_lookup},
+    {"lookup_path_replica_resumes_and_revalidates",
+     lookup_path_replica_resumes_and_revalidates},
+    {"lookup_path_file_audit_counts", lookup_path_file_audit_counts},
+};
+
+int main(int argc, char **argv) {
+  std::string stub;
+  std::string mirror;
+  std::set<std::string> selected;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "--stub" && i + 1 < argc)
+      stub = argv[++i];
+    else if (arg == "--mirror" && i + 1 < argc)
+      mirror = argv[++i];
+    else
+      selected.insert(arg);
+  }
+  std::string self(argv[0]);
+  auto slash = self.rfind('/');
+  auto directory = slash == std::string::npos ? std::string(".")
+                                              : self.substr(0, slash);
+  if (stub.empty()) stub = directory + "/password_breach_check_stub_server";
+  if (mirror.empty())
+    mirror = directory + "/password_breach_check_range_mirror";
+  stub_path = stub;
+  mirror_path = mirror;
+  Stub_server server;
+  stub_url = server.start(stub_path, {"--seed", "7"});
+  if (stub_url.empty())
+    std::cerr << "Stub server " << stub
+              << " is not available. Tests that need it are skipped."
+              << std::endl;
+
+  int failed = 0;
+  for (const auto &test : tests) {
+    if (!selected.empty() && selected.count(test.name) == 0) continue;
+    failures = 0;
+    skipped = false;
+    test.run();
+    std::cout << (failures > 0 ? "FAIL " : skipped ? "SKIP " : "ok   ")
+              << test.name << std::endl;
+    if (failures > 0) ++failed;
+  }
+  return failed > 0 ? 1 : 0;
+}
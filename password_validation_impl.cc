@@ -21,17 +21,55 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE. */
 
 #include <algorithm>
+#include <atomic>     /* std::atomic */
+#include <cstring>    /* memcpy */
+#include <functional> /* std::function */
+#include <new>        /* std::nothrow */
+#include <string>     /* std::string */
+#include <vector>     /* std::vector */
 
 #include <mysql/components/services/validate_password.h>
 #include "components/libservicebroadcast/service_broadcast.h"
+#include "file_audit.h"
+#include "latency_histogram.h"
 #include "password_breach_check.h"
+#include "range_pack.h"
+#include "secure_buffer.h"
 
 namespace password_breach_check {
 /** Function registered by this component */
 const char *FUNCTION_NAME = "password_breach_check";
 
-/** Arbitrary large value indicating that empty string is not a good password */
-const long long MAX_RETVAL = 1000000;
+/** Function auditing a file, registered by this component */
+const char *FILE_FUNCTION_NAME = "password_breach_check_file";
+
+/** Function checking a SHA1 digest, registered by this component */
+const char *SHA1_FUNCTION_NAME = "password_breach_check_sha1";
+
+/** Function returning a range, registered by this component */
+const char *PREFIX_FUNCTION_NAME = "password_breach_check_prefix";
+
+/** Dynamic privilege needed to audit files, registered by this component */
+const char *AUDIT_PRIVILEGE = "PASSWORD_BREACH_CHECK_AUDIT";
+
+/**
+  Check whether the user of the current session holds a global privilege
+
+  @param [in] privilege  Name of a dynamic privilege
+
+  @returns true if the privilege is held
+*/
+static bool has_global_grant(const char *privilege) {
+  MYSQL_THD thd = nullptr;
+  Security_context_handle context = nullptr;
+  if (mysql_service_mysql_current_thread_reader->get(&thd) ||
+      thd == nullptr ||
+      mysql_service_mysql_thd_security_context->get(thd, &context) ||
+      context == nullptr)
+    return false;
+  return mysql_service_global_grants_check->has_global_grant(
+      context, privilege, strlen(privilege));
+}
 
 /**
   Helper function to raise error.
@@ -40,37 +78,163 @@ const long long MAX_RETVAL = 1000000;
   @param [in] level          Severity of error
 */
 void raise_error(const char *error_message, loglevel level) {
-  std::stringstream ss;
-  ss << "password_breach_check component reported: " << error_message;
   LogEvent()
       .type(LOG_TYPE_ERROR)
       .prio(level)
-      .message(ss.str().c_str(), error_message);
+      .message("password_breach_check component reported: %s", error_message);
+}
+
+/**
+  Log handler for the lookup path: routes its messages to the error log
+
+  @param [in] error_message  Error message to be logged
+  @param [in] level          Severity of error
+*/
+void log_handler(const char *error_message, Log_level level) {
+  switch (level) {
+    case Log_level::ERROR:
+      raise_error(error_message, ERROR_LEVEL);
+      break;
+    case Log_level::WARNING:
+      raise_error(error_message, WARNING_LEVEL);
+      break;
+    case Log_level::INFORMATION:
+      raise_error(error_message, INFORMATION_LEVEL);
+      break;
+  }
 }
 
+/**
+  Check a password received through the validate_password service and run
+  the other validate_password implementations
+
+  A result the session obtained moments ago for the same password is
+  reused. If the password cannot be answered locally its range has to be
+  fetched, and Breach_checker::check_fetched() decides how the fetch and
+  the other implementations are ordered. Otherwise they run only for
+  passwords not found in breaches.
+
+  @param [in]  thd         Session
+  @param [in]  password    Password to be checked
+  @param [in]  validators  Other implementations, see Validators
+  @param [in]  rejected    Tells, after validators ran, whether they
+                           rejected the password without failing
+  @param [out] count       Number of times the password appeared in breach,
+                           MAX_RETVAL if it could not be checked
+
+  @returns status of other implementations
+    @retval true  Failure
+    @retval false Success, or not run
+*/
+static bool check_password(void *thd, my_h_string password,
+                           const Validators &validators,
+                           const std::function<bool()> &rejected,
+                           long long &count) {
+  static const std::atomic<bool> not_breached{false};
+  /* Locked in memory and wiped on return */
+  Secure_buffer buffer;
+  count = MAX_RETVAL;
+
+  /* Convert incoming password to UTF8 format */
+  Stage_timer timer{Stage::UTF8_CONVERSION};
+  if (mysql_service_mysql_string_converter->convert_to_buffer(
+          password, buffer.data(), buffer.size(), "utf8mb3")) {
+    log_message("Failed to convert password to 'utf8' format.",
+                Log_level::ERROR);
+    return false;
+  }
+  timer.stop();
+
+  Breach_checker breach_checker(buffer.data());
+  std::string digest;
+  if (breach_checker.digest(digest)) return false;
+  bool answered = Session_memo::find(thd, digest, count);
+  if (!answered && breach_checker.check_cached(digest, count)) {
+    Session_memo::store(thd, digest, count);
+    answered = true;
+  }
+  if (answered)
+    return count == 0 &&
+           Breach_checker::run_validators(validators, not_breached);
+
+  bool failed = breach_checker.check_fetched(digest, validators, rejected,
+                                             count);
+  if (count != MAX_RETVAL) Session_memo::store(thd, digest, count);
+  return failed;
+}
+
+/** A function registered by this component */
+struct Udf_definition {
+  const char *name;
+  Item_result result_type;
+  Udf_func_any func;
+  Udf_func_init init;
+  Udf_func_deinit deinit;
+};
+
+/** Functions registered by this component, in registration order */
+static const Udf_definition UDF_DEFINITIONS[] = {
+    {FUNCTION_NAME, Item_result::INT_RESULT,
+     (Udf_func_any)Password_validation::password_breach_check,
+     Password_validation::password_breach_check_init,
+     Password_validation::password_breach_check_deinit},
+    {FILE_FUNCTION_NAME, Item_result::STRING_RESULT,
+     (Udf_func_any)Password_validation::password_breach_check_file,
+     Password_validation::password_breach_check_file_init,
+     Password_validation::password_breach_check_file_deinit},
+    {SHA1_FUNCTION_NAME, Item_result::INT_RESULT,
+     (Udf_func_any)Password_validation::password_breach_check_sha1,
+     Password_validation::password_breach_check_sha1_init,
+     Password_validation::password_breach_check_deinit},
+    {PREFIX_FUNCTION_NAME, Item_result::STRING_RESULT,
+     (Udf_func_any)Password_validation::password_breach_check_prefix,
+     Password_validation::password_breach_check_prefix_init,
+     Password_validation::password_breach_check_prefix_deinit}};
+
 bool Password_validation::register_functions() {
-  if (mysql_service_udf_registration->udf_register(
-          FUNCTION_NAME, Item_result::INT_RESULT,
-          (Udf_func_any)Password_validation::password_breach_check,
-          Password_validation::password_breach_check_init,
-          Password_validation::password_breach_check_deinit)) {
-    raise_error("Failed to register password_breach_check function.",
-                ERROR_LEVEL);
+  if (mysql_service_dynamic_privilege_register->register_privilege(
+          AUDIT_PRIVILEGE, strlen(AUDIT_PRIVILEGE))) {
+    std::string message =
+        std::string("Failed to register ") + AUDIT_PRIVILEGE + " privilege.";
+    raise_error(message.c_str(), ERROR_LEVEL);
     return true;
   }
+  for (const auto &udf : UDF_DEFINITIONS) {
+    if (mysql_service_udf_registration->udf_register(
+            udf.name, udf.result_type, udf.func, udf.init, udf.deinit)) {
+      std::string message =
+          std::string("Failed to register ") + udf.name + " function.";
+      raise_error(message.c_str(), ERROR_LEVEL);
+      unregister_functions();
+      return true;
+    }
+  }
   return false;
 }
 
 bool Password_validation::unregister_functions() {
-  int was_present = 0;
-  if (mysql_service_udf_registration->udf_unregister(FUNCTION_NAME,
-                                                     &was_present) &&
-      was_present) {
-    raise_error("Failed to unregister password_breach_check function.",
-                WARNING_LEVEL);
-    return true;
+  bool failed = false;
+  for (const auto &udf : UDF_DEFINITIONS) {
+    int was_present = 0;
+    if (mysql_service_udf_registration->udf_unregister(udf.name,
+                                                       &was_present) &&
+        was_present) {
+      std::string message =
+          std::string("Failed to unregister ") + udf.name + " function.";
+      raise_error(message.c_str(), WARNING_LEVEL);
+      failed = true;
+    }
   }
-  return false;
+  /* Kept while a function may still be registered */
+  if (!failed &&
+      mysql_service_dynamic_privilege_register->unregister_privilege(
+          AUDIT_PRIVILEGE, strlen(AUDIT_PRIVILEGE))) {
+    std::string message =
+        std::string("Failed to unregister ") + AUDIT_PRIVILEGE + " privilege.";
+    raise_error(message.c_str(), WARNING_LEVEL);
+    failed = true;
+  }
+  return failed;
 }
 
 /**
@@ -84,17 +248,23 @@ bool Password_validation::unregister_functions() {
 */
 DEFINE_BOOL_METHOD(Password_validation::validate,
                    (void *thd, my_h_string password)) {
-  Breach_checker breach_checker(password);
-  long long count = breach_checker.check();
-  if (count == 0) {
-    if (service_broadcast::broadcast([&thd, &password](
-                                         const my_h_service *service_handle) {
-          auto service = reinterpret_cast<SERVICE_TYPE(validate_password) *>(
-              *service_handle);
-          return service->validate(thd, password);
-        }))
-      return true;
-  }
+  long long count = MAX_RETVAL;
+  if (check_password(
+          thd, password,
+          [&thd, &password](const std::atomic<bool> &breached) {
+            return service_broadcast::broadcast(
+                [&thd, &password,
+                 &breached](const my_h_service *service_handle) -> bool {
+                  /* Fails anyway */
+                  if (breached) return true;
+                  auto service =
+                      reinterpret_cast<SERVICE_TYPE(validate_password) *>(
+                          *service_handle);
+                  return service->validate(thd, password);
+                });
+          },
+          [] { return false; }, count))
+    return true;
   return count != 0;
 }
 
@@ -112,22 +282,30 @@ DEFINE_BOOL_METHOD(Password_validation::validate,
 DEFINE_BOOL_METHOD(Password_validation::get_strength,
                    (void *thd, my_h_string password, unsigned int *strength)) {
   *strength = 0;
-  Breach_checker breach_checker(password);
-  long long count = breach_checker.check();
-  if (count == 0) *strength = 100;
-
-  if (count == 0) {
-    if (service_broadcast::broadcast([&thd, &password, &strength](
-                                         const my_h_service *service_handle) {
-          auto service = reinterpret_cast<SERVICE_TYPE(validate_password) *>(
-              *service_handle);
-          unsigned int auto_strength = 0;
-          if (service->get_strength(thd, password, &auto_strength)) return true;
-          *strength = std::min(*strength, auto_strength);
-          return false;
-        }))
-      return true;
-  }
+  long long count = MAX_RETVAL;
+  unsigned int other_strength = 100;
+  if (check_password(
+          thd, password,
+          [&thd, &password,
+           &other_strength](const std::atomic<bool> &breached) {
+            return service_broadcast::broadcast(
+                [&thd, &password, &other_strength,
+                 &breached](const my_h_service *service_handle) {
+                  /* Strength is 0 anyway */
+                  if (breached) return false;
+                  auto service =
+                      reinterpret_cast<SERVICE_TYPE(validate_password) *>(
+                          *service_handle);
+                  unsigned int auto_strength = 0;
+                  if (service->get_strength(thd, password, &auto_strength))
+                    return true;
+                  other_strength = std::min(other_strength, auto_strength);
+                  return false;
+                });
+          },
+          [&other_strength] { return other_strength == 0; }, count))
+    return true;
+  if (count == 0) *strength = other_strength;
   return false;
 }
 
@@ -176,6 +354,10 @@ void Password_validation::password_breach_check_deinit(UDF_INIT *initid
 /**
   Main function for password_breach_check
 
+  An invalid argument is an error, so that the result is NULL. A password
+  that could not be checked returns MAX_RETVAL without error, so that one
+  failed row does not abort a query over many.
+
   @param [in]  initid   Unused
   @param [in]  args     UDF arguments
   @param [out] is_null  Flag indicating whether output is null or not
@@ -189,17 +371,300 @@ long long Password_validation::password_breach_check(
   *is_null = 0;
   long long count = MAX_RETVAL;
   if (!args->args[0]) {
-    raise_error(
+    log_message(
         "Provide an non-empty password value to password_breach_check "
         "function.",
-        ERROR_LEVEL);
+        Log_level::ERROR);
     return count;
   }
 
-  Breach_checker breach_checker(args->args[0]);
+  if (args->lengths[0] >= SECURE_BUFFER_SIZE) {
+    log_message(
+        "Password given to password_breach_check function is too long.",
+        Log_level::ERROR);
+    return count;
+  }
+
+  /* Arguments are not NUL terminated. Copied to be locked and wiped. */
+  Secure_buffer buffer;
+  memcpy(buffer.data(), args->args[0], args->lengths[0]);
+  buffer.data()[args->lengths[0]] = '\0';
+
+  Breach_checker breach_checker(buffer.data(), Request_class::BATCH);
   count = breach_checker.check();
   *error = 0;
   return count;
 }
 
+/**
+  Init function for password_breach_check_file
+
+  @param [in, out] initid  Structure to hold data to be passed to main
+  function
+  @param [in]      args    Argument metadata
+  @param [out]     message Buffer to store error message
+
+  @returns Status of checks
+    @retval true  Error
+    @retval false Success
+*/
+bool Password_validation::password_breach_check_file_init(UDF_INIT *initid,
+                                                          UDF_ARGS *args,
+                                                          char *message) {
+  initid->ptr = nullptr;
+
+  if (args->arg_count != 1 || args->arg_type[0] != STRING_RESULT) {
+    sprintf(message,
+            "Mismatch in expected arguments to the function. Expected 1 "
+            "argument of string type for file name.");
+    return true;
+  }
+
+  if (config.audit_dir.empty()) {
+    sprintf(message,
+            "password_breach_check.audit_dir is not set. Set it to the "
+            "directory from which files may be audited.");
+    return true;
+  }
+
+  /* The server reads and hashes the file, so not every caller may */
+  if (!has_global_grant(AUDIT_PRIVILEGE)) {
+    sprintf(message,
+            "Access denied; you need the %s privilege for this operation.",
+            AUDIT_PRIVILEGE);
+    return true;
+  }
+
+  initid->maybe_null = false;
+  initid->const_item = false;
+  initid->max_length = 255;
+  return false;
+}
+
+/** Deinit function for password_breach_check_file - Nothing to see here */
+void Password_validation::password_breach_check_file_deinit(
+    UDF_INIT *initid [[maybe_unused]]) {
+  return;
+}
+
+/**
+  Main function for password_breach_check_file
+
+  Audits a file from password_breach_check.audit_dir holding a password or
+  a SHA1 hex digest per line. Callers need the PASSWORD_BREACH_CHECK_AUDIT
+  privilege, checked in init.
+
+  @param [in]  initid   Unused
+  @param [in]  args     UDF arguments
+  @param [out] result   Buffer for JSON object with counts
+  @param [out] length   Length of result
+  @param [out] is_null  Flag indicating whether output is null or not
+  @param [out] error    Flag indicating error
+
+  @returns result
+*/
+char *Password_validation::password_breach_check_file(
+    UDF_INIT *initid [[maybe_unused]], UDF_ARGS *args, char *result,
+    unsigned long *length, unsigned char *is_null, unsigned char *error) {
+  *error = 1;
+  *is_null = 0;
+  *length = 0;
+  if (!args->args[0]) {
+    log_message(
+        "Provide a file name to password_breach_check_file function.",
+        Log_level::ERROR);
+    return result;
+  }
+
+  Audit_summary summary;
+  std::string message;
+  if (File_audit::run(config.audit_dir,
+                      std::string(args->args[0], args->lengths[0]), summary,
+                      message)) {
+    log_message(message.c_str(), Log_level::ERROR);
+    return result;
+  }
+
+  int written = snprintf(
+      result, 255,
+      "{\"lines\": %llu, \"digests\": %llu, \"checked\": %llu, "
+      "\"breached\": %llu, \"occurrences\": %llu, \"errors\": %llu}",
+      static_cast<unsigned long long>(summary.lines),
+      static_cast<unsigned long long>(summary.digests),
+      static_cast<unsigned long long>(summary.checked),
+      static_cast<unsigned long long>(summary.breached),
+      static_cast<unsigned long long>(summary.occurrences),
+      static_cast<unsigned long long>(summary.errors));
+  *length = static_cast<unsigned long>(std::min(written, 254));
+  *error = 0;
+  return result;
+}
+
+/**
+  Init function for password_breach_check_sha1
+
+  @param [in, out] initid  Structure to hold data to be passed to main
+  function
+  @param [in]      args    Argument metadata
+  @param [out]     message Buffer to store error message
+
+  @returns Status of checks
+    @retval true  Error
+    @retval false Success
+*/
+bool Password_validation::password_breach_check_sha1_init(UDF_INIT *initid,
+                                                          UDF_ARGS *args,
+                                                          char *message) {
+  initid->ptr = nullptr;
+
+  if (args->arg_count != 1 || args->arg_type[0] != STRING_RESULT) {
+    sprintf(message,
+            "Mismatch in expected arguments to the function. Expected 1 "
+            "argument of string type for SHA1 digest.");
+    return true;
+  }
+
+  initid->maybe_null = false;
+  return false;
+}
+
+/**
+  Main function for password_breach_check_sha1
+
+  Checks a SHA1 digest given as 40 hex characters (e.g. SHA1(...)) or as
+  20 bytes (e.g. UNHEX(SHA1(...))), so that no plaintext passes through
+  SQL and no hashing is done per row. As for password_breach_check, an
+  invalid argument is an error and a failed lookup returns MAX_RETVAL.
+
+  @param [in]  initid   Unused
+  @param [in]  args     UDF arguments
+  @param [out] is_null  Flag indicating whether output is null or not
+  @param [out] error    Flag indicating error
+*/
+long long Password_validation::password_breach_check_sha1(
+    UDF_INIT *initid [[maybe_unused]], UDF_ARGS *args, unsigned char *is_null,
+    unsigned char *error) {
+  *error = 1;
+  *is_null = 0;
+  std::string sha1_digest;
+  if (!args->args[0] ||
+      parse_sha1_digest(args->args[0], args->lengths[0], true, sha1_digest)) {
+    log_message(
+        "Provide a SHA1 digest as 40 hex characters or 20 bytes to "
+        "password_breach_check_sha1 function.",
+        Log_level::ERROR);
+    return MAX_RETVAL;
+  }
+
+  Breach_checker breach_checker("", Request_class::BATCH);
+  long long count = breach_checker.check_digest(sha1_digest);
+  *error = 0;
+  return count;
+}
+
+/**
+  Init function for password_breach_check_prefix
+
+  @param [in, out] initid  Structure to hold data to be passed to main
+  function
+  @param [in]      args    Argument metadata
+  @param [out]     message Buffer to store error message
+
+  @returns Status of checks
+    @retval true  Error
+    @retval false Success
+*/
+bool Password_validation::password_breach_check_prefix_init(UDF_INIT *initid,
+                                                            UDF_ARGS *args,
+                                                            char *message) {
+  initid->ptr = nullptr;
+
+  if (args->arg_count != 1 || args->arg_type[0] != STRING_RESULT) {
+    sprintf(message,
+            "Mismatch in expected arguments to the function. Expected 1 "
+            "argument of string type for SHA1 prefix.");
+    return true;
+  }
+
+  /* Result is built here, as it exceeds the buffer the server provides */
+  initid->ptr = reinterpret_cast<char *>(new (std::nothrow) std::string);
+  if (initid->ptr == nullptr) {
+    sprintf(message, "Failed to allocate memory for the result.");
+    return true;
+  }
+  initid->maybe_null = false;
+  initid->const_item = false;
+  initid->max_length = 1U << 24;
+  return false;
+}
+
+/** Deinit function for password_breach_check_prefix */
+void Password_validation::password_breach_check_prefix_deinit(
+    UDF_INIT *initid) {
+  delete reinterpret_cast<std::string *>(initid->ptr);
+  initid->ptr = nullptr;
+}
+
+/**
+  Main function for password_breach_check_prefix
+
+  Returns the range of a 5 character SHA1 prefix as a JSON object mapping
+  each 35 character suffix to its count, so that the full digest never
+  leaves the caller. Padding entries with a count of 0 are left out.
+
+  @param [in]  initid   Holds the result buffer
+  @param [in]  args     UDF arguments
+  @param [out] result   Unused, result exceeds it
+  @param [out] length   Length of result
+  @param [out] is_null  Flag indicating whether output is null or not
+  @param [out] error    Flag indicating error
+
+  @returns result
+*/
+char *Password_validation::password_breach_check_prefix(
+    UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+    unsigned char *is_null, unsigned char *error) {
+  *error = 1;
+  *is_null = 0;
+  *length = 0;
+  uint32_t prefix = 0;
+  if (!args->args[0] ||
+      parse_range_prefix(std::string_view(args->args[0], args->lengths[0]),
+                         prefix)) {
+    log_message(
+        "Provide a SHA1 prefix of 5 hex characters to "
+        "password_breach_check_prefix function.",
+        Log_level::ERROR);
+    return result;
+  }
+
+  std::string body;
+  std::vector<Range_entry> entries;
+  Breach_checker breach_checker("", Request_class::BATCH);
+  if (breach_checker.range(format_range_prefix(prefix), body) ||
+      parse_range_entries(body, entries)) {
+    log_message("Failed to get password breach data for the prefix.",
+                Log_level::ERROR);
+    return result;
+  }
+
+  auto &json = *reinterpret_cast<std::string *>(initid->ptr);
+  json.clear();
+  json.reserve(entries.size() * (RANGE_SUFFIX_LENGTH + 12) + 2);
+  json += '{';
+  for (const auto &entry : entries) {
+    if (entry.count == 0) continue;
+    char suffix[RANGE_SUFFIX_LENGTH];
+    format_range_suffix(entry.suffix, suffix);
+    json += json.length() > 1 ? ", \"" : "\"";
+    json.append(suffix, RANGE_SUFFIX_LENGTH);
+    json += "\": ";
+    json += std::to_string(entry.count);
+  }
+  json += '}';
+  *length = json.length();
+  *error = 0;
+  return &json[0];
+}
+
 }  // namespace password_breach_check
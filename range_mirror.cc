@@ -0,0 +1,726 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+/*
+  password_breach_check_range_mirror
+
+  Serves https://api.pwnedpasswords.com/range/ compatible responses from a
+  local range pack. Intended to run once per host so that every mysqld
+  instance on the host can point password_breach_check.url at it.
+
+  Usage:
+    Build a pack from a directory of <prefix>.txt files or from a single
+    sorted <sha1>:<count> file (as produced by PwnedPasswordsDownloader):
+      password_breach_check_range_mirror --build <source> --pack <file>
+
+    Serve a pack:
+      password_breach_check_range_mirror --pack <file>
+          [--listen <address>:<port>] [--socket <path>] [--threads <n>]
+*/
+
+#include <algorithm>     /* std::max */
+#include <atomic>        /* std::atomic */
+#include <cerrno>        /* errno */
+#include <csignal>       /* signal */
+#include <cstdlib>       /* strtol */
+#include <cstring>       /* strerror */
+#include <fstream>       /* std::ifstream */
+#include <iostream>      /* std::cerr */
+#include <memory>        /* std::unique_ptr */
+#include <string>        /* std::string */
+#include <thread>        /* std::thread */
+#include <unordered_map> /* std::unordered_map */
+#include <vector>        /* std::vector */
+
+#include <arpa/inet.h>    /* inet_pton */
+#include <dirent.h>       /* opendir */
+#include <netinet/in.h>   /* sockaddr_in */
+#include <netinet/tcp.h>  /* TCP_NODELAY */
+#include <sys/epoll.h>    /* epoll_* */
+#include <sys/sendfile.h> /* sendfile */
+#include <sys/socket.h>   /* socket */
+#include <sys/stat.h>     /* stat */
+#include <sys/un.h>       /* sockaddr_un */
+#include <unistd.h>       /* close */
+
+#include "range_pack.h"
+
+using namespace password_breach_check;
+
+namespace {
+
+/** Largest request header block accepted */
+const size_t MAX_REQUEST_SIZE = 8192;
+
+/** Events handled per epoll_wait() call */
+const int MAX_EVENTS = 256;
+
+/** Interval(in milliseconds) at which workers check for shutdown */
+const int POLL_INTERVAL = 500;
+
+const char *RESPONSE_BAD_REQUEST =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 42\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "The hash prefix was not in a valid format";
+
+/* Prefixes missing from the pack have no breached passwords */
+const char *RESPONSE_EMPTY_RANGE =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+const char *RESPONSE_NOT_FOUND =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+const char *RESPONSE_NOT_ALLOWED =
+    "HTTP/1.1 405 Method Not Allowed\r\n"
+    "Allow: GET\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+const char *RESPONSE_TOO_LARGE =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+std::atomic<bool> shutdown_requested{false};
+
+void handle_signal(int) { shutdown_requested = true; }
+
+/** Server settings */
+struct Options {
+  std::string pack;
+  std::string build;
+  std::string listen{"127.0.0.1:8080"};
+  std::string socket;
+  unsigned int threads{0};
+};
+
+/** Per connection state */
+struct Connection {
+  /* Unparsed input */
+  std::string in;
+  /* Response built for this request, e.g. 304 with its ETag */
+  std::string out;
+  /* Static response being sent, if any */
+  const char *static_response{nullptr};
+  size_t static_remaining{0};
+  /* Pack response being sent, if any */
+  off_t file_offset{0};
+  size_t file_remaining{0};
+  /* Close once the pending response is sent */
+  bool close_after{false};
+
+  bool sending() const { return static_remaining > 0 || file_remaining > 0; }
+};
+
+/**
+  Parse a decimal number in a range
+
+  @returns status of the operation
+    @retval true  Not a number, or out of range
+    @retval false Success
+*/
+bool parse_number(const std::string &text, long min, long max, long &value) {
+  if (text.empty()) return true;
+  char *end = nullptr;
+  errno = 0;
+  value = strtol(text.c_str(), &end, 10);
+  return errno != 0 || *end != '\0' || value < min || value > max;
+}
+
+/**
+  Split <address>:<port>
+
+  @returns status of the operation
+    @retval true  Malformed
+    @retval false Success
+*/
+bool parse_listen(const std::string &listen, std::string &address,
+                  int &port) {
+  auto colon = listen.rfind(':');
+  long value = 0;
+  if (colon == std::string::npos ||
+      parse_number(listen.substr(colon + 1), 1, 65535, value))
+    return true;
+  address = listen.substr(0, colon);
+  port = static_cast<int>(value);
+  return false;
+}
+
+int open_tcp_listener(const std::string &listen) {
+  std::string address;
+  int port = 0;
+  if (parse_listen(listen, address, port)) return -1;
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  /* Each worker binds its own listener. Kernel balances between them. */
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+      bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int open_unix_listener(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.length() >= sizeof(addr.sun_path)) return -1;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  /* mysqld usually runs as a different user */
+  chmod(path.c_str(), 0666);
+  return fd;
+}
+
+bool header_equals(std::string_view headers, std::string_view name,
+                   std::string_view value) {
+  auto lower = [](char c) { return (c >= 'A' && c <= 'Z') ? c + 32 : c; };
+  size_t start = 0;
+  while (start < headers.length()) {
+    auto end = headers.find("\r\n", start);
+    if (end == std::string_view::npos) end = headers.length();
+    auto line = headers.substr(start, end - start);
+    start = end + 2;
+    auto colon = line.find(':');
+    if (colon != name.length()) continue;
+    bool match = true;
+    for (size_t i = 0; i < name.length() && match; ++i)
+      match = lower(line[i]) == lower(name[i]);
+    if (!match) continue;
+    auto field = line.substr(colon + 1);
+    while (!field.empty() && (field.front() == ' ' || field.front() == '\t'))
+      field.remove_prefix(1);
+    if (field.length() != value.length()) continue;
+    for (size_t i = 0; i < value.length() && match; ++i)
+      match = lower(field[i]) == lower(value[i]);
+    if (match) return true;
+  }
+  return false;
+}
+
+/** One epoll loop serving its share of the connections */
+class Worker {
+ public:
+  Worker(const Range_pack &pack, int tcp_fd, int unix_fd)
+      : pack_(pack), tcp_fd_(tcp_fd), unix_fd_(unix_fd) {}
+
+  ~Worker() {
+    for (auto &connection : connections_) close(connection.first);
+    if (tcp_fd_ >= 0) close(tcp_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+  }
+
+  bool init() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) return true;
+    if (tcp_fd_ >= 0 && watch(tcp_fd_, EPOLLIN)) return true;
+    /* Unix listener is shared. Wake a single worker per connection. */
+    if (unix_fd_ >= 0 && watch(unix_fd_, EPOLLIN | EPOLLEXCLUSIVE))
+      return true;
+    return false;
+  }
+
+  void run() {
+    epoll_event events[MAX_EVENTS];
+    while (!shutdown_requested) {
+      int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, POLL_INTERVAL);
+      for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == tcp_fd_ || fd == unix_fd_) {
+          accept_all(fd, fd == tcp_fd_);
+          continue;
+        }
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) continue;
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0 ||
+            serve(fd, it->second, events[i].events))
+          drop(fd);
+      }
+    }
+  }
+
+ private:
+  bool watch(int fd, uint32_t events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0;
+  }
+
+  void rewatch(int fd, uint32_t events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+  }
+
+  void drop(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    connections_.erase(fd);
+    close(fd);
+  }
+
+  void accept_all(int listen_fd, bool tcp) {
+    while (true) {
+      int fd = accept4(listen_fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+      if (tcp) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+      if (watch(fd, EPOLLIN | EPOLLRDHUP)) {
+        close(fd);
+        continue;
+      }
+      connections_.emplace(fd, Connection{});
+    }
+  }
+
+  /**
+    Make progress on a connection
+
+    @returns true if the connection should be closed
+  */
+  bool serve(int fd, Connection &connection, uint32_t events) {
+    if ((events & EPOLLIN) != 0 && !connection.sending()) {
+      char buffer[4096];
+      while (true) {
+        auto n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+          connection.in.append(buffer, static_cast<size_t>(n));
+          if (connection.in.length() > 4 * MAX_REQUEST_SIZE) break;
+          continue;
+        }
+        if (n == 0) {
+          /* Peer closed. Answer what is buffered, then close. */
+          connection.close_after = true;
+          break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return true;
+      }
+    }
+
+    /* Serve pipelined requests until one blocks on the socket */
+    while (true) {
+      if (connection.sending()) {
+        if (send_pending(fd, connection)) return true;
+        if (connection.sending()) {
+          rewatch(fd, EPOLLOUT | EPOLLRDHUP);
+          return false;
+        }
+      }
+      if (connection.close_after && connection.in.empty()) return true;
+      if (!next_request(connection)) break;
+    }
+
+    if (connection.close_after) return true;
+    rewatch(fd, EPOLLIN | EPOLLRDHUP);
+    return false;
+  }
+
+  /**
+    Parse one request from the input buffer and queue its response
+
+    @returns true if a response was queued
+  */
+  bool next_request(Connection &connection) {
+    auto end = connection.in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      if (connection.in.length() > MAX_REQUEST_SIZE) {
+        queue_static(connection, RESPONSE_TOO_LARGE);
+        connection.close_after = true;
+        connection.in.clear();
+        return true;
+      }
+      return false;
+    }
+
+    std::string_view request(connection.in.data(), end);
+    auto line_end = request.find("\r\n");
+    auto line = request.substr(0, line_end);
+    auto headers = line_end == std::string_view::npos
+                       ? std::string_view{}
+                       : request.substr(line_end + 2);
+
+    auto method_end = line.find(' ');
+    auto target_end = line.rfind(' ');
+    if (method_end == std::string_view::npos || target_end <= method_end) {
+      queue_static(connection, RESPONSE_BAD_REQUEST);
+      connection.close_after = true;
+    } else {
+      auto method = line.substr(0, method_end);
+      auto target = line.substr(method_end + 1, target_end - method_end - 1);
+      auto version = line.substr(target_end + 1);
+
+      bool keep_alive = version == "HTTP/1.1"
+                            ? !header_equals(headers, "Connection", "close")
+                            : header_equals(headers, "Connection",
+                                            "keep-alive");
+      connection.close_after = !keep_alive;
+
+      static const std::string_view RANGE_PATH{"/range/"};
+      uint32_t prefix = 0;
+      if (method != "GET") {
+        queue_static(connection, RESPONSE_NOT_ALLOWED);
+        connection.close_after = true;
+      } else if (target.substr(0, RANGE_PATH.length()) != RANGE_PATH) {
+        queue_static(connection, RESPONSE_NOT_FOUND);
+      } else if (parse_range_prefix(
+                     target.substr(RANGE_PATH.length(),
+                                   target.find('?') - RANGE_PATH.length()),
+                     prefix)) {
+        queue_static(connection, RESPONSE_BAD_REQUEST);
+        connection.close_after = true;
+      } else {
+        uint64_t offset = 0;
+        uint32_t length = 0;
+        auto etag = pack_.etag(prefix);
+        if (!pack_.response(prefix, offset, length)) {
+          /* A 404 would be retried by the component */
+          queue_static(connection, RESPONSE_EMPTY_RANGE);
+        } else if (!etag.empty() &&
+                   header_equals(headers, "If-None-Match", etag)) {
+          connection.out.assign("HTTP/1.1 304 Not Modified\r\nETag: ");
+          connection.out.append(etag.data(), etag.length());
+          connection.out.append("\r\n\r\n");
+          queue_static(connection, connection.out.c_str());
+        } else {
+          connection.file_offset = static_cast<off_t>(offset);
+          connection.file_remaining = length;
+        }
+      }
+    }
+    connection.in.erase(0, end + 4);
+    return true;
+  }
+
+  void queue_static(Connection &connection, const char *response) {
+    connection.static_response = response;
+    connection.static_remaining = strlen(response);
+  }
+
+  /**
+    Push pending response to the socket
+
+    @returns true on socket error
+  */
+  bool send_pending(int fd, Connection &connection) {
+    while (connection.static_remaining > 0) {
+      auto n = send(fd, connection.static_response,
+                    connection.static_remaining, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return errno != EAGAIN && errno != EWOULDBLOCK;
+      }
+      connection.static_response += n;
+      connection.static_remaining -= static_cast<size_t>(n);
+    }
+    while (connection.file_remaining > 0) {
+      auto n = sendfile(fd, pack_.fd(), &connection.file_offset,
+                        connection.file_remaining);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return errno != EAGAIN && errno != EWOULDBLOCK;
+      }
+      if (n == 0) return true;
+      connection.file_remaining -= static_cast<size_t>(n);
+    }
+    return false;
+  }
+
+ private:
+  const Range_pack &pack_;
+  int tcp_fd_;
+  int unix_fd_;
+  int epoll_fd_{-1};
+  std::unordered_map<int, Connection> connections_;
+};
+
+bool read_file(const std::string &path, std::string &out) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return true;
+  out.assign(std::istreambuf_iterator<char>(file),
+             std::istreambuf_iterator<char>());
+  return false;
+}
+
+/** Build a pack from a directory with one <prefix>[.txt] file per prefix */
+bool build_from_directory(const std::string &source, Range_pack_writer &writer,
+                          uint32_t &missing) {
+  std::vector<std::string> files(RANGE_PREFIX_COUNT);
+  DIR *dir = opendir(source.c_str());
+  if (dir == nullptr) return true;
+  while (auto entry = readdir(dir)) {
+    std::string_view name(entry->d_name);
+    uint32_t prefix = 0;
+    if (parse_range_prefix(name.substr(0, RANGE_PREFIX_LENGTH), prefix))
+      continue;
+    if (name.length() != RANGE_PREFIX_LENGTH && name.substr(5) != ".txt")
+      continue;
+    files[prefix] = source + "/" + entry->d_name;
+  }
+  closedir(dir);
+
+  std::string raw, body;
+  for (uint32_t prefix = 0; prefix < RANGE_PREFIX_COUNT; ++prefix) {
+    if (files[prefix].empty()) {
+      ++missing;
+      continue;
+    }
+    if (read_file(files[prefix], raw)) {
+      std::cerr << "Failed to read " << files[prefix] << std::endl;
+      return true;
+    }
+    if (normalize_range_body(raw, body)) {
+      std::cerr << "Malformed range data in " << files[prefix] << std::endl;
+      return true;
+    }
+    if (writer.add(prefix, body)) return true;
+  }
+  return false;
+}
+
+/** Build a pack from a single <sha1>:<count> file sorted by hash */
+bool build_from_file(const std::string &source, Range_pack_writer &writer,
+                     uint32_t &missing) {
+  std::ifstream file(source);
+  if (!file) return true;
+
+  std::string line, raw, body;
+  uint32_t current = RANGE_PREFIX_COUNT;
+  uint32_t expected = 0;
+  auto flush = [&]() {
+    if (current == RANGE_PREFIX_COUNT) return false;
+    if (normalize_range_body(raw, body)) {
+      std::cerr << "Malformed range data for prefix "
+                << format_range_prefix(current) << std::endl;
+      return true;
+    }
+    raw.clear();
+    return writer.add(current, body);
+  };
+
+  while (std::getline(file, line)) {
+    if (line.empty() || line == "\r") continue;
+    uint32_t prefix = 0;
+    if (parse_range_prefix(std::string_view(line).substr(0, 5), prefix)) {
+      std::cerr << "Malformed line: " << line << std::endl;
+      return true;
+    }
+    if (prefix != current) {
+      if (flush()) return true;
+      if (prefix < expected) {
+        std::cerr << "Input is not sorted by hash" << std::endl;
+        return true;
+      }
+      missing += prefix - expected;
+      expected = prefix + 1;
+      current = prefix;
+    }
+    raw.append(line).push_back('\n');
+  }
+  if (flush()) return true;
+  missing += RANGE_PREFIX_COUNT - expected;
+  return false;
+}
+
+int build(const Options &options) {
+  Range_pack_writer writer;
+  if (writer.open(options.pack)) {
+    std::cerr << writer.last_error() << std::endl;
+    return 1;
+  }
+
+  struct stat st;
+  if (stat(options.build.c_str(), &st) != 0) {
+    std::cerr << "Failed to stat " << options.build << ": " << strerror(errno)
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t missing = 0;
+  bool error = S_ISDIR(st.st_mode)
+                   ? build_from_directory(options.build, writer, missing)
+                   : build_from_file(options.build, writer, missing);
+  if (error || writer.finish()) {
+    if (!writer.last_error().empty()) std::cerr << writer.last_error();
+    std::cerr << "Failed to build range pack from " << options.build
+              << std::endl;
+    return 1;
+  }
+  if (missing > 0)
+    std::cerr << "Warning: no data for " << missing
+              << " prefixes. Those will be answered with empty ranges."
+              << std::endl;
+  return 0;
+}
+
+int serve(const Options &options) {
+  Range_pack pack;
+  if (pack.open(options.pack)) {
+    std::cerr << pack.last_error() << std::endl;
+    return 1;
+  }
+
+  int unix_fd = -1;
+  if (!options.socket.empty()) {
+    unix_fd = open_unix_listener(options.socket);
+    if (unix_fd < 0) {
+      std::cerr << "Failed to listen on " << options.socket << ": "
+                << strerror(errno) << std::endl;
+      return 1;
+    }
+  }
+
+  unsigned int threads = options.threads;
+  if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (unsigned int i = 0; i < threads; ++i) {
+    int tcp_fd = -1;
+    if (!options.listen.empty()) {
+      tcp_fd = open_tcp_listener(options.listen);
+      if (tcp_fd < 0) {
+        std::cerr << "Failed to listen on " << options.listen << ": "
+                  << strerror(errno) << std::endl;
+        return 1;
+      }
+    }
+    workers.emplace_back(new Worker(pack, tcp_fd, unix_fd));
+    if (workers.back()->init()) {
+      std::cerr << "Failed to initialize worker: " << strerror(errno)
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<std::thread> running;
+  for (auto &worker : workers)
+    running.emplace_back([&worker]() { worker->run(); });
+  for (auto &thread : running) thread.join();
+
+  workers.clear();
+  if (unix_fd >= 0) {
+    close(unix_fd);
+    unlink(options.socket.c_str());
+  }
+  return 0;
+}
+
+void usage(const char *program) {
+  std::cerr
+      << "Usage:\n"
+      << "  " << program << " --build <directory|file> --pack <file>\n"
+      << "  " << program
+      << " --pack <file> [--listen <address>:<port>] [--socket <path>]"
+         " [--threads <n>]\n"
+      << "\n"
+      << "  --listen   TCP address to serve on (default 127.0.0.1:8080)."
+         " Empty to disable.\n"
+      << "  --socket   Unix domain socket to serve on.\n"
+      << "  --threads  Number of worker threads, at most 1024 (default:"
+         " number of CPUs).\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    std::string value(argv[++i]);
+    if (arg == "--pack")
+      options.pack = value;
+    else if (arg == "--build")
+      options.build = value;
+    else if (arg == "--listen")
+      options.listen = value;
+    else if (arg == "--socket")
+      options.socket = value;
+    else if (arg == "--threads") {
+      long threads = 0;
+      if (parse_number(value, 0, 1024, threads)) {
+        std::cerr << "Invalid --threads: " << value << std::endl;
+        usage(argv[0]);
+        return 1;
+      }
+      options.threads = static_cast<unsigned int>(threads);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  std::string address;
+  int port = 0;
+  if (!options.listen.empty() && parse_listen(options.listen, address, port)) {
+    std::cerr << "Invalid --listen: " << options.listen << std::endl;
+    usage(argv[0]);
+    return 1;
+  }
+  if (options.pack.empty() ||
+      (options.listen.empty() && options.socket.empty())) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!options.build.empty()) return build(options);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  return serve(options);
+}
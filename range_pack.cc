@@ -0,0 +1,434 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "range_pack.h"
+
+#include <algorithm> /* std::lower_bound, std::sort */
+#include <cerrno>   /* errno */
+#include <cstdio>   /* snprintf, std::rename */
+#include <cstring>  /* memcpy, strerror */
+#include <ctime>    /* time */
+
+#include <fcntl.h>    /* open */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* close, pwrite */
+
+namespace password_breach_check {
+
+/** Magic identifying a range pack */
+static const char PACK_MAGIC[8] = {'P', 'B', 'C', 'R', 'A', 'N', 'G', 'E'};
+
+/** Current pack version */
+static const uint32_t PACK_VERSION = 1;
+
+/** Size of the header and index preceding the responses */
+static const uint64_t PACK_DATA_OFFSET =
+    sizeof(Range_pack_header) +
+    sizeof(Range_pack_entry) * static_cast<uint64_t>(RANGE_PREFIX_COUNT);
+
+/** Header naming the ETag in pre-rendered responses */
+static const std::string_view ETAG_HEADER{"\r\nETag: "};
+
+/** FNV-1a hash of a body, from which its ETag is made */
+static uint64_t body_hash(std::string_view body) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto c : body) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+bool parse_range_prefix(std::string_view text, uint32_t &prefix) {
+  if (text.length() != RANGE_PREFIX_LENGTH) return true;
+  uint32_t value = 0;
+  for (auto c : text) {
+    int nibble = hex_value(c);
+    if (nibble < 0) return true;
+    value = (value << 4) | static_cast<uint32_t>(nibble);
+  }
+  prefix = value;
+  return false;
+}
+
+std::string format_range_prefix(uint32_t prefix) {
+  char buffer[8];
+  snprintf(buffer, sizeof(buffer), "%05X", prefix & (RANGE_PREFIX_COUNT - 1));
+  return std::string(buffer, RANGE_PREFIX_LENGTH);
+}
+
+bool parse_range_suffix(std::string_view text, uint8_t *suffix) {
+  if (text.length() != RANGE_SUFFIX_LENGTH) return true;
+  for (size_t i = 0; i < RANGE_SUFFIX_BYTES; ++i) {
+    int high = hex_value(text[2 * i]);
+    int low = 2 * i + 1 < text.length() ? hex_value(text[2 * i + 1]) : 0;
+    if (high < 0 || low < 0) return true;
+    suffix[i] = static_cast<uint8_t>((high << 4) | low);
+  }
+  return false;
+}
+
+void format_range_suffix(const uint8_t *suffix, char *text) {
+  static const char HEX[] = "0123456789ABCDEF";
+  for (size_t i = 0; i < RANGE_SUFFIX_LENGTH; ++i)
+    text[i] = HEX[i % 2 == 0 ? suffix[i / 2] >> 4 : suffix[i / 2] & 0x0F];
+}
+
+long long range_body_count(std::string_view body, std::string_view suffix) {
+  /*
+    Entries are in following format
+
+    <sha1_hash_suffix_1>:count_1\r\n
+    <sha1_hash_suffix_2>:count_2\r\n
+    ...
+    <sha1_hash_suffix_n>:count_n
+  */
+  size_t pos = body.find(suffix);
+  while (pos != std::string_view::npos &&
+         ((pos != 0 && body[pos - 1] != '\n') ||
+          pos + suffix.length() >= body.length() ||
+          body[pos + suffix.length()] != ':'))
+    pos = body.find(suffix, pos + 1);
+  if (pos == std::string_view::npos) return 0;
+
+  long long count = 0;
+  for (pos += suffix.length() + 1;
+       pos < body.length() && body[pos] >= '0' && body[pos] <= '9'; ++pos)
+    count = count * 10 + (body[pos] - '0');
+  return count;
+}
+
+bool parse_range_entries(std::string_view body,
+                         std::vector<Range_entry> &entries) {
+  entries.clear();
+  entries.reserve(body.length() / 40 + 1);
+  size_t start = 0;
+  while (start < body.length()) {
+    auto end = body.find("\r\n", start);
+    if (end == std::string_view::npos) end = body.length();
+    auto line = body.substr(start, end - start);
+    start = end + 2;
+    if (line.length() < RANGE_SUFFIX_LENGTH + 2 ||
+        line[RANGE_SUFFIX_LENGTH] != ':')
+      return true;
+    Range_entry entry{};
+    if (parse_range_suffix(line.substr(0, RANGE_SUFFIX_LENGTH), entry.suffix))
+      return true;
+    uint64_t count = 0;
+    for (auto c : line.substr(RANGE_SUFFIX_LENGTH + 1)) {
+      if (c < '0' || c > '9') return true;
+      count = std::min<uint64_t>(count * 10 + (c - '0'), UINT32_MAX);
+    }
+    entry.count = static_cast<uint32_t>(count);
+    entries.push_back(entry);
+  }
+  /* Ranges come sorted, but local stores rely on it */
+  std::sort(entries.begin(), entries.end(),
+            [](const Range_entry &a, const Range_entry &b) {
+              return memcmp(a.suffix, b.suffix, RANGE_SUFFIX_BYTES) < 0;
+            });
+  return false;
+}
+
+long long find_range_entry(const Range_entry *first, size_t length,
+                           const uint8_t *suffix) {
+  auto last = first + length;
+  auto found = std::lower_bound(
+      first, last, suffix, [](const Range_entry &entry, const uint8_t *value) {
+        return memcmp(entry.suffix, value, RANGE_SUFFIX_BYTES) < 0;
+      });
+  if (found != last && memcmp(found->suffix, suffix, RANGE_SUFFIX_BYTES) == 0)
+    return found->count;
+  return 0;
+}
+
+bool normalize_range_body(std::string_view in, std::string &out) {
+  out.clear();
+  out.reserve(in.length() + in.length() / 32);
+  size_t start = 0;
+  while (start < in.length()) {
+    size_t end = in.find('\n', start);
+    if (end == std::string_view::npos) end = in.length();
+    auto line = in.substr(start, end - start);
+    start = end + 1;
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty()) continue;
+
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon + 1 == line.length())
+      return true;
+    auto hash = line.substr(0, colon);
+    auto count = line.substr(colon + 1);
+    /* Full digest as found in the downloadable dataset */
+    if (hash.length() == RANGE_SUFFIX_LENGTH + RANGE_PREFIX_LENGTH)
+      hash.remove_prefix(RANGE_PREFIX_LENGTH);
+    if (hash.length() != RANGE_SUFFIX_LENGTH) return true;
+    for (auto c : hash)
+      if (hex_value(c) < 0) return true;
+    for (auto c : count)
+      if (c < '0' || c > '9') return true;
+
+    if (!out.empty()) out.append("\r\n");
+    for (auto c : hash) out.push_back((c >= 'a' && c <= 'f') ? c - 32 : c);
+    out.push_back(':');
+    out.append(count);
+  }
+  return false;
+}
+
+/****************************************************************************/
+
+Range_pack::~Range_pack() { close(); }
+
+bool Range_pack::fail(const std::string &message) {
+  error_ = message;
+  close();
+  return true;
+}
+
+/**
+  Map a range pack
+
+  @param [in] path  Location of the pack
+
+  @returns status of the operation
+    @retval true  Failure. See last_error()
+    @retval false Success
+*/
+bool Range_pack::open(const std::string &path) {
+  close();
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) return fail("Failed to open " + path + ": " + strerror(errno));
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0)
+    return fail("Failed to stat " + path + ": " + strerror(errno));
+  if (static_cast<uint64_t>(st.st_size) < PACK_DATA_OFFSET)
+    return fail(path + " is too small to be a range pack");
+
+  size_ = static_cast<size_t>(st.st_size);
+  void *base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (base == MAP_FAILED) {
+    base_ = nullptr;
+    return fail("Failed to map " + path + ": " + strerror(errno));
+  }
+  base_ = static_cast<const char *>(base);
+
+  auto header = reinterpret_cast<const Range_pack_header *>(base_);
+  if (memcmp(header->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 ||
+      header->version != PACK_VERSION ||
+      header->prefix_bits != RANGE_PREFIX_BITS)
+    return fail(path + " is not a supported range pack");
+
+  entries_ = reinterpret_cast<const Range_pack_entry *>(base_ +
+                                                        sizeof(*header));
+  for (uint32_t i = 0; i < RANGE_PREFIX_COUNT; ++i) {
+    const auto &entry = entries_[i];
+    if (entry.length == 0) continue;
+    if (entry.offset < PACK_DATA_OFFSET || entry.offset > size_ ||
+        entry.length > size_ - entry.offset ||
+        entry.header_length > entry.length)
+      return fail(path + " has an index entry out of bounds for prefix " +
+                  format_range_prefix(i));
+  }
+
+  /* Index is hot, responses are touched at random */
+  madvise(const_cast<char *>(base_), PACK_DATA_OFFSET, MADV_WILLNEED);
+  madvise(const_cast<char *>(base_) + PACK_DATA_OFFSET,
+          size_ - PACK_DATA_OFFSET, MADV_RANDOM);
+  return false;
+}
+
+void Range_pack::close() {
+  if (base_ != nullptr) munmap(const_cast<char *>(base_), size_);
+  if (fd_ >= 0) ::close(fd_);
+  base_ = nullptr;
+  entries_ = nullptr;
+  size_ = 0;
+  fd_ = -1;
+}
+
+uint64_t Range_pack::created() const {
+  if (base_ == nullptr) return 0;
+  return reinterpret_cast<const Range_pack_header *>(base_)->created;
+}
+
+bool Range_pack::response(uint32_t prefix, uint64_t &offset,
+                          uint32_t &length) const {
+  if (entries_ == nullptr || prefix >= RANGE_PREFIX_COUNT) return false;
+  const auto &entry = entries_[prefix];
+  if (entry.length == 0) return false;
+  offset = entry.offset;
+  length = entry.length;
+  return true;
+}
+
+std::string_view Range_pack::body(uint32_t prefix) const {
+  if (entries_ == nullptr || prefix >= RANGE_PREFIX_COUNT) return {};
+  const auto &entry = entries_[prefix];
+  if (entry.length == 0) return {};
+  return std::string_view(base_ + entry.offset + entry.header_length,
+                          entry.length - entry.header_length);
+}
+
+std::string_view Range_pack::etag(uint32_t prefix) const {
+  if (entries_ == nullptr || prefix >= RANGE_PREFIX_COUNT) return {};
+  const auto &entry = entries_[prefix];
+  if (entry.length == 0) return {};
+  std::string_view headers(base_ + entry.offset, entry.header_length);
+  auto start = headers.find(ETAG_HEADER);
+  if (start == std::string_view::npos) return {};
+  start += ETAG_HEADER.length();
+  auto end = headers.find("\r\n", start);
+  if (end == std::string_view::npos) return {};
+  return headers.substr(start, end - start);
+}
+
+/****************************************************************************/
+
+Range_pack_writer::~Range_pack_writer() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    unlink(temp_path_.c_str());
+  }
+}
+
+bool Range_pack_writer::fail(const std::string &message) {
+  error_ = message;
+  return true;
+}
+
+static bool write_fully(int fd, const char *data, size_t length,
+                        uint64_t offset) {
+  while (length > 0) {
+    auto written = pwrite(fd, data, length, static_cast<off_t>(offset));
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return true;
+    }
+    data += written;
+    length -= static_cast<size_t>(written);
+    offset += static_cast<uint64_t>(written);
+  }
+  return false;
+}
+
+/**
+  Start writing a range pack
+
+  @param [in] path  Final location of the pack
+
+  @returns status of the operation
+    @retval true  Failure. See last_error()
+    @retval false Success
+*/
+bool Range_pack_writer::open(const std::string &path) {
+  path_ = path;
+  temp_path_ = path + ".tmp";
+  fd_ = ::open(temp_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0644);
+  if (fd_ < 0)
+    return fail("Failed to create " + temp_path_ + ": " + strerror(errno));
+  entries_.assign(RANGE_PREFIX_COUNT, Range_pack_entry{0, 0, 0});
+  offset_ = PACK_DATA_OFFSET;
+  populated_ = 0;
+  return false;
+}
+
+bool Range_pack_writer::add(uint32_t prefix, std::string_view body) {
+  if (fd_ < 0) return fail("Range pack is not open for writing");
+  if (prefix >= RANGE_PREFIX_COUNT) return fail("Prefix out of range");
+  if (entries_[prefix].length != 0)
+    return fail("Duplicate data for prefix " + format_range_prefix(prefix));
+
+  char header[160];
+  int header_length = snprintf(header, sizeof(header),
+                               "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain\r\n"
+                               "Content-Length: %zu\r\n"
+                               "ETag: \"%016llx\"\r\n"
+                               "\r\n",
+                               body.length(),
+                               static_cast<unsigned long long>(
+                                   body_hash(body)));
+  if (static_cast<uint64_t>(header_length) + body.length() > UINT32_MAX)
+    return fail("Response too large for prefix " +
+                format_range_prefix(prefix));
+
+  if (write_fully(fd_, header, static_cast<size_t>(header_length), offset_) ||
+      write_fully(fd_, body.data(), body.length(), offset_ + header_length))
+    return fail("Failed to write " + temp_path_ + ": " + strerror(errno));
+
+  auto &entry = entries_[prefix];
+  entry.offset = offset_;
+  entry.header_length = static_cast<uint32_t>(header_length);
+  entry.length = static_cast<uint32_t>(header_length + body.length());
+  offset_ += entry.length;
+  ++populated_;
+  return false;
+}
+
+/**
+  Write the index and publish the pack
+
+  @returns status of the operation
+    @retval true  Failure. See last_error()
+    @retval false Success
+*/
+bool Range_pack_writer::finish() {
+  if (fd_ < 0) return fail("Range pack is not open for writing");
+
+  Range_pack_header header{};
+  memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+  header.version = PACK_VERSION;
+  header.prefix_bits = RANGE_PREFIX_BITS;
+  header.created = static_cast<uint64_t>(time(nullptr));
+  header.populated = populated_;
+
+  if (write_fully(fd_, reinterpret_cast<const char *>(&header), sizeof(header),
+                  0) ||
+      write_fully(fd_, reinterpret_cast<const char *>(entries_.data()),
+                  entries_.size() * sizeof(Range_pack_entry),
+                  sizeof(header)) ||
+      fsync(fd_) != 0)
+    return fail("Failed to write " + temp_path_ + ": " + strerror(errno));
+
+  ::close(fd_);
+  fd_ = -1;
+  if (std::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+    auto message = "Failed to rename " + temp_path_ + " to " + path_ + ": " +
+                   strerror(errno);
+    unlink(temp_path_.c_str());
+    return fail(message);
+  }
+  return false;
+}
+
+}  // namespace password_breach_check
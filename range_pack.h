@@ -0,0 +1,284 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#ifndef RANGE_PACK_H_INCLUDED
+#define RANGE_PACK_H_INCLUDED
+
+#include <cstddef> /* size_t */
+#include <cstdint> /* uint*_t */
+#include <string>  /* std::string */
+#include <string_view> /* std::string_view */
+#include <vector>  /* std::vector */
+
+namespace password_breach_check {
+
+/** Number of bits in a range prefix (5 hex characters) */
+const unsigned int RANGE_PREFIX_BITS = 20;
+
+/** Number of distinct range prefixes: 00000 - FFFFF */
+const uint32_t RANGE_PREFIX_COUNT = 1U << RANGE_PREFIX_BITS;
+
+/** Length of a range prefix in hex characters */
+const size_t RANGE_PREFIX_LENGTH = 5;
+
+/**
+  Parse a 5 character hex prefix
+
+  @param [in]  text    Prefix text, case insensitive
+  @param [out] prefix  Numeric value of the prefix
+
+  @returns status of the operation
+    @retval true  Not a valid prefix
+    @retval false Success
+*/
+bool parse_range_prefix(std::string_view text, uint32_t &prefix);
+
+/** Format a numeric prefix as 5 uppercase hex characters */
+std::string format_range_prefix(uint32_t prefix);
+
+/** Length of a range suffix in hex characters */
+const size_t RANGE_SUFFIX_LENGTH = 35;
+
+/** Bytes needed to hold a range suffix in binary. Last nibble is zero. */
+const size_t RANGE_SUFFIX_BYTES = 18;
+
+/**
+  Convert a 35 character hex suffix to binary
+
+  @param [in]  text    Suffix text, case insensitive
+  @param [out] suffix  RANGE_SUFFIX_BYTES bytes
+
+  @returns status of the operation
+    @retval true  Not a valid suffix
+    @retval false Success
+*/
+bool parse_range_suffix(std::string_view text, uint8_t *suffix);
+
+/**
+  Convert a binary suffix to 35 uppercase hex characters
+
+  @param [in]  suffix  RANGE_SUFFIX_BYTES bytes
+  @param [out] text    RANGE_SUFFIX_LENGTH characters, not terminated
+*/
+void format_range_suffix(const uint8_t *suffix, char *text);
+
+/** Binary form of a range line, used by local stores */
+struct Range_entry {
+  uint8_t suffix[RANGE_SUFFIX_BYTES];
+  uint8_t reserved[2];
+  uint32_t count;
+};
+
+static_assert(sizeof(Range_entry) == 24, "Unexpected range entry size");
+
+/**
+  Convert range data in wire format to entries sorted by suffix
+
+  @param [in]  body     <suffix>:<count> lines separated by CRLF
+  @param [out] entries  Parsed entries
+
+  @returns status of the operation
+    @retval true  Malformed input
+    @retval false Success
+*/
+bool parse_range_entries(std::string_view body,
+                         std::vector<Range_entry> &entries);
+
+/**
+  Find count for a suffix in entries sorted by suffix
+
+  @param [in] first   First entry
+  @param [in] length  Number of entries
+  @param [in] suffix  RANGE_SUFFIX_BYTES bytes
+
+  @returns Number of times the suffix appears in breaches, 0 if not listed
+*/
+long long find_range_entry(const Range_entry *first, size_t length,
+                           const uint8_t *suffix);
+
+/**
+  Find count for a suffix in range data in wire format
+
+  @param [in] body    <suffix>:<count> lines separated by CRLF
+  @param [in] suffix  35 character uppercase hex suffix
+
+  @returns Number of times the suffix appears in breaches, 0 if not listed
+*/
+long long range_body_count(std::string_view body, std::string_view suffix);
+
+/**
+  On-disk layout of a range pack
+
+  A range pack holds one pre-rendered HTTP/1.1 response per prefix, laid out
+  so that a response can be handed to sendfile() as-is:
+
+  +---------------------+
+  | Range_pack_header   |
+  +---------------------+
+  | Range_pack_entry    |  x RANGE_PREFIX_COUNT, indexed by prefix
+  +---------------------+
+  | response for 00000  |  status line + headers + body
+  | response for 00001  |
+  | ...                 |
+  +---------------------+
+
+  Body is exactly what https://api.pwnedpasswords.com/range/ returns:
+  <suffix>:<count> lines separated by CRLF, no CRLF after the last line.
+  Headers carry an ETag derived from the body, so that clients can
+  revalidate. Packs built before ETags were added have none.
+*/
+struct Range_pack_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t prefix_bits;
+  /* Unix time when the pack was written */
+  uint64_t created;
+  /* Number of prefixes with a response */
+  uint64_t populated;
+  uint64_t reserved[4];
+};
+
+struct Range_pack_entry {
+  /* Offset of the response from the start of the file */
+  uint64_t offset;
+  /* Length of the response including status line and headers. 0 if absent */
+  uint32_t length;
+  /* Length of status line and headers. Body starts at offset + this */
+  uint32_t header_length;
+};
+
+static_assert(sizeof(Range_pack_header) == 64, "Unexpected header size");
+static_assert(sizeof(Range_pack_entry) == 16, "Unexpected entry size");
+
+/** Read-only, memory-mapped view of a range pack */
+class Range_pack {
+ public:
+  Range_pack() = default;
+  ~Range_pack();
+
+  Range_pack(const Range_pack &) = delete;
+  Range_pack &operator=(const Range_pack &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+
+  bool is_open() const { return base_ != nullptr; }
+
+  /** File descriptor backing the pack, usable with sendfile() */
+  int fd() const { return fd_; }
+
+  /** Creation time recorded in the pack */
+  uint64_t created() const;
+
+  /**
+    Locate the pre-rendered response for a prefix
+
+    @param [in]  prefix  Numeric prefix
+    @param [out] offset  File offset of the response
+    @param [out] length  Length of the response
+
+    @returns true if the pack has a response for the prefix
+  */
+  bool response(uint32_t prefix, uint64_t &offset, uint32_t &length) const;
+
+  /** Body of the response for a prefix, empty if absent */
+  std::string_view body(uint32_t prefix) const;
+
+  /** Quoted ETag of the response for a prefix, empty if absent */
+  std::string_view etag(uint32_t prefix) const;
+
+  const std::string &last_error() const { return error_; }
+
+ private:
+  bool fail(const std::string &message);
+
+ private:
+  int fd_{-1};
+  const char *base_{nullptr};
+  size_t size_{0};
+  const Range_pack_entry *entries_{nullptr};
+  std::string error_;
+};
+
+/**
+  Writes a range pack
+
+  Responses are appended in the order they are added. The pack is written
+  to a temporary file and renamed into place by finish(), so readers either
+  see the previous pack or the complete new one.
+*/
+class Range_pack_writer {
+ public:
+  Range_pack_writer() = default;
+  ~Range_pack_writer();
+
+  Range_pack_writer(const Range_pack_writer &) = delete;
+  Range_pack_writer &operator=(const Range_pack_writer &) = delete;
+
+  bool open(const std::string &path);
+
+  /**
+    Add body of a range response
+
+    @param [in] prefix  Numeric prefix
+    @param [in] body    <suffix>:<count> lines separated by CRLF
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool add(uint32_t prefix, std::string_view body);
+
+  bool finish();
+
+  const std::string &last_error() const { return error_; }
+
+ private:
+  bool fail(const std::string &message);
+
+ private:
+  std::string path_;
+  std::string temp_path_;
+  int fd_{-1};
+  uint64_t offset_{0};
+  uint64_t populated_{0};
+  std::vector<Range_pack_entry> entries_;
+  std::string error_;
+};
+
+/**
+  Normalize range data to the wire format
+
+  Accepts <suffix>:<count> lines separated by LF or CRLF. Lines that carry
+  the full 40 character digest are reduced to the 35 character suffix.
+
+  @param [in]  in   Raw text
+  @param [out] out  Lines separated by CRLF, without trailing CRLF
+
+  @returns status of the operation
+    @retval true  Malformed input
+    @retval false Success
+*/
+bool normalize_range_body(std::string_view in, std::string &out);
+
+}  // namespace password_breach_check
+#endif /* RANGE_PACK_H_INCLUDED */
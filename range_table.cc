@@ -0,0 +1,235 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "password_breach_check.h"
+
+#include <string_view> /* std::string_view */
+#include <vector>      /* std::vector */
+
+#include "range_pack.h" /* Range_entry */
+
+namespace password_breach_check {
+
+/** HA_READ_KEY_EXACT of enum ha_rkey_function */
+static const int READ_KEY_EXACT = 0;
+
+/** Prefix value meaning no range is loaded */
+static const uint32_t NO_PREFIX = RANGE_PREFIX_COUNT;
+
+/**
+  Cursor over the table. Holds the range of the prefix looked up last,
+  decoded once into binary rows, so that a join looking up the same prefix
+  for many rows fetches and parses it once.
+*/
+struct Range_table_handle {
+  /* Row being read. The server saves and restores it for rnd_pos. */
+  size_t position{0};
+  size_t next_position{0};
+  /* Key of the last index lookup */
+  char key_buffer[64];
+  PSI_plugin_key_string key{};
+  /* Prefix the rows belong to */
+  uint32_t prefix{NO_PREFIX};
+  char prefix_text[RANGE_PREFIX_LENGTH];
+  std::vector<Range_entry> rows;
+};
+
+static PSI_table_handle *open_table(PSI_pos **pos) {
+  auto handle = new Range_table_handle();
+  handle->key.m_name = "PREFIX";
+  handle->key.m_value_buffer = handle->key_buffer;
+  handle->key.m_value_buffer_capacity = sizeof(handle->key_buffer);
+  *pos = reinterpret_cast<PSI_pos *>(&handle->position);
+  return reinterpret_cast<PSI_table_handle *>(handle);
+}
+
+static void close_table(PSI_table_handle *handle) {
+  delete reinterpret_cast<Range_table_handle *>(handle);
+}
+
+/** Scans would have to fetch every range: only lookups by PREFIX give rows */
+static int rnd_init(PSI_table_handle *h, bool) {
+  auto handle = reinterpret_cast<Range_table_handle *>(h);
+  handle->position = handle->next_position = handle->rows.size();
+  return 0;
+}
+
+static int rnd_next(PSI_table_handle *) { return PFS_HA_ERR_END_OF_FILE; }
+
+static int rnd_pos(PSI_table_handle *h) {
+  auto handle = reinterpret_cast<Range_table_handle *>(h);
+  return handle->position < handle->rows.size() ? 0 : PFS_HA_ERR_END_OF_FILE;
+}
+
+static int index_init(PSI_table_handle *h, unsigned int idx, bool,
+                      PSI_index_handle **index) {
+  if (idx != 0) return PFS_HA_ERR_WRONG_COMMAND;
+  *index = reinterpret_cast<PSI_index_handle *>(h);
+  return 0;
+}
+
+/**
+  Load the range of the prefix in the key, unless already loaded
+
+  Only equality lookups are served; others find no rows.
+*/
+static int index_read(PSI_index_handle *index, PSI_key_reader *reader,
+                      unsigned int, int find_flag) {
+  auto handle = reinterpret_cast<Range_table_handle *>(index);
+  handle->key.m_value_buffer_length = 0;
+  mysql_service_pfs_plugin_column_string_v2->read_key_string(
+      reader, &handle->key, find_flag);
+
+  uint32_t prefix = NO_PREFIX;
+  if (find_flag != READ_KEY_EXACT || handle->key.m_is_null ||
+      parse_range_prefix(std::string_view(handle->key.m_value_buffer,
+                                          handle->key.m_value_buffer_length),
+                         prefix)) {
+    handle->prefix = NO_PREFIX;
+    handle->rows.clear();
+  } else if (prefix != handle->prefix) {
+    std::string body;
+    handle->prefix = NO_PREFIX;
+    handle->rows.clear();
+    auto text = format_range_prefix(prefix);
+    Breach_checker breach_checker("", Request_class::BATCH);
+    if (breach_checker.range(text, body) ||
+        parse_range_entries(body, handle->rows)) {
+      handle->rows.clear();
+      log_message("Failed to get password breach data for SHA1 prefix '" +
+                      text + "'.",
+                  Log_level::ERROR);
+    } else {
+      handle->prefix = prefix;
+      text.copy(handle->prefix_text, RANGE_PREFIX_LENGTH);
+    }
+  }
+  handle->position = handle->next_position = 0;
+  return 0;
+}
+
+/** Next row of the range, skipping padding entries */
+static int index_next(PSI_table_handle *h) {
+  auto handle = reinterpret_cast<Range_table_handle *>(h);
+  for (handle->position = handle->next_position;
+       handle->position < handle->rows.size(); ++handle->position) {
+    if (handle->rows[handle->position].count == 0) continue;
+    handle->next_position = handle->position + 1;
+    return 0;
+  }
+  return PFS_HA_ERR_END_OF_FILE;
+}
+
+static void reset_position(PSI_table_handle *h) {
+  auto handle = reinterpret_cast<Range_table_handle *>(h);
+  handle->position = handle->next_position = 0;
+}
+
+static int read_column_value(PSI_table_handle *h, PSI_field *field,
+                             unsigned int index) {
+  auto handle = reinterpret_cast<Range_table_handle *>(h);
+  auto &row = handle->rows[handle->position];
+  switch (index) {
+    case 0:
+      mysql_service_pfs_plugin_column_string_v2->set_char_utf8mb4(
+          field, handle->prefix_text, RANGE_PREFIX_LENGTH);
+      break;
+    case 1: {
+      char suffix[RANGE_SUFFIX_LENGTH];
+      format_range_suffix(row.suffix, suffix);
+      mysql_service_pfs_plugin_column_string_v2->set_char_utf8mb4(
+          field, suffix, RANGE_SUFFIX_LENGTH);
+      break;
+    }
+    case 2:
+      mysql_service_pfs_plugin_column_bigint_v1->set_unsigned(
+          field, PSI_ulonglong{row.count, false});
+      break;
+    default:
+      return PFS_HA_ERR_WRONG_COMMAND;
+  }
+  return 0;
+}
+
+/** Estimate, so that lookups by PREFIX are preferred over scans */
+static unsigned long long get_row_count() { return RANGE_PREFIX_COUNT; }
+
+static PFS_engine_table_share_proxy range_share = [] {
+  PFS_engine_table_share_proxy share{};
+  share.m_table_name = "password_breach_range";
+  share.m_table_name_length = sizeof("password_breach_range") - 1;
+  share.m_table_definition =
+      "PREFIX CHAR(5) NOT NULL, "
+      "SUFFIX CHAR(35) NOT NULL, "
+      "COUNT BIGINT UNSIGNED NOT NULL, "
+      "KEY (PREFIX)";
+  share.m_ref_length = sizeof(Range_table_handle::position);
+  share.m_acl = READONLY;
+  share.delete_all_rows = nullptr;
+  share.get_row_count = get_row_count;
+  share.m_proxy_engine_table = {rnd_next,   rnd_init,   rnd_pos,
+                                index_init, index_read, index_next,
+                                read_column_value, reset_position,
+                                nullptr,    nullptr,    nullptr,
+                                nullptr,    nullptr,    open_table,
+                                close_table};
+  return share;
+}();
+
+static PFS_engine_table_share_proxy *shares[] = {&range_share};
+
+/**
+  Add performance_schema.password_breach_range
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Range_table::register_table() {
+  if (mysql_service_pfs_plugin_table_v1->add_tables(shares, 1) != 0) {
+    raise_error("Failed to add performance_schema.password_breach_range "
+                "table.",
+                ERROR_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+/**
+  Remove performance_schema.password_breach_range
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Range_table::unregister_table() {
+  if (mysql_service_pfs_plugin_table_v1->delete_tables(shares, 1) != 0) {
+    raise_error("Failed to remove performance_schema.password_breach_range "
+                "table.",
+                WARNING_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace password_breach_check
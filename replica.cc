@@ -0,0 +1,517 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "replica.h"
+
+#include <algorithm> /* std::sort */
+#include <cerrno>  /* errno */
+#include <chrono>  /* std::chrono */
+#include <cstdio>  /* snprintf, std::rename */
+#include <cstring> /* memcpy, strerror */
+#include <ctime>   /* time */
+#include <fstream> /* std::ifstream, std::ofstream */
+#include <memory>  /* std::unique_ptr */
+#include <sstream> /* std::stringstream */
+#include <vector>  /* std::vector */
+
+#include <dirent.h>       /* opendir */
+#include <fcntl.h>        /* open */
+#include <sys/mman.h>     /* mmap */
+#include <sys/resource.h> /* setpriority */
+#include <sys/stat.h>     /* fstat */
+#include <sys/syscall.h>  /* SYS_gettid */
+#include <unistd.h>       /* pwrite */
+
+#include "breach_checker.h"
+
+namespace password_breach_check {
+
+/** Magic identifying a replica generation */
+static const char REPLICA_MAGIC[8] = {'P', 'B', 'C', 'R', 'E', 'P', 'L', '1'};
+
+/** Current replica layout version */
+static const uint32_t REPLICA_VERSION = 1;
+
+/** Prefixes crawled between two checkpoints */
+static const uint32_t CHECKPOINT_INTERVAL = 256;
+
+/** Wait time(in seconds) before retrying a prefix that could not be fetched */
+static const unsigned int RETRY_WAIT = 60;
+
+/** Number of reader slots used for epoch tracking */
+static const size_t EPOCH_SLOTS = 64;
+
+struct Replica_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t prefix_bits;
+  uint64_t generation;
+  /* Unix time when the pass that produced this generation completed */
+  uint64_t created;
+  /* 1 once all buckets are written */
+  uint64_t complete;
+  /* Total number of entries */
+  uint64_t entries;
+  uint64_t reserved[2];
+};
+
+struct Replica_bucket {
+  /* Offset of first entry from the start of the file */
+  uint64_t offset;
+  /* Number of entries */
+  uint32_t count;
+  uint32_t reserved;
+  /* ETag of the range when it was fetched, NUL padded */
+  char etag[48];
+};
+
+static_assert(sizeof(Replica_header) == 64, "Unexpected header size");
+static_assert(sizeof(Replica_bucket) == 64, "Unexpected bucket size");
+
+/** Offset of the first entry in a generation file */
+static const uint64_t REPLICA_DATA_OFFSET =
+    sizeof(Replica_header) +
+    sizeof(Replica_bucket) * static_cast<uint64_t>(RANGE_PREFIX_COUNT);
+
+/** A complete, memory-mapped generation */
+struct Range_replica::Generation {
+  uint64_t number{0};
+  std::string path;
+  int fd{-1};
+  const char *base{nullptr};
+  size_t size{0};
+  const Replica_bucket *buckets{nullptr};
+
+  ~Generation() {
+    if (base != nullptr) munmap(const_cast<char *>(base), size);
+    if (fd >= 0) close(fd);
+  }
+
+  const Range_entry *entries(uint32_t prefix, uint32_t &count) const {
+    const auto &bucket = buckets[prefix];
+    count = bucket.count;
+    return reinterpret_cast<const Range_entry *>(base + bucket.offset);
+  }
+
+  /** Map a generation file. Returns nullptr if it is not complete. */
+  static Generation *open(const std::string &path) {
+    std::unique_ptr<Generation> generation(new Generation());
+    generation->path = path;
+    generation->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (generation->fd < 0 || fstat(generation->fd, &st) != 0 ||
+        static_cast<uint64_t>(st.st_size) < REPLICA_DATA_OFFSET)
+      return nullptr;
+
+    generation->size = static_cast<size_t>(st.st_size);
+    void *base = mmap(nullptr, generation->size, PROT_READ, MAP_SHARED,
+                      generation->fd, 0);
+    if (base == MAP_FAILED) return nullptr;
+    generation->base = static_cast<const char *>(base);
+
+    auto header = reinterpret_cast<const Replica_header *>(generation->base);
+    if (memcmp(header->magic, REPLICA_MAGIC, sizeof(REPLICA_MAGIC)) != 0 ||
+        header->version != REPLICA_VERSION ||
+        header->prefix_bits != RANGE_PREFIX_BITS || header->complete != 1)
+      return nullptr;
+    generation->number = header->generation;
+    generation->buckets = reinterpret_cast<const Replica_bucket *>(
+        generation->base + sizeof(Replica_header));
+
+    for (uint32_t i = 0; i < RANGE_PREFIX_COUNT; ++i) {
+      const auto &bucket = generation->buckets[i];
+      if (bucket.offset < REPLICA_DATA_OFFSET ||
+          bucket.offset > generation->size ||
+          static_cast<uint64_t>(bucket.count) * sizeof(Range_entry) >
+              generation->size - bucket.offset)
+        return nullptr;
+    }
+
+    madvise(const_cast<char *>(generation->base) + REPLICA_DATA_OFFSET,
+            generation->size - REPLICA_DATA_OFFSET, MADV_RANDOM);
+    return generation.release();
+  }
+};
+
+/**
+  Epoch based protection of published generations
+
+  A reader registers in the slot picked by its thread under the parity of
+  the global epoch it observed, then loads the generation pointer. After
+  swapping the pointer the writer advances the epoch and waits until no
+  reader remains registered under the previous parity, twice, as in
+  userspace RCU. A single flip is not enough: a reader that observed the
+  old parity may register only after the wait for it ended, and load the
+  new generation under a parity the next publish() would not wait for.
+  Draining both parities covers every reader that started before the
+  swap, whichever parity it registered under.
+*/
+struct alignas(64) Epoch_slot {
+  std::atomic<uint64_t> active[2];
+};
+
+static std::atomic<uint64_t> global_epoch{0};
+static Epoch_slot epoch_slots[EPOCH_SLOTS];
+
+class Epoch_guard {
+ public:
+  Epoch_guard()
+      : slot_(epoch_slots[std::hash<std::thread::id>{}(
+                              std::this_thread::get_id()) %
+                          EPOCH_SLOTS]),
+        parity_(global_epoch.load() & 1) {
+    slot_.active[parity_].fetch_add(1);
+  }
+
+  ~Epoch_guard() {
+    slot_.active[parity_].fetch_sub(1, std::memory_order_release);
+  }
+
+ private:
+  Epoch_slot &slot_;
+  uint64_t parity_;
+};
+
+/** Wait until readers that could have seen the previous pointer are gone */
+static void synchronize_epoch() {
+  static std::mutex writer_mutex;
+  std::lock_guard<std::mutex> lock(writer_mutex);
+  for (int phase = 0; phase < 2; ++phase) {
+    auto parity = global_epoch.fetch_add(1) & 1;
+    for (auto &slot : epoch_slots)
+      while (slot.active[parity].load(std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+  }
+}
+
+Range_replica &Range_replica::instance() {
+  static Range_replica replica;
+  return replica;
+}
+
+Range_replica::~Range_replica() { stop(); }
+
+std::string Range_replica::generation_path(uint64_t generation,
+                                           bool partial) const {
+  char name[64];
+  snprintf(name, sizeof(name), "/replica-%llu.dat%s",
+           static_cast<unsigned long long>(generation),
+           partial ? ".partial" : "");
+  return directory_ + name;
+}
+
+bool Range_replica::start(const std::string &directory, unsigned int rate) {
+  stop();
+  directory_ = directory;
+  rate_ = rate > 0 ? rate : 1;
+
+  /* Publish the newest complete generation, if any */
+  DIR *dir = opendir(directory_.c_str());
+  if (dir == nullptr) {
+    std::stringstream error_message;
+    error_message << "Replica directory '" << directory_
+                  << "' does not exist. Replica is disabled.";
+    log_message(error_message.str(), Log_level::ERROR);
+    directory_.clear();
+    return true;
+  }
+  std::vector<uint64_t> found;
+  std::vector<uint64_t> partial;
+  while (auto entry = readdir(dir)) {
+    unsigned long long number = 0;
+    char tail[16] = {0};
+    if (sscanf(entry->d_name, "replica-%llu.%15s", &number, tail) != 2)
+      continue;
+    if (strcmp(tail, "dat") == 0)
+      found.push_back(number);
+    else if (strcmp(tail, "dat.partial") == 0)
+      partial.push_back(number);
+  }
+  closedir(dir);
+  std::sort(found.rbegin(), found.rend());
+  for (auto number : found) {
+    auto generation = Generation::open(generation_path(number, false));
+    if (generation == nullptr) continue;
+    current_.store(generation);
+    break;
+  }
+
+  /*
+    The crawler only resumes the generation after the published one. Other
+    partial generations were abandoned by a crash or by a newer generation
+    being published, and would otherwise stay on disk forever.
+  */
+  auto current = current_.load();
+  uint64_t resumed = current != nullptr ? current->number + 1 : 1;
+  for (auto number : partial)
+    if (number != resumed) unlink(generation_path(number, true).c_str());
+
+  stop_ = false;
+  crawler_ = std::thread(&Range_replica::crawl, this);
+  return false;
+}
+
+void Range_replica::stop() {
+  if (crawler_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    crawler_.join();
+  }
+  auto generation = current_.exchange(nullptr);
+  if (generation != nullptr) {
+    synchronize_epoch();
+    delete generation;
+  }
+}
+
+bool Range_replica::lookup(uint32_t prefix, std::string_view suffix,
+                           long long &count) const {
+  if (prefix >= RANGE_PREFIX_COUNT) return false;
+  uint8_t key[RANGE_SUFFIX_BYTES];
+  if (parse_range_suffix(suffix, key)) return false;
+
+  Epoch_guard guard;
+  auto generation = current_.load(std::memory_order_acquire);
+  if (generation == nullptr) return false;
+  uint32_t length = 0;
+  auto entries = generation->entries(prefix, length);
+  count = find_range_entry(entries, length, key);
+  return true;
+}
+
+void Range_replica::publish(Generation *generation) {
+  auto previous = current_.exchange(generation);
+  if (previous == nullptr) return;
+  synchronize_epoch();
+  unlink(previous->path.c_str());
+  delete previous;
+}
+
+/**
+  Wait for the next request slot
+
+  @returns true if crawler is asked to stop
+*/
+bool Range_replica::throttle() {
+  using clock = std::chrono::steady_clock;
+  static thread_local clock::time_point next = clock::now();
+  auto now = clock::now();
+  if (next < now) next = now;
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (cv_.wait_until(lock, next, [this] { return stop_; })) return true;
+  next += std::chrono::microseconds(1000000 / rate_);
+  return false;
+}
+
+bool Range_replica::save_checkpoint(uint64_t generation, uint32_t next) {
+  auto path = directory_ + "/replica.checkpoint";
+  {
+    std::ofstream file(path + ".tmp", std::ios::trunc);
+    file << generation << " " << next << "\n";
+    if (!file.flush()) return true;
+  }
+  return std::rename((path + ".tmp").c_str(), path.c_str()) != 0;
+}
+
+bool Range_replica::load_checkpoint(uint64_t &generation, uint32_t &next) {
+  std::ifstream file(directory_ + "/replica.checkpoint");
+  unsigned long long number = 0;
+  unsigned long position = 0;
+  if (!(file >> number >> position) || position > RANGE_PREFIX_COUNT)
+    return true;
+  generation = number;
+  next = static_cast<uint32_t>(position);
+  return false;
+}
+
+/** Crawler thread */
+void Range_replica::crawl() {
+#ifdef __linux__
+  /* Stay out of the way of session threads */
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif /* __linux__ */
+
+  auto current = current_.load();
+  uint64_t generation = current != nullptr ? current->number + 1 : 1;
+  uint32_t next = 0;
+
+  uint64_t checkpoint_generation = 0;
+  uint32_t checkpoint_next = 0;
+  if (!load_checkpoint(checkpoint_generation, checkpoint_next) &&
+      checkpoint_generation == generation &&
+      access(generation_path(generation, true).c_str(), F_OK) == 0)
+    next = checkpoint_next;
+
+  while (!crawl_pass(generation, next)) {
+    ++generation;
+    next = 0;
+  }
+}
+
+/**
+  Crawl all prefixes from next onwards into a generation and publish it
+
+  @returns true if crawler is asked to stop or cannot continue
+*/
+bool Range_replica::crawl_pass(uint64_t generation, uint32_t next) {
+  std::stringstream error_message;
+  auto partial_path = generation_path(generation, true);
+  int fd = open(partial_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+  if (fd < 0) {
+    error_message << "Failed to create replica generation '" << partial_path
+                  << "': " << strerror(errno);
+    log_message(error_message.str(), Log_level::ERROR);
+    return true;
+  }
+  auto fd_cleanup = [&fd]() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  };
+
+  /* Find where data of the prefixes crawled so far ends */
+  uint64_t data_offset = REPLICA_DATA_OFFSET;
+  uint64_t total = 0;
+  if (next == 0) {
+    if (ftruncate(fd, 0) != 0 ||
+        ftruncate(fd, static_cast<off_t>(REPLICA_DATA_OFFSET)) != 0) {
+      fd_cleanup();
+      return true;
+    }
+  } else {
+    std::vector<Replica_bucket> buckets(next);
+    auto length = buckets.size() * sizeof(Replica_bucket);
+    if (pread(fd, buckets.data(), length, sizeof(Replica_header)) !=
+        static_cast<ssize_t>(length)) {
+      next = 0;
+      buckets.clear();
+    }
+    for (const auto &bucket : buckets) {
+      data_offset = std::max<uint64_t>(
+          data_offset, bucket.offset + bucket.count * sizeof(Range_entry));
+      total += bucket.count;
+    }
+  }
+
+  /* Only this thread replaces the published generation */
+  const Generation *base = current_.load();
+  Breach_checker fetcher("", Request_class::BATCH);
+  std::vector<Range_entry> entries;
+
+  for (uint32_t prefix = next; prefix < RANGE_PREFIX_COUNT; ++prefix) {
+    const Replica_bucket *previous =
+        base != nullptr ? &base->buckets[prefix] : nullptr;
+    Cached_range range{};
+
+    while (true) {
+      if (throttle()) {
+        fd_cleanup();
+        return true;
+      }
+      range.body.clear();
+      range.etag.clear();
+      if (previous != nullptr && previous->etag[0] != '\0')
+        range.etag.assign(previous->etag,
+                          strnlen(previous->etag, sizeof(previous->etag)));
+
+      if (!fetcher.password_breach_data(format_range_prefix(prefix), range,
+                                        fetcher.fetch_deadline())) {
+        if (range.not_modified && previous != nullptr) {
+          /* Not modified. Carry the bucket over. */
+          uint32_t count = 0;
+          auto first = base->entries(prefix, count);
+          entries.assign(first, first + count);
+          break;
+        }
+        if (!parse_range_entries(range.body, entries)) break;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (cv_.wait_for(lock, std::chrono::seconds(RETRY_WAIT),
+                       [this] { return stop_; })) {
+        fd_cleanup();
+        return true;
+      }
+    }
+
+    Replica_bucket bucket{};
+    bucket.offset = data_offset;
+    bucket.count = static_cast<uint32_t>(entries.size());
+    if (range.etag.length() < sizeof(bucket.etag))
+      memcpy(bucket.etag, range.etag.data(), range.etag.length());
+
+    auto length = entries.size() * sizeof(Range_entry);
+    if (pwrite(fd, entries.data(), length, static_cast<off_t>(data_offset)) !=
+            static_cast<ssize_t>(length) ||
+        pwrite(fd, &bucket, sizeof(bucket),
+               static_cast<off_t>(sizeof(Replica_header) +
+                                  prefix * sizeof(Replica_bucket))) !=
+            static_cast<ssize_t>(sizeof(bucket))) {
+      error_message << "Failed to write replica generation '" << partial_path
+                    << "': " << strerror(errno);
+      log_message(error_message.str(), Log_level::ERROR);
+      fd_cleanup();
+      return true;
+    }
+    data_offset += length;
+    total += entries.size();
+
+    if ((prefix + 1) % CHECKPOINT_INTERVAL == 0 && fdatasync(fd) == 0)
+      save_checkpoint(generation, prefix + 1);
+  }
+
+  /* Seal the generation and publish it */
+  Replica_header header{};
+  memcpy(header.magic, REPLICA_MAGIC, sizeof(REPLICA_MAGIC));
+  header.version = REPLICA_VERSION;
+  header.prefix_bits = RANGE_PREFIX_BITS;
+  header.generation = generation;
+  header.created = static_cast<uint64_t>(time(nullptr));
+  header.complete = 1;
+  header.entries = total;
+  auto final_path = generation_path(generation, false);
+  if (pwrite(fd, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      fsync(fd) != 0 ||
+      std::rename(partial_path.c_str(), final_path.c_str()) != 0) {
+    error_message << "Failed to complete replica generation '" << final_path
+                  << "': " << strerror(errno);
+    log_message(error_message.str(), Log_level::ERROR);
+    fd_cleanup();
+    return true;
+  }
+  fd_cleanup();
+  unlink((directory_ + "/replica.checkpoint").c_str());
+
+  auto published = Generation::open(final_path);
+  if (published == nullptr) return true;
+  publish(published);
+
+  error_message << "Replica generation " << generation << " with " << total
+                << " hashes is now in use.";
+  log_message(error_message.str(), Log_level::INFORMATION);
+  return false;
+}
+
+}  // namespace password_breach_check
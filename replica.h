@@ -0,0 +1,130 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#ifndef REPLICA_H_INCLUDED
+#define REPLICA_H_INCLUDED
+
+#include <atomic>             /* std::atomic */
+#include <condition_variable> /* std::condition_variable */
+#include <cstdint>            /* uint*_t */
+#include <mutex>              /* std::mutex */
+#include <string>             /* std::string */
+#include <string_view>        /* std::string_view */
+#include <thread>             /* std::thread */
+
+#include "range_pack.h"
+
+namespace password_breach_check {
+
+/**
+  Local replica of the complete range space
+
+  A background crawler walks all prefixes through
+  Breach_checker::password_breach_data() at a limited request rate and
+  writes the ranges into a generation file:
+
+  +---------------------+
+  | Replica_header      |
+  +---------------------+
+  | Replica_bucket      |  x RANGE_PREFIX_COUNT, indexed by prefix
+  +---------------------+
+  | Range_entry ...     |  sorted by suffix, one run per prefix
+  +---------------------+
+
+  Progress is checkpointed so that a restart resumes the pass. Once a pass
+  completes the generation is published by swapping an atomic pointer, and
+  the next pass starts. Later passes revalidate each bucket with its ETag,
+  copy unchanged buckets from the current generation and write changed
+  ones, so readers keep using the published generation until the next one
+  is complete.
+
+  Readers never block. They announce themselves in an epoch slot before
+  loading the pointer. A replaced generation is unmapped only after all
+  readers that could have seen it have left.
+*/
+class Range_replica {
+ public:
+  struct Generation;
+
+ public:
+  static Range_replica &instance();
+
+  ~Range_replica();
+
+  /**
+    Load latest complete generation and start the crawler
+
+    @param [in] directory  Existing directory for generations and checkpoint
+    @param [in] rate       Requests per second the crawler may issue
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool start(const std::string &directory, unsigned int rate);
+
+  /** Stop the crawler and release generations */
+  void stop();
+
+  /**
+    Look up a suffix in the published generation
+
+    @param [in]  prefix  Numeric prefix
+    @param [in]  suffix  35 character hex suffix
+    @param [out] count   Times suffix appeared in breaches, 0 if not listed
+
+    @returns true if a complete generation answered the lookup
+  */
+  bool lookup(uint32_t prefix, std::string_view suffix,
+              long long &count) const;
+
+ private:
+  void crawl();
+
+  bool crawl_pass(uint64_t generation, uint32_t next);
+
+  bool throttle();
+
+  void publish(Generation *generation);
+
+  bool save_checkpoint(uint64_t generation, uint32_t next);
+
+  bool load_checkpoint(uint64_t &generation, uint32_t &next);
+
+  std::string generation_path(uint64_t generation, bool partial) const;
+
+ private:
+  std::string directory_;
+  unsigned int rate_{1};
+
+  /* Published generation */
+  std::atomic<Generation *> current_{nullptr};
+
+  /* Crawler */
+  std::thread crawler_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_{false};
+};
+
+}  // namespace password_breach_check
+#endif /* REPLICA_H_INCLUDED */
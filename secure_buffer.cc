@@ -0,0 +1,151 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "secure_buffer.h"
+
+#include <cerrno>   /* errno */
+#include <cstring>  /* strerror */
+#include <string>   /* std::string */
+
+#include <sys/mman.h> /* mmap, mlock, madvise */
+
+#include <openssl/crypto.h> /* OPENSSL_cleanse */
+
+#include "breach_checker.h"  /* log_message */
+#include "status_counters.h" /* Status_counters */
+
+namespace password_breach_check {
+
+/** Slot of a buffer that is not from the pool */
+static const uint32_t NO_SLOT = UINT32_MAX;
+
+static const uint64_t SLOT_MASK = 0xFFFFFFFFULL;
+
+Secure_buffer_pool &Secure_buffer_pool::instance() {
+  static Secure_buffer_pool pool;
+  return pool;
+}
+
+Secure_buffer_pool::Secure_buffer_pool() = default;
+
+Secure_buffer_pool::~Secure_buffer_pool() { stop(); }
+
+bool Secure_buffer_pool::start(size_t count) {
+  stop();
+  if (count == 0) return false;
+  if (count >= NO_SLOT) return true;
+
+  size_t length = count * SECURE_BUFFER_SIZE;
+  void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    log_message(std::string("Failed to map password buffers: ") +
+                    strerror(errno),
+                Log_level::WARNING);
+    return true;
+  }
+#ifdef MADV_DONTDUMP
+  madvise(base, length, MADV_DONTDUMP);
+#endif /* MADV_DONTDUMP */
+  locked_ = mlock(base, length) == 0;
+  if (!locked_)
+    log_message(std::string("Failed to lock password buffers in memory, they "
+                            "may be swapped out: ") +
+                    strerror(errno) + ". Raise RLIMIT_MEMLOCK.",
+                Log_level::WARNING);
+
+  base_ = static_cast<char *>(base);
+  count_ = count;
+  next_.reset(new std::atomic<uint32_t>[count]);
+  /* Slot 0 on top */
+  for (size_t i = 0; i < count; ++i)
+    next_[i].store(i + 1 < count ? static_cast<uint32_t>(i + 2) : 0,
+                   std::memory_order_relaxed);
+  head_.store(1, std::memory_order_release);
+  return false;
+}
+
+void Secure_buffer_pool::stop() {
+  if (base_ == nullptr) return;
+  size_t length = count_ * SECURE_BUFFER_SIZE;
+  OPENSSL_cleanse(base_, length);
+  if (locked_) munlock(base_, length);
+  munmap(base_, length);
+  base_ = nullptr;
+  count_ = 0;
+  locked_ = false;
+  head_.store(0, std::memory_order_release);
+  next_.reset();
+}
+
+char *Secure_buffer_pool::acquire(uint32_t &slot) {
+  auto head = head_.load(std::memory_order_acquire);
+  while (true) {
+    auto top = static_cast<uint32_t>(head & SLOT_MASK);
+    if (top == 0) return nullptr;
+    uint64_t next = next_[top - 1].load(std::memory_order_relaxed);
+    uint64_t tag = (head >> 32) + 1;
+    if (head_.compare_exchange_weak(head, (tag << 32) | next,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_acquire)) {
+      slot = top - 1;
+      return base_ + static_cast<size_t>(slot) * SECURE_BUFFER_SIZE;
+    }
+  }
+}
+
+void Secure_buffer_pool::release(uint32_t slot) {
+  OPENSSL_cleanse(base_ + static_cast<size_t>(slot) * SECURE_BUFFER_SIZE,
+                  SECURE_BUFFER_SIZE);
+  auto head = head_.load(std::memory_order_relaxed);
+  uint64_t tag = 0;
+  do {
+    next_[slot].store(static_cast<uint32_t>(head & SLOT_MASK),
+                      std::memory_order_relaxed);
+    tag = (head >> 32) + 1;
+  } while (!head_.compare_exchange_weak(head, (tag << 32) | (slot + 1),
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+Secure_buffer::Secure_buffer() : slot_{NO_SLOT} {
+  auto &pool = Secure_buffer_pool::instance();
+  data_ = pool.enabled() ? pool.acquire(slot_) : nullptr;
+  if (data_ == nullptr) {
+    if (pool.enabled()) Status_counters::add(Counter::SECURE_BUFFER_FALLBACKS);
+    slot_ = NO_SLOT;
+    data_ = new char[SECURE_BUFFER_SIZE];
+  }
+  data_[0] = '\0';
+}
+
+Secure_buffer::~Secure_buffer() {
+  if (slot_ == NO_SLOT) {
+    OPENSSL_cleanse(data_, SECURE_BUFFER_SIZE);
+    delete[] data_;
+  } else {
+    Secure_buffer_pool::instance().release(slot_);
+  }
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,121 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef SECURE_BUFFER_H_INCLUDED
+#define SECURE_BUFFER_H_INCLUDED
+
+#include <atomic>  /* std::atomic */
+#include <cstddef> /* size_t */
+#include <cstdint> /* uint*_t */
+#include <memory>  /* std::unique_ptr */
+
+namespace password_breach_check {
+
+/** Size of a buffer for a plaintext password, including terminator */
+const size_t SECURE_BUFFER_SIZE = 512;
+
+/**
+  Pool of buffers for plaintext passwords
+
+  Buffers are slots of one anonymous mapping that is locked in memory, so
+  that plaintext is never written to swap, and excluded from core dumps.
+  A buffer is wiped when released. Free slots are kept on a lock-free
+  stack whose head carries a tag against ABA, so that taking and returning
+  a buffer costs a CAS each and no allocation.
+*/
+class Secure_buffer_pool {
+ public:
+  static Secure_buffer_pool &instance();
+
+  Secure_buffer_pool();
+
+  ~Secure_buffer_pool();
+
+  /**
+    Map and lock the buffers. Not safe while buffers are in use.
+
+    @param [in] count  Number of buffers, 0 to disable the pool
+
+    @returns status of the operation
+      @retval true  Failure, Secure_buffer falls back to the heap
+      @retval false Success, even if buffers could not be locked
+  */
+  bool start(size_t count);
+
+  /** Unmap the buffers. Not safe while buffers are in use. */
+  void stop();
+
+  /** Whether buffers are handed out */
+  bool enabled() const { return base_ != nullptr; }
+
+  /** Whether the buffers are locked in memory */
+  bool locked() const { return locked_; }
+
+  /**
+    Take a buffer
+
+    @param [out] slot  Slot to hand back to release()
+
+    @returns SECURE_BUFFER_SIZE bytes, nullptr if none is free
+  */
+  char *acquire(uint32_t &slot);
+
+  /** Wipe a buffer and return it to the pool */
+  void release(uint32_t slot);
+
+ private:
+  char *base_{nullptr};
+  size_t count_{0};
+  bool locked_{false};
+  /* Tag in the high half, top slot + 1 in the low half, 0 when empty */
+  std::atomic<uint64_t> head_{0};
+  /* Slot below each slot on the stack, + 1 */
+  std::unique_ptr<std::atomic<uint32_t>[]> next_;
+};
+
+/**
+  Buffer for a plaintext password, taken from Secure_buffer_pool for its
+  lifetime and wiped on destruction. Falls back to a heap buffer, also
+  wiped, when the pool is disabled or exhausted.
+*/
+class Secure_buffer {
+ public:
+  Secure_buffer();
+
+  ~Secure_buffer();
+
+  Secure_buffer(const Secure_buffer &) = delete;
+  Secure_buffer &operator=(const Secure_buffer &) = delete;
+
+  char *data() { return data_; }
+
+  static constexpr size_t size() { return SECURE_BUFFER_SIZE; }
+
+ private:
+  char *data_;
+  /* Slot in the pool, NO_SLOT if on the heap */
+  uint32_t slot_;
+};
+
+}  // namespace password_breach_check
+#endif /* SECURE_BUFFER_H_INCLUDED */
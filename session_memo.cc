@@ -0,0 +1,123 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "password_breach_check.h"
+
+#include <chrono> /* std::chrono */
+
+#include "digest_cache.h"    /* Recent_digests */
+#include "status_counters.h" /* Status_counters */
+
+namespace password_breach_check {
+
+static mysql_thd_store_slot memo_slot = nullptr;
+
+/** Called by the server when the session ends */
+static int free_memo(void *object) {
+  delete static_cast<Recent_digests *>(object);
+  return 0;
+}
+
+/**
+  Reserve a slot for memos in each THD
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Session_memo::register_slot() {
+  if (mysql_service_mysql_thd_store->register_slot(
+          "password_breach_check.session_memo", free_memo, &memo_slot)) {
+    raise_error("Failed to register session memo slot.", ERROR_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+/**
+  Release the slot
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Session_memo::unregister_slot() {
+  if (memo_slot == nullptr) return false;
+  if (mysql_service_mysql_thd_store->unregister_slot(memo_slot)) {
+    raise_error("Failed to unregister session memo slot.", WARNING_LEVEL);
+    return true;
+  }
+  memo_slot = nullptr;
+  return false;
+}
+
+/**
+  Find a recent result for a digest checked by the same session
+
+  @param [in]  thd     Session
+  @param [in]  digest  SHA1 digest of the password
+  @param [out] count   Times the password appeared in breaches
+
+  @returns true if found and not older than session_memo_ttl
+*/
+bool Session_memo::find(void *thd, const std::string &digest,
+                        long long &count) {
+  if (thd == nullptr || memo_slot == nullptr || config.session_memo_ttl == 0)
+    return false;
+  auto memo = static_cast<Recent_digests *>(
+      mysql_service_mysql_thd_store->get(static_cast<MYSQL_THD>(thd),
+                                         memo_slot));
+  if (memo == nullptr) return false;
+
+  auto oldest = Recent_digests::Clock::now() -
+                std::chrono::seconds(config.session_memo_ttl);
+  if (!memo->find(digest, oldest, count)) return false;
+  Status_counters::add(Counter::SESSION_MEMO_HITS);
+  return true;
+}
+
+/**
+  Remember a result for the session
+
+  @param [in] thd     Session
+  @param [in] digest  SHA1 digest of the password
+  @param [in] count   Times the password appeared in breaches
+*/
+void Session_memo::store(void *thd, const std::string &digest,
+                         long long count) {
+  if (thd == nullptr || memo_slot == nullptr || config.session_memo_ttl == 0)
+    return;
+  auto session = static_cast<MYSQL_THD>(thd);
+  auto memo = static_cast<Recent_digests *>(
+      mysql_service_mysql_thd_store->get(session, memo_slot));
+  if (memo == nullptr) {
+    memo = new Recent_digests();
+    if (mysql_service_mysql_thd_store->set(session, memo_slot, memo)) {
+      delete memo;
+      return;
+    }
+  }
+  memo->store(digest, count, Recent_digests::Clock::now());
+}
+
+}  // namespace password_breach_check
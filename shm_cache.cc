@@ -0,0 +1,292 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "shm_cache.h"
+
+#include <algorithm> /* std::min */
+#include <cerrno>    /* errno */
+#include <chrono>    /* std::chrono::milliseconds */
+#include <cstring>   /* memcmp */
+#include <ctime>     /* time */
+#include <sstream>   /* std::stringstream */
+#include <thread>    /* std::this_thread::sleep_for */
+#include <vector>    /* std::vector */
+
+#include <fcntl.h>    /* O_* constants */
+#include <sys/mman.h> /* shm_open, mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* ftruncate, geteuid */
+
+#include "breach_checker.h"
+
+namespace password_breach_check {
+
+/** Magic identifying an initialized segment */
+static const uint64_t SHM_MAGIC = 0x3143484353425042ULL; /* "PBSCHC1" */
+
+/** Layout version of the segment */
+static const uint32_t SHM_VERSION = 2;
+
+/** Number of slots probed for a prefix */
+static const uint32_t PROBE_LIMIT = 8;
+
+/** Attempts made by a reader before treating a busy slot as a miss */
+static const int READ_ATTEMPTS = 4;
+
+/** Segment header. Slots start at the next cache line. */
+struct alignas(64) Shm_header {
+  std::atomic<uint64_t> magic;
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t slot_capacity;
+  uint32_t slot_stride;
+};
+
+/** Distance between two slots, rounded up to a cache line */
+static const size_t SLOT_STRIDE =
+    (sizeof(Shm_range_cache::Slot) + 63) & ~static_cast<size_t>(63);
+
+Shm_range_cache &Shm_range_cache::instance() {
+  static Shm_range_cache cache;
+  return cache;
+}
+
+bool Shm_range_cache::attach(const std::string &name, size_t size,
+                             uint32_t ttl) {
+  detach();
+  std::stringstream error_message;
+  if (size < sizeof(Shm_header) + SLOT_STRIDE) {
+    error_message << "Shared memory cache size " << size << " is too small.";
+    log_message(error_message.str(), Log_level::ERROR);
+    return true;
+  }
+
+  bool created = true;
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    created = false;
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+  }
+  if (fd < 0) {
+    error_message << "Failed to open shared memory segment '" << name
+                  << "': " << strerror(errno);
+    log_message(error_message.str(), Log_level::ERROR);
+    return true;
+  }
+
+  /*
+    Anyone may create the name first. A segment that another user owns or
+    may access could feed forged ranges to the cache, so it is not used.
+  */
+  struct stat owner;
+  if (fstat(fd, &owner) != 0 || owner.st_uid != geteuid() ||
+      (owner.st_mode & 077) != 0) {
+    error_message << "Shared memory segment '" << name
+                  << "' is not owned by this user or is accessible to "
+                     "others. Remove it and restart.";
+    log_message(error_message.str(), Log_level::ERROR);
+    close(fd);
+    return true;
+  }
+
+  if (created) {
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      error_message << "Failed to size shared memory segment '" << name
+                    << "': " << strerror(errno);
+      log_message(error_message.str(), Log_level::ERROR);
+      close(fd);
+      shm_unlink(name.c_str());
+      return true;
+    }
+  } else {
+    /* Another instance may still be sizing the segment */
+    struct stat st;
+    for (int i = 0; i < 100; ++i) {
+      if (fstat(fd, &st) == 0 && st.st_size > 0) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    size = static_cast<size_t>(st.st_size);
+  }
+
+  void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    error_message << "Failed to map shared memory segment '" << name
+                  << "': " << strerror(errno);
+    log_message(error_message.str(), Log_level::ERROR);
+    return true;
+  }
+
+  auto header = static_cast<Shm_header *>(base);
+  if (created) {
+    /* Memory is zero filled, so all slots start empty */
+    header->version = SHM_VERSION;
+    header->slot_capacity = SLOT_CAPACITY;
+    header->slot_stride = static_cast<uint32_t>(SLOT_STRIDE);
+    header->slot_count =
+        static_cast<uint32_t>((size - sizeof(Shm_header)) / SLOT_STRIDE);
+    header->magic.store(SHM_MAGIC, std::memory_order_release);
+  } else {
+    for (int i = 0; i < 100; ++i) {
+      if (header->magic.load(std::memory_order_acquire) == SHM_MAGIC) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (header->magic.load(std::memory_order_acquire) != SHM_MAGIC ||
+        header->version != SHM_VERSION ||
+        header->slot_capacity != SLOT_CAPACITY ||
+        header->slot_stride != SLOT_STRIDE ||
+        sizeof(Shm_header) + header->slot_count * SLOT_STRIDE > size) {
+      error_message << "Shared memory segment '" << name
+                    << "' was created by an incompatible version. Remove it "
+                       "and restart.";
+      log_message(error_message.str(), Log_level::ERROR);
+      munmap(base, size);
+      return true;
+    }
+  }
+
+  base_ = base;
+  size_ = size;
+  slot_count_ = header->slot_count;
+  ttl_ = ttl;
+  slots_ = static_cast<char *>(base) + sizeof(Shm_header);
+  return false;
+}
+
+void Shm_range_cache::detach() {
+  /*
+    The segment is left in place for other instances. It is removed by
+    deleting /dev/shm/<name>.
+  */
+  if (base_ != nullptr) munmap(base_, size_);
+  base_ = nullptr;
+  slots_ = nullptr;
+  size_ = 0;
+  slot_count_ = 0;
+}
+
+Shm_range_cache::Slot *Shm_range_cache::slot(uint32_t index) const {
+  return reinterpret_cast<Slot *>(slots_ + index * SLOT_STRIDE);
+}
+
+/** Lock word following another, with the time it is stored at */
+static uint64_t lock_word(uint64_t sequence, uint32_t now) {
+  return (static_cast<uint64_t>(now) << 32) |
+         static_cast<uint32_t>(sequence + 1);
+}
+
+/** First slot probed for a prefix */
+static uint32_t home_slot(uint32_t prefix, uint32_t slot_count) {
+  return static_cast<uint32_t>(
+      (static_cast<uint64_t>(prefix * 2654435761U) * slot_count) >> 32);
+}
+
+bool Shm_range_cache::lookup(uint32_t prefix, std::string_view suffix,
+                             long long &count) const {
+  if (slots_ == nullptr) return false;
+
+  uint8_t key[RANGE_SUFFIX_BYTES];
+  if (parse_range_suffix(suffix, key)) return false;
+  auto now = static_cast<uint32_t>(time(nullptr));
+
+  auto home = home_slot(prefix, slot_count_);
+  for (uint32_t probe = 0; probe < PROBE_LIMIT && probe < slot_count_;
+       ++probe) {
+    auto *current = slot((home + probe) % slot_count_);
+    for (int attempt = 0; attempt < READ_ATTEMPTS; ++attempt) {
+      auto sequence = current->sequence.load(std::memory_order_acquire);
+      if ((sequence & 1) != 0) continue;
+
+      auto stored_key = current->key.load(std::memory_order_relaxed);
+      if (stored_key == 0) return false;
+      if (stored_key != prefix + 1) break;
+
+      auto entry_count = std::min(current->entry_count, SLOT_CAPACITY);
+      auto stored_at = current->stored_at;
+      /* Entries are sorted by suffix */
+      long long result = find_range_entry(current->entries, entry_count, key);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (current->sequence.load(std::memory_order_relaxed) != sequence)
+        continue;
+
+      if (now - stored_at > ttl_) return false;
+      count = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Shm_range_cache::store(uint32_t prefix, std::string_view body) {
+  if (slots_ == nullptr) return;
+
+  /* Convert to binary form outside of the critical section */
+  std::vector<Range_entry> entries;
+  if (parse_range_entries(body, entries) || entries.size() > SLOT_CAPACITY)
+    return;
+
+  /* Reuse slot holding the prefix, else an empty one, else the oldest */
+  auto home = home_slot(prefix, slot_count_);
+  Slot *victim = nullptr;
+  for (uint32_t probe = 0; probe < PROBE_LIMIT && probe < slot_count_;
+       ++probe) {
+    auto *current = slot((home + probe) % slot_count_);
+    auto stored_key = current->key.load(std::memory_order_relaxed);
+    if (stored_key == prefix + 1 || stored_key == 0) {
+      victim = current;
+      break;
+    }
+    if (victim == nullptr || current->stored_at < victim->stored_at)
+      victim = current;
+  }
+
+  /*
+    An odd sequence means another writer owns the slot, unless it took the
+    slot so long ago that it must have died while writing. Taking such a
+    slot over moves the sequence by 2, so that it stays odd.
+  */
+  auto now = static_cast<uint32_t>(time(nullptr));
+  auto sequence = victim->sequence.load(std::memory_order_relaxed);
+  uint64_t locked = lock_word(sequence, now);
+  if ((sequence & 1) != 0) {
+    auto taken_at = static_cast<uint32_t>(sequence >> 32);
+    if (now - taken_at <= STALE_LOCK_SECONDS) return;
+    locked = lock_word(sequence + 1, now);
+  }
+  if (!victim->sequence.compare_exchange_strong(sequence, locked,
+                                                std::memory_order_acquire))
+    return; /* Another writer took the slot */
+  std::atomic_thread_fence(std::memory_order_release);
+
+  victim->key.store(prefix + 1, std::memory_order_relaxed);
+  victim->entry_count = static_cast<uint32_t>(entries.size());
+  victim->stored_at = now;
+  memcpy(victim->entries, entries.data(), entries.size() * sizeof(Range_entry));
+
+  /* Fails if the slot was taken over, in which case the new owner ends */
+  victim->sequence.compare_exchange_strong(locked, lock_word(locked, now),
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed);
+}
+
+}  // namespace password_breach_check
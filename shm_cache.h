@@ -0,0 +1,134 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#ifndef SHM_CACHE_H_INCLUDED
+#define SHM_CACHE_H_INCLUDED
+
+#include <atomic>      /* std::atomic */
+#include <cstddef>     /* size_t */
+#include <cstdint>     /* uint*_t */
+#include <string>      /* std::string */
+#include <string_view> /* std::string_view */
+
+#include "range_pack.h"
+
+namespace password_breach_check {
+
+/**
+  Cache of range data in a POSIX shared memory segment
+
+  All component instances on a host that are configured with the same
+  segment name attach to the same table, so a range fetched by one server
+  is immediately available to the others.
+
+  The segment holds an open-addressing table keyed by the 20 bit prefix.
+  A slot stores the range sorted by suffix in binary form. Each slot is
+  protected by a sequence lock: writers move the sequence from even to odd
+  with a CAS, update the slot and make it even again; readers retry if the
+  sequence was odd or changed under them. Neither side ever blocks. The
+  time a slot was taken is kept in the same word, so that a slot left odd
+  by a server that died while writing is taken over by the next writer
+  after STALE_LOCK_SECONDS.
+
+  Slots have a fixed size of SLOT_CAPACITY entries, about 48 KB, so a
+  segment holds size / 48 KB ranges however short they are. The segment
+  is created with mode 0600, and an existing segment is only used if it
+  belongs to the same OS user and no one else may access it.
+*/
+class Shm_range_cache {
+ public:
+  /** Maximum number of entries in a cached range */
+  static constexpr uint32_t SLOT_CAPACITY = 2048;
+
+  /** Seconds after which a slot held by a writer may be taken over */
+  static constexpr uint32_t STALE_LOCK_SECONDS = 10;
+
+  /** Slot layout. Entries follow the slot header. */
+  struct Slot {
+    /* Sequence in the low half, Unix time it was last taken in the high */
+    std::atomic<uint64_t> sequence;
+    /* Prefix + 1, 0 if the slot was never used */
+    std::atomic<uint32_t> key;
+    uint32_t entry_count;
+    /* Unix time at which the range was stored */
+    uint32_t stored_at;
+    Range_entry entries[SLOT_CAPACITY];
+  };
+
+  static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                    std::atomic<uint64_t>::is_always_lock_free,
+                "Shared memory cache needs address free atomics");
+
+ public:
+  static Shm_range_cache &instance();
+
+  /**
+    Attach to the segment, creating it if it does not exist
+
+    @param [in] name  Segment name, e.g. /password_breach_check
+    @param [in] size  Size of the segment in bytes if it is created
+    @param [in] ttl   Seconds after which a cached range is stale
+
+    @returns status of the operation
+      @retval true  Failure
+      @retval false Success
+  */
+  bool attach(const std::string &name, size_t size, uint32_t ttl);
+
+  void detach();
+
+  bool attached() const { return slots_ != nullptr; }
+
+  /**
+    Look up a suffix
+
+    @param [in]  prefix  Numeric prefix
+    @param [in]  suffix  35 character hex suffix
+    @param [out] count   Times suffix appeared in breaches, 0 if not listed
+
+    @returns true if range for the prefix was found in the cache
+  */
+  bool lookup(uint32_t prefix, std::string_view suffix,
+              long long &count) const;
+
+  /**
+    Store a range. Best effort: silently skipped on contention or if the
+    range does not fit in a slot.
+
+    @param [in] prefix  Numeric prefix
+    @param [in] body    Range data in wire format
+  */
+  void store(uint32_t prefix, std::string_view body);
+
+ private:
+  Slot *slot(uint32_t index) const;
+
+ private:
+  void *base_{nullptr};
+  size_t size_{0};
+  char *slots_{nullptr};
+  uint32_t slot_count_{0};
+  uint32_t ttl_{0};
+};
+
+}  // namespace password_breach_check
+#endif /* SHM_CACHE_H_INCLUDED */
@@ -0,0 +1,71 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "status_counters.h"
+
+#include <atomic>     /* std::atomic */
+#include <functional> /* std::hash */
+#include <thread>     /* std::this_thread */
+
+#include <sched.h> /* sched_getcpu */
+
+namespace password_breach_check {
+
+/** Stripes. CPUs beyond this share stripes. */
+static const size_t STRIPES = 64;
+
+static const size_t COUNTERS = static_cast<size_t>(Counter::COUNT);
+
+struct alignas(64) Stripe {
+  std::atomic<uint64_t> values[COUNTERS];
+};
+
+static Stripe stripes[STRIPES];
+
+/** Stripe of the CPU the caller runs on */
+static Stripe &current_stripe() {
+  int cpu = sched_getcpu();
+  if (cpu < 0) {
+    /* Not supported: spread by thread instead */
+    thread_local size_t thread_stripe =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return stripes[thread_stripe % STRIPES];
+  }
+  return stripes[static_cast<size_t>(cpu) % STRIPES];
+}
+
+void Status_counters::add(Counter counter, uint64_t value) {
+  current_stripe()
+      .values[static_cast<size_t>(counter)]
+      .fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Status_counters::get(Counter counter) {
+  uint64_t total = 0;
+  for (auto &stripe : stripes)
+    total += stripe.values[static_cast<size_t>(counter)].load(
+        std::memory_order_relaxed);
+  return total;
+}
+
+}  // namespace password_breach_check
@@ -0,0 +1,93 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#ifndef STATUS_COUNTERS_H_INCLUDED
+#define STATUS_COUNTERS_H_INCLUDED
+
+#include <cstddef> /* size_t */
+#include <cstdint> /* uint64_t */
+
+namespace password_breach_check {
+
+/** Counters published as status variables */
+enum class Counter : size_t {
+  /* Passwords looked up */
+  CHECKS,
+  /* Lookups that found the password in breaches */
+  BREACHED,
+  /* Lookups answered without going to the network */
+  CACHE_HITS,
+  /* Lookups that needed a range fetched or revalidated */
+  CACHE_MISSES,
+  /* Requests made to the range API */
+  FETCHES,
+  /* Requests repeated after a failure */
+  RETRIES,
+  /* Requests that timed out */
+  TIMEOUTS,
+  /* Response body bytes received from the range API */
+  BYTES_RECEIVED,
+  /* Microseconds spent in requests to the range API */
+  FETCH_TIME,
+  /* Checks failed because the fetch queue was full */
+  FETCH_POOL_OVERFLOWS,
+  /* Sessions that stopped waiting for a fetch */
+  FETCH_POOL_TIMEOUTS,
+  /* Checks answered from the session's own recent results */
+  SESSION_MEMO_HITS,
+  /* Fetches skipped because other validators rejected the password */
+  SKIPPED_LOOKUPS,
+  /* Log messages suppressed by the rate limit or dropped */
+  LOG_SUPPRESSED,
+  /* Responses with HTTP 429 Too Many Requests */
+  THROTTLED,
+  /* Requests not made as rate or concurrency limits allowed none in time */
+  FETCHES_REJECTED,
+  /* Requests for sessions changing or rating passwords */
+  INTERACTIVE_FETCHES,
+  /* Requests for audits and replica crawls */
+  BATCH_FETCHES,
+  /* Lookups answered by the result cache */
+  RESULT_CACHE_HITS,
+  /* Password buffers taken from the heap as the locked pool was exhausted */
+  SECURE_BUFFER_FALLBACKS,
+  /* Number of counters, not a counter */
+  COUNT
+};
+
+/**
+  Monotonic counters, striped per CPU
+
+  Each CPU increments its own cache line with relaxed atomics, so that
+  counting does not add contention between sessions. Reads sum over all
+  stripes and are therefore only approximately consistent with each other.
+*/
+class Status_counters {
+ public:
+  static void add(Counter counter, uint64_t value = 1);
+
+  static uint64_t get(Counter counter);
+};
+
+}  // namespace password_breach_check
+#endif /* STATUS_COUNTERS_H_INCLUDED */
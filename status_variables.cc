@@ -0,0 +1,154 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+#include "password_breach_check.h"
+
+#include <cstring> /* memcpy */
+
+#include "concurrency_limiter.h" /* Concurrency_limiter */
+#include "fetch_pool.h"          /* Fetch_pool */
+#include "status_counters.h"     /* Status_counters */
+
+namespace password_breach_check {
+
+/** Report a value as a SHOW_LONGLONG */
+static int show_longlong(SHOW_VAR *var, char *buf, long long value) {
+  var->type = SHOW_LONGLONG;
+  var->value = buf;
+  memcpy(buf, &value, sizeof(value));
+  return 0;
+}
+
+/** Report a counter */
+template <Counter counter>
+static int show_counter(MYSQL_THD, SHOW_VAR *var, char *buf) {
+  return show_longlong(var, buf,
+                       static_cast<long long>(Status_counters::get(counter)));
+}
+
+/** Fetches waiting for a worker */
+static long long fetch_queue_depth() {
+  return static_cast<long long>(Fetch_pool::instance().queue_depth());
+}
+
+/** Running fetch workers */
+static long long fetch_threads() {
+  return static_cast<long long>(Fetch_pool::instance().threads());
+}
+
+/** Adaptive limit on requests in flight */
+static long long concurrency_limit() {
+  return static_cast<long long>(Concurrency_limiter::instance().limit());
+}
+
+/** Requests in flight */
+static long long fetches_in_flight() {
+  return static_cast<long long>(Concurrency_limiter::instance().in_flight());
+}
+
+/** Report a gauge read when the variable is shown */
+template <long long (*gauge)()>
+static int show_gauge(MYSQL_THD, SHOW_VAR *var, char *buf) {
+  return show_longlong(var, buf, gauge());
+}
+
+#define COUNTER_VAR(name, counter)                                  \
+  {                                                                 \
+    "password_breach_check." name,                                  \
+        reinterpret_cast<char *>(&show_counter<Counter::counter>),  \
+        SHOW_FUNC, SHOW_SCOPE_GLOBAL                                \
+  }
+
+#define GAUGE_VAR(name, gauge)                                      \
+  {                                                                 \
+    "password_breach_check." name,                                  \
+        reinterpret_cast<char *>(&show_gauge<&gauge>), SHOW_FUNC,   \
+        SHOW_SCOPE_GLOBAL                                           \
+  }
+
+static SHOW_VAR status_variables[] = {
+    COUNTER_VAR("checks", CHECKS),
+    COUNTER_VAR("breached", BREACHED),
+    COUNTER_VAR("cache_hits", CACHE_HITS),
+    COUNTER_VAR("cache_misses", CACHE_MISSES),
+    COUNTER_VAR("fetches", FETCHES),
+    COUNTER_VAR("retries", RETRIES),
+    COUNTER_VAR("timeouts", TIMEOUTS),
+    COUNTER_VAR("bytes_received", BYTES_RECEIVED),
+    COUNTER_VAR("fetch_time_us", FETCH_TIME),
+    COUNTER_VAR("fetch_pool_overflows", FETCH_POOL_OVERFLOWS),
+    COUNTER_VAR("fetch_pool_timeouts", FETCH_POOL_TIMEOUTS),
+    COUNTER_VAR("session_memo_hits", SESSION_MEMO_HITS),
+    COUNTER_VAR("skipped_lookups", SKIPPED_LOOKUPS),
+    COUNTER_VAR("log_messages_suppressed", LOG_SUPPRESSED),
+    COUNTER_VAR("throttled", THROTTLED),
+    COUNTER_VAR("fetches_rejected", FETCHES_REJECTED),
+    COUNTER_VAR("interactive_fetches", INTERACTIVE_FETCHES),
+    COUNTER_VAR("batch_fetches", BATCH_FETCHES),
+    COUNTER_VAR("result_cache_hits", RESULT_CACHE_HITS),
+    COUNTER_VAR("secure_buffer_fallbacks", SECURE_BUFFER_FALLBACKS),
+    GAUGE_VAR("fetch_concurrency_limit", concurrency_limit),
+    GAUGE_VAR("fetches_in_flight", fetches_in_flight),
+    GAUGE_VAR("fetch_pool_threads", fetch_threads),
+    GAUGE_VAR("fetch_pool_queue_depth", fetch_queue_depth),
+    {nullptr, nullptr, SHOW_UNDEF, SHOW_SCOPE_UNDEF}};
+
+#undef COUNTER_VAR
+#undef GAUGE_VAR
+
+/**
+  Register status variables
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Status_variables::register_variables() {
+  if (mysql_service_status_variable_registration->register_variable(
+          status_variables)) {
+    raise_error("Failed to register password_breach_check status variables.",
+                ERROR_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+/**
+  Unregister status variables
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool Status_variables::unregister_variables() {
+  if (mysql_service_status_variable_registration->unregister_variable(
+          status_variables)) {
+    raise_error(
+        "Failed to unregister password_breach_check status variables.",
+        WARNING_LEVEL);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace password_breach_check
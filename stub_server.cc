@@ -0,0 +1,482 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+
+/*
+  password_breach_check_stub_server
+
+  Test-only server for /range/<prefix> requests. Range bodies are synthetic,
+  generated from a seed and the prefix, so runs are reproducible on an
+  offline machine. Latency, errors and slow responses can be injected to
+  exercise timeouts and retries. Point password_breach_check.url (or the
+  benchmarks) at http://<listen>/range/.
+
+  Usage:
+    password_breach_check_stub_server [--listen <address>:<port>]
+        [--socket <path>] [--seed <n>] [--entries <min>:<max>]
+        [--latency <ms>] [--jitter <ms>] [--error-rate <0-1>]
+        [--drop-rate <0-1>] [--throttle-rate <0-1>] [--chunk <bytes>]
+        [--drip <ms>]
+
+  Each response is delayed by latency +/- jitter. A fraction error-rate of
+  requests get 503 Service Unavailable and a fraction drop-rate get the
+  connection closed without a response. A fraction throttle-rate get 429
+  Too Many Requests with Retry-After: 1. With --chunk the body is sent with
+  chunked transfer encoding, sleeping --drip between chunks. Faults are
+  drawn from the seed and the request sequence number.
+*/
+
+#include <algorithm> /* std::sort, std::min */
+#include <atomic>    /* std::atomic */
+#include <cerrno>    /* errno */
+#include <chrono>    /* std::chrono */
+#include <climits>   /* LONG_MAX */
+#include <csignal>   /* signal */
+#include <cstdio>    /* snprintf */
+#include <cstdlib>   /* strtol, strtod */
+#include <cstring>   /* strerror */
+#include <iostream>  /* std::cerr */
+#include <string>    /* std::string */
+#include <thread>    /* std::thread */
+#include <vector>    /* std::vector */
+
+#include <arpa/inet.h>   /* inet_pton */
+#include <netinet/in.h>  /* sockaddr_in */
+#include <netinet/tcp.h> /* TCP_NODELAY */
+#include <poll.h>        /* poll */
+#include <sys/socket.h>  /* socket */
+#include <sys/stat.h>    /* chmod */
+#include <sys/un.h>      /* sockaddr_un */
+#include <unistd.h>      /* close */
+
+#include "range_pack.h"
+
+using namespace password_breach_check;
+
+namespace {
+
+/** Largest request header block accepted */
+const size_t MAX_REQUEST_SIZE = 8192;
+
+/** Most entries per range accepted by --entries */
+const long MAX_ENTRIES = 100000;
+
+/** Longest delay, in milliseconds, accepted by --latency, --jitter, --drip */
+const double MAX_DELAY = 3600000;
+
+struct Options {
+  std::string listen{"127.0.0.1:8081"};
+  std::string socket;
+  uint64_t seed{1};
+  uint32_t min_entries{800};
+  uint32_t max_entries{1000};
+  double latency{0};
+  double jitter{0};
+  double error_rate{0};
+  double drop_rate{0};
+  double throttle_rate{0};
+  size_t chunk{0};
+  double drip{0};
+};
+
+Options options;
+
+/** Requests seen so far. Faults are drawn from this sequence. */
+std::atomic<uint64_t> requests{0};
+
+uint64_t splitmix64(uint64_t value) {
+  value += 0x9E3779B97F4A7C15ULL;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+  return value ^ (value >> 31);
+}
+
+/** Sequence of pseudo random numbers, identical on every platform */
+class Random {
+ public:
+  explicit Random(uint64_t state) : state_{state} {}
+
+  uint64_t next() { return splitmix64(state_++); }
+
+  /** Uniform in [0, 1) */
+  double fraction() {
+    return static_cast<double>(next() >> 11) / 9007199254740992.0;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+/** Range body for a prefix. Same seed and prefix give the same body. */
+std::string range_body(uint32_t prefix) {
+  Random random(splitmix64(options.seed) ^
+                (static_cast<uint64_t>(prefix) << 32));
+  auto entries = options.min_entries +
+                 static_cast<uint32_t>(random.next() %
+                                       (options.max_entries -
+                                        options.min_entries + 1));
+  std::vector<std::string> lines;
+  lines.reserve(entries);
+  char line[64];
+  for (uint32_t i = 0; i < entries; ++i) {
+    /* Mostly small counts, with a long tail */
+    auto count = 1 + random.next() % 100;
+    if (random.next() % 16 == 0) count *= 1000;
+    snprintf(line, sizeof(line), "%016llX%016llX%03llX:%llu",
+             static_cast<unsigned long long>(random.next()),
+             static_cast<unsigned long long>(random.next()),
+             static_cast<unsigned long long>(random.next() & 0xFFF),
+             static_cast<unsigned long long>(count));
+    lines.emplace_back(line);
+  }
+  std::sort(lines.begin(), lines.end());
+
+  std::string body;
+  body.reserve(entries * 45);
+  for (auto &entry : lines) {
+    if (!body.empty()) body.append("\r\n");
+    body.append(entry);
+  }
+  return body;
+}
+
+void sleep_ms(double milliseconds) {
+  if (milliseconds > 0)
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(static_cast<long long>(milliseconds * 1000)));
+}
+
+bool send_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    auto sent = send(fd, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) return false;
+    data += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+bool send_all(int fd, const std::string &data) {
+  return send_all(fd, data.data(), data.size());
+}
+
+/**
+  Answer one request
+
+  @returns false if the connection is to be closed
+*/
+bool respond(int fd, const std::string &request) {
+  Random faults(splitmix64(options.seed) ^ splitmix64(requests++));
+  auto delay = options.latency + (faults.fraction() * 2 - 1) * options.jitter;
+  sleep_ms(delay);
+
+  if (faults.fraction() < options.drop_rate) return false;
+  if (faults.fraction() < options.throttle_rate)
+    return send_all(fd,
+                    "HTTP/1.1 429 Too Many Requests\r\n"
+                    "Retry-After: 1\r\n"
+                    "Content-Length: 0\r\n\r\n");
+  if (faults.fraction() < options.error_rate)
+    return send_all(fd,
+                    "HTTP/1.1 503 Service Unavailable\r\n"
+                    "Content-Length: 0\r\n\r\n");
+
+  /* GET /range/XXXXX HTTP/1.1 */
+  const std::string PATH = "GET /range/";
+  uint32_t prefix = 0;
+  if (request.compare(0, PATH.length(), PATH) != 0 ||
+      request.length() < PATH.length() + RANGE_PREFIX_LENGTH ||
+      parse_range_prefix(request.substr(PATH.length(), RANGE_PREFIX_LENGTH),
+                         prefix))
+    return send_all(fd,
+                    "HTTP/1.1 404 Not Found\r\n"
+                    "Content-Length: 0\r\n\r\n");
+
+  /* Bodies never change, so the ETag only depends on seed and prefix */
+  char etag[64];
+  snprintf(etag, sizeof(etag), "\"%llx-%05X\"",
+           static_cast<unsigned long long>(options.seed), prefix);
+  if (request.find(std::string("If-None-Match: ") + etag) != std::string::npos)
+    return send_all(fd, std::string("HTTP/1.1 304 Not Modified\r\nETag: ") +
+                            etag + "\r\n\r\n");
+
+  auto body = range_body(prefix);
+  std::string header = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+  header.append("ETag: ").append(etag).append("\r\n");
+  if (options.chunk == 0) {
+    header.append("Content-Length: ")
+        .append(std::to_string(body.size()))
+        .append("\r\n\r\n");
+    return send_all(fd, header) && send_all(fd, body);
+  }
+
+  header.append("Transfer-Encoding: chunked\r\n\r\n");
+  if (!send_all(fd, header)) return false;
+  char size[32];
+  for (size_t offset = 0; offset < body.size(); offset += options.chunk) {
+    auto length = std::min(options.chunk, body.size() - offset);
+    snprintf(size, sizeof(size), "%zx\r\n", length);
+    if (!send_all(fd, size, strlen(size)) ||
+        !send_all(fd, body.data() + offset, length) ||
+        !send_all(fd, "\r\n", 2))
+      return false;
+    sleep_ms(options.drip);
+  }
+  return send_all(fd, "0\r\n\r\n", 5);
+}
+
+/** Serve requests on a connection until the client closes it */
+void serve_connection(int fd) {
+  std::string in;
+  char buffer[4096];
+  bool open = true;
+  while (open) {
+    auto received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received <= 0) break;
+    in.append(buffer, static_cast<size_t>(received));
+    size_t end;
+    while (open && (end = in.find("\r\n\r\n")) != std::string::npos) {
+      auto request = in.substr(0, end + 4);
+      in.erase(0, end + 4);
+      open = respond(fd, request) &&
+             request.find("Connection: close") == std::string::npos;
+    }
+    if (in.size() > MAX_REQUEST_SIZE) break;
+  }
+  close(fd);
+}
+
+/**
+  Parse a decimal number in a range
+
+  @returns status of the operation
+    @retval true  Not a number, or out of range
+    @retval false Success
+*/
+bool parse_number(const std::string &text, long min, long max, long &value) {
+  if (text.empty()) return true;
+  char *end = nullptr;
+  errno = 0;
+  value = strtol(text.c_str(), &end, 10);
+  return errno != 0 || *end != '\0' || value < min || value > max;
+}
+
+/**
+  Parse a real number in a range
+
+  @returns status of the operation
+    @retval true  Not a number, or out of range
+    @retval false Success
+*/
+bool parse_real(const std::string &text, double min, double max,
+                double &value) {
+  if (text.empty()) return true;
+  char *end = nullptr;
+  errno = 0;
+  value = strtod(text.c_str(), &end);
+  /* Also rejects NaN, which fails both comparisons */
+  return errno != 0 || *end != '\0' || !(value >= min && value <= max);
+}
+
+/**
+  Split <address>:<port>
+
+  @returns status of the operation
+    @retval true  Malformed
+    @retval false Success
+*/
+bool parse_listen(const std::string &listen, std::string &address,
+                  int &port) {
+  auto colon = listen.rfind(':');
+  long value = 0;
+  if (colon == std::string::npos ||
+      parse_number(listen.substr(colon + 1), 1, 65535, value))
+    return true;
+  address = listen.substr(0, colon);
+  port = static_cast<int>(value);
+  return false;
+}
+
+int open_tcp_listener(const std::string &listen) {
+  std::string address;
+  int port = 0;
+  if (parse_listen(listen, address, port)) return -1;
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int open_unix_listener(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.length() >= sizeof(addr.sun_path)) return -1;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  chmod(path.c_str(), 0666);
+  return fd;
+}
+
+void usage(const char *program) {
+  std::cerr
+      << "Usage: " << program
+      << " [--listen <address>:<port>] [--socket <path>]\n"
+         "    [--seed <n>] [--entries <min>:<max>] [--latency <ms>]\n"
+         "    [--jitter <ms>] [--error-rate <0-1>] [--drop-rate <0-1>]\n"
+         "    [--throttle-rate <0-1>] [--chunk <bytes>] [--drip <ms>]\n"
+         "\n"
+         "  --listen      TCP address (default 127.0.0.1:8081). Empty to "
+         "disable.\n"
+         "  --socket      Unix domain socket to serve on as well.\n"
+         "  --seed        Seed of range bodies and faults (default 1).\n"
+         "  --entries     Entries per range (default 800:1000).\n"
+         "  --latency     Delay before each response.\n"
+         "  --jitter      Random +/- variation of the delay.\n"
+         "  --error-rate  Fraction of requests answered with 503.\n"
+         "  --drop-rate   Fraction of requests whose connection is closed.\n"
+         "  --throttle-rate\n"
+         "                Fraction of requests answered with 429.\n"
+         "  --chunk       Send bodies in chunks of this size.\n"
+         "  --drip        Delay between chunks.\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    std::string value(argv[++i]);
+    bool invalid = false;
+    long number = 0;
+    if (arg == "--listen")
+      options.listen = value;
+    else if (arg == "--socket")
+      options.socket = value;
+    else if (arg == "--seed") {
+      invalid = parse_number(value, 0, LONG_MAX, number);
+      options.seed = static_cast<uint64_t>(number);
+    } else if (arg == "--entries") {
+      auto colon = value.find(':');
+      long max = 0;
+      invalid = colon == std::string::npos ||
+                parse_number(value.substr(0, colon), 0, MAX_ENTRIES, number) ||
+                parse_number(value.substr(colon + 1), number, MAX_ENTRIES,
+                             max);
+      options.min_entries = static_cast<uint32_t>(number);
+      options.max_entries = static_cast<uint32_t>(max);
+    } else if (arg == "--latency")
+      invalid = parse_real(value, 0, MAX_DELAY, options.latency);
+    else if (arg == "--jitter")
+      invalid = parse_real(value, 0, MAX_DELAY, options.jitter);
+    else if (arg == "--error-rate")
+      invalid = parse_real(value, 0, 1, options.error_rate);
+    else if (arg == "--drop-rate")
+      invalid = parse_real(value, 0, 1, options.drop_rate);
+    else if (arg == "--throttle-rate")
+      invalid = parse_real(value, 0, 1, options.throttle_rate);
+    else if (arg == "--chunk") {
+      invalid = parse_number(value, 0, 1L << 20, number);
+      options.chunk = static_cast<size_t>(number);
+    } else if (arg == "--drip")
+      invalid = parse_real(value, 0, MAX_DELAY, options.drip);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+    if (invalid) {
+      std::cerr << "Invalid " << arg << ": " << value << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  std::string address;
+  int port = 0;
+  if (!options.listen.empty() && parse_listen(options.listen, address, port)) {
+    std::cerr << "Invalid --listen: " << options.listen << std::endl;
+    usage(argv[0]);
+    return 1;
+  }
+  if (options.listen.empty() && options.socket.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<int> listeners;
+  if (!options.listen.empty()) {
+    int fd = open_tcp_listener(options.listen);
+    if (fd < 0) {
+      std::cerr << "Failed to listen on " << options.listen << ": "
+                << strerror(errno) << std::endl;
+      return 1;
+    }
+    listeners.push_back(fd);
+  }
+  if (!options.socket.empty()) {
+    int fd = open_unix_listener(options.socket);
+    if (fd < 0) {
+      std::cerr << "Failed to listen on " << options.socket << ": "
+                << strerror(errno) << std::endl;
+      return 1;
+    }
+    listeners.push_back(fd);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  std::vector<pollfd> fds;
+  for (int fd : listeners) fds.push_back({fd, POLLIN, 0});
+  for (;;) {
+    if (poll(fds.data(), fds.size(), -1) < 0) continue;
+    for (auto &entry : fds) {
+      if ((entry.revents & POLLIN) == 0) continue;
+      int connection = accept4(entry.fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection < 0) continue;
+      int one = 1;
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      /* A thread per connection keeps injected delays independent */
+      std::thread(serve_connection, connection).detach();
+    }
+  }
+}
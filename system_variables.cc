@@ -0,0 +1,327 @@
+/* MIT License
+
+Copyright (c) 2024, Harin Vadodaria
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE. */
+
+#include "password_breach_check.h"
+
+#include <vector> /* std::vector */
+
+namespace password_breach_check {
+
+/** Component name used as system variable prefix */
+static const char *SYSVAR_PREFIX = "password_breach_check";
+
+/** Variables registered so far, unregistered in reverse order */
+static std::vector<const char *> registered;
+
+/* Storage for system variable values */
+static char *url_value = nullptr;
+static char *unix_socket_value = nullptr;
+static char *shm_cache_name_value = nullptr;
+static unsigned int shm_cache_size_value = 0;
+static unsigned int cache_ttl_value = 0;
+static char *disk_cache_dir_value = nullptr;
+static char *replica_dir_value = nullptr;
+static unsigned int replica_rate_value = 0;
+static char *compact_store_value = nullptr;
+static unsigned int compact_store_cache_value = 0;
+static bool compact_store_direct_io_value = false;
+static unsigned int fetch_threads_value = 0;
+static unsigned int fetch_queue_size_value = 0;
+static unsigned int fetch_wait_timeout_value = 0;
+static unsigned int session_memo_ttl_value = 0;
+static bool validators_first_value = false;
+static unsigned int log_rate_limit_value = 0;
+static unsigned int max_concurrent_fetches_value = 0;
+static unsigned int interactive_rate_value = 0;
+static unsigned int batch_rate_value = 0;
+static unsigned int result_cache_size_value = 0;
+static char *audit_dir_value = nullptr;
+static unsigned int secure_buffers_value = 0;
+static char *lookup_chain_value = nullptr;
+
+static bool register_string(const char *name, const char *comment,
+                            const std::string &def_val, char **value) {
+  STR_CHECK_ARG(str) str_arg;
+  str_arg.def_val = def_val.empty() ? nullptr : const_cast<char *>(
+                                                    def_val.c_str());
+  if (mysql_service_component_sys_variable_register->register_variable(
+          SYSVAR_PREFIX, name,
+          PLUGIN_VAR_STR | PLUGIN_VAR_MEMALLOC | PLUGIN_VAR_READONLY,
+          comment, nullptr, nullptr, &str_arg, value))
+    return true;
+  registered.push_back(name);
+  return false;
+}
+
+static bool register_uint(const char *name, const char *comment,
+                          unsigned int def_val, unsigned int min_val,
+                          unsigned int max_val, unsigned int *value) {
+  INTEGRAL_CHECK_ARG(uint) uint_arg;
+  uint_arg.def_val = def_val;
+  uint_arg.min_val = min_val;
+  uint_arg.max_val = max_val;
+  uint_arg.blk_sz = 0;
+  if (mysql_service_component_sys_variable_register->register_variable(
+          SYSVAR_PREFIX, name,
+          PLUGIN_VAR_INT | PLUGIN_VAR_UNSIGNED | PLUGIN_VAR_READONLY, comment,
+          nullptr, nullptr, &uint_arg, value))
+    return true;
+  registered.push_back(name);
+  return false;
+}
+
+static bool register_bool(const char *name, const char *comment,
+                          bool def_val, bool *value) {
+  BOOL_CHECK_ARG(bool) bool_arg;
+  bool_arg.def_val = def_val;
+  if (mysql_service_component_sys_variable_register->register_variable(
+          SYSVAR_PREFIX, name, PLUGIN_VAR_BOOL | PLUGIN_VAR_READONLY, comment,
+          nullptr, nullptr, &bool_arg, value))
+    return true;
+  registered.push_back(name);
+  return false;
+}
+
+/**
+  Register system variables and copy their values into config
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool System_variables::register_variables() {
+  const Config defaults{};
+  const char *failed = nullptr;
+
+  if (register_string("url",
+                      "URL of the range API. The 5 character SHA1 prefix is "
+                      "appended to it. Point it to a local range mirror to "
+                      "avoid egress.",
+                      defaults.url, &url_value))
+    failed = "url";
+  else if (register_string("unix_socket",
+                           "Unix domain socket through which the range API "
+                           "is reached. Empty to use TCP.",
+                           defaults.unix_socket, &unix_socket_value))
+    failed = "unix_socket";
+  else if (register_string("shm_cache_name",
+                           "Name of the POSIX shared memory segment in which "
+                           "ranges are cached for all servers on the host. "
+                           "Empty to disable.",
+                           defaults.shm_cache_name, &shm_cache_name_value))
+    failed = "shm_cache_name";
+  else if (register_uint("shm_cache_size",
+                         "Size in megabytes of the shared memory segment. "
+                         "Only used by the server that creates the segment. "
+                         "Each range takes a slot of about 48 KB.",
+                         defaults.shm_cache_size, 1, 1024 * 1024,
+                         &shm_cache_size_value))
+    failed = "shm_cache_size";
+  else if (register_uint("cache_ttl",
+                         "Number of seconds for which a cached range is used "
+                         "before it is fetched again.",
+                         defaults.cache_ttl, 1, 365 * 86400,
+                         &cache_ttl_value))
+    failed = "cache_ttl";
+  else if (register_string("disk_cache_dir",
+                           "Directory in which fetched ranges are persisted "
+                           "across restarts. Empty to disable.",
+                           defaults.disk_cache_dir, &disk_cache_dir_value))
+    failed = "disk_cache_dir";
+  else if (register_string("replica_dir",
+                           "Directory in which a local replica of all ranges "
+                           "is built and kept up to date. Empty to disable.",
+                           defaults.replica_dir, &replica_dir_value))
+    failed = "replica_dir";
+  else if (register_uint("replica_rate",
+                         "Requests per second the replica crawler may issue.",
+                         defaults.replica_rate, 1, 10000,
+                         &replica_rate_value))
+    failed = "replica_rate";
+  else if (register_string("compact_store",
+                           "Compact store file built with "
+                           "password_breach_check_compact. Empty to disable.",
+                           defaults.compact_store, &compact_store_value))
+    failed = "compact_store";
+  else if (register_uint("compact_store_cache",
+                         "Number of decompressed compact store blocks kept "
+                         "in memory.",
+                         defaults.compact_store_cache, 16, 1024 * 1024,
+                         &compact_store_cache_value))
+    failed = "compact_store_cache";
+  else if (register_bool("compact_store_direct_io",
+                         "Read the compact store with O_DIRECT and io_uring "
+                         "instead of mapping it, for stores larger than "
+                         "memory.",
+                         defaults.compact_store_direct_io,
+                         &compact_store_direct_io_value))
+    failed = "compact_store_direct_io";
+  else if (register_uint("fetch_threads",
+                         "Worker threads that fetch ranges so that session "
+                         "threads do not do network I/O. 0 to fetch on "
+                         "session threads.",
+                         defaults.fetch_threads, 0, 256,
+                         &fetch_threads_value))
+    failed = "fetch_threads";
+  else if (register_uint("fetch_queue_size",
+                         "Fetches that may wait for a worker thread. Further "
+                         "checks fail.",
+                         defaults.fetch_queue_size, 1, 1024 * 1024,
+                         &fetch_queue_size_value))
+    failed = "fetch_queue_size";
+  else if (register_uint("fetch_wait_timeout",
+                         "Seconds a session waits for a fetch by a worker "
+                         "thread before the check fails. Also bounds the "
+                         "requests to the range API made for it.",
+                         defaults.fetch_wait_timeout, 1, 3600,
+                         &fetch_wait_timeout_value))
+    failed = "fetch_wait_timeout";
+  else if (register_uint("session_memo_ttl",
+                         "Seconds for which a session reuses the result of "
+                         "its own recent check of the same password. 0 to "
+                         "disable.",
+                         defaults.session_memo_ttl, 0, 3600,
+                         &session_memo_ttl_value))
+    failed = "session_memo_ttl";
+  else if (register_bool("validators_first",
+                         "Run other validate_password implementations before "
+                         "fetching a range, and skip the fetch if they "
+                         "reject the password. By default they run while "
+                         "the range is fetched.",
+                         defaults.validators_first, &validators_first_value))
+    failed = "validators_first";
+  else if (register_uint("log_rate_limit",
+                         "Messages of the same kind written to the error log "
+                         "per minute. Further ones are counted and "
+                         "summarized. 0 for no limit.",
+                         defaults.log_rate_limit, 0, 1000000,
+                         &log_rate_limit_value))
+    failed = "log_rate_limit";
+  else if (register_uint("max_concurrent_fetches",
+                         "Upper bound of the number of requests in flight to "
+                         "the range API. The actual limit adapts to latency "
+                         "and throttling below it.",
+                         defaults.max_concurrent_fetches, 1, 4096,
+                         &max_concurrent_fetches_value))
+    failed = "max_concurrent_fetches";
+  else if (register_uint("interactive_rate",
+                         "Requests per second to the range API on behalf of "
+                         "sessions changing or rating passwords. 0 for no "
+                         "limit.",
+                         defaults.interactive_rate, 0, 1000000,
+                         &interactive_rate_value))
+    failed = "interactive_rate";
+  else if (register_uint("batch_rate",
+                         "Requests per second to the range API on behalf of "
+                         "the password_breach_check() function and the "
+                         "replica crawler. 0 for no limit.",
+                         defaults.batch_rate, 0, 1000000, &batch_rate_value))
+    failed = "batch_rate";
+  else if (register_uint("result_cache_size",
+                         "Number of results kept in memory by full SHA1 "
+                         "digest, at 33 bytes each. 0 to disable.",
+                         defaults.result_cache_size, 0, 1U << 30,
+                         &result_cache_size_value))
+    failed = "result_cache_size";
+  else if (register_string("audit_dir",
+                           "Directory from which password_breach_check_file() "
+                           "may read files. Empty to disable.",
+                           defaults.audit_dir, &audit_dir_value))
+    failed = "audit_dir";
+  else if (register_uint("secure_buffers",
+                         "Buffers for plaintext passwords locked in memory "
+                         "and wiped after use. 0 to use heap buffers, which "
+                         "are wiped too.",
+                         defaults.secure_buffers, 0, 65536,
+                         &secure_buffers_value))
+    failed = "secure_buffers";
+  else if (register_string("lookup_chain",
+                           "Comma separated tiers consulted for a password, "
+                           "fastest first, out of memory, replica, compact, "
+                           "shm, disk and remote.",
+                           defaults.lookup_chain, &lookup_chain_value))
+    failed = "lookup_chain";
+
+  if (failed != nullptr) {
+    std::stringstream error_message;
+    error_message << "Failed to register password_breach_check." << failed
+                  << " variable.";
+    raise_error(error_message.str().c_str(), ERROR_LEVEL);
+    unregister_variables();
+    return true;
+  }
+
+  if (url_value != nullptr && *url_value != '\0') config.url = url_value;
+  if (unix_socket_value != nullptr) config.unix_socket = unix_socket_value;
+  if (shm_cache_name_value != nullptr)
+    config.shm_cache_name = shm_cache_name_value;
+  config.shm_cache_size = shm_cache_size_value;
+  config.cache_ttl = cache_ttl_value;
+  if (disk_cache_dir_value != nullptr)
+    config.disk_cache_dir = disk_cache_dir_value;
+  if (replica_dir_value != nullptr) config.replica_dir = replica_dir_value;
+  config.replica_rate = replica_rate_value;
+  if (compact_store_value != nullptr)
+    config.compact_store = compact_store_value;
+  config.compact_store_cache = compact_store_cache_value;
+  config.compact_store_direct_io = compact_store_direct_io_value;
+  config.fetch_threads = fetch_threads_value;
+  config.fetch_queue_size = fetch_queue_size_value;
+  config.fetch_wait_timeout = fetch_wait_timeout_value;
+  config.session_memo_ttl = session_memo_ttl_value;
+  config.validators_first = validators_first_value;
+  config.log_rate_limit = log_rate_limit_value;
+  config.max_concurrent_fetches = max_concurrent_fetches_value;
+  config.interactive_rate = interactive_rate_value;
+  config.batch_rate = batch_rate_value;
+  config.result_cache_size = result_cache_size_value;
+  if (audit_dir_value != nullptr) config.audit_dir = audit_dir_value;
+  config.secure_buffers = secure_buffers_value;
+  if (lookup_chain_value != nullptr) config.lookup_chain = lookup_chain_value;
+  return false;
+}
+
+/**
+  Unregister system variables
+
+  @returns status of the operation
+    @retval true  Failure
+    @retval false Success
+*/
+bool System_variables::unregister_variables() {
+  bool error = false;
+  while (!registered.empty()) {
+    auto name = registered.back();
+    registered.pop_back();
+    if (mysql_service_component_sys_variable_unregister->unregister_variable(
+            SYSVAR_PREFIX, name)) {
+      std::stringstream error_message;
+      error_message << "Failed to unregister password_breach_check." << name
+                    << " variable.";
+      raise_error(error_message.str().c_str(), WARNING_LEVEL);
+      error = true;
+    }
+  }
+  return error;
+}
+
+}  // namespace password_breach_check